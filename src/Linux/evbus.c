@@ -22,6 +22,15 @@ extern "C" {
     threadBus = bus;  // assign to thread-local var
   }
 
+  // and the module whose event or socket callback is running on it,
+  // so that work done on its behalf (e.g. a datagram send) can be
+  // charged to it. NULL outside of a callback.
+  static __thread EVMod *threadModule;
+
+  EVMod *EVCurrentModule() {
+    return threadModule;
+  }
+
   /*_________________--------------------------------------------------__________________
     _________________  minimal module-loader with event bus mechanism  __________________
     -----------------__________________________________________________------------------
@@ -72,6 +81,7 @@ extern "C" {
 	bus->sockets = UTArrayNew(UTARRAY_PACK);
 	bus->sockets_run = UTArrayNew(UTARRAY_DFLT);
 	bus->sockets_del = UTArrayNew(UTARRAY_DFLT);
+	bus->readProfiles = UTHASH_NEW(EVProfile, module, UTHASH_DFLT);
 	if(pipe(bus->pipe) == -1) {
 	  myLog(LOG_ERR, "pipe() failed : %s", strerror(errno));
 	  abort();
@@ -132,6 +142,15 @@ extern "C" {
 	sock->readCB = readCB;
 	sock->module = mod;
 	sock->magic = magic;
+	// read callbacks are accounted per bus and module, since
+	// sockets come and go
+	EVProfile search = { .module = mod };
+	sock->prof = UTHashGet(bus->readProfiles, &search);
+	if(sock->prof == NULL) {
+	  sock->prof = (EVProfile *)my_calloc(sizeof(EVProfile));
+	  sock->prof->module = mod;
+	  UTHashAdd(bus->readProfiles, sock->prof);
+	}
 	UTHashAdd(mod->root->sockets, sock);
 	UTArrayAdd(bus->sockets, sock);
 	bus->socketsChanged = YES;
@@ -326,6 +345,87 @@ extern "C" {
     my_free(sock);
   }
 
+  /*_________________---------------------------__________________
+    _________________     profiling             __________________
+    -----------------___________________________------------------
+    When enabled, every action and socket-read callback is timed on
+    both the thread CPU clock and the monotonic clock.  Nested local
+    events are subtracted out so that each callback is charged only
+    for its own work.  A callback that takes longer than the "slow"
+    threshold is counted and logged (rate-limited), since it holds up
+    the deci/tick/tock events on that bus.
+  */
+
+  typedef struct _EVProfileMark {
+    uint64_t wall_nS;
+    uint64_t cpu_nS;
+  } EVProfileMark;
+
+  // time spent in nested callbacks, per thread
+  static __thread EVProfileMark profileNested;
+
+  static uint64_t profileClock_nS(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+  }
+
+  static void profileStart(EVProfileMark *start, EVProfileMark *saved) {
+    *saved = profileNested;
+    memset(&profileNested, 0, sizeof(profileNested));
+    start->wall_nS = profileClock_nS(CLOCK_MONOTONIC);
+    start->cpu_nS = profileClock_nS(CLOCK_THREAD_CPUTIME_ID);
+  }
+
+  static void profileStop(EVBus *bus, EVProfile *prof, EVMod *mod, char *evtName, EVProfileMark *start, EVProfileMark *saved) {
+    uint64_t wall_nS = profileClock_nS(CLOCK_MONOTONIC) - start->wall_nS;
+    uint64_t cpu_nS = profileClock_nS(CLOCK_THREAD_CPUTIME_ID) - start->cpu_nS;
+    prof->calls++;
+    if(wall_nS > profileNested.wall_nS)
+      prof->wall_nS += wall_nS - profileNested.wall_nS;
+    if(cpu_nS > profileNested.cpu_nS)
+      prof->cpu_nS += cpu_nS - profileNested.cpu_nS;
+    if(wall_nS > prof->max_wall_nS)
+      prof->max_wall_nS = wall_nS;
+    uint32_t slow_mS = bus->root->profileSlow_mS;
+    if(slow_mS
+       && wall_nS > ((uint64_t)slow_mS * 1000000)) {
+      prof->slow++;
+      EVLog(60, LOG_INFO, "slow callback: bus=%s module=%s event=%s took %"PRIu64" mS (cpu %"PRIu64" mS)",
+	    bus->name,
+	    mod->name,
+	    evtName,
+	    wall_nS / 1000000,
+	    cpu_nS / 1000000);
+    }
+    // charge the whole of this one to the caller's nested total
+    profileNested = *saved;
+    profileNested.wall_nS += wall_nS;
+    profileNested.cpu_nS += cpu_nS;
+  }
+
+  void EVProfileEnable(EVMod *mod, bool enable, uint32_t slow_mS) {
+    mod->root->profileSlow_mS = slow_mS;
+    mod->root->profile = enable;
+  }
+
+  void EVProfileWalk(EVMod *mod, EVProfileCB profileCB, void *magic) {
+    EVBus *bus;
+    SEMLOCK_DO(mod->root->sync) {
+      UTHASH_WALK(mod->root->buses, bus) {
+	EVEvent *evt;
+	UTARRAY_WALK(bus->eventList, evt) {
+	  EVAction *act;
+	  UTARRAY_WALK(evt->actions, act)
+	    (*profileCB)(bus, act->module, evt->name, &act->prof, magic);
+	}
+	EVProfile *prof;
+	UTHASH_WALK(bus->readProfiles, prof)
+	  (*profileCB)(bus, prof->module, EVEVENT_READ, prof, magic);
+      }
+    }
+  }
+
   int EVEventTx(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     int sent = 0;
     if(evt->bus == EVCurrentBus()) {
@@ -338,10 +438,20 @@ extern "C" {
 	  evt->actionsChanged = NO;
 	}
       }
+      EVMod *caller = threadModule;
       UTARRAY_WALK(evt->actions_run, act) {
-	(*act->actionCB)(act->module, evt, data, dataLen);
+	threadModule = act->module;
+	if(mod->root->profile) {
+	  EVProfileMark start, saved;
+	  profileStart(&start, &saved);
+	  (*act->actionCB)(act->module, evt, data, dataLen);
+	  profileStop(evt->bus, &act->prof, act->module, evt->name, &start, &saved);
+	}
+	else
+	  (*act->actionCB)(act->module, evt, data, dataLen);
 	sent++;
       }
+      threadModule = caller;
     }
     else {
       // inter-bus event goes on pipe for simple select() sync.
@@ -363,7 +473,29 @@ extern "C" {
     return sent;
   }
 
+  /*_________________---------------------------__________________
+    _________________    virtual clock          __________________
+    -----------------___________________________------------------
+    A simulation harness can replace the bus clock with its own, and
+    drive a bus with EVBusStart()/EVBusStep() instead of EVBusRun().
+    With a virtual clock the buses never sleep in select(), so time
+    only moves when the harness moves it and the deci/tick/tock
+    sequence is exactly repeatable.
+  */
+
+  static EVClockFn virtualClock;
+  static void *virtualClockMagic;
+
+  void EVClockSet(EVClockFn clockFn, void *magic) {
+    virtualClockMagic = magic;
+    virtualClock = clockFn;
+  }
+
   void EVClockMono(struct timespec *ts) {
+    if(virtualClock) {
+      (*virtualClock)(ts, virtualClockMagic);
+      return;
+    }
     clockid_t monoClock = CLOCK_MONOTONIC;
 #ifdef CLOCK_MONOTONIC_COARSE
     // more efficient if supported,  since we only need mS accuracy
@@ -402,7 +534,8 @@ extern "C" {
     }
     struct timespec timeout;
     timeout.tv_sec = 0;
-    timeout.tv_nsec = bus->select_mS * 1000000;
+    // only poll if time is being simulated
+    timeout.tv_nsec = virtualClock ? 0 : (bus->select_mS * 1000000);
     int nfds = pselect(max_fd + 1,
 		       &readfds,
 		       (fd_set *)NULL,
@@ -419,8 +552,19 @@ extern "C" {
       if(FD_ISSET(bus->pipe[0], &readfds))
 	busRxPipe(bus, bus->pipe[0]);
       UTARRAY_WALK(bus->sockets_run, sock) {
-	if(FD_ISSET(sock->fd, &readfds))
-	  (*sock->readCB)(sock->module, sock, sock->magic);
+	if(FD_ISSET(sock->fd, &readfds)) {
+	  threadModule = sock->module;
+	  if(bus->root->profile) {
+	    // sock may be closed (but not freed) by the callback
+	    EVProfileMark start, saved;
+	    profileStart(&start, &saved);
+	    (*sock->readCB)(sock->module, sock, sock->magic);
+	    profileStop(bus, sock->prof, sock->module, EVEVENT_READ, &start, &saved);
+	  }
+	  else
+	    (*sock->readCB)(sock->module, sock, sock->magic);
+	  threadModule = NULL;
+	}
       }
     }
     else if(nfds < 0) {
@@ -462,44 +606,65 @@ extern "C" {
     }
   }
 
-  static void *busRun(void *magic) {
-    EVBus *bus = (EVBus *)magic;
+  void EVBusStart(EVBus *bus) {
     EVMod *mod = bus->root->rootModule;
     assert(bus->running == NO);
     EVCurrentBusSet(bus);
     bus->running = YES;
-    EVEvent *start = EVGetEvent(bus, EVEVENT_START);
-    EVEvent *tick = EVGetEvent(bus, EVEVENT_TICK);
-    EVEvent *tock = EVGetEvent(bus, EVEVENT_TOCK);
-    EVEvent *deci = EVGetEvent(bus, EVEVENT_DECI);
-    EVEvent *final = EVGetEvent(bus, EVEVENT_FINAL);
-    EVEvent *end = EVGetEvent(bus, EVEVENT_END);
-
-    EVEventTx(mod, start, NULL, 0);
+    bus->tick = EVGetEvent(bus, EVEVENT_TICK);
+    bus->tock = EVGetEvent(bus, EVEVENT_TOCK);
+    bus->deci = EVGetEvent(bus, EVEVENT_DECI);
+    // start the deci/tick clocks from now, rather than from
+    // zero, so there is no burst to catch up on at startup
+    EVClockMono(&bus->now);
+    bus->now_deci = bus->now;
+    bus->now_tick = bus->now;
+    EVEventTx(mod, EVGetEvent(bus, EVEVENT_START), NULL, 0);
+  }
 
-    for(;;) {
+  bool EVBusStep(EVBus *bus) {
+    EVMod *mod = bus->root->rootModule;
+    // a harness may step several buses from one thread
+    EVCurrentBusSet(bus);
 
-      if(bus->stop) {
-	EVEventTx(mod, final, NULL, 0);
-	EVEventTx(mod, end, NULL, 0);
-	break;
-      }
+    if(bus->stop) {
+      EVEventTx(mod, EVGetEvent(bus, EVEVENT_FINAL), NULL, 0);
+      EVEventTx(mod, EVGetEvent(bus, EVEVENT_END), NULL, 0);
+      return NO;
+    }
 
-      busRead(bus);
-
-      // Detect tick/deci boundaries.
-      // These tick/tock/deci events used to skip if something
-      // blocked for too long in this thread, but not any longer.
-      while(EVTimeDiff_nS(&bus->now_deci, &bus->now) > 100000000) {
-	EVTimeAdd_nS(&bus->now_deci, 100000000);
-	EVEventTx(mod, deci, NULL, 0);
-	if(EVTimeDiff_nS(&bus->now_tick, &bus->now_deci) > 1000000000) {
-	  EVTimeAdd_nS(&bus->now_tick, 1000000000);
-	  EVEventTx(mod, tick, NULL, 0);
-	  EVEventTx(mod, tock, NULL, 0);
-	}
+    busRead(bus);
+
+    // Detect tick/deci boundaries.
+    // These tick/tock/deci events used to skip if something
+    // blocked for too long in this thread, but not any longer.
+    // Note how far behind we are when a burst has to catch up
+    // because something blocked (select() itself may sleep for
+    // select_mS when nothing is listening for deci events).
+    int lag_mS = EVTimeDiff_mS(&bus->now_deci, &bus->now) - 100;
+    if(lag_mS > (bus->select_mS + 100)) {
+      bus->lateDeci += lag_mS / 100;
+      if(lag_mS > bus->maxLag_mS)
+	bus->maxLag_mS = lag_mS;
+      if(bus->root->profile)
+	EVLog(60, LOG_INFO, "bus %s: deci events %d mS late", bus->name, lag_mS);
+    }
+    while(EVTimeDiff_nS(&bus->now_deci, &bus->now) > 100000000) {
+      EVTimeAdd_nS(&bus->now_deci, 100000000);
+      EVEventTx(mod, bus->deci, NULL, 0);
+      if(EVTimeDiff_nS(&bus->now_tick, &bus->now_deci) > 1000000000) {
+	EVTimeAdd_nS(&bus->now_tick, 1000000000);
+	EVEventTx(mod, bus->tick, NULL, 0);
+	EVEventTx(mod, bus->tock, NULL, 0);
       }
     }
+    return YES;
+  }
+
+  static void *busRun(void *magic) {
+    EVBus *bus = (EVBus *)magic;
+    EVBusStart(bus);
+    while(EVBusStep(bus));
     return NULL;
   }
 
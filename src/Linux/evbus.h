@@ -30,6 +30,20 @@ extern "C" {
 
   struct _EVMod; // fwd decl
 
+  // Optional per-callback accounting, see EVProfileEnable().  Each
+  // profile is only written by the thread of the bus it belongs to.
+  // Times are "self" times, excluding any local events the callback
+  // sent (and so ran) itself.  The max is the full wall time, since
+  // that is what holds up the rest of the bus.
+  typedef struct _EVProfile {
+    struct _EVMod *module; // hash key for socket-read profiles
+    uint64_t calls;
+    uint64_t cpu_nS;
+    uint64_t wall_nS;
+    uint64_t max_wall_nS;
+    uint64_t slow;
+  } EVProfile;
+
   typedef struct _EVRoot {
     UTHash *buses;
     UTHash *modules;
@@ -37,6 +51,8 @@ extern "C" {
     UTHash *sockets;
     struct _EVMod *rootModule;
     pthread_mutex_t *sync;
+    bool profile;
+    uint32_t profileSlow_mS;
   } EVRoot;
 
 #define EVMOD_ROOT "_root"
@@ -78,6 +94,12 @@ extern "C" {
     pthread_t *thread;
     int childCount;
     UTHash *msgs;
+    struct _EVEvent *tick;
+    struct _EVEvent *tock;
+    struct _EVEvent *deci;
+    UTHash *readProfiles;
+    uint64_t lateDeci; // deci events that were delivered late, in a burst
+    uint32_t maxLag_mS;
     bool socketsChanged:1;
     bool running:1;
     bool stop:1;
@@ -95,6 +117,7 @@ extern "C" {
     int child_status;
     UTStrBuf *iobuf;
     UTStrBuf *ioline;
+    EVProfile *prof;
     bool errOut;
   } EVSocket;
 
@@ -114,6 +137,7 @@ extern "C" {
   typedef struct _EVAction {
     EVMod *module;
     EVActionCB actionCB;
+    EVProfile prof;
   } EVAction;
 
 #define EVEVENT_START "_start"
@@ -123,6 +147,8 @@ extern "C" {
 #define EVEVENT_FINAL "_final"
 #define EVEVENT_END "_end"
 #define EVEVENT_HANDSHAKE "_handshake"
+  // pseudo-event name for socket read callbacks in EVProfileWalk()
+#define EVEVENT_READ "_read"
 
   typedef struct _EVEventHdr {
     uint32_t modId;
@@ -145,6 +171,8 @@ extern "C" {
   EVSocket *EVBusAddSocket(EVMod *mod, EVBus *bus, int fd, EVReadCB readCB, void *magic);
   bool EVSocketClose(EVMod *mod, EVSocket *sock, bool closeFD);
   void EVClockMono(struct timespec *ts);
+  typedef void (*EVClockFn)(struct timespec *ts, void *magic);
+  void EVClockSet(EVClockFn clockFn, void *magic);
 
 #define EVSOCKETREADLINE_INCBYTES EV_MAX_EVT_DATALEN
 
@@ -173,13 +201,20 @@ extern "C" {
   void EVTimeAdd_nS(struct timespec *t, int nS);
   void EVBusRunThread(EVBus *bus, size_t stacksize);
   void EVBusRun(EVBus *bus);
+  void EVBusStart(EVBus *bus);
+  bool EVBusStep(EVBus *bus);
   void EVBusStop(EVBus *bus);
   EVBus *EVCurrentBus(void);
   void EVCurrentBusSet(EVBus *bus);
+  EVMod *EVCurrentModule(void);
   void EVRun(EVBus *mainBus);
   void EVStop(EVMod *mod);
   void EVLog(uint32_t rl_secs, int syslogType, char *fmt, ...);
 
+  typedef void (*EVProfileCB)(EVBus *bus, EVMod *mod, char *evtName, EVProfile *prof, void *magic);
+  void EVProfileEnable(EVMod *mod, bool enable, uint32_t slow_mS);
+  void EVProfileWalk(EVMod *mod, EVProfileCB profileCB, void *magic);
+
 #if defined(__cplusplus)
 } /* extern "C" */
 #endif
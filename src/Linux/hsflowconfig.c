@@ -75,7 +75,8 @@ extern "C" {
     HSPOBJ_DBUS,
     HSPOBJ_SYSTEMD,
     HSPOBJ_EAPI,
-    HSPOBJ_PORT
+    HSPOBJ_PORT,
+    HSPOBJ_TELEMETRY
   } EnumHSPObject;
 
   static const char *HSPObjectNames[] = {
@@ -98,7 +99,8 @@ extern "C" {
     "os10",
     "opx",
     "eapi",
-    "port"
+    "port",
+    "telemetry"
   };
 
   static void copyApplicationSettings(HSPSFlowSettings *from, HSPSFlowSettings *to);
@@ -555,6 +557,7 @@ extern "C" {
       to->collectors = NULL;
       copyCollectors(from, to);
       to->applicationSettings = NULL;
+      to->applicationIndex = NULL;
       copyApplicationSettings(from, to);
       to->agentCIDRs = NULL;
       copyAgentCIDRs(from, to);
@@ -682,13 +685,16 @@ extern "C" {
 
   static HSPApplicationSettings *getApplicationSettings(HSPSFlowSettings *settings, char *app, bool create)
   {
-    HSPApplicationSettings *appSettings = settings->applicationSettings;
-    for(; appSettings; appSettings = appSettings->nxt) if(my_strequal(app, appSettings->application)) break;
+    if(settings->applicationIndex == NULL)
+      settings->applicationIndex = UTHASH_NEW(HSPApplicationSettings, application, UTHASH_SKEY);
+    HSPApplicationSettings search = { .application = app };
+    HSPApplicationSettings *appSettings = UTHashGet(settings->applicationIndex, &search);
     if(appSettings == NULL && create) {
       appSettings = (HSPApplicationSettings *)my_calloc(sizeof(HSPApplicationSettings));
       appSettings->application = my_strdup(app);
       appSettings->nxt = settings->applicationSettings;
       settings->applicationSettings = appSettings;
+      UTHashAdd(settings->applicationIndex, appSettings);
     }
     return appSettings;
   }
@@ -707,6 +713,10 @@ extern "C" {
       appSettings = nextAppSettings;
     }
     settings->applicationSettings = NULL;
+    if(settings->applicationIndex) {
+      UTHashFree(settings->applicationIndex);
+      settings->applicationIndex = NULL;
+    }
   }
 
   /*_________________----------------------------__________________
@@ -760,40 +770,43 @@ extern "C" {
 
   int lookupApplicationSettings(HSPSFlowSettings *settings, char *prefix, char *app, uint32_t *p_sampling, uint32_t *p_polling)
   {
-    // in the config, the sFlow-APPLICATION settings should always start with sampling.app.<name> or polling.app.<name>
-    // so add the .app prefix here before we start searching...
-    char *search = app;
-    int search_len = my_strlen(app);
-    if(prefix) {
-      search_len = my_strlen(app) + my_strlen(prefix) + 1;
-      search = my_calloc(search_len + 1);
-      snprintf(search, search_len + 1, "%s.%s", prefix, app);
-    }
     // the top level settings are the defaults
     if(p_polling) *p_polling = settings->pollingInterval;
     if(p_sampling) *p_sampling = settings->samplingRate;
-    // now search for the deepest match
+    if(settings->applicationIndex == NULL)
+      return NO; // no application settings at all
+    // in the config, the sFlow-APPLICATION settings should always start with sampling.app.<name> or polling.app.<name>
+    // so add the .app prefix here before we start searching...
+    // (only an unusually long name needs the heap)
+    char buf[256];
+    char *search = buf;
+    int search_len = my_strlen(app) + (prefix ? my_strlen(prefix) + 1 : 0);
+    if(search_len >= sizeof(buf))
+      search = my_calloc(search_len + 1);
+    if(prefix)
+      sprintf(search, "%s.%s", prefix, app);
+    else
+      strcpy(search, app);
+    // now look for the deepest match by trying the whole name and then
+    // trimming it back one '.'-separated component at a time, so this is
+    // one hash lookup per component and does not allocate
+    HSPApplicationSettings probe = { .application = search };
     HSPApplicationSettings *deepest = NULL;
-    uint32_t deepest_len = 0;
-    for(HSPApplicationSettings *appSettings = settings->applicationSettings; appSettings; appSettings = appSettings->nxt) {
-      int len = my_strlen(appSettings->application);
-      if(len > deepest_len
-	 && len <= search_len
-	 && my_strnequal(search, appSettings->application, len)) {
-	// has to be an exact match, or one that matches up to a '.'
-	if(len == search_len || search[len] == '.') {
-	  deepest = appSettings;
-	  deepest_len = len;
-	}
-      }
+    for(;;) {
+      deepest = UTHashGet(settings->applicationIndex, &probe);
+      if(deepest)
+	break;
+      char *dot = strrchr(search, '.');
+      if(dot == NULL)
+	break;
+      *dot = '\0';
     }
 
-    if(prefix) {
+    if(search != buf)
       my_free(search);
-    }
 
     if(deepest) {
-      if(p_polling && deepest->got_polling_secs) *p_sampling = deepest->polling_secs;
+      if(p_polling && deepest->got_polling_secs) *p_polling = deepest->polling_secs;
       if(p_sampling && deepest->got_sampling_n) *p_sampling = deepest->sampling_n;
       return YES;
     }
@@ -1257,6 +1270,13 @@ extern "C" {
 	    sp->docker.docker = YES;
 	    level[++depth] = HSPOBJ_DOCKER;
 	    break;
+	  case HSPTOKEN_CRI:
+	    // same container model and settings as docker { }, fed from a CRI runtime
+	    if((tok = expectToken(sp, tok, HSPTOKEN_STARTOBJ)) == NULL) return NO;
+	    sp->docker.docker = YES;
+	    sp->docker.cri = YES;
+	    level[++depth] = HSPOBJ_DOCKER;
+	    break;
 	  case HSPTOKEN_ULOG:
 	    if((tok = expectToken(sp, tok, HSPTOKEN_STARTOBJ)) == NULL) return NO;
 	    sp->ulog.ulog = YES;
@@ -1349,6 +1369,10 @@ extern "C" {
 	    sp->eapi.eapi = YES;
 	    level[++depth] = HSPOBJ_EAPI;
 	    break;
+	  case HSPTOKEN_TELEMETRY:
+	    if((tok = expectToken(sp, tok, HSPTOKEN_STARTOBJ)) == NULL) return NO;
+	    level[++depth] = HSPOBJ_TELEMETRY;
+	    break;
 	  case HSPTOKEN_SAMPLING:
 	  case HSPTOKEN_PACKETSAMPLINGRATE:
 	    if((tok = expectInteger32(sp, tok, &sp->sFlowSettings_file->samplingRate, 0, HSP_MAX_SAMPLING_N)) == NULL) return NO;
@@ -1439,6 +1463,12 @@ extern "C" {
 	    case HSPTOKEN_DOMAIN:
 	      if((tok = expectDNSSD_domain(sp, tok)) == NULL) return NO;
 	      break;
+	    case HSPTOKEN_IP:
+	      if((tok = expectIP(sp, tok, &sp->DNSSD.server, (struct sockaddr *)&sp->DNSSD.serverSocketAddr)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_UDPPORT:
+	      if((tok = expectInteger32(sp, tok, &sp->DNSSD.serverPort, 1, 65535)) == NULL) return NO;
+	      break;
 	    default:
 	      unexpectedToken(sp, tok, level[depth]);
 	      return NO;
@@ -1536,6 +1566,18 @@ extern "C" {
 	    case HSPTOKEN_CGROUP_TRAFFIC:
 	      if((tok = expectONOFF(sp, tok, &sp->docker.markTraffic)) == NULL) return NO;
 	      break;
+	    case HSPTOKEN_SOCKET:
+	      if((tok = expectFile(sp, tok, &sp->docker.socket)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_CONNECTIONS:
+	      if((tok = expectInteger32(sp, tok, &sp->docker.connections, 1, 256)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_PIPELINE:
+	      if((tok = expectInteger32(sp, tok, &sp->docker.pipeline, 1, 64)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_CGROUPSTATS:
+	      if((tok = expectONOFF(sp, tok, &sp->docker.cgroupStats)) == NULL) return NO;
+	      break;
 	    default:
 	      unexpectedToken(sp, tok, level[depth]);
 	      return NO;
@@ -1701,6 +1743,9 @@ extern "C" {
 	case HSPOBJ_OVS:
 	  {
 	    switch(tok->stok) {
+	    case HSPTOKEN_SOCKET:
+	      if((tok = expectFile(sp, tok, &sp->ovs.socket)) == NULL) return NO;
+	      break;
 	    default:
 	      unexpectedToken(sp, tok, level[depth]);
 	      return NO;
@@ -1721,6 +1766,18 @@ extern "C" {
 	      // expect a file name such as "/tmp/hsflowd_json_fifo" that was created using mkfifo(1)
 	      if((tok = expectFile(sp, tok, &sp->json.FIFO)) == NULL) return NO;
 	      break;
+	    case HSPTOKEN_WORKERS:
+	      if((tok = expectInteger32(sp, tok, &sp->json.workers, 1, HSP_JSON_MAX_WORKERS)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_RING:
+	      if((tok = expectString(sp, tok, &sp->json.ring, "socket path")) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_AGGREGATE:
+	      if((tok = expectInteger32(sp, tok, &sp->json.aggregate, 0, 3600)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_AGGREGATEMAX:
+	      if((tok = expectInteger32(sp, tok, &sp->json.aggregateMax, 1, 1000000)) == NULL) return NO;
+	      break;
 	    default:
 	      unexpectedToken(sp, tok, level[depth]);
 	      return NO;
@@ -1761,6 +1818,9 @@ extern "C" {
 	      if((tok = expectRegex(sp, tok, &sp->opx.swp_regex)) == NULL) return NO;
 	      sp->opx.swp_regex_str = my_strdup(tok->str);
 	      break;
+	    case HSPTOKEN_DBCONFIG:
+	      if((tok = expectFile(sp, tok, &sp->sonic.dbconfig)) == NULL) return NO;
+	      break;
 	    default:
 	      unexpectedToken(sp, tok, level[depth]);
 	      return NO;
@@ -1833,6 +1893,9 @@ extern "C" {
 	    case HSPTOKEN_CGROUP_TRAFFIC:
 	      if((tok = expectONOFF(sp, tok, &sp->systemd.markTraffic)) == NULL) return NO;
 	      break;
+	    case HSPTOKEN_FDCOUNT:
+	      if((tok = expectONOFF(sp, tok, &sp->systemd.fdCount)) == NULL) return NO;
+	      break;
 	    default:
 	      unexpectedToken(sp, tok, level[depth]);
 	      return NO;
@@ -1852,6 +1915,26 @@ extern "C" {
 	  }
 	  break;
 
+	case HSPOBJ_TELEMETRY:
+	  {
+	    switch(tok->stok) {
+	    case HSPTOKEN_SOCKET:
+	      if((tok = expectString(sp, tok, &sp->telemetrySocket.path, "socket path")) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_PROFILE:
+	      if((tok = expectONOFF(sp, tok, &sp->telemetrySocket.profile)) == NULL) return NO;
+	      break;
+	    case HSPTOKEN_SLOW:
+	      if((tok = expectInteger32(sp, tok, &sp->telemetrySocket.profileSlow_mS, 1, 60000)) == NULL) return NO;
+	      break;
+	    default:
+	      unexpectedToken(sp, tok, level[depth]);
+	      return NO;
+	      break;
+	    }
+	  }
+	  break;
+
 	default:
 	  parseError(sp, tok, "unexpected state", "");
 	}
@@ -6,6 +6,7 @@
 extern "C" {
 #endif
 
+#define HSP_TELEMETRY_NAMES 1
 #include "hsflowd.h"
 #include "cpu_utils.h"
 #include "cJSON.h"
@@ -17,6 +18,7 @@ extern "C" {
 
   static bool installSFlowSettings(HSP *sp, HSPSFlowSettings *settings);
   static bool updatePollingInterval(HSP *sp);
+  static void profileDump(HSP *sp);
   
   /*_________________---------------------------__________________
     _________________     agent callbacks       __________________
@@ -53,8 +55,11 @@ extern "C" {
     if(sp->sFlowSettings == NULL)
       return;
 
-    sp->telemetry[HSP_TELEMETRY_DATAGRAMS]++;
+    // charged to whichever module's callback filled or flushed it
+    // (root outside of a callback)
+    telemetryAdd(sp, EVCurrentModule(), HSP_TELEMETRY_DATAGRAMS, 1);
 
+    uint64_t send_nS = latencyClock_nS();
     for(HSPCollector *coll = sp->sFlowSettings->collectors; coll; coll=coll->nxt) {
       if(coll->socklen && coll->socket > 0) {
 	int result = sendto(coll->socket,
@@ -65,12 +70,167 @@ extern "C" {
 			    coll->socklen);
 	if(result == -1 && errno != EINTR) {
 	  EVLog(60, LOG_ERR, "socket sendto error: %s", strerror(errno));
+	  __atomic_fetch_add(&coll->errors, 1, __ATOMIC_RELAXED);
 	}
 	else if(result == 0) {
 	  EVLog(60, LOG_ERR, "socket sendto returned 0: %s", strerror(errno));
+	  __atomic_fetch_add(&coll->errors, 1, __ATOMIC_RELAXED);
+	}
+	else if(result > 0) {
+	  __atomic_fetch_add(&coll->datagrams, 1, __ATOMIC_RELAXED);
+	  __atomic_fetch_add(&coll->bytes, result, __ATOMIC_RELAXED);
 	}
       }
     }
+    latencyRecord(sp, sp->sendModule ?: sp->rootModule, HSP_LATENCY_SEND, latencyClock_nS() - send_nS);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   latency histograms      __________________
+    -----------------___________________________------------------
+    Each bus thread keeps its own HSPLatency block per module, found
+    through a thread-local array indexed by mod->id, so recording a
+    measurement is just a clock read and a few increments.  Blocks
+    are linked onto sp->latency (under sp->sync_latency) the first
+    time they are used so that they can be found for reporting.
+  */
+
+#define HSP_LATENCY_MAX_MODULES 64
+  static __thread HSPLatency *latencyBlocks[HSP_LATENCY_MAX_MODULES];
+
+  uint64_t latencyClock_nS(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+  }
+
+  static int latencyBucket(uint64_t nS) {
+    if(nS < (1 << HSP_LATENCY_SUB_BITS))
+      return (int)nS;
+    int msb = 63 - __builtin_clzll(nS);
+    int sub = (nS >> (msb - HSP_LATENCY_SUB_BITS)) & ((1 << HSP_LATENCY_SUB_BITS) - 1);
+    int bkt = ((msb - HSP_LATENCY_SUB_BITS + 1) << HSP_LATENCY_SUB_BITS) + sub;
+    return (bkt < HSP_LATENCY_BUCKETS) ? bkt : (HSP_LATENCY_BUCKETS - 1);
+  }
+
+  static uint64_t latencyBucketFloor(int bkt) {
+    if(bkt < (1 << HSP_LATENCY_SUB_BITS))
+      return bkt;
+    int msb = (bkt >> HSP_LATENCY_SUB_BITS) + HSP_LATENCY_SUB_BITS - 1;
+    uint64_t sub = bkt & ((1 << HSP_LATENCY_SUB_BITS) - 1);
+    return ((1 << HSP_LATENCY_SUB_BITS) + sub) << (msb - HSP_LATENCY_SUB_BITS);
+  }
+
+  static HSPLatency *latencyBlock(HSP *sp, EVMod *mod) {
+    int idx = (mod->id < HSP_LATENCY_MAX_MODULES) ? mod->id : 0;
+    HSPLatency *lat = latencyBlocks[idx];
+    if(lat == NULL) {
+      EVBus *bus = EVCurrentBus();
+      lat = (HSPLatency *)my_calloc(sizeof(HSPLatency));
+      lat->bus = my_strdup(bus ? bus->name : "main");
+      lat->module = my_strdup(idx == mod->id ? mod->name : "other");
+      SEMLOCK_DO(sp->sync_latency) {
+	ADD_TO_LIST(sp->latency, lat);
+      }
+      latencyBlocks[idx] = lat;
+    }
+    return lat;
+  }
+
+  void latencyRecord(HSP *sp, EVMod *mod, EnumHSPLatencyStage stage, uint64_t nS) {
+    HSPLatencyHist *hist = &latencyBlock(sp, mod)->hist[stage];
+    hist->count++;
+    hist->sum_nS += nS;
+    if(nS > hist->max_nS)
+      hist->max_nS = nS;
+    hist->bucket[latencyBucket(nS)]++;
+  }
+
+  static void latencyAdd(HSPLatencyHist *total, HSPLatencyHist *hist) {
+    total->count += hist->count;
+    total->sum_nS += hist->sum_nS;
+    if(hist->max_nS > total->max_nS)
+      total->max_nS = hist->max_nS;
+    for(int ii = 0; ii < HSP_LATENCY_BUCKETS; ii++)
+      total->bucket[ii] += hist->bucket[ii];
+  }
+
+  void latencyMerge(HSP *sp, EnumHSPLatencyStage stage, HSPLatencyHist *total) {
+    memset(total, 0, sizeof(*total));
+    SEMLOCK_DO(sp->sync_latency) {
+      for(HSPLatency *lat = sp->latency; lat; lat = lat->nxt)
+	latencyAdd(total, &lat->hist[stage]);
+    }
+  }
+
+  uint64_t latencyPercentile(HSPLatencyHist *hist, double pc) {
+    // the bucket counts may not quite add up to hist->count
+    // if we are reading while another thread is writing.
+    uint64_t total = 0;
+    for(int ii = 0; ii < HSP_LATENCY_BUCKETS; ii++)
+      total += hist->bucket[ii];
+    if(total == 0)
+      return 0;
+    uint64_t rank = (uint64_t)((total * pc) / 100.0);
+    uint64_t seen = 0;
+    for(int ii = 0; ii < HSP_LATENCY_BUCKETS; ii++) {
+      seen += hist->bucket[ii];
+      if(seen > rank) {
+	uint64_t val = latencyBucketFloor(ii);
+	return (val < hist->max_nS) ? val : hist->max_nS;
+      }
+    }
+    return hist->max_nS;
+  }
+
+  /*_________________---------------------------__________________
+    _________________   telemetry counters      __________________
+    -----------------___________________________------------------
+    The same scheme as the latency histograms: a thread-local block
+    per module, so an increment never races with another thread and
+    never lands on a cache line that another thread is writing.
+    The blocks share the sp->latency lock for the list.
+  */
+
+  static __thread HSPTelemetry *telemetryBlocks[HSP_LATENCY_MAX_MODULES];
+
+  static HSPTelemetry *telemetryBlock(HSP *sp, EVMod *mod) {
+    if(mod == NULL)
+      mod = sp->rootModule;
+    int idx = (mod->id < HSP_LATENCY_MAX_MODULES) ? mod->id : 0;
+    HSPTelemetry *tel = telemetryBlocks[idx];
+    if(tel == NULL) {
+      EVBus *bus = EVCurrentBus();
+      if(posix_memalign((void **)&tel, HSP_CACHELINE, sizeof(HSPTelemetry)) != 0) {
+	myLog(LOG_ERR, "posix_memalign() failed : %s", strerror(errno));
+	exit(EXIT_FAILURE);
+      }
+      memset(tel, 0, sizeof(HSPTelemetry));
+      tel->bus = my_strdup(bus ? bus->name : "main");
+      tel->module = my_strdup(idx == mod->id ? mod->name : "other");
+      SEMLOCK_DO(sp->sync_latency) {
+	ADD_TO_LIST(sp->telemetry, tel);
+      }
+      telemetryBlocks[idx] = tel;
+    }
+    return tel;
+  }
+
+  void telemetryAdd(HSP *sp, EVMod *mod, EnumHSPTelemetry ctr, uint64_t n) {
+    telemetryBlock(sp, mod)->counter[ctr] += n;
+  }
+
+  void telemetrySet(HSP *sp, EVMod *mod, EnumHSPTelemetry ctr, uint64_t val) {
+    telemetryBlock(sp, mod)->counter[ctr] = val;
+  }
+
+  uint64_t telemetryGet(HSP *sp, EnumHSPTelemetry ctr) {
+    uint64_t total = 0;
+    SEMLOCK_DO(sp->sync_latency) {
+      for(HSPTelemetry *tel = sp->telemetry; tel; tel = tel->nxt)
+	total += tel->counter[ctr];
+    }
+    return total;
   }
 
   /*_________________---------------------------__________________
@@ -136,6 +296,201 @@ extern "C" {
     return NULL;
   }
 
+  /*_________________---------------------------__________________
+    _________________   adaptor lookup snapshot __________________
+    -----------------___________________________------------------
+    The packet bus looks up adaptors by MAC and by peer ifIndex for
+    every sample.  Rather than contend for the adaptor hash-table
+    locks with the poll bus (which may be in the middle of a full
+    interface refresh) we build a compact, read-only snapshot here
+    and publish it with an atomic pointer swap.  The old snapshot is
+    not freed until a grace period has elapsed,  by which time no
+    reader can still be using it.  If there is no snapshot (e.g. it
+    was retracted because an adaptor was deleted) then readers fall
+    back on the hash tables.
+  */
+
+  static uint64_t macKey(u_char *mac) {
+    uint64_t key = 0;
+    for(int ii = 0; ii < 6; ii++)
+      key = (key << 8) | mac[ii];
+    return key;
+  }
+
+  static uint32_t macSlot(uint64_t key, uint32_t bits) {
+    // Fibonacci hashing - take the high bits
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+  }
+
+  static void adaptorLookupFree(HSPAdaptorLookup *lkp) {
+    if(lkp->macs)
+      my_free(lkp->macs);
+    if(lkp->byIndex)
+      my_free(lkp->byIndex);
+    my_free(lkp);
+  }
+
+  static void adaptorLookupRetire(HSP *sp, HSPAdaptorLookup *lkp) {
+    if(lkp) {
+      lkp->retired = sp->pollBus ? sp->pollBus->now.tv_sec : 0;
+      ADD_TO_LIST(sp->adaptorLookup_retired, lkp);
+    }
+  }
+
+  static void adaptorLookupPublish(HSP *sp, HSPAdaptorLookup *lkp) {
+    HSPAdaptorLookup *old = __atomic_exchange_n(&sp->adaptorLookup, lkp, __ATOMIC_ACQ_REL);
+    adaptorLookupRetire(sp, old);
+  }
+
+  static void adaptorLookupGC(HSP *sp, time_t now) {
+    for(HSPAdaptorLookup *lkp = sp->adaptorLookup_retired, *prev = NULL; lkp; ) {
+      HSPAdaptorLookup *nextLkp = lkp->nxt;
+      if((now - lkp->retired) > HSP_ADAPTOR_LOOKUP_GRACE_SECS) {
+	if(prev) prev->nxt = nextLkp;
+	else sp->adaptorLookup_retired = nextLkp;
+	adaptorLookupFree(lkp);
+      }
+      else prev = lkp;
+      lkp = nextLkp;
+    }
+  }
+
+  static void adaptorLookupAddMac(HSPAdaptorLookup *lkp, SFLAdaptor *ad) {
+    if(ad->num_macs == 0
+       || isZeroMAC(&ad->macs[0]))
+      return;
+    uint64_t key = macKey(ad->macs[0].mac);
+    // linear probing - table is never more than half full
+    for(uint32_t slot = macSlot(key, lkp->macBits); ; slot = (slot + 1) & lkp->macMask) {
+      HSPAdaptorLookupMAC *entry = &lkp->macs[slot];
+      if(entry->key == 0) {
+	entry->key = key;
+	entry->adaptor = ad;
+	return;
+      }
+      if(entry->key == key) {
+	// same outcome as the hash table: last one in wins
+	entry->adaptor = ad;
+	return;
+      }
+    }
+  }
+
+  static HSPAdaptorLookup *adaptorLookupBuild(HSP *sp) {
+    HSPAdaptorLookup *lkp = (HSPAdaptorLookup *)my_calloc(sizeof(HSPAdaptorLookup));
+    SFLAdaptor *ad;
+
+    // MAC table - size to next power of 2 >= 2 x entries
+    uint32_t nmacs = UTHashN(sp->adaptorsByMac);
+    lkp->macBits = 4;
+    while((1U << lkp->macBits) < (nmacs * 2))
+      lkp->macBits++;
+    lkp->macMask = (1U << lkp->macBits) - 1;
+    lkp->macs = (HSPAdaptorLookupMAC *)my_calloc((lkp->macMask + 1) * sizeof(HSPAdaptorLookupMAC));
+    SEMLOCK_DO(sp->adaptorsByMac->sync) {
+      UTHASH_WALK(sp->adaptorsByMac, ad)
+	adaptorLookupAddMac(lkp, ad);
+    }
+
+    // dense ifIndex array
+    SEMLOCK_DO(sp->adaptorsByIndex->sync) {
+      UTHASH_WALK(sp->adaptorsByIndex, ad) {
+	if(ad->ifIndex > HSP_ADAPTOR_LOOKUP_MAX_IFINDEX)
+	  lkp->overflow = YES;
+	else if(ad->ifIndex > lkp->maxIfIndex)
+	  lkp->maxIfIndex = ad->ifIndex;
+      }
+    }
+    SEMLOCK_DO(sp->adaptorsByPeerIndex->sync) {
+      UTHASH_WALK(sp->adaptorsByPeerIndex, ad) {
+	if(ad->peer_ifIndex > HSP_ADAPTOR_LOOKUP_MAX_IFINDEX)
+	  lkp->overflow = YES;
+	else if(ad->peer_ifIndex > lkp->maxIfIndex)
+	  lkp->maxIfIndex = ad->peer_ifIndex;
+      }
+    }
+    lkp->byIndex = (HSPAdaptorLookupIndex *)my_calloc((lkp->maxIfIndex + 1) * sizeof(HSPAdaptorLookupIndex));
+    SEMLOCK_DO(sp->adaptorsByIndex->sync) {
+      UTHASH_WALK(sp->adaptorsByIndex, ad) {
+	if(ad->ifIndex <= lkp->maxIfIndex) {
+	  HSPAdaptorLookupIndex *entry = &lkp->byIndex[ad->ifIndex];
+	  HSPAdaptorNIO *nio = ADAPTOR_NIO(ad);
+	  entry->adaptor = ad;
+	  entry->flags = 0;
+	  if(nio->vm_or_container) entry->flags |= HSP_ADLKP_VM_OR_CONTAINER;
+	  if(nio->loopback) entry->flags |= HSP_ADLKP_LOOPBACK;
+	}
+      }
+    }
+    SEMLOCK_DO(sp->adaptorsByPeerIndex->sync) {
+      UTHASH_WALK(sp->adaptorsByPeerIndex, ad) {
+	if(ad->peer_ifIndex <= lkp->maxIfIndex) {
+	  HSPAdaptorLookupIndex *entry = &lkp->byIndex[ad->peer_ifIndex];
+	  entry->peer = ad;
+	  entry->peer_ifIndex = ad->ifIndex;
+	}
+      }
+    }
+    myDebug(1, "adaptorLookupBuild: macs=%u slots=%u maxIfIndex=%u overflow=%s",
+	    nmacs,
+	    lkp->macMask + 1,
+	    lkp->maxIfIndex,
+	    lkp->overflow ? "YES" : "NO");
+    return lkp;
+  }
+
+  void requestAdaptorLookup(HSP *sp) {
+    sp->adaptorLookup_stale = YES;
+  }
+
+  static void refreshAdaptorLookup(HSP *sp) {
+    sp->adaptorLookup_stale = NO;
+    adaptorLookupPublish(sp, adaptorLookupBuild(sp));
+  }
+
+  HSPAdaptorLookup *adaptorLookup(HSP *sp) {
+    return __atomic_load_n(&sp->adaptorLookup, __ATOMIC_ACQUIRE);
+  }
+
+  SFLAdaptor *adaptorLookupMac(HSP *sp, HSPAdaptorLookup *lkp, SFLMacAddress *mac) {
+    if(lkp == NULL)
+      return adaptorByMac(sp, mac);
+    uint64_t key = macKey(mac->mac);
+    if(key == 0)
+      return NULL;
+    for(uint32_t slot = macSlot(key, lkp->macBits); ; slot = (slot + 1) & lkp->macMask) {
+      HSPAdaptorLookupMAC *entry = &lkp->macs[slot];
+      if(entry->key == key)
+	return entry->adaptor;
+      if(entry->key == 0)
+	return NULL;
+    }
+  }
+
+  SFLAdaptor *adaptorLookupPeer(HSP *sp, HSPAdaptorLookup *lkp, SFLAdaptor *ad) {
+    if(lkp == NULL
+       || (ad->ifIndex > lkp->maxIfIndex
+	   && lkp->overflow))
+      return adaptorByPeerIndex(sp, ad->ifIndex);
+    if(ad->ifIndex > lkp->maxIfIndex)
+      return NULL;
+    return lkp->byIndex[ad->ifIndex].peer;
+  }
+
+  uint32_t adaptorLookupFlags(HSPAdaptorLookup *lkp, SFLAdaptor *ad) {
+    if(lkp
+       && ad->ifIndex <= lkp->maxIfIndex
+       && lkp->byIndex[ad->ifIndex].adaptor == ad)
+      return lkp->byIndex[ad->ifIndex].flags;
+    // not in the snapshot (e.g. container adaptor that
+    // shares an ifIndex number with a global one)
+    HSPAdaptorNIO *nio = ADAPTOR_NIO(ad);
+    uint32_t flags = 0;
+    if(nio->vm_or_container) flags |= HSP_ADLKP_VM_OR_CONTAINER;
+    if(nio->loopback) flags |= HSP_ADLKP_LOOPBACK;
+    return flags;
+  }
+
   static void deleteAdaptorFromHT(UTHash *ht, SFLAdaptor *ad, char *htname) {
     char buf[256];
     if(UTHashDel(ht, ad) != ad) {
@@ -148,6 +503,13 @@ extern "C" {
   void deleteAdaptor(HSP *sp, SFLAdaptor *ad, int freeFlag) {
     if(sp->allowDeleteAdaptor == NO)
       return;
+    // the snapshot may reference this adaptor, so retract it
+    // now and let the readers use the hash tables until the
+    // next one is built.
+    if(sp->adaptorLookup) {
+      adaptorLookupPublish(sp, NULL);
+      requestAdaptorLookup(sp);
+    }
     deleteAdaptorFromHT(sp->adaptorsByName, ad, "byName");
     deleteAdaptorFromHT(sp->adaptorsByIndex, ad, "byIndex");
     deleteAdaptorFromHT(sp->adaptorsByMac, ad, "byMac");
@@ -337,7 +699,7 @@ extern "C" {
     SEMLOCK_DO(sp->sync_agent) {
       sfl_poller_writeCountersSample(poller, cs);
       sp->counterSampleQueued = YES;
-      sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+      telemetryAdd(sp, NULL, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
     }
   }
 
@@ -542,6 +904,11 @@ extern "C" {
     // reset the pollActions
     UTArrayReset(sp->pollActions);
 
+    if(sp->telemetrySocket.profileDump) {
+      sp->telemetrySocket.profileDump = NO;
+      profileDump(sp);
+    }
+
     // send a tick to the sFlow agent. This will be passed on
     // to the samplers, pollers and receiver.  If the poller is
     // ready to poll counters it will pull it's callback, but
@@ -600,6 +967,12 @@ extern "C" {
       refreshAdaptorsAndAgentAddress(sp);
     }
 
+    // rebuild the adaptor lookup snapshot if requested, and
+    // free any that have been retired for long enough
+    if(sp->adaptorLookup_stale)
+      refreshAdaptorLookup(sp);
+    adaptorLookupGC(sp, clk);
+
     // rewrite the output if the config has changed
     if(sp->outputRevisionNo != sp->revisionNo) {
       syncOutputFile(sp);
@@ -608,6 +981,16 @@ extern "C" {
 
   }
 
+  /*_________________---------------------------__________________
+    _________________    intfs_changed          __________________
+    -----------------___________________________------------------
+  */
+
+  static void evt_poll_intfs_changed(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    refreshAdaptorLookup(sp);
+  }
+
   /*_________________---------------------------__________________
     _________________    flushCounters          __________________
     -----------------___________________________------------------
@@ -861,6 +1244,8 @@ extern "C" {
       myLog(LOG_INFO,"Received SIGUSR2");
       // memory only - then keep going
       malloc_stats();
+      // and the callback profile (from the poll bus, not from here)
+      sp->telemetrySocket.profileDump = YES;
       break;
     default:
       myLog(LOG_INFO,"Received signal %d", sig);
@@ -1155,8 +1540,11 @@ extern "C" {
     if(prev_settings
        && prev_settings != sp->sFlowSettings_file
        && prev_settings != sp->sFlowSettings) {
-      closeCollectorSockets(sp, prev_settings);
-      freeSFlowSettings(prev_settings);
+      // the telemetry reports walk the collectors under this lock
+      SEMLOCK_DO(sp->sync_agent) {
+	closeCollectorSockets(sp, prev_settings);
+	freeSFlowSettings(prev_settings);
+      }
     }
     return YES;
   }
@@ -1279,6 +1667,343 @@ extern "C" {
     return NO;
   }
 
+  /*_________________---------------------------__________________
+    _________________    telemetry socket       __________________
+    -----------------___________________________------------------
+    telemetry { socket=/var/run/hsflowd.sock }
+    A client connects, optionally writes a command line, and gets
+    the telemetry counters and latency histograms back as text, e.g.
+      echo | socat - UNIX-CONNECT:/var/run/hsflowd.sock
+    or in the Prometheus text exposition format, e.g.
+      echo prometheus | socat - UNIX-CONNECT:/var/run/hsflowd.sock
+    With telemetry { profile=on } the "profile" command lists the
+    CPU and wall time of every callback on every bus, busiest first.
+  */
+
+  typedef struct _HSPProfileEntry {
+    char *bus;
+    char *module;
+    char *event;
+    EVProfile prof;
+  } HSPProfileEntry;
+
+  static void profileCollect(EVBus *bus, EVMod *mod, char *evtName, EVProfile *prof, void *magic) {
+    UTArray *entries = (UTArray *)magic;
+    if(prof->calls == 0)
+      return;
+    // a module may have more than one action for the same event
+    HSPProfileEntry *ent;
+    UTARRAY_WALK(entries, ent) {
+      if(ent->bus == bus->name
+	 && ent->module == mod->name
+	 && my_strequal(ent->event, evtName)) {
+	ent->prof.calls += prof->calls;
+	ent->prof.cpu_nS += prof->cpu_nS;
+	ent->prof.wall_nS += prof->wall_nS;
+	ent->prof.slow += prof->slow;
+	if(prof->max_wall_nS > ent->prof.max_wall_nS)
+	  ent->prof.max_wall_nS = prof->max_wall_nS;
+	return;
+      }
+    }
+    ent = (HSPProfileEntry *)my_calloc(sizeof(HSPProfileEntry));
+    ent->bus = bus->name;
+    ent->module = mod->name;
+    ent->event = evtName;
+    ent->prof = *prof;
+    UTArrayAdd(entries, ent);
+  }
+
+  static int profileCmpCPU(const void *a, const void *b) {
+    const HSPProfileEntry *pa = *(HSPProfileEntry **)a;
+    const HSPProfileEntry *pb = *(HSPProfileEntry **)b;
+    if(pa->prof.cpu_nS == pb->prof.cpu_nS)
+      return 0;
+    return (pa->prof.cpu_nS > pb->prof.cpu_nS) ? -1 : 1;
+  }
+
+  static UTArray *profileEntries(HSP *sp) {
+    UTArray *entries = UTArrayNew(UTARRAY_DFLT);
+    EVProfileWalk(sp->rootModule, profileCollect, entries);
+    qsort(entries->objs, UTArrayN(entries), sizeof(void *), profileCmpCPU);
+    return entries;
+  }
+
+  static void profileEntriesFree(UTArray *entries) {
+    HSPProfileEntry *ent;
+    UTARRAY_WALK(entries, ent)
+      my_free(ent);
+    UTArrayFree(entries);
+  }
+
+  static void telemetryBusReport(HSP *sp, UTStrBuf *buf) {
+    EVBus *bus;
+    UTHASH_WALK(sp->rootModule->root->buses, bus) {
+      UTStrBuf_printf(buf, "bus name=%s late_deci=%"PRIu64" max_lag_mS=%u\n",
+		      bus->name,
+		      bus->lateDeci,
+		      bus->maxLag_mS);
+    }
+  }
+
+  static void telemetryProfileReport(HSP *sp, UTStrBuf *buf) {
+    if(!sp->telemetrySocket.profile) {
+      UTStrBuf_printf(buf, "profiling is off (telemetry { profile=on })\n");
+      return;
+    }
+    telemetryBusReport(sp, buf);
+    UTArray *entries = profileEntries(sp);
+    HSPProfileEntry *ent;
+    UTARRAY_WALK(entries, ent) {
+      UTStrBuf_printf(buf, "callback bus=%s module=%s event=%s calls=%"PRIu64" cpu_nS=%"PRIu64
+		      " wall_nS=%"PRIu64" max_wall_nS=%"PRIu64" slow=%"PRIu64"\n",
+		      ent->bus,
+		      ent->module,
+		      ent->event,
+		      ent->prof.calls,
+		      ent->prof.cpu_nS,
+		      ent->prof.wall_nS,
+		      ent->prof.max_wall_nS,
+		      ent->prof.slow);
+    }
+    profileEntriesFree(entries);
+  }
+
+  static void profileDump(HSP *sp) {
+    // the same report, to the log
+    UTStrBuf *buf = UTStrBuf_new();
+    telemetryProfileReport(sp, buf);
+    char *saveptr = NULL;
+    for(char *line = strtok_r(UTSTRBUF_STR(buf), "\n", &saveptr);
+	line;
+	line = strtok_r(NULL, "\n", &saveptr))
+      myLog(LOG_INFO, "profile: %s", line);
+    UTStrBuf_free(buf);
+  }
+
+  static void telemetryLatencyReport(UTStrBuf *buf, char *bus, char *module, const char *stage, HSPLatencyHist *hist) {
+    if(hist->count == 0)
+      return;
+    UTStrBuf_printf(buf, "latency bus=%s module=%s stage=%s count=%"PRIu64" mean_nS=%"PRIu64
+		    " p50_nS=%"PRIu64" p90_nS=%"PRIu64" p99_nS=%"PRIu64" p999_nS=%"PRIu64" max_nS=%"PRIu64"\n",
+		    bus,
+		    module,
+		    stage,
+		    hist->count,
+		    hist->sum_nS / hist->count,
+		    latencyPercentile(hist, 50),
+		    latencyPercentile(hist, 90),
+		    latencyPercentile(hist, 99),
+		    latencyPercentile(hist, 99.9),
+		    hist->max_nS);
+  }
+
+  static void telemetryReport(HSP *sp, UTStrBuf *buf) {
+    for(int ii = 0; ii < HSP_TELEMETRY_NUM_COUNTERS; ii++)
+      UTStrBuf_printf(buf, "%s %"PRIu64"\n", HSPTelemetryNames[ii], telemetryGet(sp, ii));
+    // installSFlowSettings() frees the old collectors under this lock
+    SEMLOCK_DO(sp->sync_agent) {
+      HSPSFlowSettings *settings = sp->sFlowSettings;
+      for(HSPCollector *coll = settings ? settings->collectors : NULL; coll; coll = coll->nxt) {
+	char ipbuf[51];
+	UTStrBuf_printf(buf, "collector ip=%s udpport=%u datagrams=%"PRIu64" bytes=%"PRIu64" errors=%"PRIu64"\n",
+			SFLAddress_print(&coll->ipAddr, ipbuf, 50),
+			coll->udpPort,
+			__atomic_load_n(&coll->datagrams, __ATOMIC_RELAXED),
+			__atomic_load_n(&coll->bytes, __ATOMIC_RELAXED),
+			__atomic_load_n(&coll->errors, __ATOMIC_RELAXED));
+      }
+    }
+    telemetryBusReport(sp, buf);
+    SEMLOCK_DO(sp->sync_latency) {
+      for(HSPLatency *lat = sp->latency; lat; lat = lat->nxt) {
+	for(int st = 0; st < HSP_LATENCY_NUM_STAGES; st++)
+	  telemetryLatencyReport(buf, lat->bus, lat->module, HSPLatencyStageNames[st], &lat->hist[st]);
+      }
+    }
+  }
+
+  static void telemetryPrometheusLatency(UTStrBuf *buf, char *bus, char *module, const char *stage, HSPLatencyHist *hist) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    if(hist->count == 0)
+      return;
+    for(int qq = 0; qq < 4; qq++)
+      UTStrBuf_printf(buf, "hsflowd_latency_seconds{bus=\"%s\",module=\"%s\",stage=\"%s\",quantile=\"%g\"} %.9f\n",
+		      bus, module, stage, quantiles[qq],
+		      latencyPercentile(hist, quantiles[qq] * 100) / 1e9);
+    UTStrBuf_printf(buf, "hsflowd_latency_seconds_sum{bus=\"%s\",module=\"%s\",stage=\"%s\"} %.9f\n",
+		    bus, module, stage, hist->sum_nS / 1e9);
+    UTStrBuf_printf(buf, "hsflowd_latency_seconds_count{bus=\"%s\",module=\"%s\",stage=\"%s\"} %"PRIu64"\n",
+		    bus, module, stage, hist->count);
+  }
+
+  static void telemetryPrometheus(HSP *sp, UTStrBuf *buf) {
+    SEMLOCK_DO(sp->sync_latency) {
+      // one series per bus and module, zeros included, so a series
+      // does not come and go between scrapes
+      for(int ii = 0; sp->telemetry && ii < HSP_TELEMETRY_NUM_COUNTERS; ii++) {
+	bool gauge = HSPTelemetryIsGauge[ii];
+	const char *suffix = gauge ? "" : "_total";
+	UTStrBuf_printf(buf, "# TYPE hsflowd_%s%s %s\n",
+			HSPTelemetryNames[ii], suffix, gauge ? "gauge" : "counter");
+	for(HSPTelemetry *tel = sp->telemetry; tel; tel = tel->nxt)
+	  UTStrBuf_printf(buf, "hsflowd_%s%s{bus=\"%s\",module=\"%s\"} %"PRIu64"\n",
+			  HSPTelemetryNames[ii], suffix, tel->bus, tel->module, tel->counter[ii]);
+      }
+      UTStrBuf_printf(buf, "# TYPE hsflowd_latency_seconds summary\n");
+      for(HSPLatency *lat = sp->latency; lat; lat = lat->nxt) {
+	for(int st = 0; st < HSP_LATENCY_NUM_STAGES; st++)
+	  telemetryPrometheusLatency(buf, lat->bus, lat->module, HSPLatencyStageNames[st], &lat->hist[st]);
+      }
+    }
+    // installSFlowSettings() frees the old collectors under this lock
+    SEMLOCK_DO(sp->sync_agent) {
+      HSPSFlowSettings *settings = sp->sFlowSettings;
+      static const char *collNames[] = { "datagrams", "bytes", "errors" };
+      for(int cc = 0; settings && cc < 3; cc++) {
+	UTStrBuf_printf(buf, "# TYPE hsflowd_collector_%s_total counter\n", collNames[cc]);
+	for(HSPCollector *coll = settings->collectors; coll; coll = coll->nxt) {
+	  uint64_t *ctr = (cc == 0) ? &coll->datagrams : (cc == 1) ? &coll->bytes : &coll->errors;
+	  char ipbuf[51];
+	  UTStrBuf_printf(buf, "hsflowd_collector_%s_total{collector=\"%s:%u\"} %"PRIu64"\n",
+			  collNames[cc],
+			  SFLAddress_print(&coll->ipAddr, ipbuf, 50),
+			  coll->udpPort,
+			  __atomic_load_n(ctr, __ATOMIC_RELAXED));
+	}
+      }
+    }
+    EVBus *bus;
+    UTStrBuf_printf(buf, "# TYPE hsflowd_bus_late_deci_total counter\n");
+    UTHASH_WALK(sp->rootModule->root->buses, bus)
+      UTStrBuf_printf(buf, "hsflowd_bus_late_deci_total{bus=\"%s\"} %"PRIu64"\n", bus->name, bus->lateDeci);
+    if(sp->telemetrySocket.profile) {
+      static const char *profNames[] = {
+	"calls_total",
+	"cpu_seconds_total",
+	"wall_seconds_total",
+	"slow_total" };
+      UTArray *entries = profileEntries(sp);
+      for(int pp = 0; pp < 4; pp++) {
+	UTStrBuf_printf(buf, "# TYPE hsflowd_callback_%s counter\n", profNames[pp]);
+	HSPProfileEntry *ent;
+	UTARRAY_WALK(entries, ent) {
+	  UTStrBuf_printf(buf, "hsflowd_callback_%s{bus=\"%s\",module=\"%s\",event=\"%s\"} ",
+			  profNames[pp], ent->bus, ent->module, ent->event);
+	  switch(pp) {
+	  case 0: UTStrBuf_printf(buf, "%"PRIu64"\n", ent->prof.calls); break;
+	  case 1: UTStrBuf_printf(buf, "%.9f\n", ent->prof.cpu_nS / 1e9); break;
+	  case 2: UTStrBuf_printf(buf, "%.9f\n", ent->prof.wall_nS / 1e9); break;
+	  case 3: UTStrBuf_printf(buf, "%"PRIu64"\n", ent->prof.slow); break;
+	  }
+	}
+      }
+      profileEntriesFree(entries);
+    }
+  }
+
+  // write as much of the pending reply as the client will take now,
+  // returning true once it has all gone
+  static bool telemetryWrite(HSPTelemetryClient *client) {
+    while(client->offset < UTSTRBUF_LEN(client->reply)) {
+      ssize_t cc = write(client->sock->fd,
+			 UTSTRBUF_STR(client->reply) + client->offset,
+			 UTSTRBUF_LEN(client->reply) - client->offset);
+      if(cc < 0) {
+	if(errno == EINTR)
+	  continue;
+	if(errno == EAGAIN)
+	  return NO;
+	myDebug(1, "telemetry socket write() failed: %s", strerror(errno));
+	break;
+      }
+      client->offset += cc;
+    }
+    UTStrBuf_reset(client->reply);
+    client->offset = 0;
+    // let the client see EOF. We close our end when it does.
+    shutdown(client->sock->fd, SHUT_WR);
+    return YES;
+  }
+
+  static void telemetryClientFree(HSP *sp, HSPTelemetryClient *client) {
+    if(UTArrayDel(sp->telemetrySocket.writers, client))
+      UTArrayPack(sp->telemetrySocket.writers);
+    UTStrBuf_free(client->reply);
+    my_free(client);
+  }
+
+  static void telemetryReadCB(EVMod *mod, EVSocket *sock, EnumEVSocketReadStatus status, void *magic) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPTelemetryClient *client = (HSPTelemetryClient *)magic;
+    switch(status) {
+    case EVSOCKETREAD_STR: {
+      // "prometheus" (or "metrics") asks for the Prometheus text format,
+      // "profile" for the per-callback accounting, any other line (including an empty one) for the full text report
+      char *cmd = UTSTRBUF_STR(sock->ioline);
+      if(UTSTRBUF_LEN(client->reply) == 0) {
+	if(my_strnequal(cmd, "prometheus", 10)
+	   || my_strnequal(cmd, "metrics", 7))
+	  telemetryPrometheus(sp, client->reply);
+	else if(my_strnequal(cmd, "profile", 7))
+	  telemetryProfileReport(sp, client->reply);
+	else
+	  telemetryReport(sp, client->reply);
+	// the socket is non-blocking, so a client that is slow to read
+	// cannot stall the poll bus. The rest goes out on the next deci.
+	if(!telemetryWrite(client))
+	  UTArrayAdd(sp->telemetrySocket.writers, client);
+      }
+      UTStrBuf_reset(sock->ioline);
+      break;
+    }
+    case EVSOCKETREAD_EOF:
+    case EVSOCKETREAD_ERR:
+    case EVSOCKETREAD_BADF:
+      telemetryClientFree(sp, client);
+      break;
+    default:
+      break;
+    }
+  }
+
+  static void telemetryRead(EVMod *mod, EVSocket *sock, void *magic) {
+    EVSocketReadLines(mod, sock, telemetryReadCB, magic);
+  }
+
+  static void telemetryAccept(EVMod *mod, EVSocket *sock, void *magic) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    int fd = accept4(sock->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if(fd < 0) {
+      myLog(LOG_ERR, "telemetry socket accept() failed: %s", strerror(errno));
+      return;
+    }
+    HSPTelemetryClient *client = (HSPTelemetryClient *)my_calloc(sizeof(HSPTelemetryClient));
+    client->reply = UTStrBuf_new();
+    client->sock = EVBusAddSocket(mod, sp->pollBus, fd, telemetryRead, client);
+  }
+
+  static void evt_telemetry_deci(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPTelemetryClient *client;
+    UTARRAY_WALK(sp->telemetrySocket.writers, client) {
+      if(telemetryWrite(client))
+	UTArrayDel(sp->telemetrySocket.writers, client);
+    }
+    // not a packing array, so the walk above cannot be disturbed
+    UTArrayPack(sp->telemetrySocket.writers);
+  }
+
+  static void telemetrySocketOpen(HSP *sp) {
+    int fd = UTUnixDomainSocketListen(sp->telemetrySocket.path);
+    if(fd < 0)
+      return;
+    myDebug(1, "telemetry socket listening on %s", sp->telemetrySocket.path);
+    sp->telemetrySocket.sock = EVBusAddSocket(sp->rootModule, sp->pollBus, fd, telemetryAccept, NULL);
+    sp->telemetrySocket.writers = UTArrayNew(UTARRAY_DFLT);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_DECI), evt_telemetry_deci);
+  }
+
   /*_________________---------------------------__________________
     _________________     evt_config_first      __________________
     -----------------___________________________------------------
@@ -1289,6 +2014,16 @@ extern "C" {
     // assert(sp->sFlowSettings);
     myDebug(1, "evt_config_first: first valid configuration");
 
+    // open this before we drop privileges
+    if(sp->telemetrySocket.path)
+      telemetrySocketOpen(sp);
+    if(sp->telemetrySocket.profile) {
+      if(sp->telemetrySocket.profileSlow_mS == 0)
+	sp->telemetrySocket.profileSlow_mS = HSP_PROFILE_SLOW_MS_DEFAULT;
+      EVProfileEnable(sp->rootModule, YES, sp->telemetrySocket.profileSlow_mS);
+      myDebug(1, "callback profiling on, slow=%u mS", sp->telemetrySocket.profileSlow_mS);
+    }
+
     if(sp->sFlowSettings == NULL
        || sp->sFlowSettings->collectors == NULL) {
       if(sp->DNSSD.DNSSD == NO
@@ -1737,6 +2472,8 @@ extern "C" {
     // and XDR datagram encoding)
     sp->sync_agent = (pthread_mutex_t *)my_calloc(sizeof(pthread_mutex_t));
     pthread_mutex_init(sp->sync_agent, NULL);
+    sp->sync_latency = (pthread_mutex_t *)my_calloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(sp->sync_latency, NULL);
 
     // poll actions array
     sp->pollActions = UTArrayNew(UTARRAY_DFLT);
@@ -1748,6 +2485,8 @@ extern "C" {
     sp->adaptorsByMac = UTHASH_NEW(SFLAdaptor, macs[0], UTHASH_SYNC);
     // sometimes need to suppress the deleting of adaptors for test purposes.
     sp->allowDeleteAdaptor = YES;
+    // the packet-path snapshot of these tables is built on the first tick
+    sp->adaptorLookup_stale = YES;
 
     // these ones do not need sync - always accessed from same thread
     sp->vmsByUUID = UTHASH_NEW(HSPVMState, uuid, UTHASH_DFLT);
@@ -1986,6 +2725,8 @@ extern "C" {
 
     EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_TICK), evt_poll_tick);
     EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_TOCK), evt_poll_tock);
+    // registered after the modules so the snapshot reflects their changes too
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, HSPEVENT_INTFS_CHANGED), evt_poll_intfs_changed);
 
     if(sp->DNSSD.DNSSD) {
       EVLoadModule(sp->rootModule, "mod_dnssd", sp->modulesPath);
@@ -157,6 +157,10 @@ extern "C" {
     char *namespace;
     char *deviceName;
     uint32_t deviceIfIndex;
+    // sent from more than one bus, so updated atomically
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t errors;
   } HSPCollector;
 
   typedef struct _HSPPcap {
@@ -211,6 +215,7 @@ extern "C" {
 
 #define HSP_MAX_HEADER_BYTES 256
     HSPApplicationSettings *applicationSettings;
+    UTHash *applicationIndex; // applicationSettings keyed by name
     HSPCIDR *agentCIDRs;
     SFLAddress agentIP;
     char *agentDevice;
@@ -367,6 +372,9 @@ extern "C" {
 #define HSPBUS_POLL "poll" // main thread
 #define HSPBUS_CONFIG "config" // DNS-SD
 #define HSPBUS_PACKET "packet" // pcap,ulog,nflog,json,tcp,psample packet processing
+#define HSPBUS_JSON "json" // json { workers=N } ingest threads json1...json<N-1>
+#define HSPBUS_NETNS "netns" // container namespace probing (docker)
+#define HSP_JSON_MAX_WORKERS 32
 
 // The generic start,tick,tock,final,end events are defined in evbus.h
 #define HSPEVENT_HOST_COUNTER_SAMPLE "csample"   // (csample *) building counter-sample
@@ -384,6 +392,17 @@ extern "C" {
 #define HSPEVENT_INTF_SPEED "intf_speed"         // (adaptor *) interface speed change
 #define HSPEVENT_INTFS_CHANGED "intfs_changed"   // some interface(s) changed
 #define HSPEVENT_UPDATE_NIO "update_nio"         // (adaptor *) nio counter refresh
+#define HSPEVENT_NETNS_REQ "netns_req"           // (HSPNetnsReq[]) namespaces to probe for VNICs
+#define HSPEVENT_NETNS_VNICS "netns_vnics"       // (HSPNetnsVNICs *) VNICs found in one namespace
+
+  typedef enum {
+    HSP_TUNNEL_NONE=0,
+    HSP_TUNNEL_IPIP,
+    HSP_TUNNEL_GRE,
+    HSP_TUNNEL_VXLAN,
+    HSP_TUNNEL_GENEVE,
+    HSP_TUNNEL_MPLS
+  } EnumHSPTunnel;
 
   typedef struct _HSPPendingSample {
     SFL_FLOW_SAMPLE_TYPE *fs;
@@ -399,8 +418,19 @@ extern "C" {
     SFLAddress dst;
     int l3_offset;
     int l4_offset;
+    uint16_t l3_type; // ethernet type at l3_offset
     uint8_t ipproto;
+    // inner header decode (only if asked for)
+    EnumHSPTunnel tunnel;
+    uint32_t tunnel_id; // VNI, GRE key or MPLS label
+    int inner_ipversion;
+    int inner_l3_offset;
+    int inner_l4_offset;
+    uint8_t inner_ipproto;
+    uint64_t taken_nS; // latencyClock_nS() at takeSample()
+    EVMod *module; // that took the sample
     bool decoded:1;
+    bool decoded_inner:1;
     // local address test
     bool localTest:1;
     bool localSrc:1;
@@ -424,6 +454,11 @@ extern "C" {
     HSP_TELEMETRY_FLOW_SAMPLES_SUPPRESSED,
     HSP_TELEMETRY_COUNTER_SAMPLES_SUPPRESSED,
     HSP_TELEMETRY_EVENT_SAMPLES,
+    HSP_TELEMETRY_JSON_DROPS,
+    HSP_TELEMETRY_DOCKER_INFLIGHT,
+    HSP_TELEMETRY_DOCKER_QUEUED,
+    HSP_TELEMETRY_DOCKER_CONNECTIONS,
+    HSP_TELEMETRY_DOCKER_LOST,
     HSP_TELEMETRY_NUM_COUNTERS
   } EnumHSPTelemetry;
 
@@ -436,11 +471,137 @@ extern "C" {
     "datagrams",
     "dropped_samples",
     "flow_samples_suppressed",
-    "counter_samples_suppressed"
+    "counter_samples_suppressed",
     "event_samples",
+    "json_drops",
+    "docker_inflight",
+    "docker_queued",
+    "docker_connections",
+    "docker_lost",
+  };
+
+  // the rest are counters
+  static const bool HSPTelemetryIsGauge[] = {
+    [HSP_TELEMETRY_DOCKER_INFLIGHT] = YES,
+    [HSP_TELEMETRY_DOCKER_QUEUED] = YES,
+    [HSP_TELEMETRY_DOCKER_CONNECTIONS] = YES,
+    [HSP_TELEMETRY_NUM_COUNTERS - 1] = NO,
+  };
+#endif
+
+  // One of these for each bus+module that counts anything, like the
+  // latency blocks below. Only that bus thread writes to it, and it is
+  // padded to whole cache lines so that no two threads share a line.
+  // Readers add them up.
+#define HSP_CACHELINE 64
+  typedef struct _HSPTelemetry {
+    struct _HSPTelemetry *nxt;
+    char *bus;
+    char *module;
+    uint64_t counter[HSP_TELEMETRY_NUM_COUNTERS];
+  } __attribute__((aligned(HSP_CACHELINE))) HSPTelemetry;
+
+  // A connection to the telemetry socket, and whatever part of its
+  // reply the client has not taken yet.
+  typedef struct _HSPTelemetryClient {
+    EVSocket *sock;
+    UTStrBuf *reply;
+    size_t offset;
+  } HSPTelemetryClient;
+
+  // Per-stage latency histograms for the packet-sample path
+  // (and for docker API round-trips).
+  typedef enum {
+    HSP_LATENCY_CAPTURE=0, // packet timestamp -> takeSample()
+    HSP_LATENCY_HOLD,      // takeSample() -> releasePendingSample()
+    HSP_LATENCY_ENCODE,    // sfl_sampler_writeFlowSample() (includes any flush)
+    HSP_LATENCY_SEND,      // sendto() to all collectors
+    HSP_LATENCY_DOCKER,    // docker API request sent -> response complete
+    HSP_LATENCY_SONIC_REDIS, // sonic COUNTERS read sent -> reply
+    HSP_LATENCY_SONIC_AGE, // sonic COUNTERS read -> counter sample taken
+    HSP_LATENCY_OVSDB,     // OVSDB transact sent -> reply
+    HSP_LATENCY_KVM_STATS, // virConnectGetAllDomainStats()
+    HSP_LATENCY_NVML_DECI, // NVML utilization sample, all GPUs (every deci)
+    HSP_LATENCY_NVML_TICK, // NVML utilization average + power read, all GPUs (every tick)
+    HSP_LATENCY_NVML_READ, // NVML counter read, one GPU
+    HSP_LATENCY_DNSSD,     // DNS-SD query sent -> answer
+    HSP_LATENCY_NUM_STAGES
+  } EnumHSPLatencyStage;
+
+#ifdef HSP_TELEMETRY_NAMES
+  static const char *HSPLatencyStageNames[] = {
+    "capture",
+    "hold",
+    "encode",
+    "send",
+    "docker_api",
+    "sonic_redis",
+    "sonic_counter_age",
+    "ovsdb_txn",
+    "kvm_stats",
+    "nvml_deci",
+    "nvml_tick",
+    "nvml_read",
+    "dnssd_query",
   };
 #endif
 
+  // log-linear buckets: 4 per power of 2 (so within 25%) up to 2^40 nS.
+#define HSP_LATENCY_SUB_BITS 2
+#define HSP_LATENCY_BUCKETS (40 << HSP_LATENCY_SUB_BITS)
+
+  typedef struct _HSPLatencyHist {
+    uint64_t count;
+    uint64_t sum_nS;
+    uint64_t max_nS;
+    uint64_t bucket[HSP_LATENCY_BUCKETS];
+  } HSPLatencyHist;
+
+  // One of these for each bus+module that records anything. Only
+  // ever written by that bus thread, so there is no locking on the
+  // hot path. Readers tolerate a slightly inconsistent snapshot.
+  typedef struct _HSPLatency {
+    struct _HSPLatency *nxt;
+    char *bus;
+    char *module;
+    HSPLatencyHist hist[HSP_LATENCY_NUM_STAGES];
+  } HSPLatency;
+
+  // Read-mostly snapshot of the adaptor tables for the packet-sample
+  // path.  Built on the poll bus whenever the interfaces change, and
+  // published with a single pointer-store so that readers on other
+  // buses never have to take the adaptor hash-table locks.
+  typedef struct _HSPAdaptorLookupMAC {
+    uint64_t key; // 48-bit MAC, 0 == empty slot
+    SFLAdaptor *adaptor;
+  } HSPAdaptorLookupMAC;
+
+  typedef struct _HSPAdaptorLookupIndex {
+    SFLAdaptor *adaptor; // adaptorByIndex()
+    SFLAdaptor *peer;    // adaptorByPeerIndex()
+    uint32_t flags;
+#define HSP_ADLKP_VM_OR_CONTAINER 0x01
+#define HSP_ADLKP_LOOPBACK 0x02
+    uint32_t peer_ifIndex;
+  } HSPAdaptorLookupIndex;
+
+  typedef struct _HSPAdaptorLookup {
+    struct _HSPAdaptorLookup *nxt; // retired list
+    time_t retired;
+    HSPAdaptorLookupMAC *macs;
+    uint32_t macMask;
+    uint32_t macBits;
+    HSPAdaptorLookupIndex *byIndex;
+    uint32_t maxIfIndex;
+    bool overflow:1; // some ifIndex did not fit in byIndex[]
+  } HSPAdaptorLookup;
+
+  // cap the dense array at 64K entries (1.5MB). Anything
+  // beyond that falls back on the hash tables.
+#define HSP_ADAPTOR_LOOKUP_MAX_IFINDEX 65535
+  // retired snapshots are freed after this grace period
+#define HSP_ADAPTOR_LOOKUP_GRACE_SECS 5
+
   typedef enum {
     HSP_VNODE_PRIORITY_SYSTEMD=1,
     HSP_VNODE_PRIORITY_DOCKER,
@@ -457,6 +618,7 @@ extern "C" {
     // agent
     SFLAgent *agent;
     pthread_mutex_t *sync_agent;
+    EVMod *sendModule; // whose sample is being written (under sync_agent)
     // main host poller
     SFLPoller *poller;
     bool counterSampleQueued;
@@ -483,11 +645,18 @@ extern "C" {
     struct {
       bool DNSSD;
       char *domain;
+      SFLAddress server; // instead of resolv.conf
+      struct sockaddr_in6 serverSocketAddr;
+      uint32_t serverPort;
     } DNSSD;
     struct {
       bool json;
       uint32_t port;
       char *FIFO;
+      uint32_t workers;
+      char *ring;
+      uint32_t aggregate;
+      uint32_t aggregateMax;
     } json;
     struct {
       bool kvm;
@@ -510,6 +679,11 @@ extern "C" {
       uint32_t forgetVMSecs;
       bool hostname;
       bool markTraffic; // TODO: use enum here?
+      char *socket;
+      uint32_t connections;
+      uint32_t pipeline;
+      bool cgroupStats;
+      bool cri; // CRI runtime (containerd, CRI-O) instead of dockerd
     } docker;
     struct {
       bool cumulus;
@@ -524,6 +698,7 @@ extern "C" {
     } dent;
     struct {
       bool ovs;
+      char *socket; // OVSDB unix socket
     } ovs;
     struct {
       bool opx;
@@ -537,6 +712,7 @@ extern "C" {
       bool sonic;
       char *swp_regex_str;
       regex_t *swp_regex;
+      char *dbconfig;
     } sonic;
     struct {
       bool nvml;
@@ -588,10 +764,20 @@ extern "C" {
       char *cgroup_procs;
       char *cgroup_acct;
       bool markTraffic;
+      bool fdCount;
     } systemd;
     struct {
       bool eapi;
     } eapi;
+    struct {
+      char *path;
+      EVSocket *sock;
+      bool profile;
+      uint32_t profileSlow_mS;
+#define HSP_PROFILE_SLOW_MS_DEFAULT 50
+      bool profileDump; // set by SIGUSR2
+      UTArray *writers; // HSPTelemetryClient with reply still to send
+    } telemetrySocket;
 
     // hardware sampling flag
     bool hardwareSampling;
@@ -621,6 +807,9 @@ extern "C" {
     UTHash *adaptorsByPeerIndex;
     UTHash *adaptorsByMac;
     bool allowDeleteAdaptor;
+    HSPAdaptorLookup *adaptorLookup; // published snapshot (may be NULL)
+    HSPAdaptorLookup *adaptorLookup_retired;
+    bool adaptorLookup_stale;
 
     // poll actions for tick-tock cycle
     UTArray *pollActions;
@@ -674,7 +863,9 @@ extern "C" {
     // handshake countdown
     int config_shake_countdown;
 
-    uint64_t telemetry[HSP_TELEMETRY_NUM_COUNTERS];
+    HSPTelemetry *telemetry;
+    HSPLatency *latency;
+    pthread_mutex_t *sync_latency;
 
   } HSP;
 
@@ -736,6 +927,11 @@ extern "C" {
   SFLAdaptor *adaptorByIndex(HSP *sp, uint32_t ifIndex);
   SFLAdaptor *adaptorByPeerIndex(HSP *sp, uint32_t ifIndex);
   SFLAdaptor *adaptorByIP(HSP *sp, SFLAddress *ip);
+  HSPAdaptorLookup *adaptorLookup(HSP *sp);
+  SFLAdaptor *adaptorLookupMac(HSP *sp, HSPAdaptorLookup *lkp, SFLMacAddress *mac);
+  SFLAdaptor *adaptorLookupPeer(HSP *sp, HSPAdaptorLookup *lkp, SFLAdaptor *ad);
+  uint32_t adaptorLookupFlags(HSPAdaptorLookup *lkp, SFLAdaptor *ad);
+  void requestAdaptorLookup(HSP *sp);
   void deleteAdaptor(HSP *sp, SFLAdaptor *ad, int freeFlag);
   int deleteMarkedAdaptors(HSP *sp, UTHash *adaptorHT, int freeFlag);
   int deleteMarkedAdaptors_adaptorList(HSP *sp, SFLAdaptorList *adList);
@@ -760,11 +956,23 @@ extern "C" {
 #define HSP_SAMPLEOPT_OPX         0x4000
 #define HSP_SAMPLEOPT_PSAMPLE     0x8000
 
-  void takeSample(HSP *sp, SFLAdaptor *ad_in, SFLAdaptor *ad_out, SFLAdaptor *ad_tap, uint32_t options, uint32_t hook, const u_char *mac_hdr, uint32_t mac_len, const u_char *cap_hdr, uint32_t cap_len, uint32_t pkt_len, uint32_t drops, uint32_t sampling_n);
+  void takeSample(HSP *sp, EVMod *mod, SFLAdaptor *ad_in, SFLAdaptor *ad_out, SFLAdaptor *ad_tap, uint32_t options, uint32_t hook, const u_char *mac_hdr, uint32_t mac_len, const u_char *cap_hdr, uint32_t cap_len, uint32_t pkt_len, uint32_t drops, uint32_t sampling_n);
   void *pendingSample_calloc(HSPPendingSample *ps, size_t len);
   void holdPendingSample(HSPPendingSample *ps);
   void releasePendingSample(HSP *sp, HSPPendingSample *ps);
   int decodePendingSample(HSPPendingSample *ps);
+  int decodePendingSampleInner(HSPPendingSample *ps);
+
+  // telemetry counters
+  void telemetryAdd(HSP *sp, EVMod *mod, EnumHSPTelemetry ctr, uint64_t n);
+  void telemetrySet(HSP *sp, EVMod *mod, EnumHSPTelemetry ctr, uint64_t val);
+  uint64_t telemetryGet(HSP *sp, EnumHSPTelemetry ctr);
+
+  // latency instrumentation
+  uint64_t latencyClock_nS(void);
+  void latencyRecord(HSP *sp, EVMod *mod, EnumHSPLatencyStage stage, uint64_t nS);
+  void latencyMerge(HSP *sp, EnumHSPLatencyStage stage, HSPLatencyHist *total);
+  uint64_t latencyPercentile(HSPLatencyHist *hist, double pc);
   SFLPoller *forceCounterPolling(HSP *sp, SFLAdaptor *adaptor);
 
   // VM lifecycle
@@ -0,0 +1,372 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+#ifndef HSFLOWD_RING_H
+#define HSFLOWD_RING_H 1
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+  /* Shared-memory ring input for mod_json (json { ring=<path> }).
+
+     A local producer creates a memfd holding an HSPRingHdr followed by
+     a power-of-2 data area, and passes the fd to hsflowd over the unix
+     socket at <path>. It then appends pre-encoded XDR rtmetric/rtflow
+     records without any further system calls.  hsflowd drains every
+     ring on the packet bus deci event and copies the records straight
+     into sFlow datagrams.  Closing the socket releases the ring.
+
+     Single-producer/single-consumer: the producer owns head, hsflowd
+     owns tail.  Each record is a uint32_t byte length (host order, a
+     multiple of 4) followed by the XDR.  A record never wraps: if it
+     will not fit before the end of the data area the producer writes
+     HSP_RING_PAD and starts again at offset 0.
+
+     Producers just include this file:
+
+       HSPRing ring;
+       if(hsp_ring_open(&ring, "/run/hsflowd_ring.sock", 1 << 20) == 0) {
+         HSPRingRec rec;
+         hsp_rec_rtmetric(&rec, "web1");
+         hsp_rec_counter32(&rec, "requests", nreq);
+         hsp_rec_gaugeDouble(&rec, "load", 0.7);
+         hsp_ring_write(&ring, &rec);
+         ...
+         hsp_ring_close(&ring);
+       }
+  */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#define HSP_RING_MAGIC 0x48535052 // "HSPR"
+#define HSP_RING_VERSION 1
+#define HSP_RING_HDR_LEN 192
+#define HSP_RING_MIN_SIZE 4096
+#define HSP_RING_MAX_SIZE (64 << 20)
+#define HSP_RING_PAD 0xFFFFFFFF
+  // must still fit in one sFlow datagram with the datagram header
+#define HSP_RING_MAX_RECORD 1300
+
+  typedef struct _HSPRingHdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;  // bytes in data area, power of 2
+    uint32_t hdr_len;
+    uint64_t drops; // records the producer discarded because the ring was full
+    uint8_t pad0[40];
+    uint64_t head;  // producer: bytes written
+    uint8_t pad1[56];
+    uint64_t tail;  // consumer: bytes read
+    uint8_t pad2[56];
+  } HSPRingHdr;
+
+  // rtmetric/rtflow structure tags and field types
+#define TAG_RTMETRIC ((4300 << 12) + 1002)
+#define TAG_RTFLOW ((4300 << 12) + 1003)
+
+  typedef enum {
+    RTMetricType_string = 0,
+    RTMetricType_counter32,
+    RTMetricType_counter64,
+    RTMetricType_gauge32,
+    RTMetricType_gauge64,
+    RTMetricType_gaugeFloat,
+    RTMetricType_gaugeDouble
+  } EnumRTMetricType;
+
+  typedef enum {
+    RTFlowType_string = 0,
+    RTFlowType_mac,
+    RTFlowType_ip,
+    RTFlowType_ip6,
+    RTFlowType_int32,
+    RTFlowType_int64,
+    RTFlowType_float,
+    RTFlowType_double
+  } EnumRTFlowType;
+
+#define HSP_MAX_RTMETRIC_KEY_LEN 64
+#define HSP_MAX_RTMETRIC_VAL_LEN 255
+
+  /*_________________---------------------------__________________
+    _________________    producer: ring         __________________
+    -----------------___________________________------------------
+  */
+
+  typedef struct _HSPRing {
+    int memfd;
+    int sock;
+    HSPRingHdr *hdr;
+    uint8_t *data;
+    size_t mapLen;
+  } HSPRing;
+
+  static inline void hsp_ring_close(HSPRing *ring) {
+    if(ring->hdr)
+      munmap(ring->hdr, ring->mapLen);
+    if(ring->memfd >= 0)
+      close(ring->memfd);
+    if(ring->sock >= 0)
+      close(ring->sock);
+    ring->hdr = NULL;
+    ring->data = NULL;
+    ring->memfd = ring->sock = -1;
+  }
+
+  // size must be a power of 2. Returns 0 or -errno.
+  static inline int hsp_ring_open(HSPRing *ring, const char *path, uint32_t size) {
+    memset(ring, 0, sizeof(*ring));
+    ring->memfd = ring->sock = -1;
+    if(size < HSP_RING_MIN_SIZE
+       || size > HSP_RING_MAX_SIZE
+       || (size & (size - 1)))
+      return -EINVAL;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if(strlen(path) >= sizeof(addr.sun_path))
+      return -ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+    int err = 0;
+    ring->mapLen = HSP_RING_HDR_LEN + size;
+    // hsflowd insists on the size seals so that the mapping cannot
+    // be truncated underneath it
+    if((ring->memfd = memfd_create("hsflowd_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0
+       || ftruncate(ring->memfd, ring->mapLen) < 0
+       || fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+      goto fail;
+    void *map = mmap(NULL, ring->mapLen, PROT_READ|PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if(map == MAP_FAILED)
+      goto fail;
+    ring->hdr = (HSPRingHdr *)map;
+    ring->data = (uint8_t *)map + HSP_RING_HDR_LEN;
+    ring->hdr->magic = HSP_RING_MAGIC;
+    ring->hdr->version = HSP_RING_VERSION;
+    ring->hdr->size = size;
+    ring->hdr->hdr_len = HSP_RING_HDR_LEN;
+    if((ring->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+       || connect(ring->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      goto fail;
+    // hand the memfd to hsflowd
+    char one = 1;
+    struct iovec iov = { .iov_base = &one, .iov_len = 1 };
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctrl.buf,
+      .msg_controllen = sizeof(ctrl.buf)
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ring->memfd, sizeof(int));
+    if(sendmsg(ring->sock, &msg, 0) != 1)
+      goto fail;
+    return 0;
+
+  fail:
+    err = errno;
+    hsp_ring_close(ring);
+    return -err;
+  }
+
+  // Append one XDR record of len bytes (a multiple of 4). Returns 0,
+  // or -ENOBUFS if the ring is full (the record is dropped and counted).
+  static inline int hsp_ring_append(HSPRing *ring, const void *rec, uint32_t len) {
+    HSPRingHdr *hdr = ring->hdr;
+    uint32_t size = hdr->size;
+    uint32_t need = 4 + len;
+    if(len & 3)
+      return -EINVAL;
+    if(len > HSP_RING_MAX_RECORD)
+      return -EMSGSIZE;
+    uint64_t head = hdr->head; // only we write it
+    uint64_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    uint32_t off = head & (size - 1);
+    uint32_t toEnd = size - off;
+    uint32_t skip = (toEnd < need) ? toEnd : 0;
+    if((head + skip + need) - tail > size) {
+      __atomic_fetch_add(&hdr->drops, 1, __ATOMIC_RELAXED);
+      return -ENOBUFS;
+    }
+    if(skip) {
+      *(uint32_t *)(ring->data + off) = HSP_RING_PAD;
+      head += skip;
+      off = 0;
+    }
+    *(uint32_t *)(ring->data + off) = len;
+    memcpy(ring->data + off + 4, rec, len);
+    __atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  /*_________________---------------------------__________________
+    _________________   producer: encoding      __________________
+    -----------------___________________________------------------
+    Build one rtmetric or rtflow record in XDR.  Errors (overflow,
+    bad name) are sticky and make hsp_ring_write() discard the record.
+  */
+
+  typedef struct _HSPRingRec {
+    uint32_t xdr[HSP_RING_MAX_RECORD / 4];
+    uint32_t cursor;
+    uint32_t nfields_at;
+    uint32_t nfields;
+    int err;
+  } HSPRingRec;
+
+  static inline void hsp_rec_int32(HSPRingRec *rec, uint32_t val) {
+    if(rec->cursor >= (HSP_RING_MAX_RECORD / 4)) {
+      rec->err = -EMSGSIZE;
+      return;
+    }
+    rec->xdr[rec->cursor++] = htonl(val);
+  }
+
+  static inline void hsp_rec_int64(HSPRingRec *rec, uint64_t val) {
+    hsp_rec_int32(rec, (uint32_t)(val >> 32));
+    hsp_rec_int32(rec, (uint32_t)val);
+  }
+
+  static inline void hsp_rec_bytes(HSPRingRec *rec, const void *data, uint32_t len) {
+    uint32_t quads = (len + 3) / 4;
+    if((rec->cursor + quads) > (HSP_RING_MAX_RECORD / 4)) {
+      rec->err = -EMSGSIZE;
+      return;
+    }
+    if(quads)
+      rec->xdr[rec->cursor + quads - 1] = 0; // zero the padding
+    memcpy(rec->xdr + rec->cursor, data, len);
+    rec->cursor += quads;
+  }
+
+  static inline void hsp_rec_str(HSPRingRec *rec, const char *str, uint32_t maxLen) {
+    uint32_t len = str ? strlen(str) : 0;
+    if(len > maxLen) {
+      rec->err = -EINVAL;
+      return;
+    }
+    hsp_rec_int32(rec, len);
+    if(len)
+      hsp_rec_bytes(rec, str, len);
+  }
+
+  static inline void hsp_rec_start(HSPRingRec *rec, uint32_t tag, const char *dsname) {
+    rec->cursor = 0;
+    rec->nfields = 0;
+    rec->err = 0;
+    hsp_rec_int32(rec, tag);
+    hsp_rec_int32(rec, 0); // length, set by hsp_ring_write()
+    hsp_rec_str(rec, dsname, HSP_MAX_RTMETRIC_KEY_LEN);
+  }
+
+  static inline void hsp_rec_rtmetric(HSPRingRec *rec, const char *dsname) {
+    hsp_rec_start(rec, TAG_RTMETRIC, dsname);
+    rec->nfields_at = rec->cursor;
+    hsp_rec_int32(rec, 0);
+  }
+
+  static inline void hsp_rec_rtflow(HSPRingRec *rec, const char *dsname, uint32_t sampling_rate) {
+    hsp_rec_start(rec, TAG_RTFLOW, dsname);
+    hsp_rec_int32(rec, sampling_rate ? sampling_rate : 1);
+    hsp_rec_int32(rec, 0); // reserved
+    rec->nfields_at = rec->cursor;
+    hsp_rec_int32(rec, 0);
+  }
+
+  static inline void hsp_rec_field(HSPRingRec *rec, const char *name, uint32_t type) {
+    hsp_rec_str(rec, name, HSP_MAX_RTMETRIC_KEY_LEN);
+    hsp_rec_int32(rec, type);
+    rec->nfields++;
+  }
+
+  // rtmetric fields
+  static inline void hsp_rec_counter32(HSPRingRec *rec, const char *name, uint32_t val) {
+    hsp_rec_field(rec, name, RTMetricType_counter32);
+    hsp_rec_int32(rec, val);
+  }
+  static inline void hsp_rec_counter64(HSPRingRec *rec, const char *name, uint64_t val) {
+    hsp_rec_field(rec, name, RTMetricType_counter64);
+    hsp_rec_int64(rec, val);
+  }
+  static inline void hsp_rec_gauge32(HSPRingRec *rec, const char *name, uint32_t val) {
+    hsp_rec_field(rec, name, RTMetricType_gauge32);
+    hsp_rec_int32(rec, val);
+  }
+  static inline void hsp_rec_gauge64(HSPRingRec *rec, const char *name, uint64_t val) {
+    hsp_rec_field(rec, name, RTMetricType_gauge64);
+    hsp_rec_int64(rec, val);
+  }
+  static inline void hsp_rec_gaugeFloat(HSPRingRec *rec, const char *name, float val) {
+    uint32_t bits;
+    memcpy(&bits, &val, 4);
+    hsp_rec_field(rec, name, RTMetricType_gaugeFloat);
+    hsp_rec_int32(rec, bits);
+  }
+  static inline void hsp_rec_gaugeDouble(HSPRingRec *rec, const char *name, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, 8);
+    hsp_rec_field(rec, name, RTMetricType_gaugeDouble);
+    hsp_rec_int64(rec, bits);
+  }
+  static inline void hsp_rec_string(HSPRingRec *rec, const char *name, const char *val) {
+    hsp_rec_field(rec, name, RTMetricType_string);
+    hsp_rec_str(rec, val, HSP_MAX_RTMETRIC_VAL_LEN);
+  }
+
+  // rtflow fields
+  static inline void hsp_rec_flow_int32(HSPRingRec *rec, const char *name, uint32_t val) {
+    hsp_rec_field(rec, name, RTFlowType_int32);
+    hsp_rec_int32(rec, val);
+  }
+  static inline void hsp_rec_flow_int64(HSPRingRec *rec, const char *name, uint64_t val) {
+    hsp_rec_field(rec, name, RTFlowType_int64);
+    hsp_rec_int64(rec, val);
+  }
+  static inline void hsp_rec_flow_string(HSPRingRec *rec, const char *name, const char *val) {
+    hsp_rec_field(rec, name, RTFlowType_string);
+    hsp_rec_str(rec, val, HSP_MAX_RTMETRIC_VAL_LEN);
+  }
+  static inline void hsp_rec_flow_mac(HSPRingRec *rec, const char *name, const uint8_t *mac) {
+    hsp_rec_field(rec, name, RTFlowType_mac);
+    hsp_rec_bytes(rec, mac, 6);
+  }
+  static inline void hsp_rec_flow_ip(HSPRingRec *rec, const char *name, const struct in_addr *ip) {
+    hsp_rec_field(rec, name, RTFlowType_ip);
+    hsp_rec_bytes(rec, ip, 4);
+  }
+  static inline void hsp_rec_flow_ip6(HSPRingRec *rec, const char *name, const struct in6_addr *ip6) {
+    hsp_rec_field(rec, name, RTFlowType_ip6);
+    hsp_rec_bytes(rec, ip6, 16);
+  }
+
+  // finish the record and append it to the ring
+  static inline int hsp_ring_write(HSPRing *ring, HSPRingRec *rec) {
+    if(rec->err)
+      return rec->err;
+    if(rec->nfields == 0)
+      return -EINVAL;
+    uint32_t len = rec->cursor * 4;
+    rec->xdr[1] = htonl(len - 8);
+    rec->xdr[rec->nfields_at] = htonl(rec->nfields);
+    return hsp_ring_append(ring, rec->xdr, len);
+  }
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
+
+#endif /* HSFLOWD_RING_H */
@@ -172,11 +172,34 @@ static const char* introspect_xml =
     for(int ii = 0; ii < HSP_TELEMETRY_NUM_COUNTERS; ii++) {
       if(!dbus_message_iter_open_container(&it2, DBUS_TYPE_DICT_ENTRY, NULL, &it3))
 	return DBUS_HANDLER_RESULT_NEED_MEMORY;
+      uint64_t val64 = telemetryGet(sp, ii);
       dbus_message_iter_append_basic(&it3, DBUS_TYPE_STRING, &HSPTelemetryNames[ii]);
-      dbus_message_iter_append_basic(&it3, DBUS_TYPE_UINT64, &sp->telemetry[ii]);
+      dbus_message_iter_append_basic(&it3, DBUS_TYPE_UINT64, &val64);
       dbus_message_iter_close_container(&it2, &it3);
     }
 
+    // latency summary per stage, merged across buses and modules
+    for(int st = 0; st < HSP_LATENCY_NUM_STAGES; st++) {
+      HSPLatencyHist hist;
+      latencyMerge(sp, st, &hist);
+      struct { const char *suffix; uint64_t val; } fields[] = {
+	{ "count", hist.count },
+	{ "p50_nS", latencyPercentile(&hist, 50) },
+	{ "p99_nS", latencyPercentile(&hist, 99) },
+	{ "max_nS", hist.max_nS },
+      };
+      for(int ff = 0; ff < 4; ff++) {
+	char fname[64];
+	char *fnamep = fname;
+	snprintf(fname, 64, "latency_%s_%s", HSPLatencyStageNames[st], fields[ff].suffix);
+	if(!dbus_message_iter_open_container(&it2, DBUS_TYPE_DICT_ENTRY, NULL, &it3))
+	  return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	dbus_message_iter_append_basic(&it3, DBUS_TYPE_STRING, &fnamep);
+	dbus_message_iter_append_basic(&it3, DBUS_TYPE_UINT64, &fields[ff].val);
+	dbus_message_iter_close_container(&it2, &it3);
+      }
+    }
+
     dbus_message_iter_close_container(&it1, &it2);
     send_reply(mod, reply);
     dbus_message_unref(reply);
@@ -198,11 +221,14 @@ static const char* introspect_xml =
       return DBUS_HANDLER_RESULT_HANDLED;
     }
     char *varname=NULL;
+    uint64_t val64=0;
     uint64_t *pval64=NULL;
     dbus_message_iter_get_basic(&it, &varname);
     for(int ii = 0; ii < HSP_TELEMETRY_NUM_COUNTERS; ii++) {
-      if(my_strequal(varname, HSPTelemetryNames[ii]))
-	pval64 = &sp->telemetry[ii];
+      if(my_strequal(varname, HSPTelemetryNames[ii])) {
+	val64 = telemetryGet(sp, ii);
+	pval64 = &val64;
+      }
     }
     if(!pval64) {
       send_reply_err(mod, msg, "unknown field");
@@ -13,6 +13,10 @@ extern "C" {
 #define HSP_DEFAULT_DNSSD_STARTDELAY 30
 #define HSP_DEFAULT_DNSSD_RETRYDELAY 300
 #define HSP_DEFAULT_DNSSD_MINDELAY 10
+#define HSP_DNSSD_JITTER_PC 20 // refresh up to this % early
+#define HSP_DNSSD_TIMEOUT 3 // seconds before trying the next server
+#define HSP_DNSSD_ATTEMPTS 2 // times round all the servers
+#define HSP_DNSSD_EDNS_BUFSIZE 4096
 
 #define HSP_MIN_DNAME 4  /* what is the shortest FQDN you can have? */
 #define HSP_MIN_TXT 4  /* what is the shortest meaingful TXT record here? */
@@ -22,60 +26,87 @@ extern "C" {
 #define HSP_MAX_DNS_LEN 255
   typedef void (*HSPDnsCB)(EVMod *mod, uint16_t rtype, uint32_t ttl, u_char *key, int keyLen, u_char *val, int valLen);
 
+  // The SRV and TXT queries are sent together from a UDP socket on the
+  // config bus, so a slow or dead resolver never blocks anything. The
+  // answers are cached until their TTL expires. The refresh is
+  // jittered, so that a fleet sharing one resolver does not re-query
+  // in lock-step. The config is only sent on if it actually changed.
+
+  typedef enum {
+    HSP_DNSSD_Q_SRV=0,
+    HSP_DNSSD_Q_TXT,
+    HSP_DNSSD_Q_NUM
+  } EnumHSPDnsQuery;
+
+  typedef struct _HSPDnsAnswer {
+    UTArray *lines; // config lines (strdup'd)
+    uint32_t ttl;   // min over records
+    int result;     // answer count, 0 for none, -1 if the query failed
+  } HSPDnsAnswer;
+
+  typedef struct _HSPDnsQuery {
+    uint16_t rtype;
+    bool pending;
+    uint16_t id;
+    uint32_t candidate; // index into names
+    uint32_t server;    // index into servers
+    uint32_t attempt;
+    time_t sent;
+    uint64_t sent_nS;
+    HSPDnsAnswer answer; // being collected
+    HSPDnsAnswer cache;  // last good answer
+    time_t expires;
+  } HSPDnsQuery;
+
+  typedef struct _HSPDnsServer {
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+  } HSPDnsServer;
+
   typedef struct _HSP_mod_DNSSD {
     int countdown;
     uint32_t startDelay;
     uint32_t retryDelay;
-    uint32_t ttl;
     EVBus *configBus;
     EVBus *pollBus;
     EVEvent *configStartEvent;
     EVEvent *configEvent;
     EVEvent *configEndEvent;
+    // resolver
+    struct __res_state res;
+    bool resInit; // res is only safe to res_nclose() after res_ninit()
+    HSPDnsServer servers[MAXNS];
+    uint32_t num_servers;
+    UTArray *names; // search list applied
+    EVSocket *sock4;
+    EVSocket *sock6;
+    HSPDnsQuery query[HSP_DNSSD_Q_NUM];
+    bool inRound;
+    char *applied; // config lines last sent
+    int appliedServers;
+    unsigned int seed; // for rand_r(), so we don't share sfl_random()
   } HSP_mod_DNSSD;
 
   /*________________---------------------------__________________
-    ________________       dnsSD_Request       __________________
+    ________________       dnsSD_Parse         __________________
     ----------------___________________________------------------
   */
 
-  static int dnsSD_Request(EVMod *mod, char *dname, uint16_t rtype, HSPDnsCB callback)
+  static int dnsSD_Parse(EVMod *mod, char *dname, u_char *buf, int anslen, uint16_t rtype, HSPDnsCB callback)
   {
-    // HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
-    u_char buf[PACKETSZ];
-
-    // We could have a config option to set the DNS servers that we will ask. If so
-    // they should be written into this array of sockaddrs...
-    // myDebug(1,"_res_nsaddr=%p", &_res.nsaddr);
-
-    myDebug(1,"=== res_search(%s, C_IN, %u) ===", dname, rtype);
-    int anslen = res_search(dname, C_IN, rtype, buf, PACKETSZ);
-    if(anslen == -1) {
-      if(errno == 0 && (h_errno == HOST_NOT_FOUND || h_errno == NO_DATA)) {
-	// although res_search returned -1, the request did actually get an answer,
-	// it's just that there was no SRV record configured,  or the response was
-	// not authoritative. Interpret this the same way as answer_count==0.
-	myDebug(1,"res_search(%s, C_IN, %u) came up blank (h_errno=%d)", dname, rtype, h_errno);
-	return 0;
-      }
-      else {
-	myLog(LOG_ERR,"res_search(%s, C_IN, %u) failed : %s (h_errno=%d)", dname, rtype, strerror(errno), h_errno);
-	return -1;
-      }
-    }
     if(anslen < sizeof(HEADER)) {
-      myLog(LOG_ERR,"res_search(%s) returned %d (too short)", dname, anslen);
+      myLog(LOG_ERR,"dnsSD(%s) answer %d bytes (too short)", dname, anslen);
       return -1;
     }
     HEADER *ans = (HEADER *)buf;
     if(ans->rcode != NOERROR) {
-      myLog(LOG_ERR,"res_search(%s) returned response code %d", dname, ans->rcode);
+      myLog(LOG_ERR,"dnsSD(%s) returned response code %d", dname, ans->rcode);
       return -1;
     }
 
     uint32_t answer_count = (ntohs(ans->ancount));
     if(answer_count == 0) {
-      myLog(LOG_INFO,"res_search(%s) returned no answer", dname);
+      myDebug(1,"dnsSD(%s) returned no answer", dname);
       return 0;
     }
     myDebug(1, "dnsSD: answer_count = %d", answer_count);
@@ -232,24 +263,6 @@ extern "C" {
     return answer_count;
   }
 
-  /*________________---------------------------__________________
-    ________________      dnsSD                __________________
-    ----------------___________________________------------------
-  */
-
-  static int dnsSD(EVMod *mod, HSPDnsCB callback)
-  {
-    HSP *sp = (HSP *)EVROOTDATA(mod);
-    // HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
-    char request[HSP_MAX_DNS_LEN];
-    char *domain_override = sp->DNSSD.domain ?: "";
-    snprintf(request, HSP_MAX_DNS_LEN, "%s%s", SFLOW_DNS_SD, domain_override);
-    int num_servers = dnsSD_Request(mod, request, T_SRV, callback);
-    dnsSD_Request(mod, request, T_TXT, callback);
-    // it's ok even if only the SRV request succeeded
-    return num_servers; //  -1 on error
-  }
-
   /*_________________---------------------------__________________
     _________________      myDnsCB              __________________
     -----------------___________________________------------------
@@ -258,11 +271,6 @@ extern "C" {
   static void myDnsCB(EVMod *mod, uint16_t rtype, uint32_t ttl, u_char *key, int keyLen, u_char *val, int valLen)
   {
     HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
-    // latch the min ttl
-    if(mdata->ttl == 0 || ttl < mdata->ttl) {
-      mdata->ttl = ttl;
-    }
-
     char keyBuf[1024];
     char valBuf[1024];
     if(keyLen > 1023 || valLen > 1023) {
@@ -279,6 +287,12 @@ extern "C" {
 
     myDebug(1, "dnsSD: (rtype=%u,ttl=%u) <%s>=<%s>", rtype, ttl, keyBuf, valBuf);
 
+    HSPDnsAnswer *answer = &mdata->query[(rtype == T_SRV) ? HSP_DNSSD_Q_SRV : HSP_DNSSD_Q_TXT].answer;
+    // latch the min ttl
+    if(answer->ttl == 0 || ttl < answer->ttl) {
+      answer->ttl = ttl;
+    }
+
     if(((keyLen ?: strlen("collector")) + valLen + 2) > EV_MAX_EVT_DATALEN) {
       myLog(LOG_ERR, "myDNSCB: config line too long");
       return;
@@ -286,34 +300,473 @@ extern "C" {
 
     char cfgLine[EV_MAX_EVT_DATALEN];
     snprintf(cfgLine, EV_MAX_EVT_DATALEN, "%s=%s", (keyLen ? keyBuf : "collector"), valBuf);
+    UTArrayAdd(answer->lines, my_strdup(cfgLine));
+  }
 
-    // sending configEvent (pollBus) from here (configBus) means it will go via pipe
-    EVEventTx(mod, mdata->configEvent, cfgLine, my_strlen(cfgLine));
+  static void linesReset(UTArray *lines) {
+    char *line;
+    UTARRAY_WALK(lines, line)
+      my_free(line);
+    UTArrayReset(lines);
   }
 
-  static void evt_tick(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+  static void answerReset(HSPDnsAnswer *answer) {
+    linesReset(answer->lines);
+    answer->ttl = 0;
+    answer->result = 0;
+  }
+
+  /*_________________---------------------------__________________
+    _________________      resolver setup       __________________
+    -----------------___________________________------------------
+    Read resolv.conf again every round (it may have changed) unless
+    a server was given in the config. The names to try follow the
+    res_search() rules: as-is first if it has enough dots, then with
+    each search domain appended.
+  */
+
+  static void addServer(EVMod *mod, struct sockaddr *sa, socklen_t len) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    if(mdata->num_servers < MAXNS) {
+      HSPDnsServer *server = &mdata->servers[mdata->num_servers++];
+      memcpy(&server->addr, sa, len);
+      server->addrLen = len;
+    }
+  }
+
+  static bool resolverSetup(EVMod *mod) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    mdata->num_servers = 0;
+    char *name;
+    UTARRAY_WALK(mdata->names, name)
+      my_free(name);
+    UTArrayReset(mdata->names);
+
+    if(mdata->resInit)
+      res_nclose(&mdata->res);
+    memset(&mdata->res, 0, sizeof(mdata->res));
+    mdata->resInit = NO;
+    if(res_ninit(&mdata->res) != 0) {
+      myLog(LOG_ERR, "dnsSD: res_ninit() failed");
+      return NO;
+    }
+    mdata->resInit = YES;
+
+    if(sp->DNSSD.server.type != SFLADDRESSTYPE_UNDEFINED) {
+      uint16_t port = htons(sp->DNSSD.serverPort ?: NAMESERVER_PORT);
+      if(sp->DNSSD.server.type == SFLADDRESSTYPE_IP_V4) {
+	struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = port };
+	memcpy(&sa.sin_addr, &sp->DNSSD.server.address.ip_v4, 4);
+	addServer(mod, (struct sockaddr *)&sa, sizeof(sa));
+      }
+      else {
+	struct sockaddr_in6 sa6 = { .sin6_family = AF_INET6, .sin6_port = port };
+	memcpy(&sa6.sin6_addr, &sp->DNSSD.server.address.ip_v6, 16);
+	addServer(mod, (struct sockaddr *)&sa6, sizeof(sa6));
+      }
+    }
+    else {
+      for(int ii = 0; ii < mdata->res.nscount && ii < MAXNS; ii++) {
+	if(mdata->res.nsaddr_list[ii].sin_family == AF_INET)
+	  addServer(mod, (struct sockaddr *)&mdata->res.nsaddr_list[ii], sizeof(struct sockaddr_in));
+#ifdef __GLIBC__
+	else if(mdata->res._u._ext.nsaddrs[ii])
+	  addServer(mod, (struct sockaddr *)mdata->res._u._ext.nsaddrs[ii], sizeof(struct sockaddr_in6));
+#endif
+      }
+    }
+    if(mdata->num_servers == 0) {
+      myLog(LOG_ERR, "dnsSD: no DNS servers");
+      return NO;
+    }
+
+    char request[HSP_MAX_DNS_LEN];
+    char *domain_override = sp->DNSSD.domain ?: "";
+    snprintf(request, HSP_MAX_DNS_LEN, "%s%s", SFLOW_DNS_SD, domain_override);
+    int dots = 0;
+    for(char *c = request; *c; c++)
+      if(*c == '.') dots++;
+    bool search = (sp->DNSSD.domain == NULL
+		   && (mdata->res.options & RES_DNSRCH));
+    if(!search
+       || dots >= mdata->res.ndots)
+      UTArrayAdd(mdata->names, my_strdup(request));
+    if(search) {
+      for(int ii = 0; ii < MAXDNSRCH && mdata->res.dnsrch[ii]; ii++) {
+	char fqdn[MAXDNAME + HSP_MAX_DNS_LEN + 2];
+	snprintf(fqdn, sizeof(fqdn), "%s.%s", request, mdata->res.dnsrch[ii]);
+	if(my_strlen(fqdn) < HSP_MAX_DNS_LEN)
+	  UTArrayAdd(mdata->names, my_strdup(fqdn));
+      }
+      if(dots < mdata->res.ndots)
+	UTArrayAdd(mdata->names, my_strdup(request));
+    }
+    return (UTArrayN(mdata->names) > 0);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      query send           __________________
+    -----------------___________________________------------------
+  */
+
+  static void readDNS(EVMod *mod, EVSocket *sock, void *magic);
+  static void queryDone(EVMod *mod, HSPDnsQuery *q, int result);
+
+  static EVSocket *querySocket(EVMod *mod, int family) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    EVSocket **sockp = (family == AF_INET6) ? &mdata->sock6 : &mdata->sock4;
+    if(*sockp == NULL) {
+      // a new socket (so a new random source port) for each round
+      int fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+      if(fd < 0) {
+	myLog(LOG_ERR, "dnsSD: socket() failed: %s", strerror(errno));
+	return NULL;
+      }
+      *sockp = EVBusAddSocket(mod, mdata->configBus, fd, readDNS, NULL);
+    }
+    return *sockp;
+  }
+
+  static void querySend(EVMod *mod, HSPDnsQuery *q) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    for(;;) {
+      char *dname = (char *)UTArrayAt(mdata->names, q->candidate);
+      HSPDnsServer *server = &mdata->servers[q->server];
+      u_char pkt[PACKETSZ];
+      int len = res_nmkquery(&mdata->res, QUERY, dname, C_IN, q->rtype, NULL, 0, NULL, pkt, sizeof(pkt));
+      if(len < 0
+	 || (len + RRFIXEDSZ + 1) > sizeof(pkt)) {
+	myLog(LOG_ERR, "dnsSD: res_nmkquery(%s) failed", dname);
+	queryDone(mod, q, -1);
+	return;
+      }
+      // add an EDNS0 OPT record so that a big TXT answer is not truncated
+      u_char *opt = pkt + len;
+      *opt++ = 0; // root
+      NS_PUT16(ns_t_opt, opt);
+      NS_PUT16(HSP_DNSSD_EDNS_BUFSIZE, opt);
+      NS_PUT32(0, opt); // rcode, version, flags
+      NS_PUT16(0, opt); // rdlen
+      len = opt - pkt;
+      HEADER *hdr = (HEADER *)pkt;
+      hdr->arcount = htons(1);
+      q->id = ntohs(hdr->id);
+      q->sent = mdata->configBus->now.tv_sec;
+      q->sent_nS = latencyClock_nS();
+      q->pending = YES;
+      EVSocket *sock = querySocket(mod, server->addr.ss_family);
+      myDebug(1, "dnsSD: query %s type=%u id=%u server=%u attempt=%u", dname, q->rtype, q->id, q->server, q->attempt);
+      if(sock
+	 && sendto(sock->fd, pkt, len, 0, (struct sockaddr *)&server->addr, server->addrLen) == len)
+	return;
+      myDebug(1, "dnsSD: sendto() failed: %s", strerror(errno));
+      // try the next server now
+      if(++q->server >= mdata->num_servers) {
+	q->server = 0;
+	if(++q->attempt >= HSP_DNSSD_ATTEMPTS) {
+	  queryDone(mod, q, -1);
+	  return;
+	}
+      }
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________      answers              __________________
+    -----------------___________________________------------------
+  */
+
+  static uint32_t dnsRandom(HSP_mod_DNSSD *mdata, uint32_t lim) {
+    // 1..lim, like sfl_random()
+    return lim ? ((rand_r(&mdata->seed) % lim) + 1) : 0;
+  }
+
+  static uint32_t jitter(HSP_mod_DNSSD *mdata, uint32_t delay) {
+    // anywhere from HSP_DNSSD_JITTER_PC% early to on time
+    uint32_t spread = (delay * HSP_DNSSD_JITTER_PC) / 100;
+    return spread ? (delay - dnsRandom(mdata, spread) + 1) : delay;
+  }
+
+  static int cmpLine(const void *a, const void *b) {
+    return strcmp(*(char **)a, *(char **)b);
+  }
+
+  static void addLines(UTStrBuf *buf, UTArray *lines) {
+    // sorted, so that a round-robin reordering is not a change
+    uint32_t n = UTArrayN(lines);
+    if(n == 0)
+      return;
+    char **sorted = (char **)my_calloc(n * sizeof(char *));
+    char *line;
+    n = 0;
+    UTARRAY_WALK(lines, line)
+      sorted[n++] = line;
+    qsort(sorted, n, sizeof(char *), cmpLine);
+    for(uint32_t ii = 0; ii < n; ii++) {
+      UTStrBuf_append(buf, sorted[ii]);
+      UTStrBuf_append(buf, "\n");
+    }
+    my_free(sorted);
+  }
+
+  static void roundDone(EVMod *mod) {
     HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
-    if(--mdata->countdown <= 0) {
-      // SIGSEGV on Fedora 14 if HSP_RLIMIT_MEMLOCK is non-zero, because calloc returns NULL.
-      // Maybe we need to repeat some of the setrlimit() calls here in the forked thread? Or
-      // maybe we are supposed to fork the DNSSD thread before dropping privileges?
-
-      // we want the min ttl, so clear it here
-      mdata->ttl = 0;
-      // now make the requests
-      EVEventTx(mod, mdata->configStartEvent, NULL, 0);
-      int num_servers = dnsSD(mod, myDnsCB); // will send config line events
-      EVEventTx(mod, mdata->configEndEvent, &num_servers, sizeof(num_servers));
-
-      // whatever happens we might still learn a TTL (e.g. from the TXT record query)
-      mdata->countdown = mdata->ttl ?: mdata->retryDelay;
-      // but make sure it's sane
-      if(mdata->countdown < HSP_DEFAULT_DNSSD_MINDELAY) {
-	myDebug(1, "forcing minimum DNS polling delay");
-	mdata->countdown = HSP_DEFAULT_DNSSD_MINDELAY;
+    HSPDnsQuery *srv = &mdata->query[HSP_DNSSD_Q_SRV];
+    HSPDnsQuery *txt = &mdata->query[HSP_DNSSD_Q_TXT];
+    mdata->inRound = NO;
+    if(mdata->sock4) {
+      EVSocketClose(mod, mdata->sock4, YES);
+      mdata->sock4 = NULL;
+    }
+    if(mdata->sock6) {
+      EVSocketClose(mod, mdata->sock6, YES);
+      mdata->sock6 = NULL;
+    }
+
+    // failed queries keep their (stale) cached answer, and if it was
+    // the SRV query that failed then the current config stays as it is.
+    int num_servers = srv->answer.result;
+    if(num_servers >= 0) {
+      UTStrBuf *cfg = UTStrBuf_new();
+      addLines(cfg, srv->cache.lines);
+      addLines(cfg, txt->cache.lines);
+      char *lines = UTStrBuf_unwrap(cfg);
+      if(mdata->applied
+	 && num_servers == mdata->appliedServers
+	 && my_strequal(lines, mdata->applied)) {
+	myDebug(1, "dnsSD: config unchanged");
+	my_free(lines);
       }
-      myDebug(1, "DNSSD polling delay set to %u seconds", mdata->countdown);
+      else {
+	myLog(LOG_INFO, "dnsSD: config changed (%d servers)", num_servers);
+	EVEventTx(mod, mdata->configStartEvent, NULL, 0);
+	// sending configEvent (pollBus) from here (configBus) means it will go via pipe
+	char *line;
+	UTARRAY_WALK(srv->cache.lines, line)
+	  EVEventTx(mod, mdata->configEvent, line, my_strlen(line));
+	UTARRAY_WALK(txt->cache.lines, line)
+	  EVEventTx(mod, mdata->configEvent, line, my_strlen(line));
+	EVEventTx(mod, mdata->configEndEvent, &num_servers, sizeof(num_servers));
+	if(mdata->applied)
+	  my_free(mdata->applied);
+	mdata->applied = lines;
+	mdata->appliedServers = num_servers;
+      }
+    }
+
+    // next round is due when the first fresh answer expires
+    uint32_t delay = 0;
+    for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++) {
+      HSPDnsAnswer *answer = &mdata->query[qq].answer;
+      if(answer->result > 0
+	 && answer->ttl
+	 && (delay == 0 || answer->ttl < delay))
+	delay = answer->ttl;
     }
+    if(delay == 0
+       || num_servers < 0)
+      delay = mdata->retryDelay;
+    // but make sure it's sane
+    if(delay < HSP_DEFAULT_DNSSD_MINDELAY) {
+      myDebug(1, "forcing minimum DNS polling delay");
+      delay = HSP_DEFAULT_DNSSD_MINDELAY;
+    }
+    mdata->countdown = jitter(mdata, delay);
+    myDebug(1, "DNSSD polling delay set to %u seconds (ttl %u)", mdata->countdown, delay);
+  }
+
+  static void queryDone(EVMod *mod, HSPDnsQuery *q, int result) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    time_t now = mdata->configBus->now.tv_sec;
+    q->pending = NO;
+    q->answer.result = result;
+    if(result < 0) {
+      if(UTArrayN(q->cache.lines))
+	myLog(LOG_ERR, "dnsSD: type %u query failed, keeping cached answer (%s)", q->rtype,
+	      (now < q->expires) ? "fresh" : "stale");
+      else
+	myLog(LOG_ERR, "dnsSD: type %u query failed, no cached answer", q->rtype);
+    }
+    else {
+      // a definite answer (even "none") replaces the cache, but leave
+      // the answer's result and ttl for roundDone()
+      UTArray *old = q->cache.lines;
+      q->cache = q->answer;
+      q->answer.lines = old;
+      linesReset(q->answer.lines);
+      q->expires = now + q->cache.ttl;
+    }
+    bool allDone = YES;
+    for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++)
+      if(mdata->query[qq].pending)
+	allDone = NO;
+    if(allDone)
+      roundDone(mod);
+  }
+
+  static bool sameServer(HSPDnsServer *server, struct sockaddr_storage *from) {
+    if(from->ss_family != server->addr.ss_family)
+      return NO;
+    if(from->ss_family == AF_INET) {
+      struct sockaddr_in *a = (struct sockaddr_in *)from;
+      struct sockaddr_in *b = (struct sockaddr_in *)&server->addr;
+      return (a->sin_port == b->sin_port
+	      && a->sin_addr.s_addr == b->sin_addr.s_addr);
+    }
+    struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)from;
+    struct sockaddr_in6 *b6 = (struct sockaddr_in6 *)&server->addr;
+    return (a6->sin6_port == b6->sin6_port
+	    && !memcmp(&a6->sin6_addr, &b6->sin6_addr, 16));
+  }
+
+  static void queryAnswer(EVMod *mod, HSPDnsQuery *q, char *dname, u_char *buf, int len) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    HEADER *hdr = (HEADER *)buf;
+    latencyRecord(sp, mod, HSP_LATENCY_DNSSD, latencyClock_nS() - q->sent_nS);
+    if(hdr->tc) {
+      myLog(LOG_ERR, "dnsSD(%s) answer truncated", dname);
+      queryDone(mod, q, -1);
+      return;
+    }
+    int result = -1;
+    switch(hdr->rcode) {
+    case NOERROR:
+      answerReset(&q->answer);
+      result = dnsSD_Parse(mod, dname, buf, len, q->rtype, myDnsCB);
+      break;
+    case NXDOMAIN:
+      result = 0;
+      break;
+    default:
+      // SERVFAIL, REFUSED...: ask the next server
+      myDebug(1, "dnsSD(%s) rcode=%d from server %u", dname, hdr->rcode, q->server);
+      if(++q->server >= mdata->num_servers) {
+	q->server = 0;
+	if(++q->attempt >= HSP_DNSSD_ATTEMPTS) {
+	  queryDone(mod, q, -1);
+	  return;
+	}
+      }
+      querySend(mod, q);
+      return;
+    }
+    if(result == 0
+       && ++q->candidate < UTArrayN(mdata->names)) {
+      // not there: try the next name in the search list
+      q->server = 0;
+      q->attempt = 0;
+      querySend(mod, q);
+      return;
+    }
+    if(result < 0)
+      answerReset(&q->answer);
+    queryDone(mod, q, result);
+  }
+
+  static void readDNS(EVMod *mod, EVSocket *sock, void *magic) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    for(;;) {
+      u_char buf[HSP_DNSSD_EDNS_BUFSIZE];
+      struct sockaddr_storage from;
+      socklen_t fromLen = sizeof(from);
+      int len = recvfrom(sock->fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromLen);
+      if(len < 0) {
+	if(errno != EAGAIN
+	   && errno != EINTR)
+	  myDebug(1, "dnsSD: recvfrom() failed: %s", strerror(errno));
+	return;
+      }
+      if(len < sizeof(HEADER))
+	continue;
+      HEADER *hdr = (HEADER *)buf;
+      if(!hdr->qr
+	 || ntohs(hdr->qdcount) != 1)
+	continue;
+      // must be from the server we asked, with our id, and echo our question
+      HSPDnsQuery *q = NULL;
+      for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++) {
+	HSPDnsQuery *qry = &mdata->query[qq];
+	if(qry->pending
+	   && qry->id == ntohs(hdr->id)
+	   && sameServer(&mdata->servers[qry->server], &from))
+	  q = qry;
+      }
+      if(q == NULL) {
+	myDebug(1, "dnsSD: ignoring unexpected answer id=%u", ntohs(hdr->id));
+	continue;
+      }
+      char *dname = (char *)UTArrayAt(mdata->names, q->candidate);
+      char qname[MAXDNAME];
+      u_char *p = buf + sizeof(HEADER);
+      int qlen = dn_expand(buf, buf + len, p, qname, MAXDNAME);
+      if(qlen < 0
+	 || (p + qlen + QFIXEDSZ) > (buf + len)
+	 || strcasecmp(qname, dname) != 0
+	 || ((p[qlen] << 8) | p[qlen + 1]) != q->rtype) {
+	myDebug(1, "dnsSD: ignoring answer to a different question");
+	continue;
+      }
+      queryAnswer(mod, q, dname, buf, len);
+      if(!mdata->inRound)
+	return; // round complete, socket closed
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________      rounds               __________________
+    -----------------___________________________------------------
+  */
+
+  static void startRound(EVMod *mod) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    if(!resolverSetup(mod)) {
+      mdata->countdown = jitter(mdata, mdata->retryDelay);
+      return;
+    }
+    mdata->inRound = YES;
+    for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++) {
+      HSPDnsQuery *q = &mdata->query[qq];
+      answerReset(&q->answer);
+      q->candidate = 0;
+      q->server = 0;
+      q->attempt = 0;
+      q->pending = YES;
+    }
+    for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++) {
+      HSPDnsQuery *q = &mdata->query[qq];
+      if(q->pending)
+	querySend(mod, q);
+    }
+  }
+
+  static void checkTimeouts(EVMod *mod) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    time_t now = mdata->configBus->now.tv_sec;
+    for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++) {
+      HSPDnsQuery *q = &mdata->query[qq];
+      if(q->pending
+	 && (now - q->sent) >= HSP_DNSSD_TIMEOUT) {
+	myDebug(1, "dnsSD: type %u query timed out (server %u)", q->rtype, q->server);
+	if(++q->server >= mdata->num_servers) {
+	  q->server = 0;
+	  if(++q->attempt >= HSP_DNSSD_ATTEMPTS) {
+	    queryDone(mod, q, -1);
+	    continue;
+	  }
+	}
+	querySend(mod, q);
+      }
+    }
+  }
+
+  static void evt_tick(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
+    if(mdata->inRound)
+      checkTimeouts(mod);
+    else if(--mdata->countdown <= 0)
+      startRound(mod);
   }
 
   /*_________________---------------------------__________________
@@ -326,9 +779,23 @@ extern "C" {
     HSP_mod_DNSSD *mdata = (HSP_mod_DNSSD *)mod->data;
     mdata->startDelay = HSP_DEFAULT_DNSSD_STARTDELAY;
     mdata->retryDelay = HSP_DEFAULT_DNSSD_RETRYDELAY;
+    mdata->names = UTArrayNew(UTARRAY_DFLT);
+    mdata->query[HSP_DNSSD_Q_SRV].rtype = T_SRV;
+    mdata->query[HSP_DNSSD_Q_TXT].rtype = T_TXT;
+    for(int qq = 0; qq < HSP_DNSSD_Q_NUM; qq++) {
+      mdata->query[qq].answer.lines = UTArrayNew(UTARRAY_DFLT);
+      mdata->query[qq].cache.lines = UTArrayNew(UTARRAY_DFLT);
+    }
     
+    // seed from the agent address (already selected before modules
+    // are loaded) so that hosts sharing a resolver spread out
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    SFLAddress *agentIP = &sp->agentIP;
+    if(agentIP->type == SFLADDRESSTYPE_IP_V4) mdata->seed = agentIP->address.ip_v4.addr;
+    else memcpy(&mdata->seed, agentIP->address.ip_v6.addr + 12, 4);
+
     // make sure we don't all hammer the DNS server immediately on restart
-    mdata->countdown = sfl_random(mdata->startDelay);
+    mdata->countdown = dnsRandom(mdata, mdata->startDelay);
 
     // register call-backs
     mdata->pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
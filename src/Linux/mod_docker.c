@@ -15,6 +15,7 @@ extern "C" {
 #include <sched.h>
 
 #include "hsflowd.h"
+#include "util_grpc.h"
 #include "cpu_utils.h"
 #include "math.h"
 
@@ -126,6 +127,11 @@ extern "C" {
     time_t last_vnic;
     time_t last_cgroup;
     char *cgroup_devices;
+    // for docker.cgroupStats
+    char *cgroup_cpuacct;
+    char *cgroup_memory;
+    char *cgroup_blkio;
+    char *cgroup_unified;
     // we now populate stats here too
     uint32_t cpu_count;
     double cpu_count_dbl;
@@ -135,14 +141,39 @@ extern "C" {
     SFLHost_vrt_dsk_counters dsk;
   } HSPVMState_DOCKER;
 
+  // netns thread request (batched) and response (one per container)
+  typedef struct _HSPNetnsReq {
+    pid_t pid;
+    char uuid[16];
+  } HSPNetnsReq;
+
+  typedef struct _HSPNetnsVNIC {
+    uint32_t ifIndex;
+    char devName[IFNAMSIZ];
+    u_char mac[6];
+    SFLAddress ipAddr;
+  } HSPNetnsVNIC;
+
+#define HSP_NETNS_BATCH (EV_MAX_EVT_DATALEN / sizeof(HSPNetnsReq))
+#define HSP_NETNS_MAX_VNICS 64
+
+  typedef struct _HSPNetnsVNICs {
+    char uuid[16];
+    uint32_t nVNICs;
+    HSPNetnsVNIC vnic[HSP_NETNS_MAX_VNICS];
+  } HSPNetnsVNICs;
+
   struct _HSPDockerRequest; // fwd decl
   typedef void (*HSPDockerCB)(EVMod *mod, UTStrBuf *buf, cJSON *obj, struct _HSPDockerRequest *req);
 
   typedef enum {
     HSPDOCKERREQ_HEADERS=0,
     HSPDOCKERREQ_LENGTH,
+    HSPDOCKERREQ_CHUNK,
+    HSPDOCKERREQ_ENDCHUNK,
+    HSPDOCKERREQ_TRAILER,
     HSPDOCKERREQ_CONTENT,
-    HSPDOCKERREQ_ENDCONTENT,
+    HSPDOCKERREQ_DONE,
     HSPDOCKERREQ_ERR
   } HSPDockerRequestState;
 
@@ -154,6 +185,8 @@ extern "C" {
     HSP_REQTYPE_STATS
   } EnumHSPDockerReqType;
     
+  struct _HSPDockerConn; // fwd decl
+
   typedef struct _HSPDockerRequest {
     struct _HSPDockerRequest *prev;
     struct _HSPDockerRequest *next;
@@ -162,31 +195,57 @@ extern "C" {
     UTStrBuf *request;
     UTStrBuf *response;
     HSPDockerCB jsonCB;
-    HSPDockerRequestState state;
-    int contentLength;
-    int chunkLength;
     char *id;
     time_t sendTime;
-    EVSocket *sock;
+    uint64_t sendTime_nS;
+    uint32_t retries;
+    struct _HSPDockerConn *conn;
 #ifdef HSP_DOCKER_WAITQ
     time_t goTime_S;
 #endif
   } HSPDockerRequest;
 
+  // A persistent HTTP/1.1 connection to the docker socket. Requests
+  // are pipelined, so responses arrive in the order of the inflight
+  // queue and the parser state always applies to its head.
+  typedef struct _HSPDockerConn {
+    struct _HSPDockerConn *prev;
+    struct _HSPDockerConn *next;
+    EVSocket *sock;
+    UTQ(HSPDockerRequest) inflight;
+    uint32_t nInflight;
+    UTStrBuf *rxbuf;
+    time_t lastActivity;
+    HSPDockerRequestState state;
+    int httpStatus;
+    int contentLength; // -1 == read to EOF
+    int chunkLength;
+    bool gotStatus:1;
+    bool chunked:1;
+    bool closing:1; // server sent "Connection: close"
+    bool broken:1; // write failed, waiting for the read side to see it
+    bool events:1; // dedicated to the never-ending events response
+  } HSPDockerConn;
+
   typedef struct _HSPDockerNameCount {
     char *name;
     uint32_t count;
   } HSPDockerNameCount;
 
 #define HSP_DOCKER_SOCK  VARFS_STR "/run/docker.sock"
+#define HSP_CRI_SOCK "/run/containerd/containerd.sock"
 #define HSP_DOCKER_MAX_CONCURRENT 15
+#define HSP_DOCKER_PIPELINE 4
+#define HSP_DOCKER_MAX_RETRIES 2
+#define HSP_DOCKER_MAX_HEADER_LINE 8192
+#define HSP_DOCKER_READ_INCBYTES 16384
+#define HSP_DOCKER_MAX_EVENT_BYTES 65536
 #define HSP_DOCKER_HTTP " HTTP/1.1\nHost: " HSP_DOCKER_SOCK "\n\n"
 #define HSP_DOCKER_API "v1.24"
 #define HSP_DOCKER_REQ_EVENTS "GET /" HSP_DOCKER_API "/events?filters={\"type\":[\"container\"]}" HSP_DOCKER_HTTP
 #define HSP_DOCKER_REQ_CONTAINERS "GET /" HSP_DOCKER_API "/containers/json" HSP_DOCKER_HTTP
 #define HSP_DOCKER_REQ_INSPECT_ID "GET /" HSP_DOCKER_API "/containers/%s/json" HSP_DOCKER_HTTP
 #define HSP_DOCKER_REQ_STATS_ID "GET /" HSP_DOCKER_API "/containers/%s/stats?stream=false" HSP_DOCKER_HTTP
-#define HSP_CONTENT_LENGTH_REGEX "^Content-Length: ([0-9]+)$"
   
 #define HSP_DOCKER_MAX_FNAME_LEN 255
 #define HSP_DOCKER_MAX_LINELEN 512
@@ -198,6 +257,7 @@ extern "C" {
 #define HSP_DOCKER_WAIT_RECHECK 120
 #define HSP_DOCKER_WAIT_STATS 3
 #define HSP_DOCKER_REQ_TIMEOUT 10
+#define HSP_DOCKER_CONN_IDLE_TIMEOUT 120
 
 #define HSP_NVIDIA_VIS_DEV_ENV "NVIDIA_VISIBLE_DEVICES"
 #define HSP_MAJOR_NVIDIA 195
@@ -240,8 +300,10 @@ extern "C" {
     int32_t currentRequests;
     int32_t lostRequests;
     int32_t statsWaitRequests;
-    UTHash *reqsBySeqNo;
-    regex_t *contentLengthPattern;
+    int32_t cgroupStats;
+    UTQ(HSPDockerConn) conns;
+    uint32_t nConns;
+    HSPDockerConn *eventsConn;
     uint32_t countdownToResync;
     uint32_t countdownToRecheck;
     int cgroupPathIdx;
@@ -250,6 +312,16 @@ extern "C" {
     uint32_t dup_names;
     uint32_t dup_hostnames;
     struct stat myNS;
+    int myNSfd;
+    EVBus *netnsBus;
+    EVEvent *netnsReqEvent;
+    EVEvent *netnsVNICsEvent;
+    HSPNetnsReq netnsBatch[HSP_NETNS_BATCH];
+    uint32_t netnsBatchN;
+    // cri { } backend
+    UTGRPCConn *criConn;
+    EVSocket *criSock;
+    bool criNoEvents;
     EnumHSPVNICLayer vnicLayer;
     UTHash *vnicByIP;
   } HSP_mod_DOCKER;
@@ -257,17 +329,27 @@ extern "C" {
 #define HSP_DOCKER_MAX_STATS_LINELEN 512
 
   static void dockerAPIRequest(EVMod *mod, HSPDockerRequest *req);
+  static void readDockerAPI(EVMod *mod, EVSocket *sock, void *magic);
+  static void dockerConnClose(EVMod *mod, HSPDockerConn *conn, bool headLost);
+  static void dockerConnCloseAll(EVMod *mod);
   static HSPDockerRequest *dockerRequest(EVMod *mod, UTStrBuf *cmd, HSPDockerCB jsonCB, EnumHSPDockerReqType reqType);
   static void  dockerRequestFree(EVMod *mod, HSPDockerRequest *req);
   static void dockerSynchronize(EVMod *mod);
   static void dockerContainerCapture(EVMod *mod);
   static void decNameCount(UTHash *ht, const char *str);
   static void getContainerStats(EVMod *mod, HSPVMState_DOCKER *container);
+  static void freeContainerCgroupPaths(HSPVMState_DOCKER *container);
+  static void containerInspected(EVMod *mod, HSPVMState_DOCKER *container);
+  static void criSynchronize(EVMod *mod);
+  static void criContainerCapture(EVMod *mod);
+  static void criClose(EVMod *mod);
+  static void serviceCRITimeouts(EVMod *mod);
   static void serviceRequestQ(EVMod *mod);
 #ifdef HSP_DOCKER_WAITQ
   static void serviceWaitQ(EVMod *mod);
 #endif
   static void serviceLostRequests(EVMod *mod);
+  static void serviceIdleConnections(EVMod *mod);
   static HSPDockerRequest *containerStatsRequest(EVMod *mod, HSPVMState_DOCKER *container);
   static const char *containerStateName(EnumHSPContainerState st);
 
@@ -298,90 +380,92 @@ extern "C" {
     ________________   containerLinkCB         __________________
     ----------------___________________________------------------
     
-    expecting lines of the form:
-    VNIC: <ifindex> <device> <mac>
+    one VNIC found by the netns thread
   */
 
-  static int containerLinkCB(EVMod *mod, HSPVMState_DOCKER *container, char *line) {
+  static int containerLinkCB(EVMod *mod, HSPVMState_DOCKER *container, HSPNetnsVNIC *vnic) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
     HSP *sp = (HSP *)EVROOTDATA(mod);
-    myDebug(1, "containerLinkCB: line=<%s>", line);
-    char deviceName[HSP_DOCKER_MAX_LINELEN];
-    char macStr[HSP_DOCKER_MAX_LINELEN];
-    char ipStr[HSP_DOCKER_MAX_LINELEN];
-    uint32_t ifIndex;
-    if(sscanf(line, "VNIC: %u %s %s %s", &ifIndex, deviceName, macStr, ipStr) == 4) {
-      u_char mac[6];
-      if(hexToBinary((u_char *)macStr, mac, 6) == 6) {
-	SFLAdaptor *adaptor = adaptorListGet(container->vm.interfaces, deviceName);
-	if(adaptor == NULL) {
-	  adaptor = nioAdaptorNew(deviceName, mac, ifIndex);
-	  adaptorListAdd(container->vm.interfaces, adaptor);
-	  // add to "all namespaces" collections too - but only the ones where
-	  // the id is really global.  For example,  many containers can have
-	  // an "eth0" adaptor so we can't add it to sp->adaptorsByName.
-
-	  // And because the containers are likely to be ephemeral, don't
-	  // replace the global adaptor if it's already there.
-
-	  if(UTHashGet(sp->adaptorsByMac, adaptor) == NULL)
-	    if(UTHashAdd(sp->adaptorsByMac, adaptor) != NULL)
-	      myDebug(1, "Warning: container adaptor overwriting adaptorsByMac");
-
-	  if(UTHashGet(sp->adaptorsByIndex, adaptor) == NULL)
-	    if(UTHashAdd(sp->adaptorsByIndex, adaptor) != NULL)
-	      myDebug(1, "Warning: container adaptor overwriting adaptorsByIndex");
-
-	  // mark it as a vm/container device
-	  ADAPTOR_NIO(adaptor)->vm_or_container = YES;
-
-	  // did we get an ip address too?
-	  SFLAddress ipAddr = { };
-	  if(parseNumericAddress(ipStr, NULL, &ipAddr, AF_INET)) {
-	    if(!SFLAddress_isZero(&ipAddr)
-	       && mdata->vnicByIP) {
-	      myDebug(1, "VNIC: learned virtual ipAddr: %s", ipStr);
-	      // Can use this to associate traffic with this container
-	      // if this address appears in sampled packet header as
-	      // outer or inner IP
-	      ADAPTOR_NIO(adaptor)->ipAddr = ipAddr;
-	      HSPVNIC search = { .ipAddr = ipAddr };
-	      HSPVNIC *vnic = UTHashGet(mdata->vnicByIP, &search);
-	      if(vnic) {
-		// found IP - check for non-unique mapping
-		if(vnic->dsIndex != container->vm.dsIndex) {
-		  myDebug(1, "VNIC: clash between %s (ds=%u) and %s (ds=%u) -- setting unique=no",
-			  vnic->c_name,
-			  vnic->dsIndex,
-			  container->name,
-			  container->vm.dsIndex);
-		  vnic->unique = NO;
-		}
-	      }
-	      else {
-		// add new VNIC entry
-		vnic = (HSPVNIC *)my_calloc(sizeof(HSPVNIC));
-		vnic->ipAddr = ipAddr;
-		vnic->dsIndex = container->vm.dsIndex;
-		vnic->c_name = my_strdup(container->name);
-		UTHashAdd(mdata->vnicByIP, vnic);
-		vnic->unique = YES;
-		myDebug(1, "VNIC: linked to %s (ds=%u)",
-			vnic->c_name,
-			vnic->dsIndex);
-	      }
-	    }
+    char ipStr[64];
+    myDebug(1, "containerLinkCB: VNIC %u %s %s", vnic->ifIndex, vnic->devName, SFLAddress_print(&vnic->ipAddr, ipStr, 64));
+    SFLAdaptor *adaptor = adaptorListGet(container->vm.interfaces, vnic->devName);
+    if(adaptor == NULL) {
+      adaptor = nioAdaptorNew(vnic->devName, vnic->mac, vnic->ifIndex);
+      adaptorListAdd(container->vm.interfaces, adaptor);
+      // add to "all namespaces" collections too - but only the ones where
+      // the id is really global.  For example,  many containers can have
+      // an "eth0" adaptor so we can't add it to sp->adaptorsByName.
+
+      // And because the containers are likely to be ephemeral, don't
+      // replace the global adaptor if it's already there.
+
+      if(UTHashGet(sp->adaptorsByMac, adaptor) == NULL)
+	if(UTHashAdd(sp->adaptorsByMac, adaptor) != NULL)
+	  myDebug(1, "Warning: container adaptor overwriting adaptorsByMac");
+
+      if(UTHashGet(sp->adaptorsByIndex, adaptor) == NULL)
+	if(UTHashAdd(sp->adaptorsByIndex, adaptor) != NULL)
+	  myDebug(1, "Warning: container adaptor overwriting adaptorsByIndex");
+
+      // packet-path snapshot of these tables is now out of date
+      requestAdaptorLookup(sp);
+
+      // mark it as a vm/container device
+      ADAPTOR_NIO(adaptor)->vm_or_container = YES;
+
+      // did we get an ip address too?
+      SFLAddress ipAddr = vnic->ipAddr;
+      if(!SFLAddress_isZero(&ipAddr)
+	 && mdata->vnicByIP) {
+	myDebug(1, "VNIC: learned virtual ipAddr: %s", ipStr);
+	// Can use this to associate traffic with this container
+	// if this address appears in sampled packet header as
+	// outer or inner IP
+	ADAPTOR_NIO(adaptor)->ipAddr = ipAddr;
+	HSPVNIC search = { .ipAddr = ipAddr };
+	HSPVNIC *vnicEntry = UTHashGet(mdata->vnicByIP, &search);
+	if(vnicEntry) {
+	  // found IP - check for non-unique mapping
+	  if(vnicEntry->dsIndex != container->vm.dsIndex) {
+	    myDebug(1, "VNIC: clash between %s (ds=%u) and %s (ds=%u) -- setting unique=no",
+		    vnicEntry->c_name,
+		    vnicEntry->dsIndex,
+		    container->name,
+		    container->vm.dsIndex);
+	    vnicEntry->unique = NO;
 	  }
-
+	}
+	else {
+	  // add new VNIC entry
+	  vnicEntry = (HSPVNIC *)my_calloc(sizeof(HSPVNIC));
+	  vnicEntry->ipAddr = ipAddr;
+	  vnicEntry->dsIndex = container->vm.dsIndex;
+	  vnicEntry->c_name = my_strdup(container->name);
+	  UTHashAdd(mdata->vnicByIP, vnicEntry);
+	  vnicEntry->unique = YES;
+	  myDebug(1, "VNIC: linked to %s (ds=%u)",
+		  vnicEntry->c_name,
+		  vnicEntry->dsIndex);
 	}
       }
     }
+    else {
+      // still here - don't let the refresh sweep it away
+      adaptor->marked = NO;
+    }
     return YES;
   }
 
 /*________________---------------------------__________________
-  ________________   readContainerInterfaces __________________
+  ________________   netns thread            __________________
   ----------------___________________________------------------
+  Container VNICs are enumerated on a dedicated bus thread rather
+  than by forking a child for each container. The poll bus sends
+  batches of {pid,uuid} and the netns thread joins each network
+  namespace just long enough to open a socket in it, then returns
+  to its own namespace and answers with one event per container.
+  Containers that share a namespace (e.g. k8s pods) only cost one
+  setns() round-trip per batch.
 */
 
 #include <linux/version.h>
@@ -395,171 +479,217 @@ extern "C" {
 #define MY_SETNS(fd, nstype) setns(fd, nstype)
 #endif
 
+  typedef struct _HSPNetnsSock {
+    dev_t dev;
+    ino_t ino;
+    int fd;
+  } HSPNetnsSock;
 
-  int readContainerInterfaces(EVMod *mod, HSPVMState_DOCKER *container)  {
+  // called in netns thread
+  static int netnsSocket(EVMod *mod, pid_t nspid, HSPNetnsSock *cache, int *nCache) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    pid_t nspid = container->pid;
-    myDebug(2, "readContainerInterfaces: pid=%u", nspid);
-    if(nspid == 0) return 0;
-
-    // do the dirty work after a fork, so we can just exit afterwards,
-    // same as they do in "ip netns exec"
-    int pfd[2];
-    if(pipe(pfd) == -1) {
-      myLog(LOG_ERR, "pipe() failed : %s", strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-    pid_t cpid;
-    if((cpid = fork()) == -1) {
-      myLog(LOG_ERR, "fork() failed : %s", strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-    if(cpid == 0) {
-      // in child
-      close(pfd[0]);   // close read-end
-      dup2(pfd[1], 1); // stdout -> write-end
-      dup2(pfd[1], 2); // stderr -> write-end
-      close(pfd[1]);
-
-      // open /proc/<nspid>/ns/net
-      char topath[HSP_DOCKER_MAX_FNAME_LEN+1];
-      snprintf(topath, HSP_DOCKER_MAX_FNAME_LEN, PROCFS_STR "/%u/ns/net", nspid);
-      int nsfd = open(topath, O_RDONLY | O_CLOEXEC);
-      if(nsfd < 0) {
-	fprintf(stderr, "cannot open %s : %s", topath, strerror(errno));
+    // open /proc/<nspid>/ns/net
+    char topath[HSP_DOCKER_MAX_FNAME_LEN+1];
+    snprintf(topath, HSP_DOCKER_MAX_FNAME_LEN, PROCFS_STR "/%u/ns/net", nspid);
+    int nsfd = open(topath, O_RDONLY | O_CLOEXEC);
+    if(nsfd < 0) {
+      myDebug(1, "cannot open %s : %s", topath, strerror(errno));
+      return -1;
+    }
+    struct stat statBuf;
+    if(fstat(nsfd, &statBuf) != 0) {
+      close(nsfd);
+      return -1;
+    }
+    myDebug(2, "container namespace dev.inode == %u.%u", statBuf.st_dev, statBuf.st_ino);
+    if(statBuf.st_dev == mdata->myNS.st_dev
+       && statBuf.st_ino == mdata->myNS.st_ino) {
+      myDebug(1, "skip my own namespace");
+      close(nsfd);
+      return -1;
+    }
+    // already joined this one in the current batch?
+    for(int ii = 0; ii < *nCache; ii++) {
+      if(cache[ii].dev == statBuf.st_dev
+	 && cache[ii].ino == statBuf.st_ino) {
+	close(nsfd);
+	return cache[ii].fd;
+      }
+    }
+    /* set network namespace
+       CLONE_NEWNET means nsfd must refer to a network namespace.
+       This only affects the calling thread, and a socket stays in
+       the namespace where it was created, so we can switch straight
+       back again. */
+    int fd = -1;
+    if(MY_SETNS(nsfd, CLONE_NEWNET) < 0) {
+      myDebug(1, "setting network namespace failed: %s", strerror(errno));
+    }
+    else {
+      fd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+      if(fd < 0)
+	myDebug(1, "error opening socket: %d (%s)", errno, strerror(errno));
+      if(MY_SETNS(mdata->myNSfd, CLONE_NEWNET) < 0) {
+	myLog(LOG_ERR, "netns: cannot restore own network namespace: %s", strerror(errno));
 	exit(EXIT_FAILURE);
       }
+    }
+    close(nsfd);
+    if(fd >= 0
+       && *nCache < HSP_NETNS_BATCH) {
+      cache[*nCache].dev = statBuf.st_dev;
+      cache[*nCache].ino = statBuf.st_ino;
+      cache[*nCache].fd = fd;
+      (*nCache)++;
+    }
+    return fd;
+  }
 
-      struct stat statBuf;
-      if(fstat(nsfd, &statBuf) == 0) {
-	myDebug(2, "container namespace dev.inode == %u.%u", statBuf.st_dev, statBuf.st_ino);
-	if(statBuf.st_dev == mdata->myNS.st_dev
-	   && statBuf.st_ino == mdata->myNS.st_ino) {
-	  myDebug(1, "skip my own namespace");
-	  exit(0);
-	}
+  // called in netns thread
+  static void netnsReadVNICs(EVMod *mod, pid_t nspid, int fd, HSPNetnsVNICs *reply) {
+    // /proc/<nspid>/net/dev lists the devices in that namespace without
+    // having to be in it. The ioctls go to the socket we opened there.
+    char path[HSP_DOCKER_MAX_FNAME_LEN+1];
+    snprintf(path, HSP_DOCKER_MAX_FNAME_LEN, PROCFS_STR "/%u/net/dev", nspid);
+    FILE *procFile = fopen(path, "r");
+    if(procFile == NULL)
+      return;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    char line[MAX_PROC_LINE_CHARS];
+    int lineNo = 0;
+    int truncated;
+    while(my_readline(procFile, line, MAX_PROC_LINE_CHARS, &truncated) != EOF) {
+      if(lineNo++ < 2) continue; // skip headers
+      if(reply->nVNICs == HSP_NETNS_MAX_VNICS) {
+	myDebug(1, "netns: pid %u has more than %u VNICs", nspid, HSP_NETNS_MAX_VNICS);
+	break;
       }
-
-      /* set network namespace
-	 CLONE_NEWNET means nsfd must refer to a network namespace
-      */
-      if(MY_SETNS(nsfd, CLONE_NEWNET) < 0) {
-	fprintf(stderr, "seting network namespace failed: %s", strerror(errno));
-	exit(EXIT_FAILURE);
+      char buf[MAX_PROC_LINE_CHARS];
+      char *p = line;
+      char *devName = parseNextTok(&p, " \t:", NO, '\0', NO, buf, MAX_PROC_LINE_CHARS);
+      if(devName == NULL
+	 || my_strlen(devName) >= IFNAMSIZ)
+	continue;
+      strncpy(ifr.ifr_name, devName, sizeof(ifr.ifr_name)-1);
+      // Get the flags for this interface
+      if(ioctl(fd,SIOCGIFFLAGS, &ifr) < 0) {
+	myDebug(1, "container device %s Get SIOCGIFFLAGS failed : %s",
+		devName,
+		strerror(errno));
+	continue;
       }
-
-      /* From "man 2 unshare":  This flag has the same effect as the clone(2)
-	 CLONE_NEWNS flag. Unshare the mount namespace, so that the calling
-	 process has a private copy of its namespace which is not shared with
-	 any other process. Specifying this flag automatically implies CLONE_FS
-	 as well. Use of CLONE_NEWNS requires the CAP_SYS_ADMIN capability. */
-      if(unshare(CLONE_NEWNS) < 0) {
-	fprintf(stderr, "seting network namespace failed: %s", strerror(errno));
-	exit(EXIT_FAILURE);
+      int up = (ifr.ifr_flags & IFF_UP) ? YES : NO;
+      int loopback = (ifr.ifr_flags & IFF_LOOPBACK) ? YES : NO;
+      if(!up || loopback)
+	continue;
+      // try to get ifIndex next, because we only care about
+      // ifIndex and MAC when looking at container interfaces
+      if(ioctl(fd,SIOCGIFINDEX, &ifr) < 0) {
+	// only complain about this if we are debugging
+	myDebug(1, "container device %s Get SIOCGIFINDEX failed : %s",
+		devName,
+		strerror(errno));
+	continue;
       }
-
-      int fd = socket(PF_INET, SOCK_DGRAM, 0);
-      if(fd < 0) {
-	fprintf(stderr, "error opening socket: %d (%s)\n", errno, strerror(errno));
-	exit(EXIT_FAILURE);
+      HSPNetnsVNIC *vnic = &reply->vnic[reply->nVNICs];
+      memset(vnic, 0, sizeof(*vnic));
+      vnic->ifIndex = ifr.ifr_ifindex;
+      strncpy(vnic->devName, devName, IFNAMSIZ-1);
+
+      // see if we can get an IP address
+      if(ioctl(fd,SIOCGIFADDR, &ifr) < 0) {
+	// only complain about this if we are debugging
+	myDebug(1, "device %s Get SIOCGIFADDR failed : %s",
+		devName,
+		strerror(errno));
       }
-
-      FILE *procFile = fopen(PROCFS_STR "/net/dev", "r");
-      if(procFile) {
-	struct ifreq ifr;
-	memset(&ifr, 0, sizeof(ifr));
-	char line[MAX_PROC_LINE_CHARS];
-	int lineNo = 0;
-	int truncated;
-	while(my_readline(procFile, line, MAX_PROC_LINE_CHARS, &truncated) != EOF) {
-	  if(lineNo++ < 2) continue; // skip headers
-	  char buf[MAX_PROC_LINE_CHARS];
-	  char *p = line;
-	  char *devName = parseNextTok(&p, " \t:", NO, '\0', NO, buf, MAX_PROC_LINE_CHARS);
-	  if(devName && my_strlen(devName) < IFNAMSIZ) {
-	    strncpy(ifr.ifr_name, devName, sizeof(ifr.ifr_name)-1);
-	    // Get the flags for this interface
-	    if(ioctl(fd,SIOCGIFFLAGS, &ifr) < 0) {
-	      fprintf(stderr, "container device %s Get SIOCGIFFLAGS failed : %s",
-		      devName,
-		      strerror(errno));
-	    }
-	    else {
-	      int up = (ifr.ifr_flags & IFF_UP) ? YES : NO;
-	      int loopback = (ifr.ifr_flags & IFF_LOOPBACK) ? YES : NO;
-
-	      if(up && !loopback) {
-		// try to get ifIndex next, because we only care about
-		// ifIndex and MAC when looking at container interfaces
-		if(ioctl(fd,SIOCGIFINDEX, &ifr) < 0) {
-		  // only complain about this if we are debugging
-		  myDebug(1, "container device %s Get SIOCGIFINDEX failed : %s",
-			  devName,
-			  strerror(errno));
-		}
-		else {
-		  int ifIndex = ifr.ifr_ifindex;
-		  SFLAddress ipAddr = {};
-
-		  // see if we can get an IP address
-		  if(ioctl(fd,SIOCGIFADDR, &ifr) < 0) {
-		    // only complain about this if we are debugging
-		    myDebug(1, "device %s Get SIOCGIFADDR failed : %s",
-			    devName,
-			    strerror(errno));
-		  }
-		  else {
-		    if (ifr.ifr_addr.sa_family == AF_INET) {
-		      struct sockaddr_in *s = (struct sockaddr_in *)&ifr.ifr_addr;
-		      // IP addr is now s->sin_addr
-		      ipAddr.type = SFLADDRESSTYPE_IP_V4;
-		      ipAddr.address.ip_v4.addr = s->sin_addr.s_addr;
-		    }
-		  }
-
-		  // Get the MAC Address for this interface
-		  if(ioctl(fd,SIOCGIFHWADDR, &ifr) < 0) {
-		    myDebug(1, "device %s Get SIOCGIFHWADDR failed : %s",
-			      devName,
-			      strerror(errno));
-		  }
-		  else {
-		    u_char macStr[13];
-		    printHex((u_char *)&ifr.ifr_hwaddr.sa_data, 6, macStr, 12, NO);
-		    char ipStr[64];
-		    SFLAddress_print(&ipAddr, ipStr, 64);
-		    // send this info back up the pipe to my my parent
-		    printf("VNIC: %u %s %s %s\n", ifIndex, devName, macStr, ipStr);
-		  }
-		}
-	      }
-	    }
-	  }
+      else {
+	if (ifr.ifr_addr.sa_family == AF_INET) {
+	  struct sockaddr_in *s = (struct sockaddr_in *)&ifr.ifr_addr;
+	  // IP addr is now s->sin_addr
+	  vnic->ipAddr.type = SFLADDRESSTYPE_IP_V4;
+	  vnic->ipAddr.address.ip_v4.addr = s->sin_addr.s_addr;
 	}
       }
 
-      // don't even bother to close file-descriptors,  just bail
-      exit(0);
+      // Get the MAC Address for this interface
+      if(ioctl(fd,SIOCGIFHWADDR, &ifr) < 0) {
+	myDebug(1, "device %s Get SIOCGIFHWADDR failed : %s",
+		devName,
+		strerror(errno));
+	continue;
+      }
+      memcpy(vnic->mac, &ifr.ifr_hwaddr.sa_data, 6);
+      reply->nVNICs++;
+    }
+    fclose(procFile);
+  }
 
+  // called in netns thread
+  static void evt_netns_req(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSPNetnsReq *reqs = (HSPNetnsReq *)data;
+    int nReqs = dataLen / sizeof(HSPNetnsReq);
+    HSPNetnsSock cache[HSP_NETNS_BATCH];
+    int nCache = 0;
+    HSPNetnsVNICs reply;
+    myDebug(2, "netns: batch of %d", nReqs);
+    for(int ii = 0; ii < nReqs; ii++) {
+      memcpy(reply.uuid, reqs[ii].uuid, 16);
+      reply.nVNICs = 0;
+      int fd = netnsSocket(mod, reqs[ii].pid, cache, &nCache);
+      if(fd >= 0)
+	netnsReadVNICs(mod, reqs[ii].pid, fd, &reply);
+      // always answer, so an unreachable or shared-with-us namespace
+      // clears out what we had before, same as an empty probe would
+      size_t len = sizeof(reply) - sizeof(reply.vnic) + (reply.nVNICs * sizeof(HSPNetnsVNIC));
+      EVEventTx(mod, mdata->netnsVNICsEvent, &reply, len);
+    }
+    for(int ii = 0; ii < nCache; ii++)
+      close(cache[ii].fd);
+  }
+
+  // called in poll thread
+  static void evt_netns_vnics(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPNetnsVNICs *reply = (HSPNetnsVNICs *)data;
+    HSPVMState_DOCKER search;
+    memcpy(search.vm.uuid, reply->uuid, 16);
+    HSPVMState_DOCKER *container = UTHashGet(mdata->vmsByUUID, &search);
+    if(container == NULL) {
+      // gone while we were waiting
+      return;
     }
-    else {
-      // in parent
-      close(pfd[1]); // close write-end
-      // read from read-end
-      FILE *ovs;
-      if((ovs = fdopen(pfd[0], "r")) == NULL) {
-	myLog(LOG_ERR, "readContainerInterfaces: fdopen() failed : %s", strerror(errno));
-	return 0;
-      }
-      char line[MAX_PROC_LINE_CHARS];
-      int truncated;
-      while(my_readline(ovs, line, MAX_PROC_LINE_CHARS, &truncated) != EOF)
-	containerLinkCB(mod, container, line);
-      fclose(ovs);
-      wait(NULL); // block here until child is done
+    HSPVMState *vm = &container->vm;
+    // reset the information that we are about to refresh
+    adaptorListMarkAll(vm->interfaces);
+    // then refresh it
+    for(uint32_t ii = 0; ii < reply->nVNICs; ii++)
+      containerLinkCB(mod, container, &reply->vnic[ii]);
+    // and clean up
+    deleteMarkedAdaptors_adaptorList(sp, vm->interfaces);
+    adaptorListFreeMarked(vm->interfaces);
+  }
+
+  // called in poll thread
+  static void netnsFlush(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(mdata->netnsBatchN) {
+      EVEventTx(mod, mdata->netnsReqEvent, mdata->netnsBatch, mdata->netnsBatchN * sizeof(HSPNetnsReq));
+      mdata->netnsBatchN = 0;
     }
+  }
 
-    return container->vm.interfaces->num_adaptors;
+  static void requestContainerInterfaces(EVMod *mod, HSPVMState_DOCKER *container) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    myDebug(2, "requestContainerInterfaces: pid=%u", container->pid);
+    HSPNetnsReq *req = &mdata->netnsBatch[mdata->netnsBatchN++];
+    req->pid = container->pid;
+    memcpy(req->uuid, container->vm.uuid, 16);
+    if(mdata->netnsBatchN == HSP_NETNS_BATCH)
+      netnsFlush(mod);
   }
 
   /*________________---------------------------__________________
@@ -682,13 +812,13 @@ extern "C" {
     // be a disaster as we would not copy the whole structure here.
     EVEventTx(sp->rootModule, evt_vm_cs, &ps, sizeof(ps));
     if(ps.suppress) {
-      sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES_SUPPRESSED]++;
+      telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES_SUPPRESSED, 1);
     }
     else {
       SEMLOCK_DO(sp->sync_agent) {
 	sfl_poller_writeCountersSample(vm->poller, &cs);
 	sp->counterSampleQueued = YES;
-	sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+	telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
       }
     }
   }
@@ -762,6 +892,7 @@ extern "C" {
     }
     if(container->dup_name) mdata->dup_names--;
     if(container->dup_hostname) mdata->dup_hostnames--;
+    freeContainerCgroupPaths(container);
     removeAndFreeVM(mod, &container->vm);
   }
 
@@ -810,11 +941,13 @@ extern "C" {
     HSP *sp = (HSP *)EVROOTDATA(mod);
     HSPVMState *vm = &container->vm;
     if(vm) {
-      // reset the information that we are about to refresh
+      if(container->pid) {
+	// refreshed asynchronously by the netns thread (see evt_netns_vnics)
+	requestContainerInterfaces(mod, container);
+	return;
+      }
+      // no namespace to look in
       adaptorListMarkAll(vm->interfaces);
-      // then refresh it
-      readContainerInterfaces(mod, container);
-      // and clean up
       deleteMarkedAdaptors_adaptorList(sp, vm->interfaces);
       adaptorListFreeMarked(vm->interfaces);
     }
@@ -825,6 +958,27 @@ extern "C" {
     -----------------_____________________________------------------
   */
 
+  static void setCgroupPath(HSPVMState_DOCKER *container, char **field, char *type, char *path) {
+    if(!my_strequal(*field, path)) {
+      if(*field)
+	my_free(*field);
+      *field = my_strdup(path);
+      myDebug(1, "docker: container(%s)->cgroup(%s)=%s", container->name, type, path);
+    }
+  }
+
+  static bool cgroupHasController(char *types, char *ctrl) {
+    // types may be a comma-separated list, such as "cpu,cpuacct"
+    char buf[MAX_PROC_LINE_CHARS];
+    char *p = types;
+    char *tok;
+    while((tok = parseNextTok(&p, ",", NO, '\0', NO, buf, MAX_PROC_LINE_CHARS)) != NULL) {
+      if(my_strequal(tok, ctrl))
+	return YES;
+    }
+    return NO;
+  }
+
   static void updateContainerCgroupPaths(EVMod *mod, HSPVMState_DOCKER *container) {
     HSPVMState *vm = &container->vm;
     if(vm) {
@@ -838,10 +992,14 @@ extern "C" {
 	while(my_readline(procFile, line, MAX_PROC_LINE_CHARS, &truncated) != EOF) {
 	  if(!truncated) {
 	    // expect lines like 3:devices:<long_path>
+	    // or 0::<long_path> for the cgroup v2 unified hierarchy
 	    int entryNo;
 	    char type[MAX_PROC_LINE_CHARS];
 	    char path[MAX_PROC_LINE_CHARS];
-	    if(sscanf(line, "%d:%[^:]:%[^:]", &entryNo, type, path) == 3) {
+	    if(sscanf(line, "%d::%[^:]", &entryNo, path) == 2) {
+	      setCgroupPath(container, &container->cgroup_unified, "unified", path);
+	    }
+	    else if(sscanf(line, "%d:%[^:]:%[^:]", &entryNo, type, path) == 3) {
 	      if(my_strequal(type, "devices")) {
 		if(!my_strequal(container->cgroup_devices, path)) {
 		  if(container->cgroup_devices)
@@ -850,6 +1008,12 @@ extern "C" {
 		  myDebug(1, "docker: container(%s)->cgroup_devices=%s", container->name, container->cgroup_devices);
 		}
 	      }
+	      else if(cgroupHasController(type, "cpuacct"))
+		setCgroupPath(container, &container->cgroup_cpuacct, "cpuacct", path);
+	      else if(cgroupHasController(type, "memory"))
+		setCgroupPath(container, &container->cgroup_memory, "memory", path);
+	      else if(cgroupHasController(type, "blkio"))
+		setCgroupPath(container, &container->cgroup_blkio, "blkio", path);
 	    }
 	  }
 	}
@@ -858,18 +1022,248 @@ extern "C" {
     }
   }
 
+  static void freeContainerCgroupPaths(HSPVMState_DOCKER *container) {
+    if(container->cgroup_devices) my_free(container->cgroup_devices);
+    if(container->cgroup_cpuacct) my_free(container->cgroup_cpuacct);
+    if(container->cgroup_memory) my_free(container->cgroup_memory);
+    if(container->cgroup_blkio) my_free(container->cgroup_blkio);
+    if(container->cgroup_unified) my_free(container->cgroup_unified);
+    container->cgroup_devices = NULL;
+    container->cgroup_cpuacct = NULL;
+    container->cgroup_memory = NULL;
+    container->cgroup_blkio = NULL;
+    container->cgroup_unified = NULL;
+  }
+
   /*_________________---------------------------__________________
-    _________________   buildRegexPatterns      __________________
+    _________________   cgroup and netns stats  __________________
     -----------------___________________________------------------
+    With docker.cgroupStats=on we read the same counters that the
+    engine would have returned in the stats response directly from
+    the container's cgroup files and /proc/<pid>/net/dev, so the API
+    is only needed for discovery and events. A container pid that
+    is restarted under a new cgroup is picked up by the periodic
+    updateContainerCgroupPaths() refresh.
   */
-  static void buildRegexPatterns(EVMod *mod) {
-    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    if(mdata->contentLengthPattern) {
-      // rebuild regex so it can clean up memory usage
-      regfree(mdata->contentLengthPattern);
-      my_free(mdata->contentLengthPattern);
+
+  static FILE *openCgroupFile(char *ctrl, char *cgroup, char *fname) {
+    char path[HSP_DOCKER_MAX_FNAME_LEN+1];
+    if(ctrl)
+      snprintf(path, HSP_DOCKER_MAX_FNAME_LEN, SYSFS_STR "/fs/cgroup/%s%s/%s", ctrl, cgroup, fname);
+    else
+      snprintf(path, HSP_DOCKER_MAX_FNAME_LEN, SYSFS_STR "/fs/cgroup%s/%s", cgroup, fname);
+    FILE *cgFile = fopen(path, "r");
+    if(cgFile == NULL)
+      myDebug(2, "docker: cannot open %s : %s", path, strerror(errno));
+    return cgFile;
+  }
+
+  static bool readCgroupValue(char *ctrl, char *cgroup, char *fname, uint64_t *pVal) {
+    bool found = NO;
+    FILE *cgFile = openCgroupFile(ctrl, cgroup, fname);
+    if(cgFile) {
+      // note: "max" (no limit) in cgroup v2 will not parse
+      found = (fscanf(cgFile, "%"SCNu64, pVal) == 1);
+      fclose(cgFile);
     }
-    mdata->contentLengthPattern = UTRegexCompile(HSP_CONTENT_LENGTH_REGEX);
+    return found;
+  }
+
+  static bool readCgroupCounters(char *ctrl, char *cgroup, char *fname, int nvals, HSPNameVal *nameVals, bool multi) {
+    // same line formats as mod_systemd: "<name> <val>" or, when
+    // multi is set, "<major:minor> <name> <val>" accumulated over devices
+    int found = 0;
+    FILE *cgFile = openCgroupFile(ctrl, cgroup, fname);
+    if(cgFile) {
+      char line[MAX_PROC_LINE_CHARS];
+      char var[MAX_PROC_LINE_CHARS];
+      uint64_t val64;
+      char *fmt = multi ?
+	"%*s %s %"SCNu64 :
+	"%s %"SCNu64 ;
+      int truncated;
+      while(my_readline(cgFile, line, MAX_PROC_LINE_CHARS, &truncated) != EOF) {
+	if(sscanf(line, fmt, var, &val64) == 2) {
+	  for(int ii = 0; ii < nvals; ii++) {
+	    if(my_strequal(var, nameVals[ii].nv_name)) {
+	      nameVals[ii].nv_found = YES;
+	      nameVals[ii].nv_val64 += val64;
+	      found++;
+	    }
+	  }
+	}
+      }
+      fclose(cgFile);
+    }
+    return (found > 0);
+  }
+
+  static bool readCgroupIOStat(char *cgroup, int nvals, HSPNameVal *nameVals) {
+    // cgroup v2 io.stat lines look like:
+    // 8:0 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0
+    int found = 0;
+    FILE *cgFile = openCgroupFile(NULL, cgroup, "io.stat");
+    if(cgFile) {
+      char line[MAX_PROC_LINE_CHARS];
+      char buf[MAX_PROC_LINE_CHARS];
+      int truncated;
+      while(my_readline(cgFile, line, MAX_PROC_LINE_CHARS, &truncated) != EOF) {
+	char *p = line;
+	// skip the device
+	if(parseNextTok(&p, " ", NO, '\0', NO, buf, MAX_PROC_LINE_CHARS) == NULL)
+	  continue;
+	char *tok;
+	while((tok = parseNextTok(&p, " ", NO, '\0', NO, buf, MAX_PROC_LINE_CHARS)) != NULL) {
+	  char *eq = strchr(tok, '=');
+	  if(eq == NULL)
+	    continue;
+	  *eq++ = '\0';
+	  for(int ii = 0; ii < nvals; ii++) {
+	    if(my_strequal(tok, nameVals[ii].nv_name)) {
+	      nameVals[ii].nv_found = YES;
+	      nameVals[ii].nv_val64 += strtoull(eq, NULL, 0);
+	      found++;
+	    }
+	  }
+	}
+      }
+      fclose(cgFile);
+    }
+    return (found > 0);
+  }
+
+  static bool readContainerCgroupCPU(HSPVMState_DOCKER *container) {
+    // total CPU in nS, same as "cpu_stats.cpu_usage.total_usage"
+    if(container->cgroup_cpuacct)
+      return readCgroupValue("cpuacct", container->cgroup_cpuacct, "cpuacct.usage", &container->cpu_total);
+    if(container->cgroup_unified) {
+      HSPNameVal cpuVals[] = {
+	{ "usage_usec",0,0 },
+      };
+      if(readCgroupCounters(NULL, container->cgroup_unified, "cpu.stat", 1, cpuVals, NO)) {
+	container->cpu_total = cpuVals[0].nv_val64 * 1000;
+	return YES;
+      }
+    }
+    return NO;
+  }
+
+  static bool readContainerCgroupMem(HSPVMState_DOCKER *container) {
+    uint64_t limit = 0;
+    if(container->cgroup_memory) {
+      if(readCgroupValue("memory", container->cgroup_memory, "memory.limit_in_bytes", &limit)
+	 && limit < 0x7FFFFFFFFFFFF000ULL) // "unlimited" is reported as a page-rounded LONG_MAX
+	container->memoryLimit = limit;
+      return readCgroupValue("memory", container->cgroup_memory, "memory.usage_in_bytes", &container->mem_usage);
+    }
+    if(container->cgroup_unified) {
+      if(readCgroupValue(NULL, container->cgroup_unified, "memory.max", &limit))
+	container->memoryLimit = limit;
+      return readCgroupValue(NULL, container->cgroup_unified, "memory.current", &container->mem_usage);
+    }
+    return NO;
+  }
+
+  static bool readContainerCgroupDsk(HSPVMState_DOCKER *container) {
+    SFLHost_vrt_dsk_counters dsk = { 0 };
+    if(container->cgroup_blkio) {
+      HSPNameVal dskValsB[] = {
+	{ "Read",0,0 },
+	{ "Write",0,0 },
+      };
+      HSPNameVal dskValsO[] = {
+	{ "Read",0,0 },
+	{ "Write",0,0 },
+      };
+      // the non-throttle files stay empty unless CFQ/BFQ is in use
+      // (this is the same fallback the engine applies)
+      if(!readCgroupCounters("blkio", container->cgroup_blkio, "blkio.io_service_bytes_recursive", 2, dskValsB, YES))
+	readCgroupCounters("blkio", container->cgroup_blkio, "blkio.throttle.io_service_bytes", 2, dskValsB, YES);
+      if(!readCgroupCounters("blkio", container->cgroup_blkio, "blkio.io_serviced_recursive", 2, dskValsO, YES))
+	readCgroupCounters("blkio", container->cgroup_blkio, "blkio.throttle.io_serviced", 2, dskValsO, YES);
+      dsk.rd_bytes = dskValsB[0].nv_val64;
+      dsk.wr_bytes = dskValsB[1].nv_val64;
+      dsk.rd_req = (uint32_t)dskValsO[0].nv_val64;
+      dsk.wr_req = (uint32_t)dskValsO[1].nv_val64;
+    }
+    else if(container->cgroup_unified) {
+      HSPNameVal dskVals[] = {
+	{ "rbytes",0,0 },
+	{ "wbytes",0,0 },
+	{ "rios",0,0 },
+	{ "wios",0,0 },
+      };
+      // io.stat is empty until the container does some I/O,  so
+      // a missing file is the only failure here
+      readCgroupIOStat(container->cgroup_unified, 4, dskVals);
+      dsk.rd_bytes = dskVals[0].nv_val64;
+      dsk.wr_bytes = dskVals[1].nv_val64;
+      dsk.rd_req = (uint32_t)dskVals[2].nv_val64;
+      dsk.wr_req = (uint32_t)dskVals[3].nv_val64;
+    }
+    else
+      return NO;
+    container->dsk = dsk;
+    return YES;
+  }
+
+  static bool readContainerNetDev(HSPVMState_DOCKER *container) {
+    // /proc/<pid>/net/dev shows the counters for the network namespace
+    // of <pid>, so there is no need to fork and setns() here
+    char path[HSP_DOCKER_MAX_FNAME_LEN+1];
+    snprintf(path, HSP_DOCKER_MAX_FNAME_LEN, PROCFS_STR "/%u/net/dev", container->pid);
+    FILE *procFile = fopen(path, "r");
+    if(procFile == NULL) {
+      myDebug(2, "docker: cannot open %s : %s", path, strerror(errno));
+      return NO;
+    }
+    SFLHost_nio_counters net = { 0 };
+    char line[MAX_PROC_LINE_CHARS];
+    int lineNo = 0;
+    int truncated;
+    while(my_readline(procFile, line, MAX_PROC_LINE_CHARS, &truncated) != EOF) {
+      if(lineNo++ < 2) continue; // skip headers
+      char deviceName[MAX_PROC_LINE_CHARS];
+      uint64_t bytes_in, pkts_in, errs_in, drops_in;
+      uint64_t bytes_out, pkts_out, errs_out, drops_out;
+      if(sscanf(line, " %[^:]:%"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64" %*u %*u %*u %*u %"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64"",
+		deviceName,
+		&bytes_in,
+		&pkts_in,
+		&errs_in,
+		&drops_in,
+		&bytes_out,
+		&pkts_out,
+		&errs_out,
+		&drops_out) == 9) {
+	// the engine reports the container's own interfaces, which never include loopback
+	if(my_strequal(deviceName, "lo"))
+	  continue;
+	net.bytes_in += bytes_in;
+	net.pkts_in += (uint32_t)pkts_in;
+	net.errs_in += (uint32_t)errs_in;
+	net.drops_in += (uint32_t)drops_in;
+	net.bytes_out += bytes_out;
+	net.pkts_out += (uint32_t)pkts_out;
+	net.errs_out += (uint32_t)errs_out;
+	net.drops_out += (uint32_t)drops_out;
+      }
+    }
+    fclose(procFile);
+    container->net = net;
+    return YES;
+  }
+
+  static bool readContainerCgroupStats(EVMod *mod, HSPVMState_DOCKER *container) {
+    if(container->pid == 0)
+      return NO;
+    // CPU and memory must be there, disk and net are best-effort
+    if(!readContainerCgroupCPU(container)
+       || !readContainerCgroupMem(container))
+      return NO;
+    readContainerCgroupDsk(container);
+    readContainerNetDev(container);
+    return YES;
   }
 
   /*_________________---------------------------__________________
@@ -879,15 +1273,29 @@ extern "C" {
 
   static void evt_tick(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+
+    if(sp->docker.cri) {
+      telemetrySet(sp, mod, HSP_TELEMETRY_DOCKER_INFLIGHT, mdata->criConn ? mdata->criConn->nStreams : 0);
+      telemetrySet(sp, mod, HSP_TELEMETRY_DOCKER_CONNECTIONS, mdata->criConn ? 1 : 0);
+    }
+    else {
+      telemetrySet(sp, mod, HSP_TELEMETRY_DOCKER_INFLIGHT, mdata->currentRequests);
+      telemetrySet(sp, mod, HSP_TELEMETRY_DOCKER_CONNECTIONS, mdata->nConns);
+    }
+    telemetrySet(sp, mod, HSP_TELEMETRY_DOCKER_QUEUED, mdata->queuedRequests + mdata->waitingRequests);
+    telemetrySet(sp, mod, HSP_TELEMETRY_DOCKER_LOST, mdata->lostRequests);
 
     if(mdata->currentRequests || mdata->queuedRequests || mdata->waitingRequests) {
-      myDebug(1, "docker currentRequests=%d, queuedRequests=%d, waitingRequests=%d, generatedRequests=%d, lostRequests=%d, statsWaitRequests=%d containers=%d, names=%d, hostnames=%d",
+      myDebug(1, "docker currentRequests=%d, queuedRequests=%d, waitingRequests=%d, connections=%u, generatedRequests=%d, lostRequests=%d, statsWaitRequests=%d, cgroupStats=%d containers=%d, names=%d, hostnames=%d",
 	      mdata->currentRequests,
 	      mdata->queuedRequests,
 	      mdata->waitingRequests,
+	      mdata->nConns,
 	      mdata->generatedRequests,
 	      mdata->lostRequests,
 	      mdata->statsWaitRequests,
+	      mdata->cgroupStats,
 	      UTHashN(mdata->vmsByID),
 	      UTHashN(mdata->nameCount),
 	      UTHashN(mdata->hostnameCount));
@@ -900,19 +1308,20 @@ extern "C" {
     }
     if(mdata->countdownToRecheck) {
       if(--mdata->countdownToRecheck == 0) {
-	// ebuild regex patterns periodically
-	buildRegexPatterns(mod);
-	// and check for missed containers
+	// check for missed containers
 	myDebug(1, "docker container recheck");
 	dockerContainerCapture(mod);
       }
     }
+    netnsFlush(mod);
     if(!mdata->dockerFlush) {
 #ifdef HSP_DOCKER_WAITQ
       serviceWaitQ(mod);
 #endif
       serviceRequestQ(mod);
       serviceLostRequests(mod);
+      serviceIdleConnections(mod);
+      serviceCRITimeouts(mod);
     }
   }
 
@@ -1154,7 +1563,6 @@ extern "C" {
   }
 
   static void dockerAPI_inspect(EVMod *mod, UTStrBuf *buf, cJSON *jcont, HSPDockerRequest *req) {
-    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
     myDebug(1, "dockerAPI_inspect");
 
     cJSON *jid = cJSON_GetObjectItem(jcont, "Id");
@@ -1212,6 +1620,19 @@ extern "C" {
       readContainerGPUsFromEnv(mod, container, jenv);
 
     container->inspect_rx = YES;
+    containerInspected(mod, container);
+  }
+
+  /*_________________---------------------------__________________
+    _________________    containerInspected     __________________
+    -----------------___________________________------------------
+    Now that we have the pid and limits, from the docker engine
+    or the CRI runtime.
+  */
+
+  static void containerInspected(EVMod *mod, HSPVMState_DOCKER *container) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
 
     // now that we have the pid,  we can probe for the MAC and peer-ifIndex
     // see if spacing the VNIC refresh reduces load
@@ -1249,7 +1670,14 @@ extern "C" {
     // 60 seconds then it's a long time for us to not be reporting any gauges.
     // So we introduced the waitQ,  which causes us to wait just a few seconds
     // before sending the first stats request:
-    if(container->stats_wait) {
+    if(sp->docker.cri
+       || (sp->docker.cgroupStats
+	   && container->pid
+	   && container->state == HSP_CS_running)) {
+      // no request needed: the first reading comes from the cgroup
+      // files at the next polling interval
+    }
+    else if(container->stats_wait) {
       // don't send it - already one outstanding
       mdata->statsWaitRequests++;
     }
@@ -1663,6 +2091,30 @@ extern "C" {
 
   static void getContainerStats(EVMod *mod, HSPVMState_DOCKER *container) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    if(sp->docker.cgroupStats
+       && container->stats_wait == NO
+       && readContainerCgroupStats(mod, container)) {
+      // same tail as dockerAPI_stats(), without the round-trip
+      mdata->cgroupStats++;
+      container->stats_rx = YES;
+      getCounters_DOCKER(mod, container);
+      if(containerDone(mod, container))
+	removeAndFreeVM_DOCKER(mod, container);
+      return;
+    }
+    if(sp->docker.cri) {
+      // No stats API to fall back on. Once we have the pid, a cgroup
+      // that cannot be read means the container is gone, which also
+      // covers a missed STOPPED event (or a runtime with no events).
+      if(container->inspect_rx) {
+	myDebug(1, "cri: no cgroup stats for %s, removing", container->name);
+	removeAndFreeVM_DOCKER(mod, container);
+      }
+      return;
+    }
+    // fall back on the API if the cgroup is gone (e.g. the final
+    // sample after a "die" event) or not known yet
     if(container->stats_wait) {
       // don't send it - already one outstanding
       mdata->statsWaitRequests++;
@@ -1896,93 +2348,522 @@ extern "C" {
     }
   }
 
-  // Assume headers include:
-  // Content-Type: Application/JSON
-  // Transfer-Encoding: chunked
-  //
-  // Assume that the chunks of JSON content do not have CR or LF characters within them
-  // (if they ever do then we can add another "within chunk" state and append lines to
-  // the response result there).
-  static void processDockerResponse(EVMod *mod, EVSocket *sock, HSPDockerRequest *req) {
+  /*_________________---------------------------__________________
+    _________________    lost requests          __________________
+    -----------------___________________________------------------
+    Free the resources and possibly resubmit.
+  */
+
+  static void dockerRequestLost(EVMod *mod, HSPDockerRequest *req, bool resubmit) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    mdata->lostRequests++;
+    myDebug(1, "dockerRequestLost: req lost seqNo=%d req=<%s>", req->seqNo, UTSTRBUF_STR(req->request));
+    if(req->reqType == HSP_REQTYPE_CONTAINERS) {
+      // nothing to do here - another will be sent at the RECHECK time
+    }
+    else if(req->id) {
+      // it must be a container-specific request
+      HSPVMState_DOCKER *container = getContainer(mod, req->id, NO, NO);
+      if(container) {
+	// container is still around
+	if(containerDone(mod, container)) {
+	  // we got the event to say it was done. I suppose we might retry if this
+	  // was an attempt to get the final stats reckoning, but seems safer to just let it go.
+	  removeAndFreeVM_DOCKER(mod, container);
+	}
+	else if(req->reqType == HSP_REQTYPE_STATS) {
+	  // unblock the stats_wait flag so another can be sent on the next polling cycle.
+	  container->stats_wait = NO;
+	}
+	else if(req->reqType == HSP_REQTYPE_INSPECT) {
+	  // retransmit this request so we don't end up with a half-discovered container,
+	  // or leave it for the next container recheck to pick up.
+	  if(resubmit)
+	    inspectContainer(mod, container);
+	  else
+	    container->inspect_tx = NO;
+	}
+	else {
+	  myDebug(1, "docker unexpected request type=%d", req->reqType);
+	}
+      }
+    }
+    dockerRequestFree(mod, req);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   docker API connections  __________________
+    -----------------___________________________------------------
+    Requests go out over a pool of persistent HTTP/1.1 connections
+    (docker { connections=N }), each with up to docker { pipeline=N }
+    requests outstanding. An idle connection is preferred, then a new
+    one, then pipelining onto the least busy. The events request has
+    a connection to itself because its response never ends.
+  */
+
+  static void dockerConnReset(HSPDockerConn *conn) {
+    conn->state = HSPDOCKERREQ_HEADERS;
+    conn->httpStatus = 0;
+    conn->contentLength = -1;
+    conn->chunkLength = 0;
+    conn->gotStatus = NO;
+    conn->chunked = NO;
+  }
+
+  static HSPDockerConn *dockerConnOpen(EVMod *mod, bool events) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    int fd = UTUnixDomainSocket(sp->docker.socket);
+    if(fd < 0)  {
+      // looks like docker was stopped
+      // wait longer before retrying
+      mdata->dockerFlush = YES;
+      mdata->countdownToResync = HSP_DOCKER_WAIT_NOSOCKET;
+      return NULL;
+    }
+    HSPDockerConn *conn = (HSPDockerConn *)my_calloc(sizeof(HSPDockerConn));
+    conn->events = events;
+    conn->rxbuf = UTStrBuf_new();
+    conn->lastActivity = EVCurrentBus()->now.tv_sec;
+    dockerConnReset(conn);
+    conn->sock = EVBusAddSocket(mod, mdata->pollBus, fd, readDockerAPI, conn);
+    if(events)
+      mdata->eventsConn = conn;
+    else {
+      UTQ_ADD_TAIL(mdata->conns, conn);
+      mdata->nConns++;
+    }
+    myDebug(1, "docker connection open fd=%d events=%u connections=%u", fd, events, mdata->nConns);
+    return conn;
+  }
+
+  static HSPDockerConn *dockerConnPick(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPDockerConn *best = NULL;
+    for(HSPDockerConn *conn = UTQ_HEAD(mdata->conns); conn; conn = conn->next) {
+      if(conn->closing
+	 || conn->broken)
+	continue;
+      if(best == NULL
+	 || conn->nInflight < best->nInflight)
+	best = conn;
+    }
+    if(best
+       && best->nInflight == 0)
+      return best;
+    if(mdata->nConns < sp->docker.connections)
+      return dockerConnOpen(mod, NO);
+    if(best
+       && best->nInflight < sp->docker.pipeline)
+      return best;
+    return NULL;
+  }
+
+  static bool dockerConnSend(EVMod *mod, HSPDockerConn *conn, HSPDockerRequest *req) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    char *cmd = UTSTRBUF_STR(req->request);
+    ssize_t len = UTSTRBUF_LEN(req->request);
+    myDebug(1, "dockerAPIRequest(%s) seqNo=%d, fd=%d inflight=%u", cmd, req->seqNo, conn->sock->fd, conn->nInflight);
+    int cc;
+    // (MSG_NOSIGNAL because the engine may have closed an idle connection)
+    while((cc = send(conn->sock->fd, cmd, len, MSG_NOSIGNAL)) != len && errno == EINTR);
+    if(cc != len) {
+      myLog(LOG_ERR, "dockerAPIRequest - write(%s) returned %d != %u: %s",
+	    cmd, cc, len, strerror(errno));
+      // let the read side find out and clean up
+      conn->broken = YES;
+      shutdown(conn->sock->fd, SHUT_RDWR);
+      return NO;
+    }
+    time_t now = EVCurrentBus()->now.tv_sec;
+    if(conn->nInflight == 0)
+      conn->lastActivity = now;
+    UTQ_ADD_TAIL(conn->inflight, req);
+    conn->nInflight++;
+    req->conn = conn;
+    req->sendTime = now;
+    req->sendTime_nS = latencyClock_nS();
+    if(!conn->events)
+      mdata->currentRequests++;
+    return YES;
+  }
+
+  static void dockerConnUnlink(EVMod *mod, HSPDockerConn *conn) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(conn->sock) {
+      EVSocketClose(mod, conn->sock, YES);
+      conn->sock = NULL;
+    }
+    if(conn->events) {
+      if(mdata->eventsConn == conn)
+	mdata->eventsConn = NULL;
+    }
+    else {
+      UTQ_REMOVE(mdata->conns, conn);
+      mdata->nConns--;
+    }
+  }
+
+  static void dockerConnFree(HSPDockerConn *conn) {
+    UTStrBuf_free(conn->rxbuf);
+    my_free(conn);
+  }
+
+  // Close a connection and requeue whatever was pipelined on it (in
+  // order, at the front of the requestQ). If headLost then the request
+  // at the head was the one that went unanswered, so give up on that one.
+  static void dockerConnClose(EVMod *mod, HSPDockerConn *conn, bool headLost) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    char *line = UTSTRBUF_STR(sock->ioline);
-    myDebug(2, "processDockerResponse got answer (seqNo=%d): <%s>", req->seqNo, line);
-    switch(req->state) {
+    myDebug(1, "docker connection close events=%u inflight=%u headLost=%u",
+	    conn->events,
+	    conn->nInflight,
+	    headLost);
+    // unlink first, in case lost-request handling sends more requests
+    dockerConnUnlink(mod, conn);
+    HSPDockerRequest *head = UTQ_HEAD(conn->inflight);
+    while(!UTQ_EMPTY(conn->inflight)) {
+      HSPDockerRequest *req;
+      UTQ_REMOVE_TAIL(conn->inflight, req);
+      req->conn = NULL;
+      req->sendTime = 0;
+      if(conn->events) {
+	dockerRequestFree(mod, req);
+	continue;
+      }
+      --mdata->currentRequests;
+      if((headLost && req == head)
+	 || ++req->retries > HSP_DOCKER_MAX_RETRIES)
+	dockerRequestLost(mod, req, YES);
+      else {
+	UTQ_ADD_HEAD(mdata->requestQ, req);
+	mdata->queuedRequests++;
+      }
+    }
+    conn->nInflight = 0;
+    dockerConnFree(conn);
+  }
+
+  // Close everything and discard any responses still due.
+  static void dockerConnCloseAll(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSPDockerConn *conn;
+    while((conn = UTQ_HEAD(mdata->conns)) != NULL
+	  || (conn = mdata->eventsConn) != NULL) {
+      dockerConnUnlink(mod, conn);
+      HSPDockerRequest *req;
+      while(!UTQ_EMPTY(conn->inflight)) {
+	UTQ_REMOVE_HEAD(conn->inflight, req);
+	if(!conn->events)
+	  --mdata->currentRequests;
+	dockerRequestFree(mod, req);
+      }
+      dockerConnFree(conn);
+    }
+  }
+
+  // Same as closing the connection, but if it carried the events
+  // then we lost the event feed and need to flush and resync.
+  static void dockerConnLost(EVMod *mod, HSPDockerConn *conn, bool headLost) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    bool events = conn->events;
+    dockerConnClose(mod, conn, headLost);
+    if(events) {
+      mdata->dockerFlush = YES;
+      dockerConnCloseAll(mod);
+      // no outstanding requests - flush is done
+      mdata->dockerFlush = NO;
+      mdata->countdownToResync = HSP_DOCKER_WAIT_EVENTDROP;
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________   HTTP response parser    __________________
+    -----------------___________________________------------------
+    Incremental, so a response can arrive in any number of reads,
+    and a read can hold the tail of one pipelined response and the
+    start of the next.  Handles Content-Length, chunked, and (for
+    completeness) read-to-EOF bodies.
+  */
+
+  // return the length of the next line (without CRLF) and set *consumed,
+  // or return -1 if there is not a complete line yet
+  static int dockerLine(char *buf, int len, int *consumed) {
+    char *nl = memchr(buf, '\n', len);
+    if(nl == NULL)
+      return -1;
+    int lineLen = nl - buf;
+    *consumed = lineLen + 1;
+    if(lineLen
+       && buf[lineLen - 1] == '\r')
+      lineLen--;
+    buf[lineLen] = '\0';
+    return lineLen;
+  }
+
+  static int dockerNeedLine(HSPDockerConn *conn, int len) {
+    if(len > HSP_DOCKER_MAX_HEADER_LINE) {
+      myDebug(1, "docker response line too long");
+      conn->state = HSPDOCKERREQ_ERR;
+    }
+    return 0;
+  }
+
+  static void dockerAppend(HSPDockerRequest *req, char *buf, int len) {
+    if(req->response == NULL)
+      req->response = UTStrBuf_new();
+    UTStrBuf_append_n(req->response, buf, len);
+  }
+
+  // The events response is a stream of JSON objects, normally one
+  // per line and one per chunk. Process each complete one and keep
+  // any partial object until the rest arrives.
+  static void dockerEventsFeed(EVMod *mod, HSPDockerRequest *req) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    UTStrBuf *resp = req->response;
+    if(resp == NULL)
+      return;
+    char *start = UTSTRBUF_STR(resp);
+    char *end = start + UTSTRBUF_LEN(resp);
+    while(start < end) {
+      char *nl = memchr(start, '\n', end - start);
+      int objLen = nl ? (nl - start) : (end - start);
+      if(objLen) {
+	UTStrBuf *obj = UTStrBuf_new();
+	UTStrBuf_append_n(obj, start, objLen);
+	cJSON *top = cJSON_Parse(UTSTRBUF_STR(obj));
+	if(top == NULL
+	   && nl == NULL) {
+	  // partial - wait for more
+	  UTStrBuf_free(obj);
+	  break;
+	}
+	if(top) {
+	  if(!mdata->dockerFlush) {
+	    logJSON(4, "dockerEventsFeed:", top);
+	    (*req->jsonCB)(mod, obj, top, req);
+	  }
+	  cJSON_Delete(top);
+	}
+	else {
+	  myDebug(1, "dockerEventsFeed: ignoring <%s>", UTSTRBUF_STR(obj));
+	}
+	UTStrBuf_free(obj);
+      }
+      start = nl ? (nl + 1) : end;
+    }
+    int remain = end - start;
+    if(remain > HSP_DOCKER_MAX_EVENT_BYTES) {
+      myLog(LOG_ERR, "docker events: discarding %d bytes of unparseable data", remain);
+      remain = 0;
+    }
+    memmove(UTSTRBUF_STR(resp), start, remain);
+    UTSTRBUF_LEN(resp) = remain;
+    UTSTRBUF_STR(resp)[remain] = '\0';
+  }
+
+  // consume what we can from buf for the request at the head of the
+  // connection and return the number of bytes used
+  static int dockerConnParse(EVMod *mod, HSPDockerConn *conn, HSPDockerRequest *req, char *buf, int len) {
+    int consumed = 0;
+    int lineLen;
+    switch(conn->state) {
 
     case HSPDOCKERREQ_HEADERS:
-      UTStrBuf_chomp(sock->ioline);
-      if(UTRegexExtractInt(mdata->contentLengthPattern, line, 1, &req->contentLength, NULL, NULL)) {
-	myDebug(1, "processDockerResponse seqNo=%d contentLength=%d", req->seqNo,  req->contentLength);
+      if((lineLen = dockerLine(buf, len, &consumed)) < 0)
+	return dockerNeedLine(conn, len);
+      myDebug(2, "docker response (seqNo=%d): <%s>", req->seqNo, buf);
+      if(!conn->gotStatus) {
+	// e.g. "HTTP/1.1 200 OK"
+	if(lineLen == 0)
+	  break;
+	conn->gotStatus = YES;
+	if(sscanf(buf, "HTTP/%*u.%*u %d", &conn->httpStatus) != 1) {
+	  myDebug(1, "Docker error: bad status line <%s> for request(seqNo=%d)", buf, req->seqNo);
+	  conn->state = HSPDOCKERREQ_ERR;
+	}
       }
-      else if(UTSTRBUF_LEN(sock->ioline) == 0) {
-	req->state = req->contentLength
-	  ? HSPDOCKERREQ_CONTENT
-	  : HSPDOCKERREQ_LENGTH;
+      else if(lineLen == 0) {
+	// end of headers
+	if(conn->chunked)
+	  conn->state = HSPDOCKERREQ_LENGTH;
+	else if(conn->contentLength == 0)
+	  conn->state = HSPDOCKERREQ_DONE;
+	else
+	  conn->state = HSPDOCKERREQ_CONTENT;
       }
+      else if(strncasecmp(buf, "Content-Length:", 15) == 0)
+	conn->contentLength = strtol(buf + 15, NULL, 10);
+      else if(strncasecmp(buf, "Transfer-Encoding:", 18) == 0)
+	conn->chunked = (strcasestr(buf + 18, "chunked") != NULL);
+      else if(strncasecmp(buf, "Connection:", 11) == 0)
+	conn->closing = (strcasestr(buf + 11, "close") != NULL);
       break;
 
-    case HSPDOCKERREQ_ENDCONTENT:
-      UTStrBuf_chomp(sock->ioline);
-      if(UTSTRBUF_LEN(sock->ioline) == 0)
-	req->state = HSPDOCKERREQ_LENGTH;
-      break;
-      
     case HSPDOCKERREQ_LENGTH: {
-      UTStrBuf_chomp(sock->ioline);
+      if((lineLen = dockerLine(buf, len, &consumed)) < 0)
+	return dockerNeedLine(conn, len);
       char *endp = NULL;
-      req->chunkLength = strtol(line, &endp, 16); // hex
-      if(*endp != '\0') {
+      conn->chunkLength = strtol(buf, &endp, 16); // hex
+      if(endp == buf
+	 || conn->chunkLength < 0
+	 || (*endp != '\0' && *endp != ';' && *endp != ' ')) {
 	// failed to consume the whole string - must be an error.
 	myDebug(1, "Docker error: <%s> for request(seqNo=%d): <%s>",
-		line, req->seqNo, UTSTRBUF_STR(req->request));
-	req->state = HSPDOCKERREQ_ERR;
+		buf, req->seqNo, UTSTRBUF_STR(req->request));
+	conn->state = HSPDOCKERREQ_ERR;
       }
       else {
-	req->state = req->chunkLength
-	  ? HSPDOCKERREQ_CONTENT
-	  : HSPDOCKERREQ_ENDCONTENT;
+	conn->state = conn->chunkLength
+	  ? HSPDOCKERREQ_CHUNK
+	  : HSPDOCKERREQ_TRAILER;
       }
       break;
     }
 
-    case HSPDOCKERREQ_CONTENT: {
-      int clen = req->chunkLength ?: req->contentLength;
-      if(clen != UTSTRBUF_LEN(sock->ioline)) {
-	myLog(LOG_ERR, "ERROR req->chunkLength=%d req->contentLength=%d len(sock->ioline)=%d",
-	      req->chunkLength,
-	      req->contentLength,
-	      UTSTRBUF_LEN(sock->ioline));
-	myLog(LOG_ERR, "request (seqno=%d)=<%s>", req->seqNo, UTSTRBUF_STR(req->request));
-	myLog(LOG_ERR, "sock->ioline content=<%s>", UTSTRBUF_STR(sock->ioline));
+    case HSPDOCKERREQ_CHUNK:
+      consumed = (len < conn->chunkLength) ? len : conn->chunkLength;
+      dockerAppend(req, buf, consumed);
+      conn->chunkLength -= consumed;
+      if(conn->chunkLength == 0) {
+	conn->state = HSPDOCKERREQ_ENDCHUNK;
+	if(conn->events)
+	  dockerEventsFeed(mod, req);
       }
-      assert(clen == UTSTRBUF_LEN(sock->ioline)); // assume no newlines in chunk (failing here!)
-      if(req->reqType == HSP_REQTYPE_EVENTS)
-	processDockerJSON(mod, req, sock->ioline);
-      else {
-	if(req->response == NULL)
-	  req->response = UTStrBuf_new();
-	UTStrBuf_append_n(req->response, line, UTSTRBUF_LEN(sock->ioline));
+      break;
+
+    case HSPDOCKERREQ_ENDCHUNK:
+      if((lineLen = dockerLine(buf, len, &consumed)) < 0)
+	return dockerNeedLine(conn, len);
+      conn->state = (lineLen == 0)
+	? HSPDOCKERREQ_LENGTH
+	: HSPDOCKERREQ_ERR;
+      break;
+
+    case HSPDOCKERREQ_TRAILER:
+      if((lineLen = dockerLine(buf, len, &consumed)) < 0)
+	return dockerNeedLine(conn, len);
+      if(lineLen == 0)
+	conn->state = HSPDOCKERREQ_DONE;
+      break;
+
+    case HSPDOCKERREQ_CONTENT:
+      consumed = len;
+      if(conn->contentLength >= 0
+	 && consumed > conn->contentLength)
+	consumed = conn->contentLength;
+      dockerAppend(req, buf, consumed);
+      if(conn->contentLength > 0) {
+	conn->contentLength -= consumed;
+	if(conn->contentLength == 0)
+	  conn->state = HSPDOCKERREQ_DONE;
       }
-      req->state = HSPDOCKERREQ_ENDCONTENT;
       break;
-    }
-      
+
+    case HSPDOCKERREQ_DONE:
     case HSPDOCKERREQ_ERR:
-      // TODO: just wait for EOF, or should we force the socket to close?
-      myDebug(1, "processDockerResponse seqNo=%d got error", req->seqNo);
       break;
     }
+    return consumed;
+  }
+
+  static void dockerResponseDone(EVMod *mod, HSPDockerConn *conn, HSPDockerRequest *req) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    UTQ_REMOVE(conn->inflight, req);
+    conn->nInflight--;
+    req->conn = NULL;
+    if(!conn->events)
+      --mdata->currentRequests;
+    conn->lastActivity = EVCurrentBus()->now.tv_sec;
+    latencyRecord(sp, mod, HSP_LATENCY_DOCKER, latencyClock_nS() - req->sendTime_nS);
+    int httpStatus = conn->httpStatus;
+    dockerConnReset(conn);
+    myDebug(1, "request done seqNo=%d status=%d =<%s>", req->seqNo, httpStatus, UTSTRBUF_STR(req->request));
+    if(!mdata->dockerFlush
+       && req->response)
+      processDockerJSON(mod, req, req->response);
+    dockerRequestFree(mod, req);
+  }
+
+  static void readDockerAPI(EVMod *mod, EVSocket *sock, void *magic) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSPDockerConn *conn = (HSPDockerConn *)magic;
+    UTStrBuf *rx = conn->rxbuf;
+    HSPDockerRequest *req;
+    UTStrBuf_need(rx, HSP_DOCKER_READ_INCBYTES);
+    int cc;
+    while((cc = read(sock->fd, UTSTRBUF_STR(rx) + UTSTRBUF_LEN(rx), HSP_DOCKER_READ_INCBYTES)) < 0
+	  && errno == EINTR);
+    if(cc < 0
+       && errno == EAGAIN)
+      return;
+    if(cc <= 0) {
+      myDebug(1, "docker connection %s (inflight=%u)", cc ? strerror(errno) : "EOF", conn->nInflight);
+      // a body with no length is terminated by EOF
+      if(conn->state == HSPDOCKERREQ_CONTENT
+	 && conn->contentLength < 0
+	 && (req = UTQ_HEAD(conn->inflight)) != NULL)
+	dockerResponseDone(mod, conn, req);
+      dockerConnLost(mod, conn, NO);
+      if(!mdata->dockerFlush)
+	serviceRequestQ(mod);
+      return;
+    }
+    UTSTRBUF_LEN(rx) += cc;
+    conn->lastActivity = EVCurrentBus()->now.tv_sec;
+    char *buf = UTSTRBUF_STR(rx);
+    int len = UTSTRBUF_LEN(rx);
+    int off = 0;
+    while(off < len
+	  && (req = UTQ_HEAD(conn->inflight)) != NULL) {
+      int consumed = dockerConnParse(mod, conn, req, buf + off, len - off);
+      off += consumed;
+      if(conn->state == HSPDOCKERREQ_DONE)
+	dockerResponseDone(mod, conn, req);
+      else if(conn->state == HSPDOCKERREQ_ERR
+	      || consumed == 0)
+	break;
+    }
+    if(off < len
+       && UTQ_EMPTY(conn->inflight)) {
+      myDebug(1, "docker connection: ignoring %d unexpected bytes", len - off);
+      off = len;
+    }
+    // keep any partial line for next time
+    memmove(buf, buf + off, len - off);
+    UTSTRBUF_LEN(rx) = len - off;
+    if(conn->state == HSPDOCKERREQ_ERR) {
+      dockerConnLost(mod, conn, YES);
+    }
+    else if(conn->closing
+	    && conn->nInflight == 0) {
+      dockerConnLost(mod, conn, NO);
+    }
+    // see if we have another request queued
+    if(!mdata->dockerFlush)
+      serviceRequestQ(mod);
   }
 
   static void serviceRequestQ(EVMod *mod) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    while(mdata->currentRequests < HSP_DOCKER_MAX_CONCURRENT
+    while(!mdata->dockerFlush
 	  && !UTQ_EMPTY(mdata->requestQ)) {
+      HSPDockerConn *conn = dockerConnPick(mod);
+      if(conn == NULL)
+	break;
       // see if we have another request queued
       HSPDockerRequest *nextReq;
       UTQ_REMOVE_HEAD(mdata->requestQ, nextReq);
       --mdata->queuedRequests;
-      dockerAPIRequest(mod, nextReq);
+      if(!dockerConnSend(mod, conn, nextReq)) {
+	if(++nextReq->retries > HSP_DOCKER_MAX_RETRIES)
+	  dockerRequestLost(mod, nextReq, NO);
+	else {
+	  UTQ_ADD_HEAD(mdata->requestQ, nextReq);
+	  mdata->queuedRequests++;
+	}
+      }
     }
   }
 
@@ -2021,175 +2902,479 @@ extern "C" {
 
   static void serviceLostRequests(EVMod *mod) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    HSPDockerRequest *req;
     time_t now = EVCurrentBus()->now.tv_sec;
-    uint32_t reqs_queued=0;
-    uint32_t reqs_lost=0;
-    UTHASH_WALK(mdata->reqsBySeqNo, req) {
-      // the events request will always be running, so don't time it out
-      if(req->reqType == HSP_REQTYPE_EVENTS)
-	continue;
-      if(req->sendTime == 0) {
-	// assume queued
-	reqs_queued++;
+    // Responses come back in order, so only the request at the head of a
+    // connection can be late. If it is, the engine seems to have ignored it,
+    // so give up on the connection and requeue the ones pipelined behind it.
+    // (the events request will always be running, so don't time it out)
+    for(HSPDockerConn *conn = UTQ_HEAD(mdata->conns); conn; ) {
+      HSPDockerConn *nextConn = conn->next;
+      if(conn->nInflight
+	 && (now - conn->lastActivity) > HSP_DOCKER_REQ_TIMEOUT) {
+	myDebug(1, "serviceLostRequests: timeout seqNo=%d req=<%s>",
+		UTQ_HEAD(conn->inflight)->seqNo,
+		UTSTRBUF_STR(UTQ_HEAD(conn->inflight)->request));
+	dockerConnClose(mod, conn, YES);
+      }
+      conn = nextConn;
+    }
+  }
+
+  static void serviceIdleConnections(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    time_t now = EVCurrentBus()->now.tv_sec;
+    for(HSPDockerConn *conn = UTQ_HEAD(mdata->conns); conn; ) {
+      HSPDockerConn *nextConn = conn->next;
+      if(conn->nInflight == 0
+	 && (now - conn->lastActivity) > HSP_DOCKER_CONN_IDLE_TIMEOUT)
+	dockerConnClose(mod, conn, NO);
+      conn = nextConn;
+    }
+  }
+
+  static void dockerAPIRequest(EVMod *mod, HSPDockerRequest *req) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(req->reqType == HSP_REQTYPE_EVENTS) {
+      HSPDockerConn *conn = dockerConnOpen(mod, YES);
+      if(conn == NULL)
+	dockerRequestFree(mod, req);
+      else if(!dockerConnSend(mod, conn, req))
+	dockerRequestFree(mod, req); // and the read side will see the connection go
+      return;
+    }
+    for(;;) {
+      HSPDockerConn *conn = mdata->dockerFlush ? NULL : dockerConnPick(mod);
+      if(conn == NULL) {
+	// just queue it
+	UTQ_ADD_TAIL(mdata->requestQ, req);
+	mdata->queuedRequests++;
+	return;
+      }
+      if(dockerConnSend(mod, conn, req))
+	return;
+      // that connection is broken - try another
+      if(++req->retries > HSP_DOCKER_MAX_RETRIES) {
+	dockerRequestLost(mod, req, NO);
+	return;
       }
-      else if((now - req->sendTime) > HSP_DOCKER_REQ_TIMEOUT) {
-	// timeout - the engine seems to have ignored this request. Have to free the resources and possibly resubmit.
-	reqs_lost++;
-	myDebug(1, "serviceLostRequests: req lost seqNo=%d req=<%s>", req->seqNo, UTSTRBUF_STR(req->request));
+    }
+  }
+
+  static HSPDockerRequest *dockerRequest(EVMod *mod, UTStrBuf *cmd, HSPDockerCB jsonCB, EnumHSPDockerReqType reqType) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSPDockerRequest *req = (HSPDockerRequest *)my_calloc(sizeof(HSPDockerRequest));
+    req->seqNo = ++mdata->generatedRequests;
+    req->request = UTStrBuf_copy(cmd);
+    req->jsonCB = jsonCB;
+    req->reqType = reqType;
+    return req;
+  }
+
+  static void  dockerRequestFree(EVMod *mod, HSPDockerRequest *req) {
+    UTStrBuf_free(req->request);
+    if(req->response) UTStrBuf_free(req->response);
+    if(req->id) my_free(req->id);
+    my_free(req);
+  }
+
+  /*_________________---------------------------__________________
+    _________________    CRI backend            __________________
+    -----------------___________________________------------------
+    With cri { } the same container model is fed from a CRI runtime
+    (containerd, CRI-O) over gRPC on its unix socket instead of from
+    the docker engine API:
+      ListContainers         replaces /containers/json
+      GetContainerEvents     replaces /events
+      ContainerStatus        replaces /containers/<id>/json (inspect)
+    and counters always come from the cgroup files (cgroupStats).
+    A runtime that does not implement GetContainerEvents is polled
+    with ListContainers instead.
+  */
 
-	if(req->reqType == HSP_REQTYPE_CONTAINERS) {
-	  // nothing to do here - another will be sent at the RECHECK time
+#define HSP_CRI_RPC "/runtime.v1.RuntimeService/"
+#define HSP_CRI_CALL_TIMEOUT 30
+#define HSP_CRI_WAIT_POLL 10
+#define HSP_CRI_MAX_MSG 1024
+
+  // runtime.v1 enums
+#define HSP_CRI_CONTAINER_RUNNING 1
+#define HSP_CRI_EVENT_CREATED 0
+#define HSP_CRI_EVENT_STARTED 1
+#define HSP_CRI_EVENT_STOPPED 2
+#define HSP_CRI_EVENT_DELETED 3
+
+  static bool criMapEntry(UTPBField *entry, UTPBField *key, UTPBField *val) {
+    // map<string,string> entries are {1: key, 2: value}
+    UTPBField fld;
+    uint32_t off = 0;
+    memset(key, 0, sizeof(*key));
+    memset(val, 0, sizeof(*val));
+    while(UTPB_next(entry->data, entry->len, &off, &fld)) {
+      if(fld.field == 1) *key = fld;
+      else if(fld.field == 2) *val = fld;
+    }
+    return (key->data != NULL);
+  }
+
+  static void criParseStatus(EVMod *mod, HSPVMState_DOCKER *container, u_char *msg, uint32_t msgLen) {
+    // ContainerStatus {2:metadata 3:state 12:labels 16:resources}
+    char *metaName = NULL, *ctName = NULL, *podName = NULL, *podNS = NULL, *podUID = NULL;
+    uint32_t attempt = 0;
+    uint64_t cpuPeriod = 0, cpuQuota = 0, memLimit = 0;
+    UTPBField fld, sub, key, val;
+    uint32_t off = 0;
+    while(UTPB_next(msg, msgLen, &off, &fld)) {
+      uint32_t off2 = 0;
+      switch(fld.field) {
+      case 2:
+	while(UTPB_next(fld.data, fld.len, &off2, &sub)) {
+	  if(sub.field == 1 && sub.wt == UTPB_WT_LEN) {
+	    if(metaName) my_free(metaName);
+	    metaName = UTPB_strdup(&sub);
+	  }
+	  else if(sub.field == 2) attempt = (uint32_t)sub.varint;
 	}
-	else {
-	  // it must be a container-specific request
-	  assert(req->id);
-	  HSPVMState_DOCKER *container = getContainer(mod, req->id, NO, NO);
-	  if(container) {
-	    // container is still around
-	    if(containerDone(mod, container)) {
-	      // we got the event to say it was done. I suppose we might retry if this
-	      // was an attempt to get the final stats reckoning, but seems safer to just let it go.
-	      removeAndFreeVM_DOCKER(mod, container);
-	    }
-	    else if(req->reqType == HSP_REQTYPE_STATS) {
-	      // unblock the stats_wait flag so another can be sent on the next polling cycle.
-	      container->stats_wait = NO;
-	    }
-	    else if(req->reqType == HSP_REQTYPE_INSPECT) {
-	      // retransmit this request so we don't end up with a half-discovered container
-	      inspectContainer(mod, container);
-	    }
-	    else {
-	      myDebug(1, "docker unexpected request type=%d", req->reqType);
+	break;
+      case 3:
+	container->state = (fld.varint == HSP_CRI_CONTAINER_RUNNING) ? HSP_CS_running : HSP_CS_exited;
+	break;
+      case 12:
+	if(criMapEntry(&fld, &key, &val)) {
+	  char **target = NULL;
+	  if(UTPB_strequal(&key, "io.kubernetes.container.name")) target = &ctName;
+	  else if(UTPB_strequal(&key, "io.kubernetes.pod.name")) target = &podName;
+	  else if(UTPB_strequal(&key, "io.kubernetes.pod.namespace")) target = &podNS;
+	  else if(UTPB_strequal(&key, "io.kubernetes.pod.uid")) target = &podUID;
+	  if(target && *target == NULL)
+	    *target = UTPB_strdup(&val);
+	}
+	break;
+      case 16:
+	// ContainerResources {1: LinuxContainerResources {1:cpu_period 2:cpu_quota 4:memory_limit_in_bytes}}
+	while(UTPB_next(fld.data, fld.len, &off2, &sub)) {
+	  if(sub.field == 1 && sub.wt == UTPB_WT_LEN) {
+	    UTPBField lin;
+	    uint32_t off3 = 0;
+	    while(UTPB_next(sub.data, sub.len, &off3, &lin)) {
+	      if(lin.field == 1) cpuPeriod = lin.varint;
+	      else if(lin.field == 2) cpuQuota = lin.varint;
+	      else if(lin.field == 4) memLimit = lin.varint;
 	    }
 	  }
 	}
+	break;
+      }
+    }
+    // name it the way dockershim did, so it reads the same in the collector
+    char name[HSP_DOCKER_MAX_LINELEN];
+    if(ctName && podName && podNS) {
+      snprintf(name, HSP_DOCKER_MAX_LINELEN, "k8s_%s_%s_%s_%s_%u", ctName, podName, podNS, podUID ?: "", attempt);
+      setContainerName(mod, container, name);
+    }
+    else if(metaName)
+      setContainerName(mod, container, metaName);
+    // kubernetes sets the container hostname to the pod name
+    char *hostname = podName ?: metaName;
+    if(hostname)
+      setContainerHostname(mod, container, hostname);
+    if((int64_t)cpuQuota > 0
+       && (int64_t)cpuPeriod > 0)
+      container->cpu_count_dbl = (double)cpuQuota / (double)cpuPeriod;
+    if((int64_t)memLimit > 0)
+      container->memoryLimit = memLimit;
+    if(metaName) my_free(metaName);
+    if(ctName) my_free(ctName);
+    if(podName) my_free(podName);
+    if(podNS) my_free(podNS);
+    if(podUID) my_free(podUID);
+  }
 
-	// if the request was really sent out correctly then it will have a socket as well as a sendTime
-	if(req->sock) {
-	  // close the socket to save file descriptors - may flush something through so make
-	  // sure we do this before freeing the request
-	  EVSocketClose(mod, req->sock, YES);
-	  dockerRequestFree(mod, req);
-	  --mdata->currentRequests;
-	  mdata->lostRequests++;
+  static UTGRPCStream *criCall(EVMod *mod, char *method, u_char *req, int reqLen, UTGRPCMsgCB msgCB, UTGRPCDoneCB doneCB, void *magic) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(mdata->criConn == NULL
+       || reqLen < 0)
+      return NULL;
+    char path[HSP_DOCKER_MAX_LINELEN];
+    snprintf(path, HSP_DOCKER_MAX_LINELEN, HSP_CRI_RPC "%s", method);
+    myDebug(2, "cri: call %s", method);
+    return UTGRPC_call(mdata->criConn, path, req, reqLen, msgCB, doneCB, magic, mdata->pollBus->now.tv_sec);
+  }
+
+  // ContainerStatus (the CRI's inspect)
+
+  static void criStatusMsg(UTGRPCStream *stream, u_char *msg, uint32_t msgLen) {
+    EVMod *mod = (EVMod *)stream->conn->magic;
+    HSPVMState_DOCKER *container = getContainer(mod, (char *)stream->magic, NO, NO);
+    if(container == NULL)
+      return;
+    // ContainerStatusResponse {1:status 2:info}
+    UTPBField fld, key, val;
+    uint32_t off = 0;
+    while(UTPB_next(msg, msgLen, &off, &fld)) {
+      if(fld.field == 1 && fld.wt == UTPB_WT_LEN)
+	criParseStatus(mod, container, fld.data, fld.len);
+      else if(fld.field == 2
+	      && criMapEntry(&fld, &key, &val)
+	      && UTPB_strequal(&key, "info")) {
+	// verbose info is a JSON string, with "pid" from containerd and CRI-O alike
+	char *json = UTPB_strdup(&val);
+	cJSON *jinfo = cJSON_Parse(json);
+	if(jinfo) {
+	  cJSON *jpid = cJSON_GetObjectItem(jinfo, "pid");
+	  if(jpid)
+	    container->pid = (pid_t)jpid->valueint;
+	  cJSON_Delete(jinfo);
 	}
+	my_free(json);
       }
     }
+    myDebug(1, "cri: container %s pid=%u state=%s", container->name, container->pid, containerStateName(container->state));
+    container->inspect_rx = YES;
+    containerInspected(mod, container);
   }
-    
-  static void readDockerCB(EVMod *mod, EVSocket *sock, EnumEVSocketReadStatus status, void *magic) {
+
+  static void criStatusDone(UTGRPCStream *stream, bool ok, int status) {
+    EVMod *mod = (EVMod *)stream->conn->magic;
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    HSPDockerRequest *req = (HSPDockerRequest *)magic;
-    switch(status) {
-    case EVSOCKETREAD_AGAIN:
-      break;
-    case EVSOCKETREAD_STR:
-      myDebug(1, "new string for request seqNo=%d=<%s>", req->seqNo, UTSTRBUF_STR(req->request));
-      if(!mdata->dockerFlush) {
-	processDockerResponse(mod, sock, req);
-	UTStrBuf_reset(sock->ioline);
+    if(stream->nMsgs == 0
+       && stream->conn == mdata->criConn) {
+      // allow the next ListContainers to try again
+      HSPVMState_DOCKER *container = getContainer(mod, (char *)stream->magic, NO, NO);
+      if(container) {
+	myDebug(1, "cri: ContainerStatus failed for %s", container->id);
+	container->inspect_tx = NO;
       }
-      break;
-    case EVSOCKETREAD_EOF:
-      myDebug(1, "EOF for request seqNo=%d=<%s>", req->seqNo, UTSTRBUF_STR(req->request));
-      if(!mdata->dockerFlush) {
-	if(req->response)
-	  processDockerJSON(mod, req, req->response);
-      }
-      // fall through
-    case EVSOCKETREAD_BADF:
-    case EVSOCKETREAD_ERR:
-      // clean up
-      myDebug(1, "request done seqNo=%d=<%s>", req->seqNo, UTSTRBUF_STR(req->request));
-
-      if(req->reqType == HSP_REQTYPE_EVENTS) {
-	// we lost the event feed - need to flush and resync
-	mdata->dockerFlush = YES;
+    }
+    my_free(stream->magic);
+  }
+
+  static void criContainerStatus(EVMod *mod, HSPVMState_DOCKER *container) {
+    u_char req[HSP_CRI_MAX_MSG];
+    int len = UTPB_putBytes(req, HSP_CRI_MAX_MSG, 0, 1, container->id, my_strlen(container->id));
+    len = UTPB_putVarint(req, HSP_CRI_MAX_MSG, len, 2, YES); // verbose, for the pid
+    if(criCall(mod, "ContainerStatus", req, len, criStatusMsg, criStatusDone, my_strdup(container->id)))
+      container->inspect_tx = YES;
+  }
+
+  // ListContainers
+
+  static void criListMsg(UTGRPCStream *stream, u_char *msg, uint32_t msgLen) {
+    EVMod *mod = (EVMod *)stream->conn->magic;
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    myDebug(1, "criListMsg");
+    // ListContainersResponse {1: repeated Container {1:id 6:state}}
+    UTPBField fld, sub;
+    uint32_t off = 0;
+    while(UTPB_next(msg, msgLen, &off, &fld)) {
+      if(fld.field != 1 || fld.wt != UTPB_WT_LEN)
+	continue;
+      char *id = NULL;
+      uint64_t state = 0;
+      uint32_t off2 = 0;
+      while(UTPB_next(fld.data, fld.len, &off2, &sub)) {
+	if(sub.field == 1 && sub.wt == UTPB_WT_LEN && id == NULL) id = UTPB_strdup(&sub);
+	else if(sub.field == 6) state = sub.varint;
       }
-      else {
-	assert(mdata->currentRequests > 0);
-	--mdata->currentRequests;
+      if(id
+	 && state == HSP_CRI_CONTAINER_RUNNING) {
+	// complain if we should have heard about it from an event
+	HSPVMState_DOCKER *container = getContainer(mod, id, YES, (mdata->dockerSync && !mdata->criNoEvents));
+	if(container) {
+	  container->state = HSP_CS_running;
+	  if(!container->inspect_tx)
+	    criContainerStatus(mod, container);
+	}
       }
+      if(id) my_free(id);
+    }
+  }
 
-      // free the request - (it's not in any other collection)
-      dockerRequestFree(mod, req);
-      req = NULL;
-      
-      if(mdata->dockerFlush &&
-	 mdata->currentRequests == 0) {
-	// no outstanding requests - flush is done
-	mdata->dockerFlush = NO;
-	mdata->countdownToResync = HSP_DOCKER_WAIT_EVENTDROP;
-      }
+  static void criEvent(EVMod *mod, u_char *msg, uint32_t msgLen);
 
-      // see if we have another request queued
-    if(!mdata->dockerFlush)
-      serviceRequestQ(mod);
+  static void criListDone(UTGRPCStream *stream, bool ok, int status) {
+    EVMod *mod = (EVMod *)stream->conn->magic;
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(stream->conn != mdata->criConn)
+      return;
+    if(!ok
+       || status != UTGRPC_STATUS_OK
+       || stream->nMsgs == 0) {
+      myLog(LOG_ERR, "cri: ListContainers failed on %s (grpc-status %d)", ((HSP *)EVROOTDATA(mod))->docker.socket, status);
+      if(mdata->countdownToResync == 0)
+	mdata->countdownToResync = HSP_DOCKER_WAIT_NOSOCKET;
+      return;
     }
-  }
-    
-  static void readDockerAPI(EVMod *mod, EVSocket *sock, void *magic) {
-    EVSocketReadLines(mod, sock, readDockerCB, magic);
+    // mark as sync'd and replay queued events
+    mdata->dockerSync = YES;
+    UTStrBuf *qbuf;
+    UTARRAY_WALK(mdata->eventQueue, qbuf) {
+      criEvent(mod, (u_char *)UTSTRBUF_STR(qbuf), UTSTRBUF_LEN(qbuf));
+      UTStrBuf_free(qbuf);
+    }
+    UTArrayReset(mdata->eventQueue);
   }
 
-  static void dockerAPIRequest(EVMod *mod, HSPDockerRequest *req) {
+  static void criContainerCapture(EVMod *mod) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    if(mdata->currentRequests >= HSP_DOCKER_MAX_CONCURRENT) {
-      // just queue it
-      UTQ_ADD_TAIL(mdata->requestQ, req);
-      mdata->queuedRequests++;
+    // ListContainersRequest {1: ContainerFilter {2: ContainerStateValue {1: RUNNING}}}
+    u_char state[8], filter[16], req[32];
+    int len = UTPB_putVarint(state, sizeof(state), 0, 1, HSP_CRI_CONTAINER_RUNNING);
+    len = UTPB_putBytes(filter, sizeof(filter), 0, 2, state, len);
+    len = UTPB_putBytes(req, sizeof(req), 0, 1, filter, len);
+    criCall(mod, "ListContainers", req, len, criListMsg, criListDone, NULL);
+    mdata->countdownToRecheck = mdata->criNoEvents ? HSP_CRI_WAIT_POLL : HSP_DOCKER_WAIT_RECHECK;
+  }
+
+  // GetContainerEvents
+
+  static void criEvent(EVMod *mod, u_char *msg, uint32_t msgLen) {
+    // ContainerEventResponse {1:container_id 2:container_event_type}
+    char *id = NULL;
+    uint64_t evType = HSP_CRI_EVENT_CREATED;
+    UTPBField fld;
+    uint32_t off = 0;
+    while(UTPB_next(msg, msgLen, &off, &fld)) {
+      if(fld.field == 1 && fld.wt == UTPB_WT_LEN && id == NULL) id = UTPB_strdup(&fld);
+      else if(fld.field == 2) evType = fld.varint;
+    }
+    if(id == NULL) {
+      myDebug(1, "cri: ignoring event with no id");
       return;
     }
-    char *cmd = UTSTRBUF_STR(req->request);
-    ssize_t len = UTSTRBUF_LEN(req->request);
-    int fd = UTUnixDomainSocket(HSP_DOCKER_SOCK);
-    myDebug(1, "dockerAPIRequest(%s) seqNo=%d, fd==%d", cmd, req->seqNo, fd);
-    if(fd < 0)  {
-      // looks like docker was stopped
-      // wait longer before retrying
-      mdata->dockerFlush = YES;
-      mdata->countdownToResync = HSP_DOCKER_WAIT_NOSOCKET;
+    EnumHSPContainerEvent ev = HSP_EV_UNKNOWN;
+    EnumHSPContainerState st = HSP_CS_UNKNOWN;
+    switch(evType) {
+    case HSP_CRI_EVENT_STARTED:
+      ev = HSP_EV_start;
+      st = HSP_CS_running;
+      break;
+    case HSP_CRI_EVENT_STOPPED:
+      ev = HSP_EV_die;
+      st = HSP_CS_exited;
+      break;
+    case HSP_CRI_EVENT_DELETED:
+      ev = HSP_EV_destroy;
+      st = HSP_CS_deleted;
+      break;
+    default:
+      // CREATED: wait for STARTED
+      break;
     }
-    else {
-      req->sock = EVBusAddSocket(mod, mdata->pollBus, fd, readDockerAPI, req);
-
-      int cc;
-      // simulate random loss
-      //if(sfl_random(100) > 80) cc = len; else
-      while((cc = write(fd, cmd, len)) != len && errno == EINTR);
-      if(cc == len) {
-	if(req->reqType != HSP_REQTYPE_EVENTS) {
-	  req->sendTime = EVCurrentBus()->now.tv_sec;
-	  mdata->currentRequests++;
-	}
+    myDebug(1, "cri: event %u for %s", (uint32_t)evType, id);
+    HSPVMState_DOCKER *container = NULL;
+    if(ev != HSP_EV_UNKNOWN)
+      container = getContainer(mod, id, (st == HSP_CS_running), NO);
+    if(container) {
+      if(st != container->state) {
+	myDebug(1, "container state %s -> %s",
+		containerStateName(container->state),
+		containerStateName(st));
+	container->state = st;
+      }
+      container->lastEvent = ev;
+      if(container->state == HSP_CS_running) {
+	if(!container->inspect_tx)
+	  criContainerStatus(mod, container);
       }
       else {
-	myLog(LOG_ERR, "dockerAPIRequest - write(%s) returned %d != %u: %s",
-	      cmd, cc, len, strerror(errno));
+	// final counter sample (if the cgroup is still there),
+	// then the container is removed
+	getContainerStats(mod, container);
       }
     }
+    my_free(id);
   }
-  
-  static HSPDockerRequest *dockerRequest(EVMod *mod, UTStrBuf *cmd, HSPDockerCB jsonCB, EnumHSPDockerReqType reqType) {
+
+  static void criEventMsg(UTGRPCStream *stream, u_char *msg, uint32_t msgLen) {
+    EVMod *mod = (EVMod *)stream->conn->magic;
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    HSPDockerRequest *req = (HSPDockerRequest *)my_calloc(sizeof(HSPDockerRequest));
-    req->seqNo = ++mdata->generatedRequests;
-    req->request = UTStrBuf_copy(cmd);
-    req->jsonCB = jsonCB;
-    req->reqType = reqType;
-    UTHashAdd(mdata->reqsBySeqNo, req);
-    return req;
+    if(mdata->dockerSync == NO) {
+      // just take a copy and queue it for now
+      UTStrBuf *qbuf = UTStrBuf_new();
+      UTStrBuf_append_n(qbuf, (char *)msg, msgLen);
+      UTArrayAdd(mdata->eventQueue, qbuf);
+      return;
+    }
+    criEvent(mod, msg, msgLen);
   }
 
-  static void  dockerRequestFree(EVMod *mod, HSPDockerRequest *req) {
+  static void criEventsDone(UTGRPCStream *stream, bool ok, int status) {
+    EVMod *mod = (EVMod *)stream->conn->magic;
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
-    UTHashDel(mdata->reqsBySeqNo, req);
-    UTStrBuf_free(req->request);
-    if(req->response) UTStrBuf_free(req->response);
-    if(req->id) my_free(req->id);
-    my_free(req);
+    if(stream->conn != mdata->criConn)
+      return;
+    if(status == UTGRPC_STATUS_UNIMPLEMENTED) {
+      // e.g. containerd before 1.7, so poll instead
+      myLog(LOG_INFO, "cri: GetContainerEvents not available, polling ListContainers every %u seconds", HSP_CRI_WAIT_POLL);
+      mdata->criNoEvents = YES;
+      mdata->countdownToRecheck = HSP_CRI_WAIT_POLL;
+      return;
+    }
+    myDebug(1, "cri: event stream ended (grpc-status %d)", status);
+    if(mdata->countdownToResync == 0)
+      mdata->countdownToResync = HSP_DOCKER_WAIT_EVENTDROP;
+  }
+
+  // connection
+
+  static void readCRI(EVMod *mod, EVSocket *sock, void *magic) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(mdata->criConn
+       && !UTGRPC_read(mdata->criConn)) {
+      myDebug(1, "cri: connection closed");
+      criClose(mod);
+      if(mdata->countdownToResync == 0)
+	mdata->countdownToResync = HSP_DOCKER_WAIT_EVENTDROP;
+    }
+  }
+
+  static void criClose(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    UTGRPCConn *conn = mdata->criConn;
+    // detach first, so the doneCBs can tell this was on purpose
+    mdata->criConn = NULL;
+    if(mdata->criSock) {
+      EVSocketClose(mod, mdata->criSock, YES);
+      mdata->criSock = NULL;
+    }
+    if(conn)
+      UTGRPC_free(conn);
+  }
+
+  static void criSynchronize(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    mdata->criConn = UTGRPC_connect(sp->docker.socket, mod);
+    if(mdata->criConn == NULL) {
+      myDebug(1, "cri: cannot connect to %s", sp->docker.socket);
+      mdata->countdownToResync = HSP_DOCKER_WAIT_NOSOCKET;
+      return;
+    }
+    mdata->criSock = EVBusAddSocket(mod, mdata->pollBus, mdata->criConn->fd, readCRI, NULL);
+    // subscribe before we list, same as for docker. Events are queued
+    // until the list is in. No point asking again if it was not there
+    // last time.
+    if(!mdata->criNoEvents)
+      criCall(mod, "GetContainerEvents", NULL, 0, criEventMsg, criEventsDone, NULL);
+    criContainerCapture(mod);
+  }
+
+  static void serviceCRITimeouts(EVMod *mod) {
+    HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    if(mdata->criConn == NULL)
+      return;
+    time_t now = mdata->pollBus->now.tv_sec;
+    UTGRPCStream *stream;
+    UTQ_WALK(mdata->criConn->streams, stream) {
+      if(stream->msgCB != criEventMsg
+	 && (now - stream->startTime) > HSP_CRI_CALL_TIMEOUT) {
+	myLog(LOG_ERR, "cri: call timed out on %s, reconnecting", ((HSP *)EVROOTDATA(mod))->docker.socket);
+	criClose(mod);
+	if(mdata->countdownToResync == 0)
+	  mdata->countdownToResync = HSP_DOCKER_WAIT_EVENTDROP;
+	return;
+      }
+    }
   }
 
   static void dockerClearAll(EVMod *mod) {
@@ -2225,16 +3410,19 @@ extern "C" {
     UTQ_CLEAR(mdata->waitQ);
     mdata->waitingRequests = 0;
 #endif
-    // 6. reqsBySeqNo
-    // could now have dangling pointers to freed requests,
-    // so only safe thing to do is wipe it and risk leaking some memory. Although
-    // that would only happen if there were any requests outstanding that the engine
-    // had ignored ("lost" requests).
-    UTHashReset(mdata->reqsBySeqNo);
+    // 6. connections, and any requests still in flight on them
+    dockerConnCloseAll(mod);
+    // 7. or the CRI runtime connection
+    criClose(mod);
   }
 
   static void dockerContainerCapture(EVMod *mod) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    if(sp->docker.cri) {
+      criContainerCapture(mod);
+      return;
+    }
     UTStrBuf *req = UTStrBuf_wrap(HSP_DOCKER_REQ_CONTAINERS);
     dockerAPIRequest(mod, dockerRequest(mod, req, dockerAPI_containers, HSP_REQTYPE_CONTAINERS));
     UTStrBuf_free(req);
@@ -2243,10 +3431,15 @@ extern "C" {
   
   static void dockerSynchronize(EVMod *mod) {
     HSP_mod_DOCKER *mdata = (HSP_mod_DOCKER *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
     dockerClearAll(mod);
     mdata->dockerSync = NO;
     mdata->dockerFlush = NO;
     mdata->cgroupPathIdx = -1;    
+    if(sp->docker.cri) {
+      criSynchronize(mod);
+      return;
+    }
     // start the event monitor before we capture the current state.  Events will be queued until we have
     // read all the current containers, then replayed.  At that point we will be "in sync".
     UTStrBuf *req = UTStrBuf_wrap(HSP_DOCKER_REQ_EVENTS);
@@ -2279,9 +3472,9 @@ extern "C" {
       break;
     case HSP_VNIC_LAYER_IPIP:
       if(ip_ver == 4
-	 && ps->ipproto == 4 // IP-over-IP
-	 && ps->l4_offset)
-	ip_offset = ps->l4_offset;
+	 && ps->ipproto == IPPROTO_IPIP
+	 && decodePendingSampleInner(ps) == 4)
+	ip_offset = ps->inner_l3_offset;
       break;
     default:
       break;
@@ -2342,12 +3535,11 @@ extern "C" {
     HSP *sp = (HSP *)EVROOTDATA(mod);
 
     // ask to retain root privileges
-    retainRootRequest(mod, "needed to access docker.sock");
+    retainRootRequest(mod, "needed to access docker.sock (or the CRI runtime socket)");
     retainRootRequest(mod, "needed by mod_docker to probe for adaptors in other namespaces");
 
     requestVNodeRole(mod, HSP_VNODE_PRIORITY_DOCKER);
 
-    buildRegexPatterns(mod);
     mdata->vmsByUUID = UTHASH_NEW(HSPVMState_DOCKER, vm.uuid, UTHASH_DFLT);
     mdata->vmsByID = UTHASH_NEW(HSPVMState_DOCKER, id, UTHASH_SKEY);
     mdata->nameCount = UTHASH_NEW(HSPDockerNameCount, name, UTHASH_SKEY);
@@ -2355,7 +3547,18 @@ extern "C" {
     mdata->pollActions = UTHASH_NEW(HSPVMState_DOCKER, id, UTHASH_IDTY);
     mdata->eventQueue = UTArrayNew(UTARRAY_DFLT);
     mdata->cgroupPathIdx = -1;
-    mdata->reqsBySeqNo = UTHASH_NEW(HSPDockerRequest, seqNo, UTHASH_DFLT);
+    if(sp->docker.cri) {
+      // the CRI has no equivalent of the stats endpoint
+      sp->docker.cgroupStats = YES;
+      if(sp->docker.socket == NULL)
+	sp->docker.socket = HSP_CRI_SOCK;
+    }
+    if(sp->docker.socket == NULL)
+      sp->docker.socket = HSP_DOCKER_SOCK;
+    if(sp->docker.connections == 0)
+      sp->docker.connections = HSP_DOCKER_MAX_CONCURRENT;
+    if(sp->docker.pipeline == 0)
+      sp->docker.pipeline = HSP_DOCKER_PIPELINE;
     
     // register call-backs
     mdata->pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
@@ -2369,13 +3572,25 @@ extern "C" {
       EVEventRx(mod, EVGetEvent(packetBus, HSPEVENT_FLOW_SAMPLE), evt_flow_sample);
       mdata->vnicByIP = UTHASH_NEW(HSPVNIC, ipAddr, UTHASH_SYNC); // need sync (poll + packet thread)
       mdata->vnicLayer = HSP_VNIC_LAYER_IPIP; // TODO: make config parameter
-
-      // learn my own namespace inode from /proc/self/ns/net
-      if(stat("/proc/self/ns/net", &mdata->myNS) == 0)
-	myDebug(1, "my namespace dev.inode == %u.%u",
-		mdata->myNS.st_dev,
-		mdata->myNS.st_ino);
     }
+
+    // learn my own namespace inode from /proc/self/ns/net, and keep
+    // it open so the netns thread can always find its way back
+    mdata->myNSfd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+    if(mdata->myNSfd >= 0
+       && fstat(mdata->myNSfd, &mdata->myNS) == 0)
+      myDebug(1, "my namespace dev.inode == %u.%u",
+	      mdata->myNS.st_dev,
+	      mdata->myNS.st_ino);
+    else
+      myLog(LOG_ERR, "docker: cannot open /proc/self/ns/net : %s", strerror(errno));
+
+    // VNIC enumeration runs on its own thread
+    mdata->netnsBus = EVGetBus(mod, HSPBUS_NETNS, YES);
+    mdata->netnsReqEvent = EVGetEvent(mdata->netnsBus, HSPEVENT_NETNS_REQ);
+    EVEventRx(mod, mdata->netnsReqEvent, evt_netns_req);
+    mdata->netnsVNICsEvent = EVGetEvent(mdata->pollBus, HSPEVENT_NETNS_VNICS);
+    EVEventRx(mod, mdata->netnsVNICsEvent, evt_netns_vnics);
   }
 
 #if defined(__cplusplus)
@@ -751,7 +751,7 @@ That would allow everything to stay on the stack as it does here, which has nice
 
     SEMLOCK_DO(sp->sync_agent) {
       sfl_notifier_writeEventSample(notifier, &discard);
-      sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+      telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
     }
 
     // first successful event confirms we are up and running
@@ -9,36 +9,12 @@ extern "C" {
 #include "hsflowd.h"
 
 #include "cJSON.h"
+#include "hsflowd_ring.h"
 #define HSP_MAX_JSON_MSG_BYTES 10000
 #define HSP_READJSON_BATCH 100
+#define HSP_JSON_MMSG_BATCH 16
 #define HSP_JSON_RCV_BUF 2000000
-
-  typedef enum {
-    RTMetricType_string = 0,
-    RTMetricType_counter32,
-    RTMetricType_counter64,
-    RTMetricType_gauge32,
-    RTMetricType_gauge64,
-    RTMetricType_gaugeFloat,
-    RTMetricType_gaugeDouble
-  } EnumRTMetricType;
-
-  typedef enum {
-    RTFlowType_string = 0,
-    RTFlowType_mac,
-    RTFlowType_ip,
-    RTFlowType_ip6,
-    RTFlowType_int32,
-    RTFlowType_int64,
-    RTFlowType_float,
-    RTFlowType_double
-  } EnumRTFlowType;
-
-#define HSP_MAX_RTMETRIC_KEY_LEN 64
-#define HSP_MAX_RTMETRIC_VAL_LEN 255
-
-#define TAG_RTMETRIC ((4300 << 12) + 1002)
-#define TAG_RTFLOW ((4300 << 12) + 1003)
+#define HSP_RTAGG_MAX_METRICS 10000
 
   typedef struct _HSPApplication {
     char *application;
@@ -60,12 +36,72 @@ extern "C" {
     SFLCounters_sample_element counters;
   } HSPApplication;
 
+  // One per UDP socket, passed as the EVSocket magic. Holds the
+  // recvmmsg() buffers and the last SO_RXQ_OVFL drop count seen.
+  typedef struct _HSPJSONSocket {
+    char *bindaddr;
+    int fd;
+    uint32_t rxq_ovfl;
+    uint64_t drops;
+    bool useRead:1;
+    struct mmsghdr msgs[HSP_JSON_MMSG_BATCH];
+    struct iovec iov[HSP_JSON_MMSG_BATCH];
+    char ctrl[HSP_JSON_MMSG_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+    char buf[HSP_JSON_MMSG_BATCH][HSP_MAX_JSON_MSG_BYTES + 1];
+  } HSPJSONSocket;
+
+  typedef union _HSPRTAggValue {
+    uint64_t u64;
+    double dbl;
+  } HSPRTAggValue;
+
+  typedef struct _HSPRTAggMetric {
+    char *name;
+    int mtype;
+    uint32_t updates;
+    HSPRTAggValue last;
+    HSPRTAggValue min;
+    HSPRTAggValue max;
+    char *str;
+  } HSPRTAggMetric;
+
+  typedef struct _HSPRTAggDS {
+    char *dsname;
+    struct _HSPRTAggDS *prev; // for UTQ
+    struct _HSPRTAggDS *next; // for UTQ
+    UTHash *metrics;
+    uint32_t nMetrics;
+    uint32_t updates;
+  } HSPRTAggDS;
+
+  // One per producer connected to json { ring=<path> }.
+  typedef struct _HSPJSONRing {
+    EVSocket *sock;
+    int memfd;
+    HSPRingHdr *hdr;
+    u_char *data;
+    size_t mapLen;
+    uint32_t size;
+    uint64_t tail;
+    uint64_t drops;
+    uint64_t records;
+  } HSPJSONRing;
+
   typedef struct _HSP_mod_JSON {
     EVBus *pollBus;
     EVBus *packetBus;
-    int json_soc;
-    int json_soc6;
+    UTArray *sockets; // HSPJSONSocket
     int json_fifo;
+    UTArray *rings; // HSPJSONRing
+    // rtmetric aggregation, only when json { aggregate=<secs> }
+    UTHash *aggDS;
+    UTQ(HSPRTAggDS) aggLRU;
+    uint32_t aggMetrics;
+    time_t aggNext;
+    pthread_mutex_t *sync_agg;
+    // only set when json { workers=N } has more than one bus
+    // reading JSON messages into the applicationHT
+    pthread_mutex_t *sync_apps;
     UTHash *applicationHT;
     UTQ(HSPApplication) timeoutQ;
     UTArray *pollActions;
@@ -134,7 +170,7 @@ extern "C" {
 	  SFLADD_ELEMENT(cs, &application->counters);
 	  sfl_poller_writeCountersSample(poller, cs);
 	  sp->counterSampleQueued = YES;
-	  sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+	  telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
 	  // and any rtcount metrics that we have been collecting
 	}
       }
@@ -341,8 +377,9 @@ extern "C" {
     -----------------___________________________------------------
   */
 
-  static void sendAppSample(HSP *sp, HSPApplication *app, uint32_t sampling_n, int as_client, char *operation, char *attributes, char *status_descr, EnumSFLAPPStatus status, uint64_t req_bytes, uint64_t resp_bytes, uint32_t duration_uS, char *parent_app, char *parent_operation, char *parent_attributes, char *actor_init, char *actor_tgt, SFLExtended_socket_ipv4 *soc4,  SFLExtended_socket_ipv6 *soc6)
+  static void sendAppSample(EVMod *mod, HSPApplication *app, uint32_t sampling_n, int as_client, char *operation, char *attributes, char *status_descr, EnumSFLAPPStatus status, uint64_t req_bytes, uint64_t resp_bytes, uint32_t duration_uS, char *parent_app, char *parent_operation, char *parent_attributes, char *actor_init, char *actor_tgt, SFLExtended_socket_ipv4 *soc4,  SFLExtended_socket_ipv6 *soc6)
   {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
 
     // encode an sFlow transaction sample
     SFL_FLOW_SAMPLE_TYPE fs = { 0 };
@@ -423,7 +460,7 @@ extern "C" {
     sfl_agent_set_now(sp->agent, bus->now.tv_sec, bus->now.tv_nsec);
     SEMLOCK_DO(sp->sync_agent) {
       sfl_sampler_writeFlowSample(app->sampler, &fs);
-      sp->telemetry[HSP_TELEMETRY_FLOW_SAMPLES]++;
+      telemetryAdd(sp, mod, HSP_TELEMETRY_FLOW_SAMPLES, 1);
     }
   }
 
@@ -435,7 +472,6 @@ extern "C" {
 static void readJSON_flowSample(EVMod *mod, cJSON *fs)
   {
     HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
-    HSP *sp = (HSP *)EVROOTDATA(mod);
 
     if(getDebug() > 1) logJSON(fs, "got flow sample");
     cJSON *app = cJSON_GetObjectItem(fs, "app_name");
@@ -561,7 +597,7 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 	    }
 
 	    // submit the flow sample
-	    sendAppSample(sp,
+	    sendAppSample(mod,
 			  application,
 			  effective_sampling_n,
 			  as_client ? (as_client->type == cJSON_True) : NO,
@@ -679,7 +715,7 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 	SEMLOCK_DO(sp->sync_agent) {
 	  sfl_poller_writeCountersSample(application->poller, &csample);
 	  sp->counterSampleQueued = YES;
-	  sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+	  telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
 	}
       }
     }
@@ -755,18 +791,26 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     return -1;
   }
 
-  static void xdr_enc_metric(XDRBuf *buf, char *mname, uint32_t mname_len, int mtype, cJSON *field, uint32_t field_len)
+  // A field value, as found by either the cJSON or the streaming
+  // parser. If str is NULL the value was a JSON number.
+  typedef struct _HSPRTValue {
+    char *str;
+    uint32_t len;
+    double dbl;
+  } HSPRTValue;
+
+  static void xdr_enc_metric(XDRBuf *buf, char *mname, uint32_t mname_len, int mtype, HSPRTValue *field)
   {
     xdr_enc_str(buf, mname, mname_len);
     xdr_enc_int32(buf, mtype);
 
-    if(field->type == cJSON_String) {
+    if(field->str) {
       // string input
       uint32_t val32;
       uint64_t val64;
       float valf;
       double vald;
-      char *instr = field->valuestring;
+      char *instr = field->str;
       // string input
       switch(mtype) {
       case RTMetricType_counter32:
@@ -788,14 +832,14 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 	xdr_enc_dbl(buf, vald);
       break;
       case RTMetricType_string:
-	xdr_enc_str(buf, instr, field_len);
+	xdr_enc_str(buf, instr, field->len);
       break;
       }
     }
-    else if(field->type == cJSON_Number) {
+    else {
       // numeric input - only certain types expressible
       // because JSON only offers number as type==double
-      double indbl = field->valuedouble;
+      double indbl = field->dbl;
       switch(mtype) {
       case RTMetricType_counter32:
       case RTMetricType_gauge32:
@@ -852,124 +896,6 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     return rtmetric_len_ok(str);
   }
 
-  /*_________________---------------------------__________________
-    _________________  readJSON_rtmetric        __________________
-    -----------------___________________________------------------
-
-    {
-       "rtmetric": {
-         "datasource": "web1",
-         "metric1": { "type": "counter32",   "value": 777          },
-         "metric2": { "type": "string",      "value": "helloworld" },
-         "metric3": { "type": "gaugedouble", "value": 1.234        },
-       }
-    }
-  */
-
-  static void readJSON_rtmetric(EVMod *mod, cJSON *rtmetric)
-  {
-    // HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
-    HSP *sp = (HSP *)EVROOTDATA(mod);
-
-    if(getDebug() > 1) logJSON(rtmetric, "got rtmetric");
-
-    SFLReceiver *receiver = sp->agent->receivers;
-    if(receiver == NULL)
-      return;
-
-    XDRBuf buf;
-    xdr_init(&buf);
-    uint32_t num_fields = 0;
-    char *dsname = NULL;
-    uint32_t dsname_len = 0;
-
-    // iterate to pull out datasource name first
-    for(cJSON *rtm = rtmetric->child; rtm; rtm = rtm->next) {
-      if(!rtm->string) {
-	if(getDebug()) logJSON(rtm, "expected named field");
-	continue;
-      }
-      // pick up optional datasource
-      if(rtm->type == cJSON_String &&
-	 my_strequal(rtm->string, "datasource")) {
-	dsname = rtm->valuestring;
-	dsname_len = dsname_len_ok(dsname);
-	if(dsname_len == 0) {
-	  myDebug(1, "invalid datasource name: %s", dsname);
-	  return; // bail completely on bad dsname
-	}
-	continue;
-      }
-    }
-
-    xdr_enc_int32(&buf, TAG_RTMETRIC);
-    uint32_t *mstart = xdr_ptr(&buf);
-    xdr_enc_int32(&buf, 0); // will be rtmetric len
-    xdr_enc_str(&buf, dsname, dsname_len);
-    uint32_t *fstart = xdr_ptr(&buf);
-    xdr_enc_int32(&buf, 0); // will be num fields
-
-    for(cJSON *rtm = rtmetric->child; rtm; rtm = rtm->next) {
-      // only want named objects now
-      if(rtm->string == NULL ||
-	 rtm->type != cJSON_Object) {
-	continue;
-      }
-
-      uint32_t mname_len = rtmetric_len_ok(rtm->string);
-      if(mname_len == 0) {
-	myDebug(1, "invalid rtmetric key: <%s>", rtm->string);
-	return; // bail on bad key
-      }
-
-      cJSON *field = cJSON_GetObjectItem(rtm, "value");
-      uint32_t field_len = sizeof(double);
-
-      if(field == NULL) {
-	myDebug(1, "rtmetric missing \"value\"");
-	return; // bail on missing value
-      }
-      if(field->type == cJSON_String) {
-	field_len = my_strlen(field->valuestring);
-	if(field_len > HSP_MAX_RTMETRIC_VAL_LEN) {
-	  myDebug(1, "rtmetric field %s len(%u) > max(%u)",
-		rtm->string,
-		field_len,
-		  HSP_MAX_RTMETRIC_VAL_LEN);
-	  return; // bail on field len error
-	}
-      }
-
-      cJSON *field_type = cJSON_GetObjectItem(rtm, "type");
-      if(field_type == NULL) {
-	myDebug(1, "rtflow missing \"type\"");
-	return; // bail on missing type
-      }
-
-      int rtmType = rtmetric_type(field_type->valuestring);
-      if(rtmType == -1) {
-	myDebug(1, "rtmetric bad type");
-	return; // bail on bad/missing type
-      }
-
-      num_fields++;
-      xdr_enc_metric(&buf, rtm->string, mname_len, rtmType, field, field_len);
-    }
-
-    if(num_fields) {
-      uint32_t len = (char *)xdr_ptr(&buf) - (char *)mstart - 4;
-      mstart[0] = htonl(len);
-      fstart[0] = htonl(num_fields);
-      SEMLOCK_DO(sp->sync_agent) {
-	sfl_receiver_writeEncoded(receiver,
-				  1,
-				  buf.xdr,
-				  (buf.cursor << 2));
-	sp->telemetry[HSP_TELEMETRY_RTMETRIC_SAMPLES]++;
-      }
-    }
-  }
-
   /*_________________---------------------------__________________
     _________________      rtflow types         __________________
     -----------------___________________________------------------
@@ -987,12 +913,12 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     return -1;
   }
 
-  static void xdr_enc_flow_field(XDRBuf *buf, char *mname, uint32_t mname_len, int mtype, cJSON *field, uint32_t field_len)
+  static void xdr_enc_flow_field(XDRBuf *buf, char *mname, uint32_t mname_len, int mtype, HSPRTValue *field)
   {
     xdr_enc_str(buf, mname, mname_len);
     xdr_enc_int32(buf, mtype);
 
-    if(field->type == cJSON_String) {
+    if(field->str) {
       // string input
       uint32_t val32;
       uint64_t val64;
@@ -1000,18 +926,18 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
       double vald;
       u_char mac[6];
       SFLAddress addr;
-      char *instr = field->valuestring;
+      char *instr = field->str;
       // string input
       switch(mtype) {
       case RTFlowType_string:
-	xdr_enc_str(buf, instr, field_len);
+	xdr_enc_str(buf, instr, field->len);
       break;
       case RTFlowType_mac:
 	if(hexToBinary((u_char *)instr, mac, 6) == 6) {
 	  xdr_enc_bytes(buf, mac, 6);
 	}
 	else {
-	  if(getDebug()) logJSON(field, "failed to parse MAC address");
+	  myDebug(1, "rtflow: failed to parse MAC address <%s>", instr);
 	}
 	break;
       case RTFlowType_ip:
@@ -1019,7 +945,7 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 	  xdr_enc_bytes(buf, (u_char *)&addr.address.ip_v4.addr, 4);
 	}
 	else {
-	  if(getDebug()) logJSON(field, "failed to parse IP address");
+	  myDebug(1, "rtflow: failed to parse IP address <%s>", instr);
 	}
 	break;
       case RTFlowType_ip6:
@@ -1027,7 +953,7 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 	  xdr_enc_bytes(buf, (u_char *)&addr.address.ip_v6.addr, 16);
 	}
 	else {
-	  if(getDebug()) logJSON(field, "failed to parse IP address");
+	  myDebug(1, "rtflow: failed to parse IP address <%s>", instr);
 	}
 	break;
       case RTFlowType_int32:
@@ -1048,9 +974,9 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
       break;
       }
     }
-    else if(field->type == cJSON_Number) {
+    else {
       // numeric input - only certain types expressible
-      double indbl = field->valuedouble;
+      double indbl = field->dbl;
       switch(mtype) {
       case RTFlowType_int32:
 	xdr_enc_int32(buf, (uint32_t)indbl);
@@ -1068,6 +994,485 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     }
   }
 
+  /*_________________---------------------------__________________
+    _________________  rtmetric/rtflow encode   __________________
+    -----------------___________________________------------------
+    Shared by the cJSON and streaming parsers so that they validate
+    and encode in exactly the same way.
+  */
+
+  typedef struct _HSPRTEncoder {
+    bool isFlow;
+    bool aggregated; // already merged, so send as is
+    XDRBuf buf;
+    uint32_t *mstart;
+    uint32_t *fstart;
+    uint32_t num_fields;
+  } HSPRTEncoder;
+
+  static bool rt_enc_start(HSPRTEncoder *enc, char *dsname, uint32_t sampling_rate) {
+    uint32_t dsname_len = 0;
+    if(dsname) {
+      dsname_len = dsname_len_ok(dsname);
+      if(dsname_len == 0) {
+	myDebug(1, "invalid datasource name: %s", dsname);
+	return NO; // bail completely on bad dsname
+      }
+    }
+    XDRBuf *buf = &enc->buf;
+    xdr_init(buf);
+    enc->num_fields = 0;
+    xdr_enc_int32(buf, enc->isFlow ? TAG_RTFLOW : TAG_RTMETRIC);
+    enc->mstart = xdr_ptr(buf);
+    xdr_enc_int32(buf, 0); // will be rtmetric/rtflow len
+    xdr_enc_str(buf, dsname, dsname_len);
+    if(enc->isFlow) {
+      xdr_enc_int32(buf, sampling_rate); // sampling_rate
+      xdr_enc_int32(buf, 0); // reserved (e.g. for sample_pool)
+    }
+    enc->fstart = xdr_ptr(buf);
+    xdr_enc_int32(buf, 0); // will be num fields
+    return YES;
+  }
+
+  static bool rt_enc_field(HSPRTEncoder *enc, char *fname, char *ftype, HSPRTValue *field) {
+    const char *what = enc->isFlow ? "rtflow" : "rtmetric";
+    uint32_t fname_len = rtmetric_len_ok(fname);
+    if(fname_len == 0) {
+      myDebug(1, "invalid %s key: <%s>", what, fname);
+      return NO; // bail on bad key
+    }
+    if(field->str
+       && field->len > HSP_MAX_RTMETRIC_VAL_LEN) {
+      myDebug(1, "%s field %s len(%u) > max(%u)",
+	      what,
+	      fname,
+	      field->len,
+	      HSP_MAX_RTMETRIC_VAL_LEN);
+      return NO; // bail on field len error
+    }
+    if(ftype == NULL) {
+      myDebug(1, "%s missing \"type\"", what);
+      return NO; // bail on missing type
+    }
+    int fType = enc->isFlow ? rtflow_type(ftype) : rtmetric_type(ftype);
+    if(fType == -1) {
+      myDebug(1, "%s field bad type <%s>", what, ftype);
+      return NO; // bail on bad/missing type
+    }
+    enc->num_fields++;
+    if(enc->isFlow)
+      xdr_enc_flow_field(&enc->buf, fname, fname_len, fType, field);
+    else
+      xdr_enc_metric(&enc->buf, fname, fname_len, fType, field);
+    return YES;
+  }
+
+  /*_________________---------------------------__________________
+    _________________  rtmetric aggregation     __________________
+    -----------------___________________________------------------
+    With json { aggregate=<secs> } rtmetric samples are not sent as
+    they arrive.  Each encoded sample (from JSON or from a ring) is
+    decoded and merged per datasource+metric, and one combined sample
+    per datasource goes out at the end of each window. Counters and
+    strings keep the last value (rtmetric counters are cumulative, so
+    nothing is lost). Gauges keep the last value and add <name>_min
+    and <name>_max metrics. The number of metrics held is bounded by
+    aggregateMax: when it is reached the least-recently-updated
+    datasource is sent early to make room.
+  */
+
+  static void rtAggSendDS(EVMod *mod, HSPRTAggDS *ds);
+  static void rt_enc_send(EVMod *mod, HSPRTEncoder *enc);
+
+  static void rtAggFreeDS(EVMod *mod, HSPRTAggDS *ds) {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSPRTAggMetric *met;
+    UTHASH_WALK(ds->metrics, met) {
+      my_free(met->name);
+      if(met->str)
+	my_free(met->str);
+      my_free(met);
+    }
+    UTHashFree(ds->metrics);
+    mdata->aggMetrics -= ds->nMetrics;
+    UTHashDel(mdata->aggDS, ds);
+    UTQ_REMOVE(mdata->aggLRU, ds);
+    my_free(ds->dsname);
+    my_free(ds);
+  }
+
+  static void rtAggEvict(EVMod *mod) {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSPRTAggDS *lru = UTQ_HEAD(mdata->aggLRU);
+    if(lru) {
+      myDebug(1, "rtmetric aggregation full: sending datasource <%s> early", lru->dsname);
+      rtAggSendDS(mod, lru);
+      rtAggFreeDS(mod, lru);
+    }
+  }
+
+  static HSPRTAggDS *rtAggGetDS(EVMod *mod, char *dsname) {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSPRTAggDS search = { .dsname = dsname };
+    HSPRTAggDS *ds = UTHashGet(mdata->aggDS, &search);
+    if(ds) {
+      // most recently used goes to the tail
+      UTQ_REMOVE(mdata->aggLRU, ds);
+    }
+    else {
+      ds = (HSPRTAggDS *)my_calloc(sizeof(HSPRTAggDS));
+      ds->dsname = my_strdup(dsname);
+      ds->metrics = UTHASH_NEW(HSPRTAggMetric, name, UTHASH_SKEY);
+      UTHashAdd(mdata->aggDS, ds);
+    }
+    UTQ_ADD_TAIL(mdata->aggLRU, ds);
+    return ds;
+  }
+
+  // bounds-checked XDR reader over one encoded sample
+  typedef struct _HSPXDRIn {
+    uint32_t *xdr;
+    uint32_t quads;
+    uint32_t cursor;
+    bool err;
+  } HSPXDRIn;
+
+  static uint32_t xdr_dec_int32(HSPXDRIn *in) {
+    if(in->cursor >= in->quads) {
+      in->err = YES;
+      return 0;
+    }
+    return ntohl(in->xdr[in->cursor++]);
+  }
+
+  static uint64_t xdr_dec_int64(HSPXDRIn *in) {
+    uint64_t hi = xdr_dec_int32(in);
+    return (hi << 32) + xdr_dec_int32(in);
+  }
+
+  // copies into str, which must have room for maxLen+1
+  static uint32_t xdr_dec_str(HSPXDRIn *in, char *str, uint32_t maxLen) {
+    uint32_t len = xdr_dec_int32(in);
+    uint32_t quads = (len + 3) >> 2;
+    if(in->err
+       || len > maxLen
+       || (in->cursor + quads) > in->quads) {
+      in->err = YES;
+      return 0;
+    }
+    memcpy(str, in->xdr + in->cursor, len);
+    str[len] = '\0';
+    in->cursor += quads;
+    return len;
+  }
+
+  static bool rtAggIsGauge(int mtype) {
+    return (mtype == RTMetricType_gauge32
+	    || mtype == RTMetricType_gauge64
+	    || mtype == RTMetricType_gaugeFloat
+	    || mtype == RTMetricType_gaugeDouble);
+  }
+
+  static bool rtAggIsInt(int mtype) {
+    return (mtype == RTMetricType_counter32
+	    || mtype == RTMetricType_counter64
+	    || mtype == RTMetricType_gauge32
+	    || mtype == RTMetricType_gauge64);
+  }
+
+  static void rtAggMerge(EVMod *mod, HSPRTAggDS *ds, HSPRTAggMetric *met, char *mname, int mtype, HSPRTAggValue *val, char *str) {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    if(met
+       && met->mtype != mtype) {
+      // type changed - start again
+      met->updates = 0;
+      met->mtype = mtype;
+    }
+    if(met == NULL) {
+      met = (HSPRTAggMetric *)my_calloc(sizeof(HSPRTAggMetric));
+      met->name = my_strdup(mname);
+      met->mtype = mtype;
+      UTHashAdd(ds->metrics, met);
+      ds->nMetrics++;
+      mdata->aggMetrics++;
+    }
+    if(mtype == RTMetricType_string) {
+      setStr(&met->str, str);
+    }
+    else if(met->updates == 0) {
+      met->last = met->min = met->max = *val;
+    }
+    else if(rtAggIsInt(mtype)) {
+      met->last = *val;
+      if(val->u64 < met->min.u64) met->min = *val;
+      if(val->u64 > met->max.u64) met->max = *val;
+    }
+    else {
+      met->last = *val;
+      if(val->dbl < met->min.dbl) met->min = *val;
+      if(val->dbl > met->max.dbl) met->max = *val;
+    }
+    met->updates++;
+    ds->updates++;
+  }
+
+  // returns NO if the sample could not be decoded
+  static bool rtAggAdd(EVMod *mod, uint32_t *xdr, uint32_t len) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSPXDRIn in = { .xdr = xdr, .quads = len >> 2 };
+    char dsname[HSP_MAX_RTMETRIC_KEY_LEN + 1];
+    char mname[HSP_MAX_RTMETRIC_KEY_LEN + 1];
+    char str[HSP_MAX_RTMETRIC_VAL_LEN + 1];
+    if(xdr_dec_int32(&in) != TAG_RTMETRIC)
+      return NO;
+    xdr_dec_int32(&in); // length
+    xdr_dec_str(&in, dsname, HSP_MAX_RTMETRIC_KEY_LEN);
+    uint32_t num_fields = xdr_dec_int32(&in);
+    if(in.err
+       || (dsname[0] && dsname_len_ok(dsname) == 0))
+      return NO;
+    bool ok = YES;
+    SEMLOCK_DO(mdata->sync_agg) {
+      for(uint32_t ii = 0; ii < num_fields; ii++) {
+	xdr_dec_str(&in, mname, HSP_MAX_RTMETRIC_KEY_LEN);
+	int mtype = xdr_dec_int32(&in);
+	HSPRTAggValue val = { };
+	str[0] = '\0';
+	switch(mtype) {
+	case RTMetricType_string:
+	  xdr_dec_str(&in, str, HSP_MAX_RTMETRIC_VAL_LEN);
+	  break;
+	case RTMetricType_counter32:
+	case RTMetricType_gauge32:
+	  val.u64 = xdr_dec_int32(&in);
+	  break;
+	case RTMetricType_counter64:
+	case RTMetricType_gauge64:
+	  val.u64 = xdr_dec_int64(&in);
+	  break;
+	case RTMetricType_gaugeFloat: {
+	  uint32_t bits = xdr_dec_int32(&in);
+	  float valf;
+	  memcpy(&valf, &bits, 4);
+	  val.dbl = valf;
+	  break;
+	}
+	case RTMetricType_gaugeDouble: {
+	  uint64_t bits = xdr_dec_int64(&in);
+	  memcpy(&val.dbl, &bits, 8);
+	  break;
+	}
+	default:
+	  in.err = YES;
+	  break;
+	}
+	if(in.err
+	   || rtmetric_len_ok(mname) == 0) {
+	  ok = NO;
+	  break;
+	}
+	HSPRTAggDS *ds = rtAggGetDS(mod, dsname);
+	HSPRTAggMetric search = { .name = mname };
+	HSPRTAggMetric *met = UTHashGet(ds->metrics, &search);
+	if(met == NULL
+	   && mdata->aggMetrics >= sp->json.aggregateMax) {
+	  // only make room when a new metric is about to go in. If this
+	  // datasource is the only one it is sent early and starts again.
+	  bool self = (UTQ_HEAD(mdata->aggLRU) == ds);
+	  rtAggEvict(mod);
+	  if(self)
+	    ds = rtAggGetDS(mod, dsname);
+	}
+	rtAggMerge(mod, ds, met, mname, mtype, &val, str);
+      }
+    }
+    return ok;
+  }
+
+  static void rtAggEncodeValue(XDRBuf *buf, int mtype, HSPRTAggValue *val) {
+    switch(mtype) {
+    case RTMetricType_counter32:
+    case RTMetricType_gauge32:
+      xdr_enc_int32(buf, (uint32_t)val->u64);
+      break;
+    case RTMetricType_counter64:
+    case RTMetricType_gauge64:
+      xdr_enc_int64(buf, val->u64);
+      break;
+    case RTMetricType_gaugeFloat:
+      xdr_enc_float(buf, (float)val->dbl);
+      break;
+    case RTMetricType_gaugeDouble:
+      xdr_enc_dbl(buf, val->dbl);
+      break;
+    }
+  }
+
+  static void rtAggSendDS(EVMod *mod, HSPRTAggDS *ds) {
+    if(ds->updates == 0)
+      return;
+    HSPRTEncoder enc = { .isFlow = NO, .aggregated = YES };
+    rt_enc_start(&enc, ds->dsname[0] ? ds->dsname : NULL, 0);
+    HSPRTAggMetric *met;
+    UTHASH_WALK(ds->metrics, met) {
+      if(met->updates == 0)
+	continue;
+      uint32_t nlen = my_strlen(met->name);
+      // worst case is a gauge with _min and _max, or a max-length string
+      uint32_t need = 3 * (8 + HSP_MAX_RTMETRIC_KEY_LEN + 12) + HSP_MAX_RTMETRIC_VAL_LEN;
+      if(((enc.buf.cursor << 2) + need) > HSP_RING_MAX_RECORD) {
+	// split across samples
+	rt_enc_send(mod, &enc);
+	rt_enc_start(&enc, ds->dsname[0] ? ds->dsname : NULL, 0);
+      }
+      xdr_enc_str(&enc.buf, met->name, nlen);
+      xdr_enc_int32(&enc.buf, met->mtype);
+      enc.num_fields++;
+      if(met->mtype == RTMetricType_string) {
+	xdr_enc_str(&enc.buf, met->str, my_strlen(met->str));
+      }
+      else {
+	rtAggEncodeValue(&enc.buf, met->mtype, &met->last);
+	if(rtAggIsGauge(met->mtype)
+	   && (nlen + 4) <= HSP_MAX_RTMETRIC_KEY_LEN) {
+	  char mname[HSP_MAX_RTMETRIC_KEY_LEN + 1];
+	  snprintf(mname, sizeof(mname), "%s_min", met->name);
+	  xdr_enc_str(&enc.buf, mname, nlen + 4);
+	  xdr_enc_int32(&enc.buf, met->mtype);
+	  rtAggEncodeValue(&enc.buf, met->mtype, &met->min);
+	  snprintf(mname, sizeof(mname), "%s_max", met->name);
+	  xdr_enc_str(&enc.buf, mname, nlen + 4);
+	  xdr_enc_int32(&enc.buf, met->mtype);
+	  rtAggEncodeValue(&enc.buf, met->mtype, &met->max);
+	  enc.num_fields += 2;
+	}
+      }
+    }
+    rt_enc_send(mod, &enc);
+  }
+
+  static void rtAggFlush(EVMod *mod) {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    SEMLOCK_DO(mdata->sync_agg) {
+      // free rather than reset so that anything that has gone quiet
+      // does not hold memory
+      for(HSPRTAggDS *ds; (ds = UTQ_HEAD(mdata->aggLRU)); ) {
+	rtAggSendDS(mod, ds);
+	rtAggFreeDS(mod, ds);
+      }
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________  rt_enc_send              __________________
+    -----------------___________________________------------------
+  */
+
+  static void rt_enc_send(EVMod *mod, HSPRTEncoder *enc) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    SFLReceiver *receiver = sp->agent->receivers;
+    if(receiver == NULL
+       || enc->num_fields == 0)
+      return;
+    uint32_t len = (char *)xdr_ptr(&enc->buf) - (char *)enc->mstart - 4;
+    enc->mstart[0] = htonl(len);
+    enc->fstart[0] = htonl(enc->num_fields);
+    if(mdata->aggDS
+       && !enc->isFlow
+       && !enc->aggregated) {
+      rtAggAdd(mod, enc->buf.xdr, (enc->buf.cursor << 2));
+      return;
+    }
+    SEMLOCK_DO(sp->sync_agent) {
+      sfl_receiver_writeEncoded(receiver,
+				1,
+				enc->buf.xdr,
+				(enc->buf.cursor << 2));
+      telemetryAdd(sp, mod, enc->isFlow ? HSP_TELEMETRY_RTFLOW_SAMPLES : HSP_TELEMETRY_RTMETRIC_SAMPLES, 1);
+    }
+  }
+
+  // encode one { "type":..., "value":... } field object from cJSON
+  static bool rt_enc_cjson_field(HSPRTEncoder *enc, cJSON *rtf) {
+    const char *what = enc->isFlow ? "rtflow" : "rtmetric";
+    cJSON *field = cJSON_GetObjectItem(rtf, "value");
+    if(field == NULL) {
+      myDebug(1, "%s missing \"value\"", what);
+      return NO; // bail on missing value
+    }
+    HSPRTValue val = { };
+    if(field->type == cJSON_String) {
+      val.str = field->valuestring;
+      val.len = my_strlen(field->valuestring);
+    }
+    else if(field->type == cJSON_Number) {
+      val.dbl = field->valuedouble;
+    }
+    else {
+      myDebug(1, "%s field %s \"value\" not string or number", what, rtf->string);
+      return NO; // bail on bad value
+    }
+    cJSON *field_type = cJSON_GetObjectItem(rtf, "type");
+    return rt_enc_field(enc,
+			rtf->string,
+			field_type ? field_type->valuestring : NULL,
+			&val);
+  }
+
+  /*_________________---------------------------__________________
+    _________________  readJSON_rtmetric        __________________
+    -----------------___________________________------------------
+
+    {
+       "rtmetric": {
+         "datasource": "web1",
+         "metric1": { "type": "counter32",   "value": 777          },
+         "metric2": { "type": "string",      "value": "helloworld" },
+         "metric3": { "type": "gaugedouble", "value": 1.234        },
+       }
+    }
+  */
+
+  static void readJSON_rtmetric(EVMod *mod, cJSON *rtmetric)
+  {
+    if(getDebug() > 1) logJSON(rtmetric, "got rtmetric");
+
+    char *dsname = NULL;
+
+    // iterate to pull out datasource name first
+    for(cJSON *rtm = rtmetric->child; rtm; rtm = rtm->next) {
+      if(!rtm->string) {
+	if(getDebug()) logJSON(rtm, "expected named field");
+	continue;
+      }
+      // pick up optional datasource
+      if(rtm->type == cJSON_String &&
+	 my_strequal(rtm->string, "datasource")) {
+	dsname = rtm->valuestring;
+	continue;
+      }
+    }
+
+    HSPRTEncoder enc = { .isFlow = NO };
+    if(!rt_enc_start(&enc, dsname, 0))
+      return;
+
+    for(cJSON *rtm = rtmetric->child; rtm; rtm = rtm->next) {
+      // only want named objects now
+      if(rtm->string == NULL ||
+	 rtm->type != cJSON_Object) {
+	continue;
+      }
+      if(!rt_enc_cjson_field(&enc, rtm))
+	return;
+    }
+
+    rt_enc_send(mod, &enc);
+  }
+
   /*_________________---------------------------__________________
     _________________  readJSON_rtflow          __________________
     -----------------___________________________------------------
@@ -1086,20 +1491,10 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
   */
 
   static void readJSON_rtflow(EVMod *mod, cJSON *rtflow) {
-    // HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
-    HSP *sp = (HSP *)EVROOTDATA(mod);
-
     if(getDebug() > 1) logJSON(rtflow, "got rtflow");
-    SFLReceiver *receiver = sp->agent->receivers;
-    if(receiver == NULL)
-      return;
 
-    XDRBuf buf;
-    xdr_init(&buf);
     uint32_t sampling_rate = 1;
-    uint32_t num_fields = 0;
     char *dsname = NULL;
-    uint32_t dsname_len = 0;
 
     // iterate to pull out sampling_rate and datasource name first
     for(cJSON *rtf = rtflow->child; rtf; rtf = rtf->next) {
@@ -1118,11 +1513,6 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
       if(rtf->type == cJSON_String &&
 	 my_strequal(rtf->string, "datasource")) {
 	dsname = rtf->valuestring;
-	dsname_len = dsname_len_ok(dsname);
-	if(dsname_len == 0) {
-	  myDebug(1, "invalid datasource name: %s", dsname);
-	  return; // bail completely on bad dsname
-	}
 	continue;
       }
       // all other fields must be objects
@@ -1132,14 +1522,9 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
       }
     }
 
-    xdr_enc_int32(&buf, TAG_RTFLOW);
-    uint32_t *mstart = xdr_ptr(&buf);
-    xdr_enc_int32(&buf, 0); // will be rtflow len
-    xdr_enc_str(&buf, dsname, dsname_len);
-    xdr_enc_int32(&buf, sampling_rate); // sampling_rate
-    xdr_enc_int32(&buf, 0); // reserved (e.g. for sample_pool)
-    uint32_t *fstart = xdr_ptr(&buf);
-    xdr_enc_int32(&buf, 0); // will be num fields
+    HSPRTEncoder enc = { .isFlow = YES };
+    if(!rt_enc_start(&enc, dsname, sampling_rate))
+      return;
 
     for(cJSON *rtf = rtflow->child; rtf; rtf = rtf->next) {
       // only want named objects now
@@ -1147,96 +1532,485 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 	 rtf->type != cJSON_Object) {
 	continue;
       }
+      if(!rt_enc_cjson_field(&enc, rtf))
+	return;
+    }
 
-      uint32_t fname_len = rtmetric_len_ok(rtf->string);
-      if(fname_len == 0) {
-	myDebug(1, "invalid rtflow key: <%s>", rtf->string);
-	return; // bail on bad key
+    rt_enc_send(mod, &enc);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   streaming rtmetric      __________________
+    -----------------___________________________------------------
+    At high rtmetric/rtflow message rates the cJSON_Parse(), walk and
+    cJSON_Delete() cycle is dominated by malloc churn.  Messages of
+    the simple form {"rtmetric":{...}} or {"rtflow":{...}} are
+    therefore scanned in a single pass that only records where the
+    names and values are in the datagram buffer. If the scan succeeds
+    the strings are unescaped and terminated in place, and encoded
+    with the same rt_enc_* functions as the cJSON path.  Anything the
+    scanner does not expect (other top-level keys, arrays, nested
+    objects, true/false/null, surrogate-pair escapes, too many fields)
+    makes it give up before touching the buffer, and the message goes
+    to cJSON as before.
+  */
+
+#define HSP_JSON_SCAN_MAX_FIELDS 64
+
+  typedef struct _HSPJSONSpan {
+    char *str;
+    uint32_t len;
+    bool escaped;
+  } HSPJSONSpan;
+
+  typedef struct _HSPJSONScanField {
+    HSPJSONSpan name;
+    HSPJSONSpan type;
+    HSPJSONSpan value;
+    double dbl;
+    bool hasType:1;
+    bool hasValue:1;
+    bool isString:1;
+  } HSPJSONScanField;
+
+  typedef struct _HSPJSONScan {
+    char *ptr;
+    char *end;
+  } HSPJSONScan;
+
+  static void jscan_ws(HSPJSONScan *js) {
+    while(js->ptr < js->end
+	  && (*js->ptr == ' '
+	      || *js->ptr == '\t'
+	      || *js->ptr == '\n'
+	      || *js->ptr == '\r'))
+      js->ptr++;
+  }
+
+  static bool jscan_peek(HSPJSONScan *js, char ch) {
+    jscan_ws(js);
+    return (js->ptr < js->end && *js->ptr == ch);
+  }
+
+  static bool jscan_ch(HSPJSONScan *js, char ch) {
+    if(jscan_peek(js, ch)) {
+      js->ptr++;
+      return YES;
+    }
+    return NO;
+  }
+
+  static int jscan_hex4(char *p) {
+    int val = 0;
+    for(int ii = 0; ii < 4; ii++) {
+      int ch = p[ii];
+      if(!isxdigit(ch))
+	return -1;
+      val = (val << 4) | (isdigit(ch) ? (ch - '0') : ((ch | 0x20) - 'a' + 10));
+    }
+    return val;
+  }
+
+  static bool jscan_str(HSPJSONScan *js, HSPJSONSpan *span) {
+    if(!jscan_ch(js, '"'))
+      return NO;
+    char *start = js->ptr;
+    span->escaped = NO;
+    while(js->ptr < js->end) {
+      char ch = *js->ptr;
+      if(ch == '"') {
+	span->str = start;
+	span->len = js->ptr - start;
+	js->ptr++;
+	return YES;
       }
+      if(ch == '\\') {
+	span->escaped = YES;
+	if((js->end - js->ptr) < 2)
+	  return NO;
+	switch(js->ptr[1]) {
+	case '"': case '\\': case '/':
+	case 'b': case 'f': case 'n': case 'r': case 't':
+	  js->ptr += 2;
+	  continue;
+	case 'u': {
+	  if((js->end - js->ptr) < 6)
+	    return NO;
+	  int uc = jscan_hex4(js->ptr + 2);
+	  if(uc < 0
+	     || (uc >= 0xD800 && uc <= 0xDFFF))
+	    return NO; // leave surrogate pairs to cJSON
+	  js->ptr += 6;
+	  continue;
+	}
+	default:
+	  return NO;
+	}
+      }
+      if((u_char)ch < 0x20)
+	return NO; // unescaped control character
+      js->ptr++;
+    }
+    return NO; // unterminated
+  }
+
+  static bool jscan_num(HSPJSONScan *js, double *val) {
+    jscan_ws(js);
+    if(js->ptr >= js->end
+       || (*js->ptr != '-'
+	   && !isdigit(*js->ptr)))
+      return NO;
+    // only the JSON number grammar characters (strtod would also take hex)
+    char *endp = js->ptr;
+    while(endp < js->end
+	  && (isdigit(*endp)
+	      || *endp == '-'
+	      || *endp == '+'
+	      || *endp == '.'
+	      || *endp == 'e'
+	      || *endp == 'E'))
+      endp++;
+    char *numEnd;
+    *val = strtod(js->ptr, &numEnd);
+    if(numEnd != endp)
+      return NO;
+    js->ptr = endp;
+    return YES;
+  }
+
+  static bool jspan_is(HSPJSONSpan *span, const char *lit) {
+    return (!span->escaped
+	    && span->len == my_strlen((char *)lit)
+	    && memcmp(span->str, lit, span->len) == 0);
+  }
 
-      cJSON *field = cJSON_GetObjectItem(rtf, "value");
-      uint32_t field_len = sizeof(double);
+  // for keys that the cJSON path looks up with cJSON_GetObjectItem()
+  static bool jspan_is_nocase(HSPJSONSpan *span, const char *lit) {
+    return (!span->escaped
+	    && span->len == my_strlen((char *)lit)
+	    && strncasecmp(span->str, lit, span->len) == 0);
+  }
 
-      if(field == NULL) {
-	myDebug(1, "rtflow missing \"value\"");
-	return; // bail on missing value
+  // unescape and NUL-terminate in place. Only safe once the scan is complete.
+  static char *jspan_cstr(HSPJSONSpan *span) {
+    if(span->escaped) {
+      char *in = span->str;
+      char *end = span->str + span->len;
+      char *out = span->str;
+      while(in < end) {
+	if(*in != '\\') {
+	  *out++ = *in++;
+	  continue;
+	}
+	char esc = in[1];
+	in += 2;
+	switch(esc) {
+	case 'b': *out++ = '\b'; break;
+	case 'f': *out++ = '\f'; break;
+	case 'n': *out++ = '\n'; break;
+	case 'r': *out++ = '\r'; break;
+	case 't': *out++ = '\t'; break;
+	case 'u': {
+	  int uc = jscan_hex4(in);
+	  in += 4;
+	  // UTF-8 encode (never longer than the 6-byte escape)
+	  if(uc < 0x80) {
+	    *out++ = uc;
+	  }
+	  else if(uc < 0x800) {
+	    *out++ = 0xC0 | (uc >> 6);
+	    *out++ = 0x80 | (uc & 0x3F);
+	  }
+	  else {
+	    *out++ = 0xE0 | (uc >> 12);
+	    *out++ = 0x80 | ((uc >> 6) & 0x3F);
+	    *out++ = 0x80 | (uc & 0x3F);
+	  }
+	  break;
+	}
+	default: *out++ = esc; break;
+	}
       }
+      span->len = out - span->str;
+      span->escaped = NO;
+    }
+    span->str[span->len] = '\0';
+    return span->str;
+  }
 
-      if(field->type == cJSON_String) {
-	field_len = my_strlen(field->valuestring);
-	if(field_len > HSP_MAX_RTMETRIC_VAL_LEN) {
-	  myDebug(1, "rtflow field %s len(%u) > max(%u)",
-		  rtf->string,
-		  field_len,
-		  HSP_MAX_RTMETRIC_VAL_LEN);
-	  return; // bail on field len error
+  // { "type": "...", "value": ... } - other members are ignored
+  static bool jscan_field(HSPJSONScan *js, HSPJSONScanField *fld) {
+    if(!jscan_ch(js, '{'))
+      return NO;
+    if(jscan_ch(js, '}'))
+      return YES;
+    for(;;) {
+      HSPJSONSpan key;
+      if(!jscan_str(js, &key)
+	 || !jscan_ch(js, ':')
+	 || key.escaped)
+	return NO; // leave escaped keys to cJSON
+      bool isType = jspan_is_nocase(&key, "type");
+      bool isValue = jspan_is_nocase(&key, "value");
+      if(jscan_peek(js, '"')) {
+	HSPJSONSpan str;
+	if(!jscan_str(js, &str))
+	  return NO;
+	if(isType && !fld->hasType) {
+	  fld->type = str;
+	  fld->hasType = YES;
+	}
+	else if(isValue && !fld->hasValue) {
+	  fld->value = str;
+	  fld->isString = YES;
+	  fld->hasValue = YES;
 	}
       }
+      else {
+	double dbl;
+	if(!jscan_num(js, &dbl))
+	  return NO;
+	if(isValue && !fld->hasValue) {
+	  fld->dbl = dbl;
+	  fld->hasValue = YES;
+	}
+	else if(isType && !fld->hasType) {
+	  return NO; // cJSON would see a non-string type
+	}
+      }
+      if(jscan_ch(js, ','))
+	continue;
+      return jscan_ch(js, '}');
+    }
+  }
 
-      cJSON *field_type = cJSON_GetObjectItem(rtf, "type");
-      if(field_type == NULL) {
-	myDebug(1, "rtflow missing \"type\"");
-	return; // bail on missing type
+  static bool readJSON_scan(EVMod *mod, char *buf, int len)
+  {
+    HSPJSONScan js = { .ptr = buf, .end = buf + len };
+    HSPJSONScanField fields[HSP_JSON_SCAN_MAX_FIELDS];
+    uint32_t num_fields = 0;
+    HSPJSONSpan top, dsname;
+    bool hasDsname = NO;
+    double sampling_rate = 1;
+
+    if(!jscan_ch(&js, '{')
+       || !jscan_str(&js, &top)
+       || !jscan_ch(&js, ':')
+       || !jscan_ch(&js, '{'))
+      return NO;
+    bool isFlow;
+    if(jspan_is_nocase(&top, "rtmetric"))
+      isFlow = NO;
+    else if(jspan_is_nocase(&top, "rtflow"))
+      isFlow = YES;
+    else
+      return NO;
+
+    if(!jscan_ch(&js, '}')) {
+      for(;;) {
+	HSPJSONSpan key;
+	if(!jscan_str(&js, &key)
+	   || !jscan_ch(&js, ':'))
+	  return NO;
+	if(jscan_peek(&js, '{')) {
+	  if(num_fields == HSP_JSON_SCAN_MAX_FIELDS)
+	    return NO;
+	  HSPJSONScanField *fld = &fields[num_fields++];
+	  memset(fld, 0, sizeof(*fld));
+	  fld->name = key;
+	  if(!jscan_field(&js, fld))
+	    return NO;
+	}
+	else if(jscan_peek(&js, '"')) {
+	  HSPJSONSpan str;
+	  if(!jscan_str(&js, &str))
+	    return NO;
+	  if(jspan_is(&key, "datasource")) {
+	    dsname = str;
+	    hasDsname = YES;
+	  }
+	}
+	else {
+	  double dbl;
+	  if(!jscan_num(&js, &dbl))
+	    return NO;
+	  if(isFlow
+	     && jspan_is(&key, "sampling_rate"))
+	    sampling_rate = dbl;
+	}
+	if(jscan_ch(&js, ','))
+	  continue;
+	if(jscan_ch(&js, '}'))
+	  break;
+	return NO;
       }
+    }
+    // must be the only top-level member
+    if(!jscan_ch(&js, '}'))
+      return NO;
+    jscan_ws(&js);
+    if(js.ptr < js.end
+       && *js.ptr != '\0')
+      return NO;
+    // let cJSON report anything incomplete, before we touch the buffer
+    for(uint32_t ii = 0; ii < num_fields; ii++) {
+      if(!fields[ii].hasValue)
+	return NO;
+    }
 
-      int rtfType = rtflow_type(field_type->valuestring);
-      if(rtfType == -1) {
-	myDebug(1, "rtflow field bad type <%s>", field_type->valuestring);
-	return; // bail on bad/missing type
+    // scan complete - from here on the message is ours
+    myDebug(2, "json: streaming %s with %u fields", isFlow ? "rtflow" : "rtmetric", num_fields);
+    uint32_t sr = (uint32_t)sampling_rate;
+    HSPRTEncoder enc = { .isFlow = isFlow };
+    if(!rt_enc_start(&enc,
+		     hasDsname ? jspan_cstr(&dsname) : NULL,
+		     sr ? sr : 1))
+      return YES;
+    for(uint32_t ii = 0; ii < num_fields; ii++) {
+      HSPJSONScanField *fld = &fields[ii];
+      HSPRTValue val = { };
+      if(fld->isString) {
+	val.str = jspan_cstr(&fld->value);
+	val.len = fld->value.len;
       }
+      else {
+	val.dbl = fld->dbl;
+      }
+      if(!rt_enc_field(&enc,
+		       jspan_cstr(&fld->name),
+		       fld->hasType ? jspan_cstr(&fld->type) : NULL,
+		       &val))
+	return YES;
+    }
+    rt_enc_send(mod, &enc);
+    return YES;
+  }
 
-      num_fields++;
-      xdr_enc_flow_field(&buf, rtf->string, fname_len, rtfType, field, field_len);
+  /*_________________---------------------------__________________
+    _________________      readJSON             __________________
+    -----------------___________________________------------------
+  */
+
+  static void readJSON_msg(EVMod *mod, char *buf, int len)
+  {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    myDebug(2, "got JSON msg: %u bytes", len);
+    // try the allocation-free path first
+    if(readJSON_scan(mod, buf, len))
+      return;
+    cJSON *top = cJSON_Parse(buf);
+    if(top) {
+      if(getDebug()) logJSON(top, "got JSON message");
+      SEMLOCK_DO(mdata->sync_apps) {
+	cJSON *fs = cJSON_GetObjectItem(top, "flow_sample");
+	if(fs) readJSON_flowSample(mod, fs);
+	cJSON *cs = cJSON_GetObjectItem(top, "counter_sample");
+	if(cs) readJSON_counterSample(mod, cs);
+      }
+      cJSON *rtmetric = cJSON_GetObjectItem(top, "rtmetric");
+      if(rtmetric) readJSON_rtmetric(mod, rtmetric);
+      cJSON *rtflow = cJSON_GetObjectItem(top, "rtflow");
+      if(rtflow) readJSON_rtflow(mod, rtflow);
+      cJSON_Delete(top);
     }
+  }
 
-    if(num_fields) {
-      uint32_t len = (char *)xdr_ptr(&buf) - (char *)mstart - 4;
-      mstart[0] = htonl(len);
-      fstart[0] = htonl(num_fields);
-      SEMLOCK_DO(sp->sync_agent) {
-	sfl_receiver_writeEncoded(receiver,
-				  1,
-				  buf.xdr,
-				  (buf.cursor << 2));
-	sp->telemetry[HSP_TELEMETRY_RTFLOW_SAMPLES]++;
+  /*_________________---------------------------__________________
+    _________________    SO_RXQ_OVFL drops      __________________
+    -----------------___________________________------------------
+    The kernel attaches the socket's cumulative drop count to each
+    datagram once it is non-zero.
+  */
+
+  static void readJSON_drops(EVMod *mod, HSPJSONSocket *jsock, struct msghdr *msg)
+  {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+      if(cmsg->cmsg_level == SOL_SOCKET
+	 && cmsg->cmsg_type == SO_RXQ_OVFL) {
+	uint32_t ovfl;
+	memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(ovfl));
+	int32_t delta = ovfl - jsock->rxq_ovfl;
+	if(delta > 0) {
+	  jsock->rxq_ovfl = ovfl;
+	  jsock->drops += delta;
+	  telemetryAdd(sp, mod, HSP_TELEMETRY_JSON_DROPS, delta);
+	  EVLog(60, LOG_WARNING, "json: receive buffer overflow on %s port %u (fd=%d, %"PRIu64" dropped)",
+		jsock->bindaddr,
+		sp->json.port,
+		jsock->fd,
+		jsock->drops);
+	}
       }
     }
   }
 
   /*_________________---------------------------__________________
-    _________________      readJSON             __________________
+    _________________    readJSON_mmsg          __________________
     -----------------___________________________------------------
+    Read up to HSP_JSON_MMSG_BATCH datagrams per system call.
   */
 
+  static int readJSON_mmsg(EVMod *mod, HSPJSONSocket *jsock)
+  {
+    for(int ii = 0; ii < HSP_JSON_MMSG_BATCH; ii++) {
+      jsock->iov[ii].iov_base = jsock->buf[ii];
+      jsock->iov[ii].iov_len = HSP_MAX_JSON_MSG_BYTES;
+      struct msghdr *hdr = &jsock->msgs[ii].msg_hdr;
+      memset(hdr, 0, sizeof(*hdr));
+      hdr->msg_iov = &jsock->iov[ii];
+      hdr->msg_iovlen = 1;
+      hdr->msg_control = jsock->ctrl[ii];
+      hdr->msg_controllen = sizeof(jsock->ctrl[ii]);
+    }
+    int nmsgs = recvmmsg(jsock->fd, jsock->msgs, HSP_JSON_MMSG_BATCH, MSG_DONTWAIT, NULL);
+    if(nmsgs < 0) {
+      if(errno == ENOSYS) {
+	myLog(LOG_INFO, "json: recvmmsg() not available, using read()");
+	jsock->useRead = YES;
+      }
+      else if(errno != EAGAIN
+	      && errno != EINTR) {
+	EVLog(60, LOG_ERR, "json: recvmmsg() failed: %s", strerror(errno));
+      }
+      return 0;
+    }
+    for(int ii = 0; ii < nmsgs; ii++) {
+      int len = jsock->msgs[ii].msg_len;
+      jsock->buf[ii][len] = '\0';
+      readJSON_drops(mod, jsock, &jsock->msgs[ii].msg_hdr);
+      readJSON_msg(mod, jsock->buf[ii], len);
+    }
+    return nmsgs;
+  }
+
   static void readJSON(EVMod *mod, EVSocket *sock, void *magic)
   {
     HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPJSONSocket *jsock = (HSPJSONSocket *)magic;
 
     if(sp->sFlowSettings == NULL) {
       // config was turned off
       return;
     }
     int batch = 0;
-    if(sock->fd) {
+    if(jsock
+       && !jsock->useRead) {
+      while(batch < HSP_READJSON_BATCH) {
+	int nmsgs = readJSON_mmsg(mod, jsock);
+	batch += nmsgs;
+	if(nmsgs < HSP_JSON_MMSG_BATCH)
+	  break;
+      }
+    }
+    else if(sock->fd) {
       for( ; batch < HSP_READJSON_BATCH; batch++) {
-	char buf[HSP_MAX_JSON_MSG_BYTES];
+	char buf[HSP_MAX_JSON_MSG_BYTES + 1];
 	// use read() so that it works for both UDP and FIFO inputs
 	int len = read(sock->fd, buf, HSP_MAX_JSON_MSG_BYTES);
 	if(len <= 0) break;
-	myDebug(2, "got JSON msg: %u bytes", len);
-	cJSON *top = cJSON_Parse(buf);
-	if(top) {
-	  if(getDebug()) logJSON(top, "got JSON message");
-	  cJSON *fs = cJSON_GetObjectItem(top, "flow_sample");
-	  if(fs) readJSON_flowSample(mod, fs);
-	  cJSON *cs = cJSON_GetObjectItem(top, "counter_sample");
-	  if(cs) readJSON_counterSample(mod, cs);
-	  cJSON *rtmetric = cJSON_GetObjectItem(top, "rtmetric");
-	  if(rtmetric) readJSON_rtmetric(mod, rtmetric);
-	  cJSON *rtflow = cJSON_GetObjectItem(top, "rtflow");
-	  if(rtflow) readJSON_rtflow(mod, rtflow);
-	  cJSON_Delete(top);
-	}
+	buf[len] = '\0';
+	readJSON_msg(mod, buf, len);
       }
     }
     // may have queued one or more counter-samples during this read-batch.
@@ -1249,6 +2023,227 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     flushCounters(mod);
   }
 
+  /*_________________---------------------------__________________
+    _________________    shared-memory rings    __________________
+    -----------------___________________________------------------
+    Local producers hand us a sealed memfd ring over the json { ring }
+    unix socket (see hsflowd_ring.h). Records are pre-encoded
+    rtmetric/rtflow XDR, so draining is just validate-and-copy.
+  */
+
+  static void ringDetach(EVMod *mod, HSPJSONRing *ring)
+  {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    myDebug(1, "json ring: detach fd=%d records=%"PRIu64, ring->memfd, ring->records);
+    UTArrayDel(mdata->rings, ring);
+    munmap(ring->hdr, ring->mapLen);
+    close(ring->memfd);
+    EVSocketClose(mod, ring->sock, YES);
+    my_free(ring);
+  }
+
+  static HSPJSONRing *ringAttach(EVMod *mod, EVSocket *sock, int memfd)
+  {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    struct stat st;
+    if(fstat(memfd, &st) < 0
+       || st.st_size < (HSP_RING_HDR_LEN + HSP_RING_MIN_SIZE)
+       || st.st_size > (HSP_RING_HDR_LEN + HSP_RING_MAX_SIZE)) {
+      myLog(LOG_ERR, "json ring: bad memfd size");
+      return NULL;
+    }
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if(seals < 0
+       || (seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) != (F_SEAL_SHRINK | F_SEAL_SEAL)) {
+      myLog(LOG_ERR, "json ring: memfd must be sealed against shrinking");
+      return NULL;
+    }
+    size_t mapLen = st.st_size;
+    void *map = mmap(NULL, mapLen, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+    if(map == MAP_FAILED) {
+      myLog(LOG_ERR, "json ring: mmap failed: %s", strerror(errno));
+      return NULL;
+    }
+    HSPRingHdr *hdr = (HSPRingHdr *)map;
+    uint32_t size = hdr->size;
+    if(hdr->magic != HSP_RING_MAGIC
+       || hdr->version != HSP_RING_VERSION
+       || hdr->hdr_len != HSP_RING_HDR_LEN
+       || size < HSP_RING_MIN_SIZE
+       || (size & (size - 1))
+       || (HSP_RING_HDR_LEN + size) > mapLen) {
+      myLog(LOG_ERR, "json ring: bad header (magic=0x%x version=%u size=%u)",
+	    hdr->magic,
+	    hdr->version,
+	    size);
+      munmap(map, mapLen);
+      return NULL;
+    }
+    HSPJSONRing *ring = (HSPJSONRing *)my_calloc(sizeof(HSPJSONRing));
+    ring->sock = sock;
+    ring->memfd = memfd;
+    ring->hdr = hdr;
+    ring->data = (u_char *)map + HSP_RING_HDR_LEN;
+    ring->mapLen = mapLen;
+    // keep our own copies - the producer can write to the header
+    ring->size = size;
+    ring->tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    ring->drops = __atomic_load_n(&hdr->drops, __ATOMIC_RELAXED);
+    UTArrayAdd(mdata->rings, ring);
+    myDebug(1, "json ring: attach fd=%d size=%u", memfd, size);
+    return ring;
+  }
+
+  static void ringRead(EVMod *mod, EVSocket *sock, void *magic)
+  {
+    HSPJSONRing *ring = (HSPJSONRing *)sock->magic;
+    char buf[64];
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctrl.buf,
+      .msg_controllen = sizeof(ctrl.buf)
+    };
+    int cc = recvmsg(sock->fd, &msg, MSG_CMSG_CLOEXEC);
+    if(cc < 0
+       && (errno == EAGAIN
+	   || errno == EINTR))
+      return;
+    int memfd = -1;
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if(cmsg->cmsg_level == SOL_SOCKET
+	 && cmsg->cmsg_type == SCM_RIGHTS
+	 && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+	memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if(cc <= 0) {
+      // producer went away
+      if(memfd >= 0)
+	close(memfd);
+      if(ring)
+	ringDetach(mod, ring);
+      else
+	EVSocketClose(mod, sock, YES);
+      return;
+    }
+    if(memfd >= 0) {
+      if(ring
+	 || (sock->magic = ringAttach(mod, sock, memfd)) == NULL) {
+	// only one ring per connection
+	close(memfd);
+	if(ring)
+	  ringDetach(mod, ring);
+	else
+	  EVSocketClose(mod, sock, YES);
+      }
+    }
+  }
+
+  static void ringAccept(EVMod *mod, EVSocket *sock, void *magic)
+  {
+    int fd = accept4(sock->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if(fd < 0) {
+      myLog(LOG_ERR, "json ring accept() failed: %s", strerror(errno));
+      return;
+    }
+    EVBusAddSocket(mod, sock->bus, fd, ringRead, NULL);
+  }
+
+  // returns NO if the ring is corrupt and should be dropped
+  static bool ringDrain(EVMod *mod, HSPJSONRing *ring)
+  {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    SFLReceiver *receiver = sp->agent->receivers;
+    HSPRingHdr *hdr = ring->hdr;
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    uint64_t drops = __atomic_load_n(&hdr->drops, __ATOMIC_RELAXED);
+    uint64_t tail = ring->tail;
+    uint32_t nRTMetric = 0;
+    uint32_t nRTFlow = 0;
+    bool ok = YES;
+
+    if((head - tail) > ring->size) {
+      myLog(LOG_ERR, "json ring: head/tail out of range");
+      return NO;
+    }
+    if(head == tail
+       && drops == ring->drops)
+      return YES;
+
+    while(tail < head) {
+      uint32_t off = tail & (ring->size - 1);
+      uint32_t len;
+      memcpy(&len, ring->data + off, 4);
+      if(len == HSP_RING_PAD) {
+	tail += ring->size - off;
+	continue;
+      }
+      if((len & 3)
+	 || len < 8
+	 || len > HSP_RING_MAX_RECORD
+	 || (off + 4 + len) > ring->size
+	 || (tail + 4 + len) > head) {
+	myLog(LOG_ERR, "json ring: bad record length %u", len);
+	ok = NO;
+	break;
+      }
+      // copy out before checking, so the producer cannot change it under us
+      uint32_t xdr[HSP_RING_MAX_RECORD / 4];
+      memcpy(xdr, ring->data + off + 4, len);
+      tail += 4 + len;
+      uint32_t tag = ntohl(xdr[0]);
+      if((tag != TAG_RTMETRIC
+	  && tag != TAG_RTFLOW)
+	 || ntohl(xdr[1]) != (len - 8)) {
+	myDebug(1, "json ring: skipping record tag=0x%x len=%u", tag, len);
+	continue;
+      }
+      if(receiver == NULL)
+	continue;
+      if(tag == TAG_RTMETRIC
+	 && mdata->aggDS) {
+	if(!rtAggAdd(mod, xdr, len))
+	  myDebug(1, "json ring: skipping bad rtmetric record len=%u", len);
+	ring->records++;
+	continue;
+      }
+      SEMLOCK_DO(sp->sync_agent) {
+	if(sfl_receiver_writeEncoded(receiver, 1, xdr, len) > 0) {
+	  if(tag == TAG_RTMETRIC)
+	    nRTMetric++;
+	  else
+	    nRTFlow++;
+	}
+      }
+    }
+    telemetryAdd(sp, mod, HSP_TELEMETRY_RTMETRIC_SAMPLES, nRTMetric);
+    telemetryAdd(sp, mod, HSP_TELEMETRY_RTFLOW_SAMPLES, nRTFlow);
+    telemetryAdd(sp, mod, HSP_TELEMETRY_JSON_DROPS, (drops - ring->drops));
+    ring->records += nRTMetric + nRTFlow;
+    ring->drops = drops;
+    ring->tail = tail;
+    __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+    return ok;
+  }
+
+  static void evt_packet_deci(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    if(sp->sFlowSettings == NULL)
+      return;
+    HSPJSONRing *ring;
+    UTARRAY_WALK(mdata->rings, ring) {
+      if(!ringDrain(mod, ring))
+	ringDetach(mod, ring);
+    }
+  }
+
   /*_________________---------------------------__________________
     _________________    module init            __________________
     -----------------___________________________------------------
@@ -1256,9 +2251,17 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
 
   static void evt_packet_tick(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
     time_t clk = evt->bus->now.tv_sec;
+    if(mdata->aggDS
+       && clk >= mdata->aggNext) {
+      rtAggFlush(mod);
+      mdata->aggNext = clk + sp->json.aggregate;
+    }
     if(clk > mdata->next_app_timeout_check) {
-      json_app_timeout_check(mod);
+      SEMLOCK_DO(mdata->sync_apps) {
+	json_app_timeout_check(mod);
+      }
       mdata->next_app_timeout_check = clk + HSP_JSON_APP_TIMEOUT;
     }
   }
@@ -1267,18 +2270,45 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
     // pollActions collect pollers from the pollBus callbacks. Here we process
     // them on the packet thread.  pollActions has sync so we can walk this way....
-    for(int ii = 0; ii < UTArrayN(mdata->pollActions); ii++) {
-      SFLPoller *poller = (SFLPoller *)UTArrayAt(mdata->pollActions, ii);
-      if(poller) {
-	SFL_COUNTERS_SAMPLE_TYPE cs;
-	memset(&cs, 0, sizeof(cs));
-	agentCB_getCounters_JSON((void *)mod, poller, &cs);
-	UTArrayDelAt(mdata->pollActions, ii);
+    SEMLOCK_DO(mdata->sync_apps) {
+      for(int ii = 0; ii < UTArrayN(mdata->pollActions); ii++) {
+	SFLPoller *poller = (SFLPoller *)UTArrayAt(mdata->pollActions, ii);
+	if(poller) {
+	  SFL_COUNTERS_SAMPLE_TYPE cs;
+	  memset(&cs, 0, sizeof(cs));
+	  agentCB_getCounters_JSON((void *)mod, poller, &cs);
+	  UTArrayDelAt(mdata->pollActions, ii);
+	}
       }
     }
     UTArrayPack(mdata->pollActions);
   }
 
+  /*_________________---------------------------__________________
+    _________________    openJSONSocket         __________________
+    -----------------___________________________------------------
+  */
+
+  static void openJSONSocket(EVMod *mod, EVBus *bus, char *bindaddr, int family)
+  {
+    HSP_mod_JSON *mdata = (HSP_mod_JSON *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    int fd = (sp->json.workers > 1)
+      ? UTSocketUDPReusePort(bindaddr, family, sp->json.port, HSP_JSON_RCV_BUF)
+      : UTSocketUDP(bindaddr, family, sp->json.port, HSP_JSON_RCV_BUF);
+    if(fd <= 0)
+      return;
+    int one = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+      myLog(LOG_ERR, "json: setsockopt(SO_RXQ_OVFL) failed: %s", strerror(errno));
+    }
+    HSPJSONSocket *jsock = (HSPJSONSocket *)my_calloc(sizeof(HSPJSONSocket));
+    jsock->bindaddr = bindaddr;
+    jsock->fd = fd;
+    UTArrayAdd(mdata->sockets, jsock);
+    EVBusAddSocket(mod, bus, fd, readJSON, jsock);
+  }
+
   void mod_json(EVMod *mod) {
     HSP *sp = (HSP *)EVROOTDATA(mod);
     mod->data = my_calloc(sizeof(HSP_mod_JSON));
@@ -1289,6 +2319,7 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     // are iterating over the array)
     mdata->pollActions = UTArrayNew(UTARRAY_SYNC);
     // but the applicationHT is only ever accessed from the packetBus
+    // (or under sync_apps when there are json worker buses too)
     mdata->applicationHT = UTHASH_NEW(HSPApplication, application, UTHASH_SKEY);
 
     mdata->pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
@@ -1301,13 +2332,45 @@ static void readJSON_flowSample(EVMod *mod, cJSON *fs)
     // counters in the packetBus thread too.
     EVEventRx(mod, EVGetEvent(mdata->packetBus, EVEVENT_TOCK), evt_packet_tock);
 
+    mdata->sockets = UTArrayNew(UTARRAY_DFLT);
     if(sp->json.port) {
-      // TODO: do we really need to bind to both "127.0.0.1" and "::1" ?
-      mdata->json_soc = UTSocketUDP("127.0.0.1", PF_INET, sp->json.port, HSP_JSON_RCV_BUF);
-      EVBusAddSocket(mod, mdata->packetBus, mdata->json_soc, readJSON, NULL);
+      // With workers=N each extra bus binds its own pair of SO_REUSEPORT
+      // sockets, and the kernel spreads the senders across them. The first
+      // pair stays on the packetBus.
+      uint32_t workers = sp->json.workers ?: 1;
+      if(workers > 1) {
+	mdata->sync_apps = (pthread_mutex_t *)my_calloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(mdata->sync_apps, NULL);
+      }
+      for(uint32_t ww = 0; ww < workers; ww++) {
+	EVBus *bus = mdata->packetBus;
+	if(ww > 0) {
+	  char busName[32];
+	  snprintf(busName, sizeof(busName), HSPBUS_JSON "%u", ww);
+	  bus = EVGetBus(mod, busName, YES);
+	}
+	// TODO: do we really need to bind to both "127.0.0.1" and "::1" ?
+	openJSONSocket(mod, bus, "127.0.0.1", PF_INET);
+	openJSONSocket(mod, bus, "::1", PF_INET6);
+      }
+    }
 
-      mdata->json_soc6 = UTSocketUDP("::1", PF_INET6, sp->json.port, HSP_JSON_RCV_BUF);
-      EVBusAddSocket(mod, mdata->packetBus, mdata->json_soc6, readJSON, NULL);
+    if(sp->json.aggregate) {
+      mdata->aggDS = UTHASH_NEW(HSPRTAggDS, dsname, UTHASH_SKEY);
+      mdata->sync_agg = (pthread_mutex_t *)my_calloc(sizeof(pthread_mutex_t));
+      pthread_mutex_init(mdata->sync_agg, NULL);
+      if(sp->json.aggregateMax == 0)
+	sp->json.aggregateMax = HSP_RTAGG_MAX_METRICS;
+    }
+
+    mdata->rings = UTArrayNew(UTARRAY_DFLT);
+    if(sp->json.ring) {
+      int fd = UTUnixDomainSocketListen(sp->json.ring);
+      if(fd >= 0) {
+	myDebug(1, "json ring socket listening on %s", sp->json.ring);
+	EVBusAddSocket(mod, mdata->packetBus, fd, ringAccept, NULL);
+	EVEventRx(mod, EVGetEvent(mdata->packetBus, EVEVENT_DECI), evt_packet_deci);
+      }
     }
 
     if(sp->json.FIFO) {
@@ -14,6 +14,7 @@ extern "C" {
   typedef struct _HSPVMState_KVM {
     HSPVMState vm; // superclass: must come first
     int virDomainId;
+    virDomainStatsRecordPtr stats; // only set during evt_tock
   } HSPVMState_KVM;
 
   typedef struct _HSP_mod_KVM {
@@ -25,167 +26,359 @@ extern "C" {
     uint32_t refreshVMListSecs;
     time_t next_refreshVMList;
     uint32_t forgetVMSecs;
+    EVBus *pollBus;
+    // libvirt event loop on the poll bus
+    UTArray *virWatches;
+    UTArray *virTimers;
+    int virNextId;
+    // domain event subscriptions
+    int lifecycleCB;
+    int deviceAddedCB;
+    int deviceRemovedCB;
+    bool eventsOK;
+    bool connLost;
+    bool closeCBRegistered;
+    bool rescan;
   } HSP_mod_KVM;
 
-  static void agentCB_getCounters_KVM(void *magic, SFLPoller *poller, SFL_COUNTERS_SAMPLE_TYPE *cs)
-  {
-    EVMod *mod = (EVMod *)magic;
+  /*_________________---------------------------__________________
+    _________________   libvirt event loop      __________________
+    -----------------___________________________------------------
+    libvirt only delivers domain events through an event loop that the
+    application registers with virEventRegisterImpl(), so give it one
+    that runs on the poll bus. A handle with READABLE interest is an
+    EVBus socket. WRITABLE interest is called back on each deci,
+    because the socket is almost never full. Timeouts are checked on
+    each deci, and zero-delay ones also right after a handle callback,
+    so queued domain events are dispatched at once. These callbacks
+    have no context argument, hence the static module pointer. Removal
+    only marks an entry, and its free-callback runs on the next deci
+    from a clean stack, as libvirt requires.
+  */
+
+  typedef struct _HSPVirWatch {
+    int id;
+    int fd;
+    int events;
+    virEventHandleCallback cb;
+    void *opaque;
+    virFreeCallback ff;
+    EVSocket *sock;
+    bool deleted;
+  } HSPVirWatch;
+
+  typedef struct _HSPVirTimer {
+    int id;
+    int frequency_mS; // -1 == disabled
+    uint64_t due_mS;
+    virEventTimeoutCallback cb;
+    void *opaque;
+    virFreeCallback ff;
+    bool deleted;
+  } HSPVirTimer;
+
+  static EVMod *virEventMod;
+
+  static uint64_t virNow_mS(EVMod *mod) {
     HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
-    HSP *sp = (HSP *)EVROOTDATA(mod);
+    struct timespec *now = &mdata->pollBus->now;
+    return ((uint64_t)now->tv_sec * 1000) + (now->tv_nsec / 1000000);
+  }
 
-    assert(poller->magic);
-    HSPVMState_KVM *state = (HSPVMState_KVM *)poller->userData;
-    HSPVMState *vm = (HSPVMState *)&state->vm;
-    if(state == NULL) {
-      myDebug(1, "agentCB_getCounters_KVM: state==NULL");
-      return;
+  static void virTimersRun(EVMod *mod, bool zeroOnly) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    uint64_t now_mS = virNow_mS(mod);
+    // (callbacks may add timers, so index every time)
+    for(uint32_t ii = 0; ii < UTArrayN(mdata->virTimers); ii++) {
+      HSPVirTimer *timer = (HSPVirTimer *)UTArrayAt(mdata->virTimers, ii);
+      if(timer == NULL
+	 || timer->deleted
+	 || timer->frequency_mS < 0
+	 || (zeroOnly && timer->frequency_mS != 0)
+	 || now_mS < timer->due_mS)
+	continue;
+      timer->due_mS = now_mS + timer->frequency_mS;
+      (*timer->cb)(timer->id, timer->opaque);
     }
+  }
 
-    if(mdata->virConn) {
-      virDomainPtr domainPtr = virDomainLookupByID(mdata->virConn, state->virDomainId);
-      if(domainPtr == NULL) {
-	sp->refreshVMList = YES;
-      }
-      else {
-	// host ID
-	SFLCounters_sample_element hidElem = { 0 };
-	hidElem.tag = SFLCOUNTERS_HOST_HID;
-	const char *hname = virDomainGetName(domainPtr); // no need to free this one
-	if(hname) {
-	  // copy the name out here so we can free it straight away
-	  hidElem.counterBlock.host_hid.hostname.str = (char *)hname;
-	  hidElem.counterBlock.host_hid.hostname.len = strlen(hname);
-	  virDomainGetUUID(domainPtr, hidElem.counterBlock.host_hid.uuid);
-
-	  // char *osType = virDomainGetOSType(domainPtr); $$$
-	  hidElem.counterBlock.host_hid.machine_type = SFLMT_unknown;//$$$
-	  hidElem.counterBlock.host_hid.os_name = SFLOS_unknown;//$$$
-	  //hidElem.counterBlock.host_hid.os_release.str = NULL;
-	  //hidElem.counterBlock.host_hid.os_release.len = 0;
-	  SFLADD_ELEMENT(cs, &hidElem);
-	}
+  static void virWatchRead(EVMod *mod, EVSocket *sock, void *magic) {
+    HSPVirWatch *watch = (HSPVirWatch *)magic;
+    if(!watch->deleted
+       && (watch->events & VIR_EVENT_HANDLE_READABLE))
+      (*watch->cb)(watch->id, watch->fd, VIR_EVENT_HANDLE_READABLE, watch->opaque);
+    virTimersRun(mod, YES);
+  }
 
-	// host parent
-	SFLCounters_sample_element parElem = { 0 };
-	parElem.tag = SFLCOUNTERS_HOST_PAR;
-	parElem.counterBlock.host_par.dsClass = SFL_DSCLASS_PHYSICAL_ENTITY;
-	parElem.counterBlock.host_par.dsIndex = HSP_DEFAULT_PHYSICAL_DSINDEX;
-	SFLADD_ELEMENT(cs, &parElem);
-
-	// VM Net I/O
-	SFLCounters_sample_element nioElem = { 0 };
-	nioElem.tag = SFLCOUNTERS_HOST_VRT_NIO;
-	// since we are already maintaining the accumulated network counters (and handling issues like 32-bit
-	// rollover) then we can just use the same mechanism again.  On a non-linux platform we may
-	// want to take advantage of the libvirt call to get the counters (it takes the domain id and the
-	// device name as parameters so you have to call it multiple times),  but even then we would
-	// probably do that down inside the readNioCounters() fn in case there is work to do on the
-	// accumulation and rollover-detection.
-	readNioCounters(sp, (SFLHost_nio_counters *)&nioElem.counterBlock.host_vrt_nio, NULL, vm->interfaces);
-	SFLADD_ELEMENT(cs, &nioElem);
-
-	// VM cpu counters [ref xenstat.c]
-	SFLCounters_sample_element cpuElem = { 0 };
-	cpuElem.tag = SFLCOUNTERS_HOST_VRT_CPU;
-	virDomainInfo domainInfo;
-	int domainInfoOK = NO;
-	if(virDomainGetInfo(domainPtr, &domainInfo) != 0) {
-	  myLog(LOG_ERR, "virDomainGetInfo() failed");
-	}
-	else {
-	  domainInfoOK = YES;
-	  // enum virDomainState really is the same as enum SFLVirDomainState
-	  cpuElem.counterBlock.host_vrt_cpu.state = domainInfo.state;
-	  cpuElem.counterBlock.host_vrt_cpu.cpuTime = (domainInfo.cpuTime / 1000000);
-	  cpuElem.counterBlock.host_vrt_cpu.nrVirtCpu = domainInfo.nrVirtCpu;
-	  SFLADD_ELEMENT(cs, &cpuElem);
-	}
+  // keep an EVBus socket only while libvirt wants to read, otherwise
+  // select() would keep waking us up for input nobody will consume
+  static void virWatchSync(EVMod *mod, HSPVirWatch *watch) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    bool wantRead = (!watch->deleted
+		     && (watch->events & VIR_EVENT_HANDLE_READABLE));
+    if(wantRead
+       && watch->sock == NULL)
+      watch->sock = EVBusAddSocket(mod, mdata->pollBus, watch->fd, virWatchRead, watch);
+    else if(!wantRead
+	    && watch->sock) {
+      EVSocketClose(mod, watch->sock, NO); // libvirt owns the fd
+      watch->sock = NULL;
+    }
+  }
 
-	SFLCounters_sample_element memElem = { 0 };
-	memElem.tag = SFLCOUNTERS_HOST_VRT_MEM;
-	if(domainInfoOK) {
-	  memElem.counterBlock.host_vrt_mem.memory = domainInfo.memory * 1024;
-	  memElem.counterBlock.host_vrt_mem.maxMemory = (domainInfo.maxMem == UINT_MAX) ? -1 : (domainInfo.maxMem * 1024);
-	  SFLADD_ELEMENT(cs, &memElem);
-	}
+  static HSPVirWatch *virWatchGet(EVMod *mod, int id) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSPVirWatch *watch;
+    UTARRAY_WALK(mdata->virWatches, watch) {
+      if(watch->id == id
+	 && !watch->deleted)
+	return watch;
+    }
+    return NULL;
+  }
 
-	// VM disk I/O counters
-	SFLCounters_sample_element dskElem = { 0 };
-	dskElem.tag = SFLCOUNTERS_HOST_VRT_DSK;
-	for(int i = strArrayN(vm->disks); --i >= 0; ) {
-	  /* vm->volumes and vm->disks are populated in lockstep
-	   * so they always have the same number of elements
-	   */
-	  char *volPath = strArrayAt(vm->volumes, i);
-	  char *dskPath = strArrayAt(vm->disks, i);
-	  bool gotVolInfo = NO;
-
-#if (LIBVIR_VERSION_NUMBER >= 8001)
-	  if(gotVolInfo == NO) {
-	    /* try appealing directly to the disk path instead */
-	    /* this call was only added in April 2010 (version 0.8.1).
-	     * See http://markmail.org/message/mjafgt47f5e5zzfc
-	     */
-	    virDomainBlockInfo blkInfo;
-	    if(virDomainGetBlockInfo(domainPtr, volPath, &blkInfo, 0) == -1) {
-	      myLog(LOG_ERR, "virDomainGetBlockInfo(%s) failed", dskPath);
-	    }
-	    else {
-	      dskElem.counterBlock.host_vrt_dsk.capacity += blkInfo.capacity;
-	      dskElem.counterBlock.host_vrt_dsk.allocation += blkInfo.allocation;
-	      dskElem.counterBlock.host_vrt_dsk.available += (blkInfo.capacity - blkInfo.allocation);
-	      // don't need blkInfo.physical
-	      gotVolInfo = YES;
-	    }
-	  }
-#endif
+  static HSPVirTimer *virTimerGet(EVMod *mod, int id) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSPVirTimer *timer;
+    UTARRAY_WALK(mdata->virTimers, timer) {
+      if(timer->id == id
+	 && !timer->deleted)
+	return timer;
+    }
+    return NULL;
+  }
 
-	  if(gotVolInfo == NO) {
-	    virStorageVolPtr volPtr = virStorageVolLookupByPath(mdata->virConn, volPath);
-	    if(volPtr == NULL) {
-	      myLog(LOG_ERR, "virStorageLookupByPath(%s) failed", volPath);
-	    }
-	    else {
-	      virStorageVolInfo volInfo;
-	      if(virStorageVolGetInfo(volPtr, &volInfo) != 0) {
-		myLog(LOG_ERR, "virStorageVolGetInfo(%s) failed", volPath);
-	      }
-	      else {
-		gotVolInfo = YES;
-		dskElem.counterBlock.host_vrt_dsk.capacity += volInfo.capacity;
-		dskElem.counterBlock.host_vrt_dsk.allocation += volInfo.allocation;
-		dskElem.counterBlock.host_vrt_dsk.available += (volInfo.capacity - volInfo.allocation);
-	      }
-	    }
-	  }
+  static int virAddHandle(int fd, int event, virEventHandleCallback cb, void *opaque, virFreeCallback ff) {
+    EVMod *mod = virEventMod;
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSPVirWatch *watch = (HSPVirWatch *)my_calloc(sizeof(HSPVirWatch));
+    watch->id = ++mdata->virNextId;
+    watch->fd = fd;
+    watch->events = event;
+    watch->cb = cb;
+    watch->opaque = opaque;
+    watch->ff = ff;
+    UTArrayAdd(mdata->virWatches, watch);
+    virWatchSync(mod, watch);
+    myDebug(1, "kvm: libvirt add handle %d fd=%d events=0x%x", watch->id, fd, event);
+    return watch->id;
+  }
 
-	  /* we get reads, writes and errors from a different call */
-	  virDomainBlockStatsStruct blkStats;
-	  if(virDomainBlockStats(domainPtr, dskPath, &blkStats, sizeof(blkStats)) != -1) {
-	    if(blkStats.rd_req != -1) dskElem.counterBlock.host_vrt_dsk.rd_req += blkStats.rd_req;
-	    if(blkStats.rd_bytes != -1) dskElem.counterBlock.host_vrt_dsk.rd_bytes += blkStats.rd_bytes;
-	    if(blkStats.wr_req != -1) dskElem.counterBlock.host_vrt_dsk.wr_req += blkStats.wr_req;
-	    if(blkStats.wr_bytes != -1) dskElem.counterBlock.host_vrt_dsk.wr_bytes += blkStats.wr_bytes;
-	    if(blkStats.errs != -1) dskElem.counterBlock.host_vrt_dsk.errs += blkStats.errs;
-	  }
-	}
-	SFLADD_ELEMENT(cs, &dskElem);
-
-	// include my slice of the adaptor list
-	SFLCounters_sample_element adaptorsElem = { 0 };
-	adaptorsElem.tag = SFLCOUNTERS_ADAPTORS;
-	adaptorsElem.counterBlock.adaptors = vm->interfaces;
-	SFLADD_ELEMENT(cs, &adaptorsElem);
-
-	SEMLOCK_DO(sp->sync_agent) {
-	  sfl_poller_writeCountersSample(poller, cs);
-	  sp->counterSampleQueued = YES;
-	  sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
-	}
+  static void virUpdateHandle(int id, int event) {
+    EVMod *mod = virEventMod;
+    HSPVirWatch *watch = virWatchGet(mod, id);
+    if(watch) {
+      watch->events = event;
+      virWatchSync(mod, watch);
+    }
+  }
+
+  static int virRemoveHandle(int id) {
+    EVMod *mod = virEventMod;
+    HSPVirWatch *watch = virWatchGet(mod, id);
+    if(watch == NULL)
+      return -1;
+    myDebug(1, "kvm: libvirt remove handle %d fd=%d", id, watch->fd);
+    watch->deleted = YES;
+    virWatchSync(mod, watch);
+    return 0;
+  }
+
+  static int virAddTimeout(int frequency, virEventTimeoutCallback cb, void *opaque, virFreeCallback ff) {
+    EVMod *mod = virEventMod;
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSPVirTimer *timer = (HSPVirTimer *)my_calloc(sizeof(HSPVirTimer));
+    timer->id = ++mdata->virNextId;
+    timer->frequency_mS = frequency;
+    timer->due_mS = virNow_mS(mod) + ((frequency > 0) ? frequency : 0);
+    timer->cb = cb;
+    timer->opaque = opaque;
+    timer->ff = ff;
+    UTArrayAdd(mdata->virTimers, timer);
+    return timer->id;
+  }
+
+  static void virUpdateTimeout(int id, int frequency) {
+    EVMod *mod = virEventMod;
+    HSPVirTimer *timer = virTimerGet(mod, id);
+    if(timer) {
+      timer->frequency_mS = frequency;
+      timer->due_mS = virNow_mS(mod) + ((frequency > 0) ? frequency : 0);
+    }
+  }
+
+  static int virRemoveTimeout(int id) {
+    EVMod *mod = virEventMod;
+    HSPVirTimer *timer = virTimerGet(mod, id);
+    if(timer == NULL)
+      return -1;
+    timer->deleted = YES;
+    return 0;
+  }
 
-	virDomainFree(domainPtr);
+  static void virEventPurge(EVMod *mod) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSPVirWatch *watch;
+    UTARRAY_WALK(mdata->virWatches, watch) {
+      if(watch->deleted) {
+	UTArrayDel(mdata->virWatches, watch);
+	if(watch->ff)
+	  (*watch->ff)(watch->opaque);
+	my_free(watch);
       }
     }
+    UTArrayPack(mdata->virWatches);
+    HSPVirTimer *timer;
+    UTARRAY_WALK(mdata->virTimers, timer) {
+      if(timer->deleted) {
+	UTArrayDel(mdata->virTimers, timer);
+	if(timer->ff)
+	  (*timer->ff)(timer->opaque);
+	my_free(timer);
+      }
+    }
+    UTArrayPack(mdata->virTimers);
+  }
+
+  static void evt_deci(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    virEventPurge(mod);
+    for(uint32_t ii = 0; ii < UTArrayN(mdata->virWatches); ii++) {
+      HSPVirWatch *watch = (HSPVirWatch *)UTArrayAt(mdata->virWatches, ii);
+      if(watch
+	 && !watch->deleted
+	 && (watch->events & VIR_EVENT_HANDLE_WRITABLE))
+	(*watch->cb)(watch->id, watch->fd, VIR_EVENT_HANDLE_WRITABLE, watch->opaque);
+    }
+    virTimersRun(mod, NO);
+  }
+
+  /*_________________---------------------------__________________
+    _________________    domain stats           __________________
+    -----------------___________________________------------------
+    All the counters come from one virConnectGetAllDomainStats() call
+    per poll cycle, as typed parameters such as "cpu.time" or
+    "block.<n>.rd.bytes". The vNIC counters are still read locally
+    from the adaptors (readNioCounters), so those stats are not asked for.
+  */
+
+#define HSP_KVM_DOMAIN_STATS (VIR_DOMAIN_STATS_STATE		\
+			      | VIR_DOMAIN_STATS_CPU_TOTAL	\
+			      | VIR_DOMAIN_STATS_BALLOON	\
+			      | VIR_DOMAIN_STATS_VCPU		\
+			      | VIR_DOMAIN_STATS_BLOCK)
+
+  static uint64_t domainStat64(virDomainStatsRecordPtr rec, char *name, bool *found) {
+    unsigned long long val = 0;
+    int ok = virTypedParamsGetULLong(rec->params, rec->nparams, name, &val);
+    if(found) *found = (ok == 1);
+    return (ok == 1) ? val : 0;
+  }
+
+  static uint64_t blockStat64(virDomainStatsRecordPtr rec, uint32_t blk, char *field) {
+    char name[64];
+    snprintf(name, sizeof(name), "block.%u.%s", blk, field);
+    return domainStat64(rec, name, NULL);
+  }
+
+  static void agentCB_getCounters_KVM(EVMod *mod, SFLPoller *poller, virDomainStatsRecordPtr rec)
+  {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPVMState_KVM *state = (HSPVMState_KVM *)poller->userData;
+    HSPVMState *vm = (HSPVMState *)&state->vm;
+    SFL_COUNTERS_SAMPLE_TYPE cs = { 0 };
+
+    // host ID
+    SFLCounters_sample_element hidElem = { 0 };
+    hidElem.tag = SFLCOUNTERS_HOST_HID;
+    const char *hname = virDomainGetName(rec->dom); // no need to free this one
+    if(hname) {
+      hidElem.counterBlock.host_hid.hostname.str = (char *)hname;
+      hidElem.counterBlock.host_hid.hostname.len = strlen(hname);
+      memcpy(hidElem.counterBlock.host_hid.uuid, vm->uuid, 16);
+      hidElem.counterBlock.host_hid.machine_type = SFLMT_unknown;//$$$
+      hidElem.counterBlock.host_hid.os_name = SFLOS_unknown;//$$$
+      SFLADD_ELEMENT(&cs, &hidElem);
+    }
+
+    // host parent
+    SFLCounters_sample_element parElem = { 0 };
+    parElem.tag = SFLCOUNTERS_HOST_PAR;
+    parElem.counterBlock.host_par.dsClass = SFL_DSCLASS_PHYSICAL_ENTITY;
+    parElem.counterBlock.host_par.dsIndex = HSP_DEFAULT_PHYSICAL_DSINDEX;
+    SFLADD_ELEMENT(&cs, &parElem);
+
+    // VM Net I/O
+    SFLCounters_sample_element nioElem = { 0 };
+    nioElem.tag = SFLCOUNTERS_HOST_VRT_NIO;
+    // since we are already maintaining the accumulated network counters (and handling issues like 32-bit
+    // rollover) then we can just use the same mechanism again.
+    readNioCounters(sp, (SFLHost_nio_counters *)&nioElem.counterBlock.host_vrt_nio, NULL, vm->interfaces);
+    SFLADD_ELEMENT(&cs, &nioElem);
+
+    // VM cpu counters [ref xenstat.c]
+    SFLCounters_sample_element cpuElem = { 0 };
+    cpuElem.tag = SFLCOUNTERS_HOST_VRT_CPU;
+    int domState = 0;
+    if(virTypedParamsGetInt(rec->params, rec->nparams, "state.state", &domState) == 1) {
+      // enum virDomainState really is the same as enum SFLVirDomainState
+      cpuElem.counterBlock.host_vrt_cpu.state = domState;
+      cpuElem.counterBlock.host_vrt_cpu.cpuTime = (domainStat64(rec, "cpu.time", NULL) / 1000000);
+      unsigned int nrVirtCpu = 0;
+      virTypedParamsGetUInt(rec->params, rec->nparams, "vcpu.current", &nrVirtCpu);
+      cpuElem.counterBlock.host_vrt_cpu.nrVirtCpu = nrVirtCpu;
+      SFLADD_ELEMENT(&cs, &cpuElem);
+    }
+
+    SFLCounters_sample_element memElem = { 0 };
+    memElem.tag = SFLCOUNTERS_HOST_VRT_MEM;
+    bool gotBalloon = NO;
+    uint64_t memKB = domainStat64(rec, "balloon.current", &gotBalloon);
+    if(gotBalloon) {
+      bool gotMax = NO;
+      uint64_t maxKB = domainStat64(rec, "balloon.maximum", &gotMax);
+      memElem.counterBlock.host_vrt_mem.memory = memKB * 1024;
+      memElem.counterBlock.host_vrt_mem.maxMemory = gotMax ? (maxKB * 1024) : -1;
+      SFLADD_ELEMENT(&cs, &memElem);
+    }
+
+    // VM disk I/O counters - just the disks we kept from the XML
+    // (so not the readonly ones), matched by target dev.
+    SFLCounters_sample_element dskElem = { 0 };
+    dskElem.tag = SFLCOUNTERS_HOST_VRT_DSK;
+    unsigned int nBlocks = 0;
+    virTypedParamsGetUInt(rec->params, rec->nparams, "block.count", &nBlocks);
+    for(uint32_t blk = 0; blk < nBlocks; blk++) {
+      char name[64];
+      const char *dev = NULL;
+      snprintf(name, sizeof(name), "block.%u.name", blk);
+      if(virTypedParamsGetString(rec->params, rec->nparams, name, &dev) != 1
+	 || strArrayIndexOf(vm->disks, (char *)dev) < 0)
+	continue;
+      uint64_t capacity = blockStat64(rec, blk, "capacity");
+      uint64_t allocation = blockStat64(rec, blk, "allocation");
+      dskElem.counterBlock.host_vrt_dsk.capacity += capacity;
+      dskElem.counterBlock.host_vrt_dsk.allocation += allocation;
+      dskElem.counterBlock.host_vrt_dsk.available += (capacity - allocation);
+      dskElem.counterBlock.host_vrt_dsk.rd_req += blockStat64(rec, blk, "rd.reqs");
+      dskElem.counterBlock.host_vrt_dsk.rd_bytes += blockStat64(rec, blk, "rd.bytes");
+      dskElem.counterBlock.host_vrt_dsk.wr_req += blockStat64(rec, blk, "wr.reqs");
+      dskElem.counterBlock.host_vrt_dsk.wr_bytes += blockStat64(rec, blk, "wr.bytes");
+      dskElem.counterBlock.host_vrt_dsk.errs += blockStat64(rec, blk, "errors");
+    }
+    SFLADD_ELEMENT(&cs, &dskElem);
+
+    // include my slice of the adaptor list
+    SFLCounters_sample_element adaptorsElem = { 0 };
+    adaptorsElem.tag = SFLCOUNTERS_ADAPTORS;
+    adaptorsElem.counterBlock.adaptors = vm->interfaces;
+    SFLADD_ELEMENT(&cs, &adaptorsElem);
+
+    SEMLOCK_DO(sp->sync_agent) {
+      sfl_poller_writeCountersSample(poller, &cs);
+      sp->counterSampleQueued = YES;
+      telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
+    }
   }
 
   /*_________________--------------------------------------__________________
@@ -309,6 +502,7 @@ extern "C" {
 		// This may be a mistake since ifIndex is unknown
 		if(UTHashAdd(sp->adaptorsByMac, adaptor) != NULL)
 		  myDebug(1, "Warning: kvm adaptor overwriting adaptorsByMac");
+		requestAdaptorLookup(sp);
 	      }
 	      adaptorListAdd(state->vm.interfaces, adaptor);
 	    }
@@ -359,6 +553,8 @@ extern "C" {
 	  state->vm.dsIndex,
 	  state->virDomainId);
     UTHashDel(mdata->vmsByUUID, state);
+    // in case it was due to be polled
+    UTArrayDel(mdata->pollActions, state->vm.poller);
     HSPVMState *vm = &state->vm;
     removeAndFreeVM(mod, vm);
   }
@@ -368,67 +564,79 @@ extern "C" {
     -----------------___________________________------------------
   */
 
+  static void domainReadXML(EVMod *mod, HSPVMState_KVM *state, virDomainPtr domainPtr) {
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPVMState *vm = (HSPVMState *)&state->vm;
+    myDebug(1, "kvm: reading XML for domain %u", state->virDomainId);
+    // reset the information that we are about to refresh
+    adaptorListMarkAll(vm->interfaces);
+    strArrayReset(vm->volumes);
+    strArrayReset(vm->disks);
+    // get the XML descr - this seems more portable than some of
+    // the newer libvert API calls,  such as those to list interfaces
+    char *xmlstr = virDomainGetXMLDesc(domainPtr, 0 /*VIR_DOMAIN_XML_SECURE not allowed for read-only */);
+    if(xmlstr == NULL) {
+      myLog(LOG_ERR, "virDomainGetXMLDesc(domain=%u, 0) failed", state->virDomainId);
+    }
+    else {
+      // parse the XML to get the list of interfaces and storage nodes
+      xmlDoc *doc = xmlParseMemory(xmlstr, strlen(xmlstr));
+      if(doc) {
+	xmlNode *rootNode = xmlDocGetRootElement(doc);
+	domain_xml_node(sp, rootNode, state);
+	xmlFreeDoc(doc);
+      }
+      free(xmlstr); // allocated by virDomainGetXMLDesc()
+    }
+    xmlCleanupParser();
+    // fully delete and free the marked adaptors - some may return if
+    // they are still present in the global-namespace list,  but
+    // we have to do this here in case one of these was discovered
+    // and allocated just for this VM.
+    deleteMarkedAdaptors_adaptorList(sp, vm->interfaces);
+    adaptorListFreeMarked(vm->interfaces);
+  }
+
+  static void configDomain(EVMod *mod, virDomainPtr domainPtr) {
+    char uuid[16];
+    virDomainGetUUID(domainPtr, (u_char *)uuid);
+    int domId = virDomainGetID(domainPtr);
+    HSPVMState_KVM *state = getVM_KVM(mod, uuid);
+    if(state) {
+      HSPVMState *vm = (HSPVMState *)&state->vm;
+      vm->marked = NO;
+      // The XML (interfaces and disks) is cached, and only read
+      // again if this is a new VM or it was restarted (new domId),
+      // or when a device is added or removed.
+      if(vm->created
+	 || state->virDomainId != domId) {
+	state->virDomainId = domId;
+	domainReadXML(mod, state, domainPtr);
+      }
+      vm->created = NO;
+    }
+  }
+
   static void configVMs_KVM(EVMod *mod) {
     HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
-    HSP *sp = (HSP *)EVROOTDATA(mod);
     if(mdata->virConn == NULL) {
       // no libvirt connection
       return;
     }
-    int num_domains = virConnectNumOfDomains(mdata->virConn);
-    if(num_domains == -1) {
-      myLog(LOG_ERR, "virConnectNumOfDomains() returned -1");
-      return;
-    }
-    int *domainIds = (int *)my_calloc(num_domains * sizeof(int));
-    if(virConnectListDomains(mdata->virConn, domainIds, num_domains) != num_domains) {
-      my_free(domainIds);
+    // one call for the running domains, and the uuid and id
+    // come with each virDomainPtr so no per-domain lookups.
+    virDomainPtr *domains = NULL;
+    int num_domains = virConnectListAllDomains(mdata->virConn, &domains, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+    if(num_domains < 0) {
+      myLog(LOG_ERR, "virConnectListAllDomains() returned %d", num_domains);
       return;
     }
     for(int i = 0; i < num_domains; i++) {
-      int domId = domainIds[i];
-      virDomainPtr domainPtr = virDomainLookupByID(mdata->virConn, domId);
-      if(domainPtr) {
-	char uuid[16];
-	virDomainGetUUID(domainPtr, (u_char *)uuid);
-	HSPVMState_KVM *state = getVM_KVM(mod, uuid);
-	HSPVMState *vm = (HSPVMState *)&state->vm;
-	vm->marked = NO;
-	vm->created = NO;
-	// remember the domId, which might have changed (if vm rebooted)
-	state->virDomainId = domId;
-	// reset the information that we are about to refresh
-	adaptorListMarkAll(vm->interfaces);
-	strArrayReset(vm->volumes);
-	strArrayReset(vm->disks);
-	// get the XML descr - this seems more portable than some of
-	// the newer libvert API calls,  such as those to list interfaces
-	char *xmlstr = virDomainGetXMLDesc(domainPtr, 0 /*VIR_DOMAIN_XML_SECURE not allowed for read-only */);
-	if(xmlstr == NULL) {
-	  myLog(LOG_ERR, "virDomainGetXMLDesc(domain=%u, 0) failed", domId);
-	}
-	else {
-	  // parse the XML to get the list of interfaces and storage nodes
-	  xmlDoc *doc = xmlParseMemory(xmlstr, strlen(xmlstr));
-	  if(doc) {
-	    xmlNode *rootNode = xmlDocGetRootElement(doc);
-	    domain_xml_node(sp, rootNode, state);
-	    xmlFreeDoc(doc);
-	  }
-	  free(xmlstr); // allocated by virDomainGetXMLDesc()
-	}
-	xmlCleanupParser();
-	virDomainFree(domainPtr);
-	// fully delete and free the marked adaptors - some may return if
-	// they are still present in the global-namespace list,  but
-	// we have to do this here in case one of these was discovered
-	// and allocated just for this VM.
-	deleteMarkedAdaptors_adaptorList(sp, vm->interfaces);
-	adaptorListFreeMarked(vm->interfaces);
-      }
+      configDomain(mod, domains[i]);
+      virDomainFree(domains[i]);
     }
+    free(domains); // allocated by virConnectListAllDomains()
     mdata->num_domains = num_domains;
-    my_free(domainIds);
   }
 
   /*_________________---------------------------__________________
@@ -436,6 +644,8 @@ extern "C" {
     -----------------___________________________------------------
   */
 
+  static void registerEvents(EVMod *mod);
+
   static virConnectPtr getConnection(EVMod *mod) {
     HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
     if(mdata->virConn == NULL) {
@@ -443,10 +653,121 @@ extern "C" {
       if(mdata->virConn == NULL) {
 	myLog(LOG_ERR, "virConnectOpenReadOnly() failed\n");
       }
+      else
+	registerEvents(mod);
     }
     return mdata->virConn;
   }
 
+  static void connCloseCB(virConnectPtr conn, int reason, void *opaque);
+
+  static void closeConnection(EVMod *mod) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    if(mdata->virConn == NULL)
+      return;
+    if(mdata->lifecycleCB >= 0)
+      virConnectDomainEventDeregisterAny(mdata->virConn, mdata->lifecycleCB);
+    if(mdata->deviceAddedCB >= 0)
+      virConnectDomainEventDeregisterAny(mdata->virConn, mdata->deviceAddedCB);
+    if(mdata->deviceRemovedCB >= 0)
+      virConnectDomainEventDeregisterAny(mdata->virConn, mdata->deviceRemovedCB);
+    mdata->lifecycleCB = mdata->deviceAddedCB = mdata->deviceRemovedCB = -1;
+    // or libvirt could still call it after we have let go
+    if(mdata->closeCBRegistered)
+      virConnectUnregisterCloseCallback(mdata->virConn, connCloseCB);
+    mdata->closeCBRegistered = NO;
+    virConnectClose(mdata->virConn);
+    mdata->virConn = NULL;
+    mdata->eventsOK = NO;
+    mdata->connLost = NO;
+  }
+
+  /*_________________---------------------------__________________
+    _________________    domain events          __________________
+    -----------------___________________________------------------
+    VMs are added and removed as libvirtd tells us they start and
+    stop, and their XML is read again when a device is hot-plugged.
+    With events there is no periodic rescan: only a full one after
+    (re)connecting, or if the bulk stats ever miss a VM we know about.
+  */
+
+  static HSPVMState_KVM *getDomainVM(EVMod *mod, virDomainPtr dom) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSPVMState_KVM search;
+    memset(&search, 0, sizeof(search));
+    virDomainGetUUID(dom, (u_char *)search.vm.uuid);
+    return UTHashGet(mdata->vmsByUUID, &search);
+  }
+
+  static int domainLifecycleCB(virConnectPtr conn, virDomainPtr dom, int event, int detail, void *opaque) {
+    EVMod *mod = (EVMod *)opaque;
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    myDebug(1, "kvm: domain %s event=%d detail=%d", virDomainGetName(dom), event, detail);
+    HSPVMState_KVM *state;
+    switch(event) {
+    case VIR_DOMAIN_EVENT_STARTED:
+    case VIR_DOMAIN_EVENT_RESUMED:
+      configDomain(mod, dom);
+      break;
+    case VIR_DOMAIN_EVENT_STOPPED:
+      if((state = getDomainVM(mod, dom)) != NULL)
+	removeAndFreeVM_KVM(mod, state);
+      break;
+    default:
+      break;
+    }
+    mdata->num_domains = UTHashN(mdata->vmsByUUID);
+    return 0;
+  }
+
+  static void domainDeviceCB(virConnectPtr conn, virDomainPtr dom, const char *devAlias, void *opaque) {
+    EVMod *mod = (EVMod *)opaque;
+    myDebug(1, "kvm: domain %s device %s added/removed", virDomainGetName(dom), devAlias);
+    HSPVMState_KVM *state = getDomainVM(mod, dom);
+    if(state)
+      domainReadXML(mod, state, dom);
+  }
+
+  static void connCloseCB(virConnectPtr conn, int reason, void *opaque) {
+    EVMod *mod = (EVMod *)opaque;
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    myLog(LOG_INFO, "kvm: libvirt connection closed (reason=%d)", reason);
+    // not safe to close it from in here
+    mdata->connLost = YES;
+  }
+
+  static void registerEvents(EVMod *mod) {
+    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    mdata->lifecycleCB = virConnectDomainEventRegisterAny(mdata->virConn,
+							  NULL,
+							  VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+							  VIR_DOMAIN_EVENT_CALLBACK(domainLifecycleCB),
+							  mod,
+							  NULL);
+#if (LIBVIR_VERSION_NUMBER >= 1002015)
+    mdata->deviceAddedCB = virConnectDomainEventRegisterAny(mdata->virConn,
+							    NULL,
+							    VIR_DOMAIN_EVENT_ID_DEVICE_ADDED,
+							    VIR_DOMAIN_EVENT_CALLBACK(domainDeviceCB),
+							    mod,
+							    NULL);
+#endif
+    mdata->deviceRemovedCB = virConnectDomainEventRegisterAny(mdata->virConn,
+							      NULL,
+							      VIR_DOMAIN_EVENT_ID_DEVICE_REMOVED,
+							      VIR_DOMAIN_EVENT_CALLBACK(domainDeviceCB),
+							      mod,
+							      NULL);
+    mdata->closeCBRegistered = (virConnectRegisterCloseCallback(mdata->virConn, connCloseCB, mod, NULL) == 0);
+    // so that a dead libvirtd is noticed even when we are not calling it
+    virConnectSetKeepAlive(mdata->virConn, 5, 3);
+    mdata->eventsOK = (mdata->lifecycleCB >= 0);
+    if(mdata->eventsOK)
+      myDebug(1, "kvm: subscribed to domain events");
+    else
+      myLog(LOG_ERR, "kvm: virConnectDomainEventRegisterAny() failed - will rescan every %u seconds", mdata->refreshVMListSecs);
+  }
+
   /*_________________---------------------------__________________
     _________________    configVMs              __________________
     -----------------___________________________------------------
@@ -480,21 +801,75 @@ extern "C" {
     HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
     HSP *sp = (HSP *)EVROOTDATA(mod);
     time_t clk = evt->bus->now.tv_sec;
-    if(clk >= mdata->next_refreshVMList
-       && sp->sFlowSettings) {
+    if(mdata->connLost) {
+      // libvirtd restarted or went away: reconnect (and rescan) now
+      closeConnection(mod);
+      mdata->next_refreshVMList = clk;
+    }
+    if(sp->sFlowSettings == NULL)
+      return;
+    if(mdata->rescan
+       || (clk >= mdata->next_refreshVMList
+	   && !mdata->eventsOK)) {
+      // full rescan: on startup, on reconnect, if a VM went missing
+      // or all the time if we could not subscribe to events.
+      mdata->rescan = NO;
       configVMs(mod);
+      mdata->num_domains = UTHashN(mdata->vmsByUUID);
       mdata->next_refreshVMList = clk + mdata->refreshVMListSecs;
     }
   }
 
   static void evt_tock(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
     // now we can execute pollActions without holding on to the semaphore
-    for(uint32_t ii = 0; ii < UTArrayN(mdata->pollActions); ii++) {
-      SFLPoller *poller = (SFLPoller *)UTArrayAt(mdata->pollActions, ii);
-      SFL_COUNTERS_SAMPLE_TYPE cs;
-      memset(&cs, 0, sizeof(cs));
-      agentCB_getCounters_KVM((void *)mod, poller, &cs);
+    if(UTArrayN(mdata->pollActions) == 0)
+      return;
+    if(mdata->virConn) {
+      // one round-trip to libvirtd for every domain's counters
+      virDomainStatsRecordPtr *records = NULL;
+      uint64_t start_nS = latencyClock_nS();
+      int nRecords = virConnectGetAllDomainStats(mdata->virConn,
+						 HSP_KVM_DOMAIN_STATS,
+						 &records,
+						 VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+      latencyRecord(sp, mod, HSP_LATENCY_KVM_STATS, latencyClock_nS() - start_nS);
+      if(nRecords < 0) {
+	myLog(LOG_ERR, "virConnectGetAllDomainStats() failed");
+	mdata->rescan = YES;
+      }
+      else {
+	// hand each record to its VM
+	for(int ii = 0; ii < nRecords; ii++) {
+	  HSPVMState_KVM search;
+	  memset(&search, 0, sizeof(search));
+	  virDomainGetUUID(records[ii]->dom, (u_char *)search.vm.uuid);
+	  HSPVMState_KVM *state = UTHashGet(mdata->vmsByUUID, &search);
+	  if(state)
+	    state->stats = records[ii];
+	}
+	for(uint32_t ii = 0; ii < UTArrayN(mdata->pollActions); ii++) {
+	  SFLPoller *poller = (SFLPoller *)UTArrayAt(mdata->pollActions, ii);
+	  if(poller == NULL)
+	    continue;
+	  HSPVMState_KVM *state = (HSPVMState_KVM *)poller->userData;
+	  if(state == NULL) {
+	    myDebug(1, "agentCB_getCounters_KVM: state==NULL");
+	    continue;
+	  }
+	  if(state->stats == NULL) {
+	    // domain has gone, but we missed the event?
+	    mdata->rescan = YES;
+	    continue;
+	  }
+	  agentCB_getCounters_KVM(mod, poller, state->stats);
+	}
+	HSPVMState_KVM *state;
+	UTHASH_WALK(mdata->vmsByUUID, state)
+	  state->stats = NULL;
+	virDomainStatsRecordListFree(records);
+      }
     }
     UTArrayReset(mdata->pollActions);
   }
@@ -518,11 +893,7 @@ extern "C" {
   }
 
   static void evt_final(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
-    HSP_mod_KVM *mdata = (HSP_mod_KVM *)mod->data;
-    if(mdata->virConn) {
-      virConnectClose(mdata->virConn);
-      mdata->virConn = NULL;
-    }
+    closeConnection(mod);
   }
 
   /*_________________---------------------------__________________
@@ -547,16 +918,31 @@ extern "C" {
 
     mdata->vmsByUUID = UTHASH_NEW(HSPVMState_KVM, vm.uuid, UTHASH_DFLT);
     mdata->pollActions = UTArrayNew(UTARRAY_DFLT);
+    mdata->virWatches = UTArrayNew(UTARRAY_DFLT);
+    mdata->virTimers = UTArrayNew(UTARRAY_DFLT);
+    mdata->lifecycleCB = mdata->deviceAddedCB = mdata->deviceRemovedCB = -1;
+    mdata->rescan = YES;
+    mdata->pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
+
+    // libvirt's events come through our event loop, which must be
+    // registered before the connection is opened
+    virEventMod = mod;
+    virEventRegisterImpl(virAddHandle,
+			 virUpdateHandle,
+			 virRemoveHandle,
+			 virAddTimeout,
+			 virUpdateTimeout,
+			 virRemoveTimeout);
 
     mdata->refreshVMListSecs = sp->kvm.refreshVMListSecs ?: sp->refreshVMListSecs;
     mdata->forgetVMSecs = sp->kvm.forgetVMSecs ?: sp->forgetVMSecs;
 
     // register call-backs
-    EVBus *pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
-    EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_TICK), evt_tick);
-    EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_TOCK), evt_tock);
-    EVEventRx(mod, EVGetEvent(pollBus, HSPEVENT_HOST_COUNTER_SAMPLE), evt_host_cs);
-    EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_FINAL), evt_final);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_TICK), evt_tick);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_TOCK), evt_tock);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_DECI), evt_deci);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, HSPEVENT_HOST_COUNTER_SAMPLE), evt_host_cs);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_FINAL), evt_final);
   }
 
 #if defined(__cplusplus)
@@ -156,6 +156,7 @@ extern "C" {
 	      }
 
 	      takeSample(sp,
+			 mod,
 			 adaptorByIndex(sp, (ifin_phys ?: ifin)),
 			 adaptorByIndex(sp, (ifout_phys ?: ifout)),
 			 NULL,
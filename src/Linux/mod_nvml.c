@@ -9,11 +9,47 @@ extern "C" {
 #include "hsflowd.h"
 #include <nvml.h>
 
+#define HSP_NVML_UTIL_SAMPLES 10 // utilization samples per second (one per deci)
+
+  // fetched together with one nvmlDeviceGetFieldValues() call
+  typedef enum {
+    HSP_NVML_FI_ECC=0,
+    HSP_NVML_FI_ENERGY,
+    HSP_NVML_FI_NUM
+  } EnumHSPNVMLField;
+
+  static const unsigned int HSPNVMLFieldIds[HSP_NVML_FI_NUM] = {
+    NVML_FI_DEV_ECC_DBE_VOL_TOTAL,
+    NVML_FI_DEV_TOTAL_ENERGY_CONSUMPTION,
+  };
+
+  typedef struct _HSPNVMLGpu {
+    nvmlDevice_t handle;
+    bool valid;
+    // utilization sampled every deci, averaged into gpu_time/mem_time every tick
+    uint8_t gpu_util[HSP_NVML_UTIL_SAMPLES];
+    uint8_t mem_util[HSP_NVML_UTIL_SAMPLES];
+    uint32_t util_n;
+    // accumulators
+    uint32_t gpu_time; // mS.
+    uint32_t mem_time; // mS.
+    uint32_t energy;  // mJ.
+    bool energy_field; // have the energy counter (otherwise integrate power)
+    uint64_t energy_last_mJ;
+    // read at most once per second, whatever the number of counter samples
+    time_t read_time;
+    uint64_t mem_total;
+    uint64_t mem_free;
+    uint32_t ecc_errors;
+    uint32_t temperature;
+    uint32_t fan_speed;
+    uint32_t processes;
+  } HSPNVMLGpu;
+
   typedef struct _HSP_mod_NVML {
+    EVBus *pollBus;
     unsigned int gpu_count;
-    uint32_t *gpu_time; // mS. accumulators
-    uint32_t *mem_time; // mS. accumulators
-    uint32_t *energy;  // mJ. accumulators
+    HSPNVMLGpu *gpus;
     UTHash *byUUID; // look up uuid -> gpu
     UTHash *byMinor; // look up minor -> gpu
     SFLCounters_sample_element nvmlElem;
@@ -22,6 +58,44 @@ extern "C" {
 #include <linux/param.h> // for HZ
 #include <sys/sysinfo.h> // for get_nprocs()
 
+  /*_________________---------------------------__________________
+    _________________     readFields            __________________
+    -----------------___________________________------------------
+    One nvmlDeviceGetFieldValues() call for the ECC and energy counters.
+    The energy counter is mJ since the driver was loaded, so just add
+    the delta.
+  */
+
+  static uint64_t fieldValue64(nvmlFieldValue_t *fv) {
+    switch(fv->valueType) {
+    case NVML_VALUE_TYPE_DOUBLE: return (uint64_t)fv->value.dVal;
+    case NVML_VALUE_TYPE_UNSIGNED_INT: return fv->value.uiVal;
+    case NVML_VALUE_TYPE_UNSIGNED_LONG: return fv->value.ulVal;
+    case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG: return fv->value.ullVal;
+    case NVML_VALUE_TYPE_SIGNED_LONG_LONG: return (uint64_t)fv->value.sllVal;
+    case NVML_VALUE_TYPE_SIGNED_INT: return (uint64_t)fv->value.siVal;
+    default: return 0;
+    }
+  }
+
+  static void readFields(EVMod *mod, HSPNVMLGpu *gpu) {
+    nvmlFieldValue_t fv[HSP_NVML_FI_NUM];
+    memset(fv, 0, sizeof(fv));
+    for(int ff = 0; ff < HSP_NVML_FI_NUM; ff++)
+      fv[ff].fieldId = HSPNVMLFieldIds[ff];
+    if(NVML_SUCCESS != nvmlDeviceGetFieldValues(gpu->handle, HSP_NVML_FI_NUM, fv))
+      return;
+    if(fv[HSP_NVML_FI_ECC].nvmlReturn == NVML_SUCCESS)
+      gpu->ecc_errors = (uint32_t)fieldValue64(&fv[HSP_NVML_FI_ECC]);
+    if(fv[HSP_NVML_FI_ENERGY].nvmlReturn == NVML_SUCCESS) {
+      uint64_t energy_mJ = fieldValue64(&fv[HSP_NVML_FI_ENERGY]);
+      if(gpu->energy_field)
+	gpu->energy += (uint32_t)(energy_mJ - gpu->energy_last_mJ);
+      gpu->energy_last_mJ = energy_mJ;
+      gpu->energy_field = YES;
+    }
+  }
+
   /*_________________---------------------------__________________
     _________________     nvml_init             __________________
     -----------------___________________________------------------
@@ -38,10 +112,8 @@ extern "C" {
       return;
     }
     mdata->gpu_count = gpuCount;
-    // allocate accumulator arrays
-    mdata->gpu_time = my_calloc(gpuCount * sizeof(uint32_t));
-    mdata->mem_time = my_calloc(gpuCount * sizeof(uint32_t));
-    mdata->energy = my_calloc(gpuCount * sizeof(uint32_t));
+    // per-device handles and accumulators
+    mdata->gpus = my_calloc(gpuCount * sizeof(HSPNVMLGpu));
     // Build hash table to get from UUID to index
     // (yes, library has getDeviceByUUID() but it expects a
     // ascii-hex string and we prefer to keep UUIDs as 16-byte
@@ -49,8 +121,15 @@ extern "C" {
     mdata->byUUID = UTHASH_NEW(HSPGpuID, uuid, UTHASH_DFLT);
     mdata->byMinor = UTHASH_NEW(HSPGpuID, minor, UTHASH_DFLT);
     for (int ii = 0; ii < mdata->gpu_count; ii++) {
+      HSPNVMLGpu *gpuState = &mdata->gpus[ii];
       nvmlDevice_t gpu;
       if (NVML_SUCCESS == nvmlDeviceGetHandleByIndex(ii, &gpu)) {
+	// the handle stays valid until nvmlShutdown()
+	gpuState->handle = gpu;
+	gpuState->valid = YES;
+	// baseline the energy counter (and find out if we have it)
+	readFields(mod, gpuState);
+	myDebug(1, "nvml: GPU index=%u energy counter %s", ii, gpuState->energy_field ? "available" : "not available - integrating power");
 	char uuidstr[128];
 	if(NVML_SUCCESS == nvmlDeviceGetUUID(gpu, uuidstr, 128)) {
 	  myDebug(2, "nvml: deviceGetUUID(index=%u) returned %s", ii, uuidstr);
@@ -94,6 +173,34 @@ extern "C" {
     nvmlShutdown();
   }
 
+  /*_________________---------------------------__________________
+    _________________     nvml_deci             __________________
+    -----------------___________________________------------------
+    Called every 100mS. The utilization that NVML reports covers only
+    its own last sample period (1/6 to 1 second depending on the
+    device), so sampling once per second could miss short bursts.
+    Instead, append to a per-GPU buffer here, which nvml_tick()
+    averages and empties again every second.
+  */
+  void nvml_deci(EVMod *mod) {
+    HSP_mod_NVML *mdata = (HSP_mod_NVML *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    uint64_t start_nS = latencyClock_nS();
+    for (int ii = 0; ii < mdata->gpu_count; ii++) {
+      HSPNVMLGpu *gpu = &mdata->gpus[ii];
+      nvmlUtilization_t util;
+      if (gpu->valid
+	  && gpu->util_n < HSP_NVML_UTIL_SAMPLES
+	  && NVML_SUCCESS == nvmlDeviceGetUtilizationRates(gpu->handle, &util)) {
+	gpu->gpu_util[gpu->util_n] = util.gpu;
+	gpu->mem_util[gpu->util_n] = util.memory;
+	gpu->util_n++;
+      }
+    }
+    if(mdata->gpu_count)
+      latencyRecord(sp, mod, HSP_LATENCY_NVML_DECI, latencyClock_nS() - start_nS);
+  }
+
   /*_________________---------------------------__________________
     _________________     nvml_tick             __________________
     -----------------___________________________------------------
@@ -101,76 +208,114 @@ extern "C" {
   */
   void nvml_tick(EVMod *mod) {
     HSP_mod_NVML *mdata = (HSP_mod_NVML *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    uint64_t start_nS = latencyClock_nS();
     for (int ii = 0; ii < mdata->gpu_count; ii++) {
-      nvmlDevice_t gpu;
-      unsigned int power_mW;
-      nvmlUtilization_t util;
-      if (NVML_SUCCESS != nvmlDeviceGetHandleByIndex(ii, &gpu)) {
+      HSPNVMLGpu *gpu = &mdata->gpus[ii];
+      if (!gpu->valid) {
 	continue;
       }
-      if (NVML_SUCCESS == nvmlDeviceGetUtilizationRates(gpu, &util)) {
-	mdata->gpu_time[ii] += util.gpu * 10; // accumulate as mS
-	mdata->mem_time[ii] += util.memory * 10; // accumulate as mS
+      if (gpu->util_n) {
+	// average % over the last second, accumulate as mS
+	uint32_t gpu_sum = 0, mem_sum = 0;
+	for (int rr = 0; rr < gpu->util_n; rr++) {
+	  gpu_sum += gpu->gpu_util[rr];
+	  mem_sum += gpu->mem_util[rr];
+	}
+	gpu->gpu_time += (gpu_sum * 10) / gpu->util_n;
+	gpu->mem_time += (mem_sum * 10) / gpu->util_n;
+	gpu->util_n = 0;
       }
-      if (NVML_SUCCESS == nvmlDeviceGetPowerUsage(gpu, &power_mW)) {
-	mdata->energy[ii] += power_mW; // accumulate as mJ
+      unsigned int power_mW;
+      if (!gpu->energy_field
+	  && NVML_SUCCESS == nvmlDeviceGetPowerUsage(gpu->handle, &power_mW)) {
+	gpu->energy += power_mW; // accumulate as mJ
       }
     }
+    if(mdata->gpu_count)
+      latencyRecord(sp, mod, HSP_LATENCY_NVML_TICK, latencyClock_nS() - start_nS);
   }
 
   /*_________________---------------------------__________________
-    _________________   accumulateGPUCounters   __________________
+    _________________       readGPU             __________________
     -----------------___________________________------------------
+    Refresh the counters that are only needed for counter samples.
+    A host sample and any number of VM samples in the same second
+    share one read.
   */
 
-  static void accumulateGPUCounters(EVMod *mod, SFLHost_gpu_nvml *nvml, int gpu_index) {
+  static void readGPU(EVMod *mod, HSPNVMLGpu *gpu) {
     HSP_mod_NVML *mdata = (HSP_mod_NVML *)mod->data;
-    nvmlDevice_t gpu;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    time_t now = mdata->pollBus->now.tv_sec;
+    if(gpu->read_time == now)
+      return;
+    gpu->read_time = now;
+    uint64_t start_nS = latencyClock_nS();
     nvmlMemory_t memInfo;
-    unsigned long long eccErrors;
     unsigned int temp;
     unsigned int speed;
     unsigned int procs;
     nvmlReturn_t result;
 
-    if (NVML_SUCCESS != nvmlDeviceGetHandleByIndex(gpu_index, &gpu))
+    // ECC errors and energy
+    readFields(mod, gpu);
+    if (NVML_SUCCESS == nvmlDeviceGetMemoryInfo(gpu->handle, &memInfo)) {
+      gpu->mem_total = memInfo.total;
+      gpu->mem_free  = memInfo.free;
+    }
+    if (NVML_SUCCESS == nvmlDeviceGetTemperature(gpu->handle, NVML_TEMPERATURE_GPU, &temp)) {
+      gpu->temperature = temp;
+    }
+    if (NVML_SUCCESS == nvmlDeviceGetFanSpeed(gpu->handle, &speed)) {
+      gpu->fan_speed = speed;
+    }
+    procs = 0;
+    result = nvmlDeviceGetComputeRunningProcesses(gpu->handle, &procs, NULL);
+    if (NVML_SUCCESS == result || NVML_ERROR_INSUFFICIENT_SIZE == result) {
+      gpu->processes = procs;
+    }
+    latencyRecord(sp, mod, HSP_LATENCY_NVML_READ, latencyClock_nS() - start_nS);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   accumulateGPUCounters   __________________
+    -----------------___________________________------------------
+  */
+
+  static void accumulateGPUCounters(EVMod *mod, SFLHost_gpu_nvml *nvml, int gpu_index) {
+    HSP_mod_NVML *mdata = (HSP_mod_NVML *)mod->data;
+    if (gpu_index >= mdata->gpu_count)
+      return;
+    HSPNVMLGpu *gpu = &mdata->gpus[gpu_index];
+    if (!gpu->valid)
       return;
 
+    readGPU(mod, gpu);
+
     // accumulate gpu count
     nvml->device_count++;
 
     // pick up latest value of 'tick' accumulators
-    nvml->gpu_time += mdata->gpu_time[gpu_index];
-    nvml->mem_time += mdata->mem_time[gpu_index];
-    nvml->energy += mdata->energy[gpu_index];
+    nvml->gpu_time += gpu->gpu_time;
+    nvml->mem_time += gpu->mem_time;
+    nvml->energy += gpu->energy;
 
     // sum memory
-    if (NVML_SUCCESS == nvmlDeviceGetMemoryInfo(gpu, &memInfo)) {
-      nvml->mem_total += memInfo.total;
-      nvml->mem_free  += memInfo.free;
-    }
+    nvml->mem_total += gpu->mem_total;
+    nvml->mem_free  += gpu->mem_free;
     // sum errors
-    if (NVML_SUCCESS == nvmlDeviceGetTotalEccErrors(gpu, NVML_DOUBLE_BIT_ECC, NVML_VOLATILE_ECC, &eccErrors)) {
-      nvml->ecc_errors += eccErrors;
-    }
+    nvml->ecc_errors += gpu->ecc_errors;
     // max temperature
-    if (NVML_SUCCESS == nvmlDeviceGetTemperature(gpu, NVML_TEMPERATURE_GPU, &temp)) {
-      if (nvml->temperature < temp) {
-	nvml->temperature = temp;
-      }
+    if (nvml->temperature < gpu->temperature) {
+      nvml->temperature = gpu->temperature;
     }
     // max fan speed
-    if (NVML_SUCCESS == nvmlDeviceGetFanSpeed(gpu, &speed)) {
-      if (nvml->fan_speed < speed) {
-	nvml->fan_speed = speed;
-      }
+    if (nvml->fan_speed < gpu->fan_speed) {
+      nvml->fan_speed = gpu->fan_speed;
     }
     // sum processes
-    procs = 0;
-    result = nvmlDeviceGetComputeRunningProcesses(gpu, &procs, NULL);
-    if (NVML_SUCCESS == result || NVML_ERROR_INSUFFICIENT_SIZE == result) {
-      nvml->processes += procs;
-    }
+    nvml->processes += gpu->processes;
   }
 
   /*_________________---------------------------__________________
@@ -256,6 +401,10 @@ extern "C" {
     -----------------___________________________------------------
   */
 
+  static void evt_deci(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    nvml_deci(mod);
+  }
+
   static void evt_tick(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     nvml_tick(mod);
   }
@@ -271,9 +420,12 @@ extern "C" {
 
   void mod_nvml(EVMod *mod) {
     mod->data = my_calloc(sizeof(HSP_mod_NVML));
+    HSP_mod_NVML *mdata = (HSP_mod_NVML *)mod->data;
+    EVBus *pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
+    mdata->pollBus = pollBus;
     nvml_init(mod);
     // register call-backs
-    EVBus *pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
+    EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_DECI), evt_deci);
     EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_TICK), evt_tick);
     EVEventRx(mod, EVGetEvent(pollBus, HSPEVENT_HOST_COUNTER_SAMPLE), evt_host_cs);
     EVEventRx(mod, EVGetEvent(pollBus, HSPEVENT_VM_COUNTER_SAMPLE), evt_vm_cs);
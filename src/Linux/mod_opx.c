@@ -194,6 +194,7 @@ extern "C" {
 			 | HSP_SAMPLEOPT_OPX
 			 | HSP_SAMPLEOPT_INGRESS);
       takeSample(sp,
+		 mod,
 		 dev_in,
 		 dev_out,
 		 NULL, // tap
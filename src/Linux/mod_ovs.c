@@ -6,7 +6,9 @@
 extern "C" {
 #endif
 
+#include <poll.h>
 #include "hsflowd.h"
+#include "cJSON.h"
 
   typedef enum { SFVSSTATE_INIT=0,
 		 SFVSSTATE_READCONFIG,
@@ -17,6 +19,7 @@ extern "C" {
 		 SFVSSTATE_SYNC_DESTROY,
 		 SFVSSTATE_SYNC_FAILED,
 		 SFVSSTATE_SYNC_OK,
+		 SFVSSTATE_OVSDB,
 		 SFVSSTATE_END,
   } EnumSFVSState;
 
@@ -30,6 +33,7 @@ extern "C" {
     "SYNC_DESTROY",
     "SYNC_FAILED",
     "SYNC_OK",
+    "OVSDB",
     "END"
   };
 
@@ -62,6 +66,35 @@ extern "C" {
 // new sflow id must start with '@'
 #define SFVS_NEW_SFLOW_ID "@newsflow"
 
+  // OVSDB JSON-RPC (RFC 7047) on the ovsdb-server unix socket.
+  // ovs-vsctl is only used if the socket is not there.
+#define SFVS_OVSDB_SOCK VARFS_STR "/run/openvswitch/db.sock"
+#define SFVS_OVSDB_DB "Open_vSwitch"
+#define SFVS_OVSDB_MONITOR "hsflowd"
+// uuid-name of a new sFlow row, so bridges can refer to it in the same transaction
+#define SFVS_OVSDB_NEW_SFLOW "newsflow"
+#define SFVS_OVSDB_READ_INCBYTES 8192
+#define SFVS_OVSDB_TXN_TIMEOUT 10
+#define SFVS_OVSDB_FINAL_WAIT_mS 2000
+#define SFVS_OVSDB_RETRY_MIN 2
+#define SFVS_OVSDB_RETRY_MAX 60
+
+  // local replica of the monitored Bridge and sFlow rows
+  typedef struct _SFVSBridge {
+    char *uuid;
+    char *name;
+    char *sflow; // uuid of sFlow row, or NULL
+  } SFVSBridge;
+
+  typedef struct _SFVSSFlow {
+    char *uuid;
+    char *agent;
+    int64_t header; // -1 == not set
+    int64_t polling;
+    int64_t sampling;
+    UTStringArray *targets; // sorted
+  } SFVSSFlow;
+
   typedef struct _HSP_mod_OVS {
     EnumSFVSState state;
     time_t tick;
@@ -75,6 +108,21 @@ extern "C" {
     int usingAtVar;
     int usedAtVarOK;
     int ovs10;
+    // OVSDB connection
+    EVBus *pollBus;
+    char *dbSocket;
+    EVSocket *dbSock;
+    UTStrBuf *dbRx;
+    uint32_t dbNextId;
+    uint32_t monitorId;
+    bool monitoring;
+    uint32_t txnId;
+    time_t txnTime;
+    uint64_t txnTime_nS;
+    time_t txnRetry; // after a failure, not before this
+    uint32_t txnBackoff;
+    UTHash *bridges;
+    UTHash *sflows;
   } HSP_mod_OVS;
 
   /*_________________---------------------------__________________
@@ -554,6 +602,631 @@ extern "C" {
     return mdata->cmdFailed ? NO : YES;
   }
 
+  /*_________________---------------------------__________________
+    _________________   OVSDB - replica         __________________
+    -----------------___________________________------------------
+    An OVSDB <value> is either a bare <atom> or ["set", [<atom>...]],
+    and a uuid <atom> is ["uuid", "<uuid>"]. Optional columns such as
+    Bridge:sflow or sFlow:header are sets of 0 or 1 atoms.
+  */
+
+  static cJSON *ovsdbAtom(cJSON *val, int idx) {
+    if(val == NULL)
+      return NULL;
+    if(val->type == cJSON_Array) {
+      cJSON *tag = cJSON_GetArrayItem(val, 0);
+      if(tag
+	 && tag->type == cJSON_String
+	 && my_strequal(tag->valuestring, "set"))
+	return cJSON_GetArrayItem(cJSON_GetArrayItem(val, 1), idx);
+    }
+    return (idx == 0) ? val : NULL;
+  }
+
+  static char *ovsdbAtomStr(cJSON *atom) {
+    if(atom == NULL)
+      return NULL;
+    if(atom->type == cJSON_String)
+      return atom->valuestring;
+    if(atom->type == cJSON_Array) {
+      cJSON *uuid = cJSON_GetArrayItem(atom, 1);
+      if(uuid
+	 && uuid->type == cJSON_String)
+	return uuid->valuestring;
+    }
+    return NULL;
+  }
+
+  static int64_t ovsdbAtomInt(cJSON *atom) {
+    return (atom && atom->type == cJSON_Number) ? (int64_t)atom->valuedouble : -1;
+  }
+
+  static cJSON *ovsdbEmptySet(void) {
+    cJSON *set = cJSON_CreateArray();
+    cJSON_AddItemToArray(set, cJSON_CreateString("set"));
+    cJSON_AddItemToArray(set, cJSON_CreateArray());
+    return set;
+  }
+
+  static cJSON *ovsdbUUID(char *tag, char *uuid) {
+    cJSON *atom = cJSON_CreateArray();
+    cJSON_AddItemToArray(atom, cJSON_CreateString(tag));
+    cJSON_AddItemToArray(atom, cJSON_CreateString(uuid));
+    return atom;
+  }
+
+  static void bridgeFree(SFVSBridge *br) {
+    my_free(br->uuid);
+    setStr(&br->name, NULL);
+    setStr(&br->sflow, NULL);
+    my_free(br);
+  }
+
+  static void sFlowFree(SFVSSFlow *sf) {
+    my_free(sf->uuid);
+    setStr(&sf->agent, NULL);
+    strArrayFree(sf->targets);
+    my_free(sf);
+  }
+
+  static void ovsdbUpdateBridge(EVMod *mod, char *uuid, cJSON *row) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    SFVSBridge search = { .uuid = uuid };
+    SFVSBridge *br = UTHashGet(mdata->bridges, &search);
+    if(row == NULL) {
+      if(br) {
+	myDebug(1, "OVSDB: bridge %s deleted", br->name);
+	UTHashDel(mdata->bridges, br);
+	bridgeFree(br);
+      }
+      return;
+    }
+    if(br == NULL) {
+      br = (SFVSBridge *)my_calloc(sizeof(SFVSBridge));
+      br->uuid = my_strdup(uuid);
+      UTHashAdd(mdata->bridges, br);
+    }
+    // a "modify" may only carry the columns that changed
+    cJSON *jname = cJSON_GetObjectItem(row, "name");
+    if(jname)
+      setStr(&br->name, ovsdbAtomStr(ovsdbAtom(jname, 0)));
+    cJSON *jsflow = cJSON_GetObjectItem(row, "sflow");
+    if(jsflow)
+      setStr(&br->sflow, ovsdbAtomStr(ovsdbAtom(jsflow, 0)));
+    myDebug(1, "OVSDB: bridge %s sflow=%s", br->name, br->sflow ?: "[]");
+  }
+
+  static void ovsdbUpdateSFlow(EVMod *mod, char *uuid, cJSON *row) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    SFVSSFlow search = { .uuid = uuid };
+    SFVSSFlow *sf = UTHashGet(mdata->sflows, &search);
+    if(row == NULL) {
+      if(sf) {
+	myDebug(1, "OVSDB: sFlow %s deleted", sf->uuid);
+	UTHashDel(mdata->sflows, sf);
+	sFlowFree(sf);
+      }
+      return;
+    }
+    if(sf == NULL) {
+      sf = (SFVSSFlow *)my_calloc(sizeof(SFVSSFlow));
+      sf->uuid = my_strdup(uuid);
+      sf->header = sf->polling = sf->sampling = -1;
+      sf->targets = strArrayNew();
+      UTHashAdd(mdata->sflows, sf);
+    }
+    cJSON *jcol;
+    if((jcol = cJSON_GetObjectItem(row, "agent")))
+      setStr(&sf->agent, ovsdbAtomStr(ovsdbAtom(jcol, 0)));
+    if((jcol = cJSON_GetObjectItem(row, "header")))
+      sf->header = ovsdbAtomInt(ovsdbAtom(jcol, 0));
+    if((jcol = cJSON_GetObjectItem(row, "polling")))
+      sf->polling = ovsdbAtomInt(ovsdbAtom(jcol, 0));
+    if((jcol = cJSON_GetObjectItem(row, "sampling")))
+      sf->sampling = ovsdbAtomInt(ovsdbAtom(jcol, 0));
+    if((jcol = cJSON_GetObjectItem(row, "targets"))) {
+      strArrayReset(sf->targets);
+      cJSON *atom;
+      for(int ii = 0; (atom = ovsdbAtom(jcol, ii)) != NULL; ii++) {
+	char *target = ovsdbAtomStr(atom);
+	if(target)
+	  strArrayAdd(sf->targets, target);
+      }
+      strArraySort(sf->targets);
+    }
+    myDebug(1, "OVSDB: sFlow %s agent=%s header=%"PRId64" polling=%"PRId64" sampling=%"PRId64" targets=%u",
+	    sf->uuid,
+	    sf->agent ?: "[]",
+	    sf->header,
+	    sf->polling,
+	    sf->sampling,
+	    strArrayN(sf->targets));
+  }
+
+  // apply <table-updates>: {<table>: {<uuid>: {"old": <row>, "new": <row>}}}
+  static void ovsdbTableUpdates(EVMod *mod, cJSON *updates) {
+    if(updates == NULL
+       || updates->type != cJSON_Object)
+      return;
+    for(cJSON *jtab = updates->child; jtab; jtab = jtab->next) {
+      bool bridge = my_strequal(jtab->string, "Bridge");
+      bool sflow = my_strequal(jtab->string, "sFlow");
+      for(cJSON *jrow = jtab->child; jrow; jrow = jrow->next) {
+	cJSON *jnew = cJSON_GetObjectItem(jrow, "new");
+	if(bridge)
+	  ovsdbUpdateBridge(mod, jrow->string, jnew);
+	else if(sflow)
+	  ovsdbUpdateSFlow(mod, jrow->string, jnew);
+      }
+    }
+  }
+
+  static void ovsdbResetReplica(EVMod *mod) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    SFVSBridge *br;
+    UTHASH_WALK(mdata->bridges, br)
+      bridgeFree(br);
+    UTHashReset(mdata->bridges);
+    SFVSSFlow *sf;
+    UTHASH_WALK(mdata->sflows, sf)
+      sFlowFree(sf);
+    UTHashReset(mdata->sflows);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   OVSDB - connection      __________________
+    -----------------___________________________------------------
+  */
+
+  static void ovsdbRead(EVMod *mod, EVSocket *sock, void *magic);
+
+  static void ovsdbClose(EVMod *mod) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    if(mdata->dbSock) {
+      EVSocketClose(mod, mdata->dbSock, YES);
+      mdata->dbSock = NULL;
+    }
+    UTStrBuf_reset(mdata->dbRx);
+    mdata->monitorId = 0;
+    mdata->monitoring = NO;
+    mdata->txnId = 0;
+    ovsdbResetReplica(mod);
+  }
+
+  static bool ovsdbSend(EVMod *mod, cJSON *msg) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    char *str = cJSON_PrintUnformatted(msg);
+    ssize_t len = my_strlen(str);
+    myDebug(3, "OVSDB send: %s", str);
+    ssize_t cc;
+    while((cc = send(mdata->dbSock->fd, str, len, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    my_free(str);
+    if(cc != len) {
+      myLog(LOG_ERR, "OVSDB: send() returned %d != %d: %s", (int)cc, (int)len, strerror(errno));
+      // let the read side find out and clean up
+      shutdown(mdata->dbSock->fd, SHUT_RDWR);
+      return NO;
+    }
+    return YES;
+  }
+
+  // send a request and return its id, or 0 on failure. Takes over params.
+  static uint32_t ovsdbRequest(EVMod *mod, char *method, cJSON *params) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    uint32_t id = ++mdata->dbNextId;
+    if(id == 0)
+      id = ++mdata->dbNextId;
+    cJSON *req = cJSON_CreateObject();
+    cJSON_AddStringToObject(req, "method", method);
+    cJSON_AddItemToObject(req, "params", params);
+    cJSON_AddNumberToObject(req, "id", id);
+    bool ok = ovsdbSend(mod, req);
+    cJSON_Delete(req);
+    return ok ? id : 0;
+  }
+
+  static bool ovsdbConnect(EVMod *mod) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    if(access(mdata->dbSocket, F_OK) != 0) {
+      myDebug(1, "OVSDB: no socket at %s", mdata->dbSocket);
+      return NO;
+    }
+    int fd = UTUnixDomainSocket(mdata->dbSocket);
+    if(fd < 0)
+      return NO;
+    mdata->dbSock = EVBusAddSocket(mod, mdata->pollBus, fd, ovsdbRead, NULL);
+    myDebug(1, "OVSDB: connected to %s fd=%d", mdata->dbSocket, fd);
+    // monitor just the columns we manage: the reply is the initial
+    // contents and every change after that comes as an "update"
+    cJSON *bridgeCols = cJSON_CreateArray();
+    cJSON_AddItemToArray(bridgeCols, cJSON_CreateString("name"));
+    cJSON_AddItemToArray(bridgeCols, cJSON_CreateString("sflow"));
+    cJSON *sflowCols = cJSON_CreateArray();
+    cJSON_AddItemToArray(sflowCols, cJSON_CreateString("agent"));
+    cJSON_AddItemToArray(sflowCols, cJSON_CreateString("header"));
+    cJSON_AddItemToArray(sflowCols, cJSON_CreateString("polling"));
+    cJSON_AddItemToArray(sflowCols, cJSON_CreateString("sampling"));
+    cJSON_AddItemToArray(sflowCols, cJSON_CreateString("targets"));
+    cJSON *bridgeReq = cJSON_CreateObject();
+    cJSON_AddItemToObject(bridgeReq, "columns", bridgeCols);
+    cJSON *sflowReq = cJSON_CreateObject();
+    cJSON_AddItemToObject(sflowReq, "columns", sflowCols);
+    cJSON *monReqs = cJSON_CreateObject();
+    cJSON_AddItemToObject(monReqs, "Bridge", bridgeReq);
+    cJSON_AddItemToObject(monReqs, "sFlow", sflowReq);
+    cJSON *params = cJSON_CreateArray();
+    cJSON_AddItemToArray(params, cJSON_CreateString(SFVS_OVSDB_DB));
+    cJSON_AddItemToArray(params, cJSON_CreateString(SFVS_OVSDB_MONITOR));
+    cJSON_AddItemToArray(params, monReqs);
+    mdata->monitorId = ovsdbRequest(mod, "monitor", params);
+    if(mdata->monitorId == 0) {
+      ovsdbClose(mod);
+      return NO;
+    }
+    return YES;
+  }
+
+  /*_________________---------------------------__________________
+    _________________   OVSDB - sync            __________________
+    -----------------___________________________------------------
+    Compare the replica with the config and submit one transaction
+    with whatever changes are needed: adopt one sFlow row (preferring
+    one that a bridge already uses), fix any of its columns that have
+    drifted, point every bridge at it and delete the rest. With no
+    config, detach all bridges and delete every sFlow row. Only one
+    transaction is outstanding at a time, and after a failure we try
+    again from evt_tick, backing off up to SFVS_OVSDB_RETRY_MAX secs.
+  */
+
+  static cJSON *ovsdbWhereUUID(char *uuid) {
+    cJSON *cond = cJSON_CreateArray();
+    cJSON_AddItemToArray(cond, cJSON_CreateString("_uuid"));
+    cJSON_AddItemToArray(cond, cJSON_CreateString("=="));
+    cJSON_AddItemToArray(cond, ovsdbUUID("uuid", uuid));
+    cJSON *where = cJSON_CreateArray();
+    cJSON_AddItemToArray(where, cond);
+    return where;
+  }
+
+  static cJSON *ovsdbOp(char *op, char *table, char *uuid, cJSON *row) {
+    cJSON *jop = cJSON_CreateObject();
+    cJSON_AddStringToObject(jop, "op", op);
+    cJSON_AddStringToObject(jop, "table", table);
+    if(uuid)
+      cJSON_AddItemToObject(jop, "where", ovsdbWhereUUID(uuid));
+    if(row)
+      cJSON_AddItemToObject(jop, "row", row);
+    return jop;
+  }
+
+  // the sFlow columns that differ from the config (all of them if sf == NULL)
+  static cJSON *ovsdbSFlowRow(EVMod *mod, SFVSSFlow *sf) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    SFVSConfig *cfg = &mdata->config;
+    cJSON *row = cJSON_CreateObject();
+    if(sf == NULL
+       || !my_strequal(sf->agent, cfg->agent_dev))
+      cJSON_AddItemToObject(row, "agent", cfg->agent_dev ? cJSON_CreateString(cfg->agent_dev) : ovsdbEmptySet());
+    if(sf == NULL
+       || sf->header != cfg->header_bytes)
+      cJSON_AddNumberToObject(row, "header", cfg->header_bytes);
+    if(sf == NULL
+       || sf->polling != cfg->polling_secs)
+      cJSON_AddNumberToObject(row, "polling", cfg->polling_secs);
+    if(sf == NULL
+       || sf->sampling != cfg->sampling_n)
+      cJSON_AddNumberToObject(row, "sampling", cfg->sampling_n);
+    if(sf == NULL
+       || !strArrayEqual(sf->targets, cfg->targets)) {
+      cJSON *targets = cJSON_CreateArray();
+      for(int ii = 0; ii < strArrayN(cfg->targets); ii++)
+	cJSON_AddItemToArray(targets, cJSON_CreateString(strArrayAt(cfg->targets, ii)));
+      cJSON *set = cJSON_CreateArray();
+      cJSON_AddItemToArray(set, cJSON_CreateString("set"));
+      cJSON_AddItemToArray(set, targets);
+      cJSON_AddItemToObject(row, "targets", set);
+    }
+    return row;
+  }
+
+  static void ovsdbSync(EVMod *mod) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    SFVSConfig *cfg = &mdata->config;
+    if(!mdata->monitoring
+       || mdata->txnId
+       || mdata->pollBus->now.tv_sec < mdata->txnRetry)
+      return;
+    bool wanted = !(cfg->error
+		    || cfg->num_collectors == 0
+		    || (cfg->sampling_n == 0 && cfg->polling_secs == 0));
+    cJSON *params = cJSON_CreateArray();
+    cJSON_AddItemToArray(params, cJSON_CreateString(SFVS_OVSDB_DB));
+    SFVSBridge *br;
+    SFVSSFlow *sf;
+    SFVSSFlow *keep = NULL;
+    bool create = NO;
+    if(wanted) {
+      UTHASH_WALK(mdata->bridges, br) {
+	if(keep == NULL
+	   && br->sflow) {
+	  SFVSSFlow search = { .uuid = br->sflow };
+	  keep = UTHashGet(mdata->sflows, &search);
+	}
+      }
+      UTHASH_WALK(mdata->sflows, sf) {
+	if(keep == NULL)
+	  keep = sf;
+      }
+      cJSON *row = ovsdbSFlowRow(mod, keep);
+      if(keep) {
+	if(row->child) {
+	  myDebug(1, "OVSDB: update sFlow %s", keep->uuid);
+	  cJSON_AddItemToArray(params, ovsdbOp("update", "sFlow", keep->uuid, row));
+	}
+	else
+	  cJSON_Delete(row);
+      }
+      else if(UTHashN(mdata->bridges)) {
+	// (an sFlow row that no bridge refers to is garbage-collected)
+	myDebug(1, "OVSDB: insert sFlow");
+	cJSON *jop = ovsdbOp("insert", "sFlow", NULL, row);
+	cJSON_AddStringToObject(jop, "uuid-name", SFVS_OVSDB_NEW_SFLOW);
+	cJSON_AddItemToArray(params, jop);
+	create = YES;
+      }
+      else
+	cJSON_Delete(row);
+    }
+    UTHASH_WALK(mdata->bridges, br) {
+      cJSON *ref = NULL;
+      if(create)
+	ref = ovsdbUUID("named-uuid", SFVS_OVSDB_NEW_SFLOW);
+      else if(keep
+	      && !my_strequal(br->sflow, keep->uuid))
+	ref = ovsdbUUID("uuid", keep->uuid);
+      else if(keep == NULL
+	      && br->sflow)
+	ref = ovsdbEmptySet();
+      if(ref) {
+	myDebug(1, "OVSDB: set sflow for bridge %s", br->name);
+	cJSON *row = cJSON_CreateObject();
+	cJSON_AddItemToObject(row, "sflow", ref);
+	cJSON_AddItemToArray(params, ovsdbOp("update", "Bridge", br->uuid, row));
+      }
+    }
+    UTHASH_WALK(mdata->sflows, sf) {
+      if(sf != keep) {
+	myDebug(1, "OVSDB: delete sFlow %s", sf->uuid);
+	cJSON_AddItemToArray(params, ovsdbOp("delete", "sFlow", sf->uuid, NULL));
+      }
+    }
+    if(cJSON_GetArraySize(params) == 1) {
+      myDebug(2, "OVSDB: in sync");
+      cJSON_Delete(params);
+      return;
+    }
+    mdata->txnTime = mdata->pollBus->now.tv_sec;
+    mdata->txnTime_nS = latencyClock_nS();
+    mdata->txnId = ovsdbRequest(mod, "transact", params);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   OVSDB - input           __________________
+    -----------------___________________________------------------
+  */
+
+  static void ovsdbLogError(char *msg, cJSON *jerr) {
+    char *str = cJSON_PrintUnformatted(jerr);
+    myLog(LOG_ERR, "OVSDB: %s: %s", msg, str);
+    my_free(str);
+  }
+
+  static void ovsdbTransactFailed(EVMod *mod) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    if(mdata->txnBackoff == 0)
+      mdata->txnBackoff = SFVS_OVSDB_RETRY_MIN;
+    else if((mdata->txnBackoff *= 2) > SFVS_OVSDB_RETRY_MAX)
+      mdata->txnBackoff = SFVS_OVSDB_RETRY_MAX;
+    mdata->txnRetry = mdata->pollBus->now.tv_sec + mdata->txnBackoff;
+    myDebug(1, "OVSDB: retry in %u seconds", mdata->txnBackoff);
+  }
+
+  static void ovsdbTransactReply(EVMod *mod, cJSON *result, cJSON *error) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    latencyRecord(sp, mod, HSP_LATENCY_OVSDB, latencyClock_nS() - mdata->txnTime_nS);
+    mdata->txnId = 0;
+    if(error) {
+      ovsdbLogError("transact failed", error);
+      ovsdbTransactFailed(mod);
+      return;
+    }
+    // one result per op, and an extra one if the commit itself failed
+    cJSON *jres;
+    cJSON_ArrayForEach(jres, result) {
+      cJSON *jerr = cJSON_GetObjectItem(jres, "error");
+      if(jerr) {
+	ovsdbLogError("transact failed", jres);
+	ovsdbTransactFailed(mod);
+	return;
+      }
+    }
+    myDebug(1, "OVSDB: transact OK");
+    mdata->txnBackoff = 0;
+    // the updates it caused were sent before the reply, so
+    // anything still different has changed since
+    ovsdbSync(mod);
+  }
+
+  static void ovsdbMessage(EVMod *mod, cJSON *msg) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    cJSON *jmethod = cJSON_GetObjectItem(msg, "method");
+    cJSON *jparams = cJSON_GetObjectItem(msg, "params");
+    cJSON *jid = cJSON_GetObjectItem(msg, "id");
+    if(jmethod
+       && jmethod->type == cJSON_String) {
+      if(my_strequal(jmethod->valuestring, "update")) {
+	ovsdbTableUpdates(mod, cJSON_GetArrayItem(jparams, 1));
+	ovsdbSync(mod);
+      }
+      else if(my_strequal(jmethod->valuestring, "echo")) {
+	// inactivity probe
+	cJSON *reply = cJSON_CreateObject();
+	cJSON_AddItemToObject(reply, "result", jparams ? cJSON_Duplicate(jparams, YES) : cJSON_CreateArray());
+	cJSON_AddItemToObject(reply, "error", cJSON_CreateNull());
+	cJSON_AddItemToObject(reply, "id", jid ? cJSON_Duplicate(jid, YES) : cJSON_CreateNull());
+	ovsdbSend(mod, reply);
+	cJSON_Delete(reply);
+      }
+      return;
+    }
+    // a reply to one of ours
+    if(jid == NULL
+       || jid->type != cJSON_Number)
+      return;
+    uint32_t id = (uint32_t)jid->valuedouble;
+    cJSON *jresult = cJSON_GetObjectItem(msg, "result");
+    cJSON *jerror = cJSON_GetObjectItem(msg, "error");
+    if(jerror
+       && jerror->type == cJSON_NULL)
+      jerror = NULL;
+    if(id == mdata->monitorId) {
+      if(jerror) {
+	ovsdbLogError("monitor failed", jerror);
+	ovsdbClose(mod);
+	setState(mod, SFVSSTATE_SYNC_FAILED);
+	return;
+      }
+      ovsdbTableUpdates(mod, jresult);
+      myDebug(1, "OVSDB: monitoring bridges=%u sFlow=%u",
+	      UTHashN(mdata->bridges),
+	      UTHashN(mdata->sflows));
+      mdata->monitoring = YES;
+      ovsdbSync(mod);
+    }
+    else if(id == mdata->txnId)
+      ovsdbTransactReply(mod, jresult, jerror);
+  }
+
+  // Length of the first complete JSON value in buf (including any
+  // whitespace before it), 0 if it is not all here yet or -1 if this
+  // does not look like JSON-RPC at all.
+  static int ovsdbFrame(char *buf, int len) {
+    int depth = 0;
+    bool inStr = NO;
+    bool esc = NO;
+    for(int ii = 0; ii < len; ii++) {
+      char ch = buf[ii];
+      if(inStr) {
+	if(esc) esc = NO;
+	else if(ch == '\\') esc = YES;
+	else if(ch == '"') inStr = NO;
+	continue;
+      }
+      switch(ch) {
+      case '"':
+	if(depth == 0) return -1;
+	inStr = YES;
+	break;
+      case '{':
+      case '[':
+	depth++;
+	break;
+      case '}':
+      case ']':
+	if(--depth == 0) return ii + 1;
+	if(depth < 0) return -1;
+	break;
+      default:
+	if(depth == 0
+	   && !isspace(ch))
+	  return -1;
+	break;
+      }
+    }
+    return 0;
+  }
+
+  static void ovsdbRead(EVMod *mod, EVSocket *sock, void *magic) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    UTStrBuf *rx = mdata->dbRx;
+    UTStrBuf_need(rx, SFVS_OVSDB_READ_INCBYTES);
+    int cc;
+    while((cc = read(sock->fd, UTSTRBUF_STR(rx) + UTSTRBUF_LEN(rx), SFVS_OVSDB_READ_INCBYTES)) < 0
+	  && errno == EINTR);
+    if(cc < 0
+       && errno == EAGAIN)
+      return;
+    if(cc <= 0) {
+      myLog(LOG_INFO, "OVSDB: connection %s", cc ? strerror(errno) : "closed");
+      ovsdbClose(mod);
+      // reconnect on the next tick
+      setState(mod, SFVSSTATE_SYNC);
+      return;
+    }
+    UTSTRBUF_LEN(rx) += cc;
+    char *buf = UTSTRBUF_STR(rx);
+    int len = UTSTRBUF_LEN(rx);
+    int off = 0;
+    for(;;) {
+      int msgLen = ovsdbFrame(buf + off, len - off);
+      if(msgLen == 0)
+	break;
+      if(msgLen < 0) {
+	myLog(LOG_ERR, "OVSDB: unexpected input from %s", mdata->dbSocket);
+	ovsdbClose(mod);
+	setState(mod, SFVSSTATE_SYNC_FAILED);
+	return;
+      }
+      char save = buf[off + msgLen];
+      buf[off + msgLen] = '\0';
+      myDebug(3, "OVSDB recv: %s", buf + off);
+      cJSON *msg = cJSON_Parse(buf + off);
+      buf[off + msgLen] = save;
+      off += msgLen;
+      if(msg) {
+	ovsdbMessage(mod, msg);
+	cJSON_Delete(msg);
+      }
+      if(mdata->dbSock == NULL)
+	return; // closed while processing
+    }
+    UTStrBuf_snip_prefix(rx, off);
+  }
+
+  /*_________________---------------------------__________________
+    _________________   OVSDB - final           __________________
+    -----------------___________________________------------------
+    On shutdown we block here (briefly) until our last transaction
+    has been answered.
+  */
+
+  static void ovsdbFinal(EVMod *mod) {
+    HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    bool submitted = NO;
+    for(int waited = 0; waited < SFVS_OVSDB_FINAL_WAIT_mS; waited += 100) {
+      if(mdata->dbSock == NULL)
+	break;
+      if(mdata->txnId == 0) {
+	if(submitted)
+	  break;
+	mdata->txnRetry = 0;
+	ovsdbSync(mod);
+	submitted = YES;
+	if(mdata->txnId == 0)
+	  break; // nothing to do
+      }
+      struct pollfd pfd = { .fd = mdata->dbSock->fd, .events = POLLIN };
+      if(poll(&pfd, 1, 100) > 0)
+	ovsdbRead(mod, mdata->dbSock, NULL);
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________    evt_tick               __________________
+    -----------------___________________________------------------
+  */
+
   static void evt_config_changed(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     setState(mod, SFVSSTATE_READCONFIG);
   }
@@ -578,11 +1251,32 @@ extern "C" {
 
     case SFVSSTATE_SYNC:
       {
-	if(syncOVS(mod)) setState(mod, SFVSSTATE_SYNC_OK);
+	if(mdata->dbSock
+	   || ovsdbConnect(mod)) {
+	  // changes are applied as the monitor tells us about them
+	  setState(mod, SFVSSTATE_OVSDB);
+	  mdata->txnRetry = 0;
+	  ovsdbSync(mod);
+	}
+	else if(syncOVS(mod)) setState(mod, SFVSSTATE_SYNC_OK);
 	else setState(mod, SFVSSTATE_SYNC_FAILED);
       }
       break;
 
+    case SFVSSTATE_OVSDB:
+      if(mdata->txnId
+	 && (mdata->pollBus->now.tv_sec - mdata->txnTime) > SFVS_OVSDB_TXN_TIMEOUT) {
+	myLog(LOG_ERR, "OVSDB: transact timed out, reconnecting");
+	ovsdbClose(mod);
+	setState(mod, SFVSSTATE_SYNC);
+      }
+      else if(mdata->txnRetry
+	      && mdata->pollBus->now.tv_sec >= mdata->txnRetry) {
+	mdata->txnRetry = 0;
+	ovsdbSync(mod);
+      }
+      break;
+
     case SFVSSTATE_INIT:
     case SFVSSTATE_READCONFIG_FAILED:
     case SFVSSTATE_SYNC_SEARCH:
@@ -606,7 +1300,10 @@ extern "C" {
     HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
     myDebug(1, "graceful shutdown: turning off OVS sFlow");
     mdata->config.num_collectors = 0;
-    syncOVS(mod);
+    if(mdata->monitoring)
+      ovsdbFinal(mod);
+    else
+      syncOVS(mod);
   }
 
   /*_________________---------------------------__________________
@@ -617,6 +1314,7 @@ extern "C" {
   void mod_ovs(EVMod *mod) {
     mod->data = my_calloc(sizeof(HSP_mod_OVS));
     HSP_mod_OVS *mdata = (HSP_mod_OVS *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
 
     retainRootRequest(mod, "needed by mod_ovs to call ovs_vsctl and connect to OVSDB");
 
@@ -625,13 +1323,17 @@ extern "C" {
     mdata->config.targets = strArrayNew();
     mdata->ovs10 = NO;
     mdata->useAtVar = YES;
+    mdata->dbSocket = sp->ovs.socket ?: SFVS_OVSDB_SOCK;
+    mdata->dbRx = UTStrBuf_new();
+    mdata->bridges = UTHASH_NEW(SFVSBridge, uuid, UTHASH_SKEY);
+    mdata->sflows = UTHASH_NEW(SFVSSFlow, uuid, UTHASH_SKEY);
     setState(mod, SFVSSTATE_READCONFIG);
 
     // register call-backs
-    EVBus *pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
-    EVEventRx(mod, EVGetEvent(pollBus, HSPEVENT_CONFIG_CHANGED), evt_config_changed);
-    EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_TICK), evt_tick);
-    EVEventRx(mod, EVGetEvent(pollBus, EVEVENT_FINAL), evt_final);
+    mdata->pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, HSPEVENT_CONFIG_CHANGED), evt_config_changed);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_TICK), evt_tick);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_FINAL), evt_final);
   }
 
 #if defined(__cplusplus)
@@ -68,14 +68,15 @@ extern "C" {
       EVMod *mod = bpfs->module;
       HSP *sp = (HSP *)EVROOTDATA(mod);
 
-      // global MAC -> adaptor
+      // global MAC -> adaptor (from the read-only snapshot)
       SFLMacAddress macdst, macsrc;
       memset(&macdst, 0, sizeof(macdst));
       memset(&macsrc, 0, sizeof(macsrc));
       memcpy(macdst.mac, buf, 6);
       memcpy(macsrc.mac, buf+6, 6);
-      SFLAdaptor *srcdev = adaptorByMac(sp, &macsrc);
-      SFLAdaptor *dstdev = adaptorByMac(sp, &macdst);
+      HSPAdaptorLookup *lkp = adaptorLookup(sp);
+      SFLAdaptor *srcdev = adaptorLookupMac(sp, lkp, &macsrc);
+      SFLAdaptor *dstdev = adaptorLookupMac(sp, lkp, &macdst);
 
       if(getDebug() > 2) {
 	u_char mac_s[13], mac_d[13];
@@ -96,6 +97,14 @@ extern "C" {
 	}
       }
 
+      // capture -> takeSample() latency
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      int64_t capture_nS = ((int64_t)(now.tv_sec - hdr->ts.tv_sec) * 1000000000)
+	+ (now.tv_nsec - (hdr->ts.tv_usec * 1000));
+      if(capture_nS >= 0)
+	latencyRecord(sp, mod, HSP_LATENCY_CAPTURE, capture_nS);
+
       uint32_t ds_options = (HSP_SAMPLEOPT_DEV_SAMPLER
 			     | HSP_SAMPLEOPT_DEV_POLLER);
       bool isBridge = (ADAPTOR_NIO(bpfs->adaptor)->devType == HSPDEV_BRIDGE);
@@ -110,6 +119,7 @@ extern "C" {
 	ds_options |= HSP_SAMPLEOPT_IF_POLLER;
 
       takeSample(sp,
+		 mod,
 		 srcdev,
 		 dstdev,
 		 bpfs->adaptor,
@@ -316,6 +326,8 @@ extern "C" {
   */
   
   static void tap_close(EVMod *mod, BPFSoc *bpfs) {
+    if(bpfs->sock == NULL)
+      return; // already closed
     bpfs->adaptor = NULL;
     bpfs->sock->fd = -1;
     if(bpfs->pcap) {
@@ -24,6 +24,8 @@ extern "C" {
 #define HSP_PSAMPLE_READNL_RCV_BUF 8192
 #define HSP_PSAMPLE_READNL_BATCH 100
 #define HSP_PSAMPLE_RCVBUF 8000000
+  // not in older linux/psample.h (kernel 5.13 and later)
+#define HSP_PSAMPLE_ATTR_TIMESTAMP 13
   
   typedef enum {
     HSP_PSAMPLE_STATE_INIT=0,
@@ -193,6 +195,7 @@ extern "C" {
     uint32_t grp_no=0;
     uint32_t grp_seq=0;
     uint32_t sample_n=0;
+    uint64_t tstamp_nS=0;
     u_char *pkt=NULL;
   
     for(int offset = GENL_HDRLEN; offset < msglen; ) {
@@ -211,6 +214,7 @@ extern "C" {
       case PSAMPLE_ATTR_GROUP_SEQ: grp_seq = *(uint32_t *)datap; break;
       case PSAMPLE_ATTR_SAMPLE_RATE: sample_n = *(uint32_t *)datap; break;
       case PSAMPLE_ATTR_DATA: pkt = datap; break;
+      case HSP_PSAMPLE_ATTR_TIMESTAMP: memcpy(&tstamp_nS, datap, 8); break;
       }
       offset += NLMSG_ALIGN(ps_attr->nla_len);
     }
@@ -281,8 +285,19 @@ extern "C" {
 	}
       }
 
+      if(takeIt
+	 && tstamp_nS) {
+	// kernel timestamp is CLOCK_REALTIME
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t now_nS = ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+	if(now_nS >= tstamp_nS)
+	  latencyRecord(sp, mod, HSP_LATENCY_CAPTURE, now_nS - tstamp_nS);
+      }
+
       if(takeIt)
 	takeSample(sp,
+		   mod,
 		   inDev,
 		   outDev,
 		   samplerDev,
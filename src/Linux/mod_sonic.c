@@ -38,7 +38,7 @@ extern "C" {
 #define HSP_SONIC_FIELD_IFIN_UNKNOWNS "SAI_PORT_STAT_IF_IN_UNKNOWN_PROTOS"
 #define HSP_SONIC_FIELD_IFIN_DISCARDS "SAI_PORT_STAT_IF_IN_DISCARDS"
 
-#define HSP_SONIC_FIELD_IFOUT_UCASTS "SAI_PORT_STAT_IF_OUT_UCAST"
+#define HSP_SONIC_FIELD_IFOUT_UCASTS "SAI_PORT_STAT_IF_OUT_UCAST_PKTS"
 #define HSP_SONIC_FIELD_IFOUT_MCASTS "SAI_PORT_STAT_IF_OUT_MULTICAST_PKTS"
 #define HSP_SONIC_FIELD_IFOUT_BCASTS "SAI_PORT_STAT_IF_OUT_BROADCAST_PKTS"
 #define HSP_SONIC_FIELD_IFOUT_OCTETS "SAI_PORT_STAT_IF_OUT_OCTETS"
@@ -55,6 +55,10 @@ extern "C" {
 
 #define HSP_SONIC_DEFAULT_POLLING_INTERVAL 20
 #define HSP_SONIC_MIN_POLLING_INTERVAL 5
+#define HSP_SONIC_MAX_KEY_LEN 256
+// a port whose counters were read less than this long ago
+// is not asked for again when its poller comes due
+#define HSP_SONIC_PREFETCH_FRESH_mS 1500
 
 #define ISEVEN(i) (((i) & 1) == 0)
 
@@ -65,6 +69,56 @@ extern "C" {
     HSP_SONIC_STATE_DISCOVER,
     HSP_SONIC_STATE_RUN } EnumSonicState;
 
+  // Port state and counters are read with HMGET, which returns the
+  // values in the order the fields were asked for. So these tables
+  // double as the dispatch: reply->element[i] is field i, and no
+  // field names come back to be matched.
+  typedef enum {
+    HSP_SONIC_PST_SPEED=0,
+    HSP_SONIC_PST_ALIAS,
+    HSP_SONIC_PST_ADMIN,
+    HSP_SONIC_PST_OPER,
+    HSP_SONIC_PST_NUM } EnumSonicPortStateField;
+
+  static const char *HSPSonicPortStateFields[HSP_SONIC_PST_NUM] = {
+    [HSP_SONIC_PST_SPEED] = HSP_SONIC_FIELD_IFSPEED,
+    [HSP_SONIC_PST_ALIAS] = HSP_SONIC_FIELD_IFALIAS,
+    [HSP_SONIC_PST_ADMIN] = HSP_SONIC_FIELD_IFADMINSTATUS,
+    [HSP_SONIC_PST_OPER] = HSP_SONIC_FIELD_IFOPERSTATUS,
+  };
+
+  typedef enum {
+    HSP_SONIC_CTR_IN_UCASTS=0,
+    HSP_SONIC_CTR_IN_ERRORS,
+    HSP_SONIC_CTR_IN_DISCARDS,
+    HSP_SONIC_CTR_IN_OCTETS,
+    HSP_SONIC_CTR_OUT_UCASTS,
+    HSP_SONIC_CTR_OUT_ERRORS,
+    HSP_SONIC_CTR_OUT_DISCARDS,
+    HSP_SONIC_CTR_OUT_OCTETS,
+    HSP_SONIC_CTR_IN_MCASTS,
+    HSP_SONIC_CTR_IN_BCASTS,
+    HSP_SONIC_CTR_IN_UNKNOWNS,
+    HSP_SONIC_CTR_OUT_MCASTS,
+    HSP_SONIC_CTR_OUT_BCASTS,
+    HSP_SONIC_CTR_NUM } EnumSonicCounterField;
+
+  static const char *HSPSonicCounterFields[HSP_SONIC_CTR_NUM] = {
+    [HSP_SONIC_CTR_IN_UCASTS] = HSP_SONIC_FIELD_IFIN_UCASTS,
+    [HSP_SONIC_CTR_IN_ERRORS] = HSP_SONIC_FIELD_IFIN_ERRORS,
+    [HSP_SONIC_CTR_IN_DISCARDS] = HSP_SONIC_FIELD_IFIN_DISCARDS,
+    [HSP_SONIC_CTR_IN_OCTETS] = HSP_SONIC_FIELD_IFIN_OCTETS,
+    [HSP_SONIC_CTR_OUT_UCASTS] = HSP_SONIC_FIELD_IFOUT_UCASTS,
+    [HSP_SONIC_CTR_OUT_ERRORS] = HSP_SONIC_FIELD_IFOUT_ERRORS,
+    [HSP_SONIC_CTR_OUT_DISCARDS] = HSP_SONIC_FIELD_IFOUT_DISCARDS,
+    [HSP_SONIC_CTR_OUT_OCTETS] = HSP_SONIC_FIELD_IFOUT_OCTETS,
+    [HSP_SONIC_CTR_IN_MCASTS] = HSP_SONIC_FIELD_IFIN_MCASTS,
+    [HSP_SONIC_CTR_IN_BCASTS] = HSP_SONIC_FIELD_IFIN_BCASTS,
+    [HSP_SONIC_CTR_IN_UNKNOWNS] = HSP_SONIC_FIELD_IFIN_UNKNOWNS,
+    [HSP_SONIC_CTR_OUT_MCASTS] = HSP_SONIC_FIELD_IFOUT_MCASTS,
+    [HSP_SONIC_CTR_OUT_BCASTS] = HSP_SONIC_FIELD_IFOUT_BCASTS,
+  };
+
   typedef struct _HSPSonicCollector {
     char *collectorName;
     bool mark:1;
@@ -80,6 +134,9 @@ extern "C" {
     bool mark:1;
     bool operUp:1;
     bool adminUp:1;
+    bool pollQueued:1;
+    uint64_t pollSent_nS;
+    uint64_t ctrsRead_nS;
     uint32_t ifIndex;
     uint32_t osIndex;
     uint32_t osIndex_expected;
@@ -90,15 +147,25 @@ extern "C" {
     UTStringArray *components;
   } HSPSonicPort;
 
-  typedef struct _HSPSonicDBClient {
-    redisAsyncContext *ctx;
-    int dbNo;
-    EVMod *mod;
+  typedef struct _HSPSonicDBInstance {
     char *dbInstance;
     char *hostname;
     int port;
+    char *unixSock;
+  } HSPSonicDBInstance;
+
+  // One connection per database, SELECTed once when it connects,
+  // so there is never a SELECT on the query path.
+  typedef struct _HSPSonicDBClient {
+    redisAsyncContext *ctx;
+    char *dbName; // <instance>/<dbNo>, or the name of an event client
+    char *dbInstance;
+    int dbNo; // -1 == no SELECT
+    EVMod *mod;
     EVSocket *sock;
     bool connected;
+    bool corked;
+    bool writePending;
     uint32_t reads;
     uint32_t writes;
     UTStrBuf *replyBuf;
@@ -106,6 +173,7 @@ extern "C" {
 
   typedef struct _HSPSonicDBTable {
     char *dbTable;
+    char *dbInstance;
     int id;
     HSPSonicDBClient *dbClient;
     HSPSonicDBClient *evtClient;
@@ -117,11 +185,14 @@ extern "C" {
     EVBus *pollBus;
     EVBus *packetBus;
     UTHash *dbInstances;
+    UTHash *dbClients;
     UTHash *dbTables;
     UTHash *portsByName;
     UTHash *portsByOsIndex;
     UTArray *newPorts;
     UTArray *unmappedPorts;
+    UTArray *pollPorts;
+    uint32_t pollRounds;
     bool changedSwitchPorts:1;
     u_char actorSystemMAC[8];
     uint32_t localAS;
@@ -136,6 +207,7 @@ extern "C" {
   } HSP_mod_SONIC;
 
   static void db_ping(EVMod *mod, HSPSonicDBClient *db);
+  static void db_select(EVMod *mod, HSPSonicDBClient *db);
   static bool mapPorts(EVMod *mod);
   static bool discoverNewPorts(EVMod *mod);
   static void signalCounterDiscontinuity(EVMod *mod, HSPSonicPort *prt);
@@ -360,6 +432,8 @@ extern "C" {
       if(prt->mark) {
 	myDebug(1, "sonic port removed %s", prt->portName);
 	UTHashDel(mdata->portsByName, prt);
+	if(prt->pollQueued)
+	  UTArrayDel(mdata->pollPorts, prt);
 	if(prt->portName)
 	  my_free(prt->portName);
 	if(prt->oid)
@@ -425,34 +499,72 @@ extern "C" {
     -----------------___________________________------------------
   */
 
-  static HSPSonicDBClient *getDB(EVMod *mod, char *dbInstance) {
+  static HSPSonicDBInstance *getDBInstance(EVMod *mod, char *dbInstance) {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
-    HSPSonicDBClient search = { .dbInstance = dbInstance };
+    HSPSonicDBInstance search = { .dbInstance = dbInstance };
     return UTHashGet(mdata->dbInstances, &search);
   }
 
-  static HSPSonicDBClient *addDB(EVMod *mod, char *dbInstance, char *hostname, int port) {
+  static HSPSonicDBInstance *addDBInstance(EVMod *mod, char *dbInstance, char *hostname, int port, char *unixSock) {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
-    myDebug(1, "addDB: %s hostname=%s, port=%d", dbInstance, hostname, port);
-    HSPSonicDBClient *db = getDB(mod, dbInstance);
+    myDebug(1, "addDBInstance: %s hostname=%s, port=%d, unix_socket_path=%s",
+	    dbInstance,
+	    hostname ?: "<none>",
+	    port,
+	    unixSock ?: "<none>");
+    HSPSonicDBInstance *inst = getDBInstance(mod, dbInstance);
+    if(inst == NULL) {
+      inst = (HSPSonicDBInstance *)my_calloc(sizeof(HSPSonicDBInstance));
+      inst->dbInstance = my_strdup(dbInstance);
+      UTHashAdd(mdata->dbInstances, inst);
+    }
+    // the addresses take effect at the next connect
+    setStr(&inst->hostname, hostname);
+    inst->port = port;
+    setStr(&inst->unixSock, (unixSock && unixSock[0]) ? unixSock : NULL);
+    return inst;
+  }
+
+  /*_________________---------------------------__________________
+    _________________   get/add db clients      __________________
+    -----------------___________________________------------------
+  */
+
+  static HSPSonicDBClient *getDB(EVMod *mod, char *dbName) {
+    HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
+    HSPSonicDBClient search = { .dbName = dbName };
+    return UTHashGet(mdata->dbClients, &search);
+  }
+
+  static HSPSonicDBClient *addDB(EVMod *mod, char *dbName, char *dbInstance, int dbNo) {
+    HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
+    HSPSonicDBClient *db = getDB(mod, dbName);
     if(db == NULL) {
+      myDebug(1, "addDB: %s instance=%s, dbNo=%d", dbName, dbInstance, dbNo);
       db = (HSPSonicDBClient *)my_calloc(sizeof(HSPSonicDBClient));
+      db->dbName = my_strdup(dbName);
       db->dbInstance = my_strdup(dbInstance);
+      db->dbNo = dbNo;
       db->replyBuf = UTStrBuf_new();
       db->mod = mod;
-      db->hostname = my_strdup(hostname);
-      db->port = port;
-      UTHashAdd(mdata->dbInstances, db);
+      UTHashAdd(mdata->dbClients, db);
       // the socket will be opened later
     }
     return db;
   }
 
+  static HSPSonicDBClient *addTableDB(EVMod *mod, HSPSonicDBTable *dbTab) {
+    // tables that share a database share its client
+    char dbName[HSP_SONIC_MAX_KEY_LEN];
+    snprintf(dbName, HSP_SONIC_MAX_KEY_LEN, "%s/%d", dbTab->dbInstance, dbTab->id);
+    return addDB(mod, dbName, dbTab->dbInstance, dbTab->id);
+  }
+
 #if 0
-  static void freeDB(HSPSonicDBTable *db) {
+  static void freeDB(HSPSonicDBClient *db) {
+    my_free(db->dbName);
     my_free(db->dbInstance);
     UTStrBuf_free(db->replyBuf);
-    my_free(db->hostname);
     my_free(db);
   }
 #endif
@@ -476,8 +588,8 @@ extern "C" {
     if(dbTab == NULL) {
       dbTab = (HSPSonicDBTable *)my_calloc(sizeof(HSPSonicDBTable));
       dbTab->dbTable = my_strdup(dbTable);
+      dbTab->dbInstance = my_strdup(dbInstance);
       dbTab->id = id;
-      dbTab->dbClient = getDB(mod, dbInstance);
       dbTab->separator = my_strdup(sep);
       UTHashAdd(mdata->dbTables, dbTab);
    }
@@ -486,6 +598,7 @@ extern "C" {
 
   static void freeDBTable(HSPSonicDBTable *dbTab) {
     my_free(dbTab->dbTable);
+    my_free(dbTab->dbInstance);
     my_free(dbTab->separator);
     my_free(dbTab);
   }
@@ -502,15 +615,24 @@ extern "C" {
       freeDBTable(dbTab);
     }
     UTHashReset(mdata->dbTables);
-    // we let the client instances represent
-    // all instances seen, so do not touch
-    // mdata->dbInstances here. The socket
+    // we let the clients represent all the
+    // databases seen, so do not touch
+    // mdata->dbClients here. The socket
     // will be closed if the connection is closed.
     // See db_cleanupCB.
   }
 
+  // the tables that we read, and so need a connection for
+  static char *HSPSonicDBTablesUsed[] = {
+    HSP_SONIC_DB_APPL_NAME,
+    HSP_SONIC_DB_COUNTERS_NAME,
+    HSP_SONIC_DB_CONFIG_NAME,
+    HSP_SONIC_DB_STATE_NAME,
+  };
+
   static void loadDBConfig(EVMod *mod) {
-    char *fname = HSP_SONIC_DB_JSON;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    char *fname = sp->sonic.dbconfig ?: HSP_SONIC_DB_JSON;
     myDebug(1, "sonic loadDBConfig from %s", fname);
     resetDBConfig(mod);
     FILE *fjson = fopen(fname, "r");
@@ -533,14 +655,18 @@ extern "C" {
       else {
 	cJSON *instances = cJSON_GetObjectItem(dbconfig, "INSTANCES");
 	cJSON *databases = cJSON_GetObjectItem(dbconfig, "DATABASES");
-	for(cJSON *inst = instances->child; inst; inst = inst->next) {
+	for(cJSON *inst = instances ? instances->child : NULL; inst; inst = inst->next) {
 	  cJSON *hostname = cJSON_GetObjectItem(inst, "hostname");
 	  cJSON *port = cJSON_GetObjectItem(inst, "port");
-	  // cJSON *unixSockPath = cJSON_GetObjectItem(inst, "unix_socket_path");
+	  cJSON *unixSockPath = cJSON_GetObjectItem(inst, "unix_socket_path");
 	  // cJSON *persist = cJSON_GetObjectItem(inst, "persistence_for_warm_boot");
-	  addDB(mod, inst->string, hostname->valuestring, port->valueint);
+	  addDBInstance(mod,
+			inst->string,
+			hostname ? hostname->valuestring : NULL,
+			port ? port->valueint : 0,
+			unixSockPath ? unixSockPath->valuestring : NULL);
 	}
-	for(cJSON *dbTab = databases->child; dbTab; dbTab = dbTab->next) {
+	for(cJSON *dbTab = databases ? databases->child : NULL; dbTab; dbTab = dbTab->next) {
 	  cJSON *id = cJSON_GetObjectItem(dbTab, "id");
 	  cJSON *inst = cJSON_GetObjectItem(dbTab, "instance");
 	  cJSON *sep = cJSON_GetObjectItem(dbTab, "separator");
@@ -548,9 +674,16 @@ extern "C" {
 	    addDBTable(mod, inst->valuestring, dbTab->string, id->valueint, sep->valuestring);
 	  }
 	}
+	// only connect to the databases we use
+	for(int ii = 0; ii < sizeof(HSPSonicDBTablesUsed) / sizeof(char *); ii++) {
+	  HSPSonicDBTable *dbTab = getDBTable(mod, HSPSonicDBTablesUsed[ii]);
+	  if(dbTab
+	     && getDBInstance(mod, dbTab->dbInstance))
+	    dbTab->dbClient = addTableDB(mod, dbTab);
+	}
       }
       // clean up
-      cJSON_free(dbconfig);
+      cJSON_Delete(dbconfig);
       UTStrBuf_free(sbuf);
       fclose(fjson);
     }
@@ -564,12 +697,13 @@ extern "C" {
   static void addEventClients(EVMod *mod) {
     // add separate client connections for events.
     // Currently we only need one, for the CONFIG_DB table.
+    // (No SELECT: keyspace notifications name the db explicitly.)
     HSPSonicDBTable *configTab = getDBTable(mod, HSP_SONIC_DB_CONFIG_NAME);
     if(configTab
        && configTab->dbClient) {
       configTab->evtClient = addDB(mod, HSP_SONIC_DB_CONFIG_NAME HSP_SONIC_DB_EVENT_SUFFIX,
-				   configTab->dbClient->hostname,
-				   configTab->dbClient->port);
+				   configTab->dbInstance,
+				   -1);
     }
   }
 
@@ -587,6 +721,11 @@ extern "C" {
 
   static void db_addWriteCB(void *magic) {
     HSPSonicDBClient *db = (HSPSonicDBClient *)magic;
+    if(db->corked) {
+      // a batch is being queued: write it all at once in db_uncork()
+      db->writePending = YES;
+      return;
+    }
     // We could modify evbus to regulate writes, but
     // since the write direction consists only of short
     // queries we just assume it's OK to go ahead.
@@ -598,6 +737,29 @@ extern "C" {
     redisAsyncHandleWrite(db->ctx);
   }
 
+  /*_________________---------------------------__________________
+    Hold back the writes that hiredis asks for while a batch of
+    commands is queued, then send the whole output buffer together.
+    hiredis calls addWrite again if the buffer was only partly
+    written, so keep going until it stops asking.
+  */
+
+  static void db_cork(HSPSonicDBClient *db) {
+    db->corked = YES;
+  }
+
+  static void db_uncork(HSPSonicDBClient *db) {
+    while(db->writePending
+	  && db->ctx
+	  && db->connected) {
+      db->writePending = NO;
+      db->writes++;
+      redisAsyncHandleWrite(db->ctx);
+    }
+    db->corked = NO;
+    db->writePending = NO;
+  }
+
   static void db_cleanupCB(void *magic) {
     HSPSonicDBClient *db = (HSPSonicDBClient *)magic;
     myDebug(1, "sonic db_cleanupCB dbSock=%p", db->sock);
@@ -608,8 +770,8 @@ extern "C" {
       db->sock = NULL;
     }
     // dedided not to free client here. Would have to find and
-    // remove it from mdata->dbInstances too. Easier to just
-    // let the dbInstances represent all instances seen. If
+    // remove it from mdata->dbClients too. Easier to just
+    // let the dbClients represent all databases seen. If
     // any are not longer referenced, then that's not a big
     // problem, provided the socket is closed.
   }
@@ -622,7 +784,7 @@ extern "C" {
   static bool db_allConnected(EVMod *mod) {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
     HSPSonicDBClient *db;
-    UTHASH_WALK(mdata->dbInstances, db) {
+    UTHASH_WALK(mdata->dbClients, db) {
       if(!db->connected)
 	return NO;
     }
@@ -632,26 +794,45 @@ extern "C" {
   static void db_connectCB(const redisAsyncContext *ctx, int status) {
     HSPSonicDBClient *db = (HSPSonicDBClient *)ctx->ev.data;
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)db->mod->data;
-    myDebug(1, "sonic db_connectCB: status= %d", status);
+    myDebug(1, "sonic db_connectCB: %s status= %d", db->dbName, status);
     if(status == REDIS_OK) {
       db->connected = YES;
       if(db_allConnected(db->mod))
 	mdata->state = HSP_SONIC_STATE_CONNECTED;
     }
+    else {
+      // hiredis frees the context after this
+      db->ctx = NULL;
+    }
   }
 
   static void db_disconnectCB(const redisAsyncContext *ctx, int status) {
     HSPSonicDBClient *db = (HSPSonicDBClient *)ctx->ev.data;
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)db->mod->data;
-    myDebug(1, "sonic db_disconnectCB: status= %d", status);
+    myDebug(1, "sonic db_disconnectCB: %s status= %d", db->dbName, status);
     db->connected = NO;
+    // hiredis frees the context after this
+    db->ctx = NULL;
     mdata->state = HSP_SONIC_STATE_CONNECT;
   }
 
   static bool db_connectClient(EVMod *mod, HSPSonicDBClient *db) {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
-    myDebug(1, "sonic db_connectClient %s = %s:%d", db->dbInstance, db->hostname, db->port);
-    redisAsyncContext *ctx = db->ctx = redisAsyncConnect(db->hostname, db->port);
+    HSPSonicDBInstance *inst = getDBInstance(mod, db->dbInstance);
+    if(inst == NULL)
+      return NO;
+    redisAsyncContext *ctx = NULL;
+    // prefer the unix socket if we can see it
+    if(inst->unixSock
+       && access(inst->unixSock, R_OK|W_OK) == 0) {
+      myDebug(1, "sonic db_connectClient %s = unix:%s", db->dbName, inst->unixSock);
+      ctx = redisAsyncConnectUnix(inst->unixSock);
+    }
+    else if(inst->hostname) {
+      myDebug(1, "sonic db_connectClient %s = %s:%d", db->dbName, inst->hostname, inst->port);
+      ctx = redisAsyncConnect(inst->hostname, inst->port);
+    }
+    db->ctx = ctx;
     if(ctx) {
       redisAsyncSetConnectCallback(ctx, db_connectCB);
       redisAsyncSetDisconnectCallback(ctx, db_disconnectCB);
@@ -673,16 +854,21 @@ extern "C" {
 
   static void db_connect(EVMod *mod) {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
-    // try to connect all db instances
+    // try to connect all db clients
     HSPSonicDBClient *db;
-    UTHASH_WALK(mdata->dbInstances, db) {
-      if(!db->connected) {
-	db_connectClient(mod, db);
+    UTHASH_WALK(mdata->dbClients, db) {
+      if(!db->connected
+	 && db->sock == NULL // not still connecting
+	 && db_connectClient(mod, db)) {
 	// async connect requires something to do before it will complete,
-	// so go ahead and issue the first query.  Use a neutral "no-op"
-	// and save the actual discovery queries for the next step once
+	// so go ahead and issue the first query. That is the one and only
+	// SELECT for this connection, or a neutral "no-op" for the event
+	// client. Save the actual discovery queries for the next step once
 	// everything is connected.
-	db_ping(mod, db);
+	if(db->dbNo >= 0)
+	  db_select(mod, db);
+	else
+	  db_ping(mod, db);
       }
     }
   }
@@ -696,37 +882,46 @@ extern "C" {
   {
     HSPSonicDBClient *db = (HSPSonicDBClient *)ctx->ev.data;
     redisReply *reply = (redisReply *)magic;
-    myDebug(1, "sonic db_selectCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic db_selectCB: %s reply=%s", db->dbName, db_replyStr(reply, db->replyBuf, YES));
+    if(reply
+       && reply->type == REDIS_REPLY_ERROR)
+      myLog(LOG_ERR, "sonic: SELECT %d on %s failed: %s", db->dbNo, db->dbInstance, reply->str);
   }
 
-  static bool db_select(HSPSonicDBClient *db, int dbNo) {
-    if(dbNo == db->dbNo)
-      return YES;
-    myDebug(1, "sonic db_select(%u)", dbNo);
-    int status = redisAsyncCommand(db->ctx, db_selectCB, NULL /*privData*/, "select %u", dbNo);
+  static void db_select(EVMod *mod, HSPSonicDBClient *db) {
+    myDebug(1, "sonic db_select(%s)", db->dbName);
+    int status = redisAsyncCommand(db->ctx, db_selectCB, NULL /*privData*/, "select %u", db->dbNo);
     myDebug(1, "sonic db_select returned %d", status);
-    if(status == REDIS_OK) {
-      db->dbNo = dbNo;
-      return YES;
-    }
-    return NO;
   }
 
-  static bool db_selectTab(HSPSonicDBTable *dbTab) {
-    return(dbTab
-	   && dbTab->dbClient
-	   && db_select(dbTab->dbClient, dbTab->id));
+  // each table's client is pinned to its database,
+  // so there is nothing to switch here
+  static HSPSonicDBClient *db_tableClient(HSPSonicDBTable *dbTab) {
+    return (dbTab
+	    && dbTab->dbClient
+	    && dbTab->dbClient->connected) ? dbTab->dbClient : NULL;
   }
 
-  static HSPSonicDBClient *db_selectClient(EVMod *mod, char *dbTable) {
-    // return the dbInstance, pointed to this table id
-    HSPSonicDBTable *dbTab = getDBTable(mod, dbTable);
-    if(dbTab == NULL)
-      return NULL;
-    return db_selectTab(dbTab) ? dbTab->dbClient : NULL;
+  static HSPSonicDBClient *db_getClient(EVMod *mod, char *dbTable) {
+    return db_tableClient(getDBTable(mod, dbTable));
   }
 
 
+  /*_________________---------------------------__________________
+    _________________         db_hmget          __________________
+    -----------------___________________________------------------
+  */
+
+  static int db_hmget(HSPSonicDBClient *db, redisCallbackFn *cb, void *req_magic, char *key, const char **fields, int nFields) {
+    const char *argv[2 + HSP_SONIC_CTR_NUM];
+    assert(nFields <= HSP_SONIC_CTR_NUM);
+    argv[0] = "HMGET";
+    argv[1] = key;
+    memcpy(&argv[2], fields, nFields * sizeof(char *));
+    return redisAsyncCommandArgv(db->ctx, cb, req_magic, 2 + nFields, argv, NULL);
+  }
+
   /*_________________---------------------------__________________
     _________________         db_ping           __________________
     -----------------___________________________------------------
@@ -736,13 +931,14 @@ extern "C" {
   {
     HSPSonicDBClient *db = (HSPSonicDBClient *)ctx->ev.data;
     redisReply *reply = (redisReply *)magic;
-    myDebug(1, "sonic db_pingCB: %s reply=%s",
-	    db->dbInstance,
-	    db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic db_pingCB: %s reply=%s",
+	      db->dbName,
+	      db_replyStr(reply, db->replyBuf, YES));
   }
 
   static void db_ping(EVMod *mod, HSPSonicDBClient *db) {
-    myDebug(1, "sonic db_ping: %s", db->dbInstance);
+    myDebug(1, "sonic db_ping: %s", db->dbName);
     int status = redisAsyncCommand(db->ctx, db_pingCB, NULL /*privData*/, "ping");
     myDebug(1, "sonic db_ping returned %d", status);
   }
@@ -757,7 +953,8 @@ extern "C" {
     HSPSonicDBClient *db = (HSPSonicDBClient *)ctx->ev.data;
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)db->mod->data;
     redisReply *reply = (redisReply *)magic;
-    myDebug(1, "sonic db_metaCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic db_metaCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
 
@@ -768,7 +965,8 @@ extern "C" {
 	redisReply *c_name = reply->element[ii];
 	redisReply *c_val = reply->element[ii + 1];
 	if(c_name->type == REDIS_REPLY_STRING) {
-	  myDebug(1, "sonic db_metaCB: %s=%s", c_name->str, db_replyStr(c_val, db->replyBuf, YES));
+	  if(debug(1))
+	    myDebug(1, "sonic db_metaCB: %s=%s", c_name->str, db_replyStr(c_val, db->replyBuf, YES));
 	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_MAC)
 	     && c_val->type == REDIS_REPLY_STRING
 	     && c_val->str) {
@@ -784,7 +982,7 @@ extern "C" {
 
   static void db_getMeta(EVMod *mod) {
     myDebug(1, "sonic db_getMeta");
-    HSPSonicDBClient *db = db_selectClient(mod, HSP_SONIC_DB_CONFIG_NAME); 
+    HSPSonicDBClient *db = db_getClient(mod, HSP_SONIC_DB_CONFIG_NAME); 
     if(db) {
       int status = redisAsyncCommand(db->ctx, db_metaCB, NULL /*privData*/, "HGETALL DEVICE_METADATA|localhost");
       myDebug(1, "sonic db_getMeta returned %d", status);
@@ -803,7 +1001,8 @@ extern "C" {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
     redisReply *reply = (redisReply *)magic;
     HSPSonicPort *prt = (HSPSonicPort *)req_magic;
-    myDebug(1, "sonic db_ifIndexMapCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic db_ifIndexMapCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     if(reply->type == REDIS_REPLY_ARRAY
@@ -813,7 +1012,8 @@ extern "C" {
 	redisReply *c_name = reply->element[ii];
 	redisReply *c_val = reply->element[ii + 1];
 	if(c_name->type == REDIS_REPLY_STRING) {
-	  myDebug(1, "sonic db_ifIndexMapCB: %s=%s", c_name->str, db_replyStr(c_val, db->replyBuf, YES));
+	  if(debug(1))
+	    myDebug(1, "sonic db_ifIndexMapCB: %s=%s", c_name->str, db_replyStr(c_val, db->replyBuf, YES));
 	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFINDEX)) {
 	    uint32_t idx = db_getU32(c_val);
 	    if(prt->ifIndex != idx) {
@@ -864,9 +1064,10 @@ extern "C" {
 
   static void db_getIfIndexMap(EVMod *mod, HSPSonicPort *prt) {
     HSPSonicDBTable *dbTab = getDBTable(mod, HSP_SONIC_DB_STATE_NAME);
-    if(db_selectTab(dbTab)) {
+    HSPSonicDBClient *db = db_tableClient(dbTab);
+    if(db) {
       myDebug(1, "sonic db_getIfIndexMap()");
-      int status = redisAsyncCommand(dbTab->dbClient->ctx,
+      int status = redisAsyncCommand(db->ctx,
 				     db_ifIndexMapCB,
 				     prt,
 				     "HGETALL PORT_INDEX_TABLE%s%s", dbTab->separator, prt->portName);
@@ -908,7 +1109,8 @@ extern "C" {
     EVMod *mod = db->mod;
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
     redisReply *reply = (redisReply *)magic;
-    myDebug(1, "sonic db_portNamesCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic db_portNamesCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     markPorts(mod);
@@ -946,7 +1148,7 @@ extern "C" {
   }
 
   static void db_getPortNames(EVMod *mod) {
-    HSPSonicDBClient *db = db_selectClient(mod, HSP_SONIC_DB_COUNTERS_NAME);
+    HSPSonicDBClient *db = db_getClient(mod, HSP_SONIC_DB_COUNTERS_NAME);
     if(db) {
       myDebug(1, "sonic db_getPortNames()");
       int status = redisAsyncCommand(db->ctx, db_portNamesCB, NULL, "HGETALL COUNTERS_PORT_NAME_MAP");
@@ -968,32 +1170,41 @@ extern "C" {
     HSP *sp = (HSP *)EVROOTDATA(mod);
     redisReply *reply = (redisReply *)magic;
     HSPSonicPort *prt = (HSPSonicPort *)req_magic;
-    myDebug(1, "sonic db_portStateCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic db_portStateCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     if(reply->type == REDIS_REPLY_ARRAY
-       && reply->elements > 0
-       && ISEVEN(reply->elements)) {
-      for(int ii = 0; ii < reply->elements; ii += 2) {
-	redisReply *c_name = reply->element[ii];
-	redisReply *c_val = reply->element[ii + 1];
-	if(c_name->type == REDIS_REPLY_STRING) {
-	  myDebug(1, "sonic db_portStateCB: %s=%s", c_name->str, db_replyStr(c_val, db->replyBuf, YES));
-	  // This "index" field is neither ifIndex nor osIndex, so ignore it.
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFSPEED))
-	    prt->ifSpeed = db_getU64(c_val) * HSP_SONIC_FIELD_IFSPEED_UNITS;
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFALIAS))
-	    prt->ifAlias = my_strdup(c_val->str);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFADMINSTATUS))
-	    prt->adminUp = my_strequal(c_val->str, "up");
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOPERSTATUS))
-	    prt->operUp = my_strequal(c_val->str, "up");
+       && reply->elements == HSP_SONIC_PST_NUM) {
+      int found = 0;
+      for(int ii = 0; ii < HSP_SONIC_PST_NUM; ii++) {
+	redisReply *c_val = reply->element[ii];
+	if(c_val->type != REDIS_REPLY_STRING)
+	  continue; // nil: field not present
+	found++;
+	if(debug(1))
+	  myDebug(1, "sonic db_portStateCB: %s=%s", HSPSonicPortStateFields[ii], db_replyStr(c_val, db->replyBuf, YES));
+	// The "index" field is neither ifIndex nor osIndex, so we don't ask for it.
+	switch(ii) {
+	case HSP_SONIC_PST_SPEED:
+	  prt->ifSpeed = db_getU64(c_val) * HSP_SONIC_FIELD_IFSPEED_UNITS;
+	  break;
+	case HSP_SONIC_PST_ALIAS:
+	  setStr(&prt->ifAlias, c_val->str);
+	  break;
+	case HSP_SONIC_PST_ADMIN:
+	  prt->adminUp = my_strequal(c_val->str, "up");
+	  break;
+	case HSP_SONIC_PST_OPER:
+	  prt->operUp = my_strequal(c_val->str, "up");
+	  break;
 	}
       }
-      SFLAdaptor *adaptor = adaptorByName(sp, prt->portName);
+      SFLAdaptor *adaptor = found ? adaptorByName(sp, prt->portName) : NULL;
 
 #ifdef HSP_SONIC_TEST_REDISONLY
-      if(adaptor == NULL) {
+      if(found
+	 && adaptor == NULL) {
 	// get here when testing a redis dump on a system that does not
 	// have the same interfaces. Go ahead and add anyway.  Note that
 	// readInterfaces() will remove these again unless prevented from
@@ -1027,10 +1238,12 @@ extern "C" {
   }
 
   static void db_getPortState(EVMod *mod, HSPSonicPort *prt) {
-    HSPSonicDBClient *db = db_selectClient(mod, HSP_SONIC_DB_APPL_NAME);
+    HSPSonicDBClient *db = db_getClient(mod, HSP_SONIC_DB_APPL_NAME);
     if(db) {
       myDebug(1, "sonic db_getPortState()");
-      int status = redisAsyncCommand(db->ctx, db_portStateCB, prt, "HGETALL PORT_TABLE:%s", prt->portName);
+      char key[HSP_SONIC_MAX_KEY_LEN];
+      snprintf(key, HSP_SONIC_MAX_KEY_LEN, "PORT_TABLE:%s", prt->portName);
+      int status = db_hmget(db, db_portStateCB, prt, key, HSPSonicPortStateFields, HSP_SONIC_PST_NUM);
       myDebug(1, "sonic db_getPortState returned %d", status);
     }
   }
@@ -1061,54 +1274,50 @@ extern "C" {
     redisReply *reply = (redisReply *)magic;
     HSPSonicPort *prt = (HSPSonicPort *)req_magic;
 
-    myDebug(1, "sonic portCounters: reply=%s", db_replyStr(reply, db->replyBuf, YES));
-    if(reply == NULL)
+    if(debug(2))
+      myDebug(2, "sonic portCounters: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(reply == NULL
+       || reply->type != REDIS_REPLY_ARRAY
+       || reply->elements != HSP_SONIC_CTR_NUM)
       return;
     memset(&prt->ctrs, 0, sizeof(prt->ctrs));
     memset(&prt->et_ctrs, 0, sizeof(prt->et_ctrs));
-    if(reply->type == REDIS_REPLY_ARRAY
-       && reply->elements > 0
-       && ISEVEN(reply->elements)) {
-      for(int ii = 0; ii < reply->elements; ii += 2) {
-	redisReply *c_name = reply->element[ii];
-	redisReply *c_val = reply->element[ii + 1];
-	if(c_name->type == REDIS_REPLY_STRING) {
-	  myDebug(1, "sonic portCounters: %s=%s", c_name->str, db_replyStr(c_val, db->replyBuf, YES));
-
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_UCASTS))
-	    prt->ctrs.pkts_in = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_ERRORS))
-	    prt->ctrs.errs_in = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_DISCARDS))
-	    prt->ctrs.drops_in = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_OCTETS))
-	    prt->ctrs.bytes_in = db_getU64(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOUT_UCASTS))
-	    prt->ctrs.pkts_out = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOUT_ERRORS))
-	    prt->ctrs.errs_out = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOUT_DISCARDS))
-	    prt->ctrs.drops_out = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOUT_OCTETS))
-	    prt->ctrs.bytes_out = db_getU64(c_val);
-
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_MCASTS))
-	    prt->et_ctrs.mcasts_in = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_BCASTS))
-	    prt->et_ctrs.bcasts_in = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFIN_UNKNOWNS))
-	    prt->et_ctrs.unknown_in = db_getU32(c_val);
-
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOUT_MCASTS))
-	    prt->et_ctrs.mcasts_out = db_getU32(c_val);
-	  if(my_strequal(c_name->str, HSP_SONIC_FIELD_IFOUT_BCASTS))
-	    prt->et_ctrs.bcasts_out = db_getU32(c_val);
-
-	  prt->et_ctrs.operStatus = prt->operUp;
-	  prt->et_ctrs.adminStatus = prt->adminUp;
-	}
+    int found = 0;
+    for(int ii = 0; ii < HSP_SONIC_CTR_NUM; ii++) {
+      redisReply *c_val = reply->element[ii];
+      if(c_val->type != REDIS_REPLY_STRING)
+	continue; // nil: counter not supported on this port
+      found++;
+      if(debug(2))
+	myDebug(2, "sonic portCounters: %s=%s", HSPSonicCounterFields[ii], db_replyStr(c_val, db->replyBuf, YES));
+      switch(ii) {
+      case HSP_SONIC_CTR_IN_UCASTS: prt->ctrs.pkts_in = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_IN_ERRORS: prt->ctrs.errs_in = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_IN_DISCARDS: prt->ctrs.drops_in = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_IN_OCTETS: prt->ctrs.bytes_in = db_getU64(c_val); break;
+      case HSP_SONIC_CTR_OUT_UCASTS: prt->ctrs.pkts_out = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_OUT_ERRORS: prt->ctrs.errs_out = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_OUT_DISCARDS: prt->ctrs.drops_out = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_OUT_OCTETS: prt->ctrs.bytes_out = db_getU64(c_val); break;
+      case HSP_SONIC_CTR_IN_MCASTS: prt->et_ctrs.mcasts_in = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_IN_BCASTS: prt->et_ctrs.bcasts_in = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_IN_UNKNOWNS: prt->et_ctrs.unknown_in = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_OUT_MCASTS: prt->et_ctrs.mcasts_out = db_getU32(c_val); break;
+      case HSP_SONIC_CTR_OUT_BCASTS: prt->et_ctrs.bcasts_out = db_getU32(c_val); break;
       }
     }
+    if(found == 0) {
+      // COUNTERS:<oid> not there (yet). Don't accumulate a row of zeros.
+      myDebug(1, "sonic portCounters: no counters for %s (oid=%s)", prt->portName, prt->oid);
+      return;
+    }
+    prt->ctrsRead_nS = latencyClock_nS();
+    if(prt->pollSent_nS) {
+      latencyRecord(sp, mod, HSP_LATENCY_SONIC_REDIS, prt->ctrsRead_nS - prt->pollSent_nS);
+      prt->pollSent_nS = 0;
+    }
+    prt->et_ctrs.operStatus = prt->operUp;
+    prt->et_ctrs.adminStatus = prt->adminUp;
 
     // sumbit counters for deltas to be accumulated
     SFLAdaptor *adaptor = adaptorByName(sp, prt->portName);
@@ -1129,16 +1338,103 @@ extern "C" {
   }
 
   static void db_getPortCounters(EVMod *mod, HSPSonicPort *prt) {
-    HSPSonicDBClient *db = db_selectClient(mod, HSP_SONIC_DB_COUNTERS_NAME);
+    HSPSonicDBClient *db = db_getClient(mod, HSP_SONIC_DB_COUNTERS_NAME);
     if(db) {
-      myDebug(1, "sonic getPortCounters(%s) oid=%s", prt->portName, prt->oid ?: "<none>");
+      myDebug(2, "sonic getPortCounters(%s) oid=%s", prt->portName, prt->oid ?: "<none>");
       if(prt->oid) {
-	int status = redisAsyncCommand(db->ctx, db_portCountersCB, prt, "HGETALL COUNTERS:%s", prt->oid);
-	myDebug(1, "sonic getPortCounters() returned %d", status);
+	char key[HSP_SONIC_MAX_KEY_LEN];
+	snprintf(key, HSP_SONIC_MAX_KEY_LEN, "COUNTERS:%s", prt->oid);
+	int status = db_hmget(db, db_portCountersCB, prt, key, HSPSonicCounterFields, HSP_SONIC_CTR_NUM);
+	if(status != REDIS_OK)
+	  myDebug(1, "sonic getPortCounters(%s) returned %d", prt->portName, status);
       }
     }
   }
 
+  /*_________________---------------------------__________________
+    _________________      queuePortPoll        __________________
+    -----------------___________________________------------------
+  */
+
+  static void queuePortPoll(EVMod *mod, HSPSonicPort *prt) {
+    HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
+    if(!prt->pollQueued) {
+      prt->pollQueued = YES;
+      UTArrayAdd(mdata->pollPorts, prt);
+    }
+  }
+
+  static void prefetchDuePorts(EVMod *mod) {
+    HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
+    HSP *sp = (HSP *)EVROOTDATA(mod);
+    HSPSonicPort *prt;
+    UTHASH_WALK(mdata->portsByName, prt) {
+      if(prt->oid == NULL
+	 || prt->pollQueued)
+	continue;
+      SFLAdaptor *adaptor = adaptorByName(sp, prt->portName);
+      if(adaptor == NULL)
+	continue;
+      HSPAdaptorNIO *nio = ADAPTOR_NIO(adaptor);
+      // sfl_poller_tick() polls when the countdown goes from 1 to 0
+      if(nio
+	 && nio->poller
+	 && nio->poller->sFlowCpReceiver
+	 && nio->poller->countersCountdown == 1
+	 && !nio->bond_master
+	 && !nio->loopback)
+	queuePortPoll(mod, prt);
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________      db_pollPorts         __________________
+    -----------------___________________________------------------
+    The pollers are synchronized (see syncPollingInterval) so the
+    ports come due together, and evt_poll_update_nio() just queues
+    them. Here, at the end of the tick, the state and counter reads
+    for every queued port go out as one pipelined round: all the
+    PORT_TABLE reads on APPL_DB, then all the COUNTERS reads on
+    COUNTERS_DB, each connection's share written together. The
+    replies come back in a handful of reads.
+    evt_tock() queues the ports whose pollers are due on the next
+    tick, so the counters are in place (and less than a second old)
+    when the sample is taken. Ports that were not prefetched are
+    queued by evt_poll_update_nio() and picked up at the next poll.
+  */
+
+  static void db_pollPorts(EVMod *mod) {
+    HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
+    uint32_t nPorts = UTArrayN(mdata->pollPorts);
+    if(nPorts == 0)
+      return;
+    mdata->pollRounds++;
+    myDebug(1, "sonic pollPorts: round %u, %u ports", mdata->pollRounds, nPorts);
+    HSPSonicDBTable *applTab = getDBTable(mod, HSP_SONIC_DB_APPL_NAME);
+    HSPSonicDBTable *ctrsTab = getDBTable(mod, HSP_SONIC_DB_COUNTERS_NAME);
+    HSPSonicDBClient *applDB = applTab ? applTab->dbClient : NULL;
+    HSPSonicDBClient *ctrsDB = ctrsTab ? ctrsTab->dbClient : NULL;
+    if(applDB)
+      db_cork(applDB);
+    if(ctrsDB)
+      db_cork(ctrsDB);
+    HSPSonicPort *prt;
+    UTARRAY_WALK(mdata->pollPorts, prt)
+      db_getPortState(mod, prt);
+    uint64_t now_nS = latencyClock_nS();
+    UTARRAY_WALK(mdata->pollPorts, prt) {
+      prt->pollSent_nS = now_nS;
+      db_getPortCounters(mod, prt);
+      prt->pollQueued = NO;
+    }
+    UTArrayReset(mdata->pollPorts);
+    // may be the same connection
+    if(applDB)
+      db_uncork(applDB);
+    if(ctrsDB)
+      db_uncork(ctrsDB);
+  }
+
   /*_________________---------------------------__________________
     _________________      db_getLagInfo        __________________
     -----------------___________________________------------------
@@ -1151,7 +1447,8 @@ extern "C" {
     redisReply *reply = (redisReply *)magic;
     char *sep = (char *)req_magic;
 
-    myDebug(1, "sonic getLagInfoCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic getLagInfoCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     if(reply->type == REDIS_REPLY_ARRAY
@@ -1185,9 +1482,10 @@ extern "C" {
 
   static void db_getLagInfo(EVMod *mod) {
     HSPSonicDBTable *dbTab = getDBTable(mod, HSP_SONIC_DB_CONFIG_NAME);
-    if(db_selectTab(dbTab)) {
+    HSPSonicDBClient *db = db_tableClient(dbTab);
+    if(db) {
       myDebug(1, "sonic getLagInfo()");
-      int status = redisAsyncCommand(dbTab->dbClient->ctx,
+      int status = redisAsyncCommand(db->ctx,
 				     db_getLagInfoCB,
 				     dbTab->separator,
 				     "KEYS PORTCHANNEL_MEMBER%s*", dbTab->separator);
@@ -1207,7 +1505,8 @@ extern "C" {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
     redisReply *reply = (redisReply *)magic;
 
-    myDebug(1, "sonic getSflowGlobalCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic getSflowGlobalCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     // first extract the latest settings
@@ -1221,7 +1520,8 @@ extern "C" {
 	redisReply *f_name = reply->element[ii];
 	redisReply *f_val = reply->element[ii + 1];
 	if(f_name->type == REDIS_REPLY_STRING) {
-	  myDebug(1, "sonic sflow: %s=%s", f_name->str, db_replyStr(f_val, db->replyBuf, YES));
+	  if(debug(1))
+	    myDebug(1, "sonic sflow: %s=%s", f_name->str, db_replyStr(f_val, db->replyBuf, YES));
 
 	  if(my_strequal(f_name->str, HSP_SONIC_FIELD_SFLOW_ADMIN_STATE))
 	    sflow_enable = my_strequal(f_val->str, "up"); // note: was "enable" before
@@ -1259,7 +1559,7 @@ extern "C" {
   }
 
   static void db_getsFlowGlobal(EVMod *mod) {
-    HSPSonicDBClient *db = db_selectClient(mod, HSP_SONIC_DB_CONFIG_NAME);
+    HSPSonicDBClient *db = db_getClient(mod, HSP_SONIC_DB_CONFIG_NAME);
     if(db) {
       myDebug(1, "sonic getsFlowGlobal()");
       int status = redisAsyncCommand(db->ctx, db_getsFlowGlobalCB, NULL, "HGETALL SFLOW|global");
@@ -1279,9 +1579,10 @@ extern "C" {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
     redisReply *reply = (redisReply *)magic;
     HSPSonicCollector *coll = (HSPSonicCollector *)req_magic;
-    myDebug(1, "sonic getCollectorInfoCB(%s): reply=%s",
-	    coll->collectorName,
-	    db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic getCollectorInfoCB(%s): reply=%s",
+	      coll->collectorName,
+	      db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     if(reply->type == REDIS_REPLY_ARRAY
@@ -1302,7 +1603,8 @@ extern "C" {
 	redisReply *f_name = reply->element[ii];
 	redisReply *f_val = reply->element[ii + 1];
 	if(f_name->type == REDIS_REPLY_STRING) {
-	  myDebug(1, "sonic sflow collector: %s=%s", f_name->str, db_replyStr(f_val, db->replyBuf, YES));
+	  if(debug(1))
+	    myDebug(1, "sonic sflow collector: %s=%s", f_name->str, db_replyStr(f_val, db->replyBuf, YES));
 	  if(my_strequal(f_name->str, HSP_SONIC_FIELD_COLLECTOR_IP)) {
 	    SFLAddress ip;
 	    coll->ipStr = my_strdup(f_val->str);
@@ -1335,7 +1637,7 @@ extern "C" {
   }
 
   static void db_getCollectorInfo(EVMod *mod, HSPSonicCollector *coll) {
-    HSPSonicDBClient *db = db_selectClient(mod, HSP_SONIC_DB_CONFIG_NAME);
+    HSPSonicDBClient *db = db_getClient(mod, HSP_SONIC_DB_CONFIG_NAME);
     if(db) {
       myDebug(1, "sonic getCollectorInfo(%s)", coll->collectorName);
       int status = redisAsyncCommand(db->ctx, db_getCollectorInfoCB, coll, "HGETALL SFLOW_COLLECTOR|%s", coll->collectorName);
@@ -1367,7 +1669,8 @@ extern "C" {
     redisReply *reply = (redisReply *)magic;
     char *sep = (char *)req_magic;
 
-    myDebug(1, "sonic getCollectorNamesCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
+    if(debug(1))
+      myDebug(1, "sonic getCollectorNamesCB: reply=%s", db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     markCollectors(mod);
@@ -1405,9 +1708,10 @@ extern "C" {
 
   static void db_getCollectorNames(EVMod *mod) {
     HSPSonicDBTable *dbTab = getDBTable(mod, HSP_SONIC_DB_CONFIG_NAME);
-    if(db_selectTab(dbTab)) {
+    HSPSonicDBClient *db = db_tableClient(dbTab);
+    if(db) {
       myDebug(1, "sonic getCollectorNames()");
-      int status = redisAsyncCommand(dbTab->dbClient->ctx,
+      int status = redisAsyncCommand(db->ctx,
 				     db_getCollectorNamesCB,
 				     dbTab->separator,
 				     "KEYS SFLOW_COLLECTOR|*");
@@ -1455,8 +1759,9 @@ extern "C" {
     HSPSonicDBClient *db = (HSPSonicDBClient *)ctx->ev.data;
     EVMod *mod = db->mod;
     redisReply *reply = (redisReply *)magic;
-    myDebug(3, "sonic dbEvt_subscribeCB: reply=%s",
-	    db_replyStr(reply, db->replyBuf, YES));
+    if(debug(3))
+      myDebug(3, "sonic dbEvt_subscribeCB: reply=%s",
+	      db_replyStr(reply, db->replyBuf, YES));
     if(reply == NULL)
       return;
     if(reply->type == REDIS_REPLY_ARRAY
@@ -1614,11 +1919,14 @@ extern "C" {
 
     HSPSonicPort *prt = getPort(mod, adaptor->deviceName, NO);
     if(prt) {
-      // OK to queue 4 requests on the TCP connection, and ordering
-      // is preserved, so can just ask for state-refresh and counters
-      // together:
-      db_getPortState(mod, prt);
-      db_getPortCounters(mod, prt);
+      uint64_t age_nS = prt->ctrsRead_nS ? (latencyClock_nS() - prt->ctrsRead_nS) : 0;
+      if(age_nS) {
+	// how old are the counters going out in this sample?
+	latencyRecord(sp, mod, HSP_LATENCY_SONIC_AGE, age_nS);
+      }
+      if(age_nS == 0
+	 || age_nS > (HSP_SONIC_PREFETCH_FRESH_mS * 1000000LL))
+	queuePortPoll(mod, prt);
     }
   }
 
@@ -1669,6 +1977,27 @@ extern "C" {
 
   }
 
+  /*_________________---------------------------__________________
+    _________________    evt_tock               __________________
+    -----------------___________________________------------------
+  */
+
+  static void evt_tock(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
+    if(mdata->state == HSP_SONIC_STATE_RUN
+       || mdata->state == HSP_SONIC_STATE_DISCOVER) {
+      prefetchDuePorts(mod);
+      db_pollPorts(mod);
+    }
+    else if(UTArrayN(mdata->pollPorts)) {
+      // lost the connection: these will be asked for again
+      HSPSonicPort *prt;
+      UTARRAY_WALK(mdata->pollPorts, prt)
+	prt->pollQueued = NO;
+      UTArrayReset(mdata->pollPorts);
+    }
+  }
+
   /*_________________---------------------------__________________
     _________________        evt_final          __________________
     -----------------___________________________------------------
@@ -1795,13 +2124,15 @@ extern "C" {
     HSP_mod_SONIC *mdata = (HSP_mod_SONIC *)mod->data;
     mdata->pollBus = EVGetBus(mod, HSPBUS_POLL, YES);
     mdata->packetBus = EVGetBus(mod, HSPBUS_PACKET, YES);
-    mdata->dbInstances = UTHASH_NEW(HSPSonicDBClient, dbInstance, UTHASH_SKEY);
+    mdata->dbInstances = UTHASH_NEW(HSPSonicDBInstance, dbInstance, UTHASH_SKEY);
+    mdata->dbClients = UTHASH_NEW(HSPSonicDBClient, dbName, UTHASH_SKEY);
     mdata->dbTables = UTHASH_NEW(HSPSonicDBTable, dbTable, UTHASH_SKEY);
     mdata->portsByName = UTHASH_NEW(HSPSonicPort, portName, UTHASH_SKEY);
     mdata->portsByOsIndex = UTHASH_NEW(HSPSonicPort, osIndex, UTHASH_DFLT);
     mdata->collectors = UTHASH_NEW(HSPSonicCollector, collectorName, UTHASH_SKEY);
     mdata->newPorts = UTArrayNew(UTARRAY_DFLT);
     mdata->unmappedPorts = UTArrayNew(UTARRAY_DFLT);
+    mdata->pollPorts = UTArrayNew(UTARRAY_DFLT);
     mdata->newCollectors = UTArrayNew(UTARRAY_DFLT);
     // retainRootRequest(mod, "Needed to call out to OPX scripts (PYTHONPATH)");
 
@@ -1820,6 +2151,7 @@ extern "C" {
 
     EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_FINAL), evt_final);
     EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_TICK), evt_tick);
+    EVEventRx(mod, EVGetEvent(mdata->pollBus, EVEVENT_TOCK), evt_tock);
 
     // we know there are no 32-bit counters
     sp->nio_polling_secs = 0;
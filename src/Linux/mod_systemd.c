@@ -41,20 +41,44 @@ extern "C" {
 #define HSP_SYSTEMD_SERVICE_REGEX "\\.service$"
 #define HSP_SYSTEMD_SYSTEM_SLICE_REGEX "system\\.slice"
 
-#define HSP_DBUS_MONITOR 0
+  // once we are getting unit signals, a full ListUnits is only a safety net
+#define HSP_SYSTEMD_RESYNC_SECS 1800
+  // max processes per unit whose /proc/<pid>/fd is walked on each poll
+#define HSP_SYSTEMD_FD_SAMPLE 32
+#define HSP_SYSTEMD_CGROUP_BUFLEN 8192
 
 #define HSP_SYSTEMD_CGROUP_PROCS SYSFS_STR "/fs/cgroup/systemd/%s/cgroup.procs"
+#define HSP_SYSTEMD_CGROUP_PROCS_V2 SYSFS_STR "/fs/cgroup/%s/cgroup.procs"
 #define HSP_SYSTEMD_CGROUP_ACCT SYSFS_STR "/fs/cgroup/%s%s/%s"
+
+#define HSP_SYSTEMD_DBUS_NAME "org.freedesktop.systemd1"
+#define HSP_SYSTEMD_DBUS_OBJ "/org/freedesktop/systemd1"
+#define HSP_SYSTEMD_DBUS_UNIT_PREFIX "/org/freedesktop/systemd1/unit/"
   
   typedef void (*HSPDBusHandler)(EVMod *mod, DBusMessage *dbm, void *magic);
+  static void readDBus(EVMod *mod, EVSocket *sock, void *magic);
+  static void untrackUnit(EVMod *mod, char *name);
 
   typedef struct _HSPDBusRequest {
     int serial;
     HSPDBusHandler handler;
     void *magic;
     struct timespec send_time;
+    bool cancelled; // magic was freed before the reply came
   } HSPDBusRequest;
 
+  // cgroup accounting files that are held open per unit and re-read
+  // from offset 0 with pread() on each poll
+  typedef enum {
+    HSP_CGF_PROCS=0, // cgroup.procs (only tested for non-empty)
+    HSP_CGF_CPU,     // v1: cpuacct.stat                      v2: cpu.stat
+    HSP_CGF_MEM,     // v1: memory.stat                       v2: memory.stat
+    HSP_CGF_IOB,     // v1: blkio.io_service_bytes_recursive  v2: io.stat
+    HSP_CGF_IOO,     // v1: blkio.io_serviced_recursive       v2: (in io.stat)
+    HSP_CGF_EVENTS,  // v1: -                                 v2: cgroup.events
+    HSP_CGF_NUM
+  } EnumHSPCgroupFile;
+
   typedef struct _HSPUnitCounters {
     uint64_t rd_bytes;
     uint64_t wr_bytes;
@@ -68,11 +92,16 @@ extern "C" {
     char uuid[16];
     UTHash *processes;
     bool marked:1;
+    bool inactive:1; // polled once more, then dropped
     bool cpuAccounting:1;
     bool memoryAccounting:1;
     bool blockIOAccounting:1;
     HSPUnitCounters cntr;
     uint listenSocksRev;
+    int cgroupFD[HSP_CGF_NUM];
+    uint32_t fdCursor;
+    uint32_t fdCount;
+    uint32_t fdMax;
   } HSPDBusUnit;
 
   typedef struct _HSPDBusProcess {
@@ -80,6 +109,7 @@ extern "C" {
     bool marked:1;
     HSPUnitCounters cntr;
     HSPUnitCounters last;
+    uint32_t fds;
   } HSPDBusProcess;
 
   typedef struct _HSPVMState_SYSTEMD {
@@ -114,11 +144,14 @@ extern "C" {
     UTHash *pollActions;
     SFLCounters_sample_element vnodeElem;
     uint32_t countdownToResync;
+    uint32_t countdownToListenSocks;
     regex_t *service_regex;
     regex_t *system_slice_regex;
-#ifdef HSP_DBUS_MONITOR
     bool subscribed;
-#endif
+    bool signals;
+    uint32_t dbus_signals;
+    EVSocket *dbusSock;
+    bool cgroupV2;
     uint32_t page_size;
     char *cgroup_procs;
     char *cgroup_acct;
@@ -257,11 +290,29 @@ extern "C" {
     unit->name = my_strdup(name);
     unit->processes = UTHASH_NEW(HSPDBusProcess, pid, UTHASH_DFLT);
     uuidgen_type5(sp, (u_char *)unit->uuid, unit->name);
+    for(int ii = 0; ii < HSP_CGF_NUM; ii++)
+      unit->cgroupFD[ii] = -1;
     return unit;
   }
 
+  static void closeCgroupFiles(HSPDBusUnit *unit) {
+    for(int ii = 0; ii < HSP_CGF_NUM; ii++) {
+      if(unit->cgroupFD[ii] >= 0) {
+	close(unit->cgroupFD[ii]);
+	unit->cgroupFD[ii] = -1;
+      }
+    }
+  }
+
   static void HSPDBusUnitFree(EVMod *mod, HSPDBusUnit *unit) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    // a signal can remove a unit while we are still waiting
+    // for a property, so make sure the reply is ignored
+    HSPDBusRequest *req;
+    UTHASH_WALK(mdata->dbusRequests, req)
+      if(req->magic == unit)
+	req->cancelled = YES;
+    closeCgroupFiles(unit);
     if(unit->name) my_free(unit->name);
     if(unit->obj) my_free(unit->obj);
     if(unit->cgroup) my_free(unit->cgroup);
@@ -278,6 +329,53 @@ extern "C" {
     my_free(unit);
   }
 
+  /*_________________---------------------------__________________
+    _________________    readUnitProcesses      __________________
+    -----------------___________________________------------------
+    Only needed when we have to fall back on per-process accounting
+    or walk /proc/<pid>/fd, so this is done on demand at poll time.
+  */
+
+  static void readUnitProcesses(EVMod *mod, HSPDBusUnit *unit) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    // mark and sweep - mark
+    HSPDBusProcess *process;
+    UTHASH_WALK(unit->processes, process)
+      process->marked = YES;
+
+    char path[HSP_SYSTEMD_MAX_FNAME_LEN+1];
+    snprintf(path, HSP_SYSTEMD_MAX_FNAME_LEN, mdata->cgroup_procs, unit->cgroup);
+    FILE *pidsFile = fopen(path, "r");
+    if(pidsFile == NULL) {
+      myDebug(2, "cannot open %s : %s", path, strerror(errno));
+    }
+    else {
+      char line[MAX_PROC_LINELEN];
+      uint64_t pid64;
+      int truncated;
+      while(my_readline(pidsFile, line, MAX_PROC_LINELEN, &truncated) != EOF) {
+	if(sscanf(line, "%"SCNu64, &pid64) == 1) {
+	  myDebug(3, "got PID=%"PRIu64, pid64);
+	  HSPDBusProcess search = { .pid = pid64 };
+	  process = UTHashGet(unit->processes, &search);
+	  if(process)
+	    process->marked = NO;
+	  else {
+	    process = (HSPDBusProcess *)my_calloc(sizeof(HSPDBusProcess));
+	    process->pid = pid64;
+	    UTHashAdd(unit->processes, process);
+	  }
+	}
+      }
+      fclose(pidsFile);
+    }
+    // mark and sweep - sweep
+    UTHASH_WALK(unit->processes, process)
+      if(process->marked)
+	if(UTHashDel(unit->processes, process))
+	  my_free(process);
+  }
+
   /*________________---------------------------__________________
     ________________    deltaProcessCPU        __________________
     ----------------___________________________------------------
@@ -489,20 +587,26 @@ extern "C" {
     ----------------___________________________------------------
   */
 
-  static uint32_t accumulateFileDescriptors(EVMod *mod, HSPDBusUnit *unit, uint32_t *pMaxByProcess) {
+  static uint32_t accumulateFileDescriptors(EVMod *mod, HSPDBusUnit *unit, bool mapListenSocks, uint32_t *pMaxByProcess) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
-    // re-map the sockets for these processes if there was any change at all
-    // to the listenSocks hash table since the last time we were here.
-    bool mapListenSocks = mdata->listenSocks && (mdata->listenSocksRev != unit->listenSocksRev);
+    // Only HSP_SYSTEMD_FD_SAMPLE processes are walked each time, taking
+    // turns, and the rest contribute their last count. Re-mapping the
+    // listen sockets has to see every process, so that walks them all.
+    uint32_t nProcs = UTHashN(unit->processes);
+    uint32_t nSample = mapListenSocks ? nProcs : HSP_SYSTEMD_FD_SAMPLE;
+    uint32_t cursor = nProcs ? (unit->fdCursor % nProcs) : 0;
     HSPDBusProcess *process;
     uint32_t unitFDs = 0;
     uint32_t maxProcessFDs = 0;
+    uint32_t ii = 0;
     UTHASH_WALK(unit->processes, process) {
-      uint32_t processFDs = readProcessFDs(mod, unit, process, mapListenSocks);
-      unitFDs += processFDs;
-      if(processFDs > maxProcessFDs)
-	maxProcessFDs = processFDs;
+      if(((ii++ + nProcs - cursor) % nProcs) < nSample)
+	process->fds = readProcessFDs(mod, unit, process, mapListenSocks);
+      unitFDs += process->fds;
+      if(process->fds > maxProcessFDs)
+	maxProcessFDs = process->fds;
     }
+    unit->fdCursor = cursor + nSample;
     if(pMaxByProcess)
       *pMaxByProcess = maxProcessFDs;
     if(mapListenSocks)
@@ -511,46 +615,149 @@ extern "C" {
   }
 
   /*_________________---------------------------__________________
-    _________________     readCgroupCounters    __________________
+    _________________     readCgroupFile        __________________
     -----------------___________________________------------------
+    Each file is opened once and then re-read from the start with
+    pread(), which regenerates the contents, so a poll costs one
+    syscall per file rather than open+read+close. When systemd
+    removes and recreates the cgroup (e.g. on restart) the old fd
+    fails with ENODEV, so we reopen and try once more.
   */
 
-  static bool readCgroupCounters(EVMod *mod, char *acct, char *cgroup, char *fname, int nvals, HSPNameVal *nameVals, bool multi) {
+  static const char *cgroupFilesV1[HSP_CGF_NUM][2] = {
+    { NULL, "cgroup.procs" },
+    { "cpuacct", "cpuacct.stat" },
+    { "memory", "memory.stat" },
+    { "blkio", "blkio.io_service_bytes_recursive" },
+    { "blkio", "blkio.io_serviced_recursive" },
+    { NULL, NULL },
+  };
+
+  static const char *cgroupFilesV2[HSP_CGF_NUM][2] = {
+    { NULL, "cgroup.procs" },
+    { "", "cpu.stat" },
+    { "", "memory.stat" },
+    { "", "io.stat" },
+    { NULL, NULL },
+    { "", "cgroup.events" },
+  };
+
+  static int readCgroupFile(EVMod *mod, HSPDBusUnit *unit, EnumHSPCgroupFile cgf, char *buf, int bufLen) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
-    int found = 0;
-    char statsFileName[HSP_SYSTEMD_MAX_FNAME_LEN+1];
-    snprintf(statsFileName, HSP_SYSTEMD_MAX_FNAME_LEN, mdata->cgroup_acct, acct, cgroup, fname);
-    FILE *statsFile = fopen(statsFileName, "r");
-    if(statsFile == NULL) {
-      myDebug(2, "cannot open %s : %s", statsFileName, strerror(errno));
+    for(int attempt = 0; attempt < 2; attempt++) {
+      bool cached = (unit->cgroupFD[cgf] >= 0);
+      if(!cached) {
+	char path[HSP_SYSTEMD_MAX_FNAME_LEN+1];
+	const char **cgfile = mdata->cgroupV2 ? cgroupFilesV2[cgf] : cgroupFilesV1[cgf];
+	if(cgfile[1] == NULL)
+	  return -1;
+	if(cgf == HSP_CGF_PROCS)
+	  snprintf(path, HSP_SYSTEMD_MAX_FNAME_LEN, mdata->cgroup_procs, unit->cgroup);
+	else
+	  snprintf(path, HSP_SYSTEMD_MAX_FNAME_LEN, mdata->cgroup_acct, cgfile[0], unit->cgroup, cgfile[1]);
+	if((unit->cgroupFD[cgf] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+	  myDebug(2, "cannot open %s : %s", path, strerror(errno));
+	  return -1;
+	}
+      }
+      int len = pread(unit->cgroupFD[cgf], buf, bufLen - 1, 0);
+      if(len >= 0) {
+	if(len == bufLen - 1) {
+	  // truncated: drop the partial line
+	  char *eol = memrchr(buf, '\n', len);
+	  len = eol ? (eol - buf + 1) : 0;
+	}
+	buf[len] = '\0';
+	return len;
+      }
+      myDebug(2, "%s: cgroup file read failed : %s", unit->name, strerror(errno));
+      close(unit->cgroupFD[cgf]);
+      unit->cgroupFD[cgf] = -1;
+      if(!cached)
+	break;
     }
-    else {
-      char line[HSP_SYSTEMD_MAX_STATS_LINELEN];
-      char var[HSP_SYSTEMD_MAX_STATS_LINELEN];
-      uint64_t val64;
-      char *fmt = multi ?
-	"%*s %s %"SCNu64 :
-	"%s %"SCNu64 ;
-      int truncated;
-      while(my_readline(statsFile, line, HSP_SYSTEMD_MAX_STATS_LINELEN, &truncated) != EOF) {
-	if(found == nvals && !multi) break;
-	if(sscanf(line, fmt, var, &val64) == 2) {
-	  for(int ii = 0; ii < nvals; ii++) {
-	    char *nm = nameVals[ii].nv_name;
-	    if(nm == NULL) break; // null name is double-check
-	    if(strcmp(var, nm) == 0)  {
-	      nameVals[ii].nv_found = YES;
-	      nameVals[ii].nv_val64 += val64;
-	      found++;
-	    }
+    return -1;
+  }
+
+  /*_________________---------------------------__________________
+    _________________     readCgroupCounters    __________________
+    -----------------___________________________------------------
+    HSP_CGFMT_FLAT:  "name value"                     (cpuacct.stat, cpu.stat, memory.stat)
+    HSP_CGFMT_DEV:   "maj:min name value"             (v1 blkio, summed over devices)
+    HSP_CGFMT_KEYED: "maj:min name=value name=value"  (v2 io.stat, summed over devices)
+  */
+
+  typedef enum {
+    HSP_CGFMT_FLAT=0,
+    HSP_CGFMT_DEV,
+    HSP_CGFMT_KEYED
+  } EnumHSPCgroupFmt;
+
+  static int addCgroupVal(char *var, uint64_t val64, int nvals, HSPNameVal *nameVals) {
+    for(int ii = 0; ii < nvals; ii++) {
+      char *nm = nameVals[ii].nv_name;
+      if(nm == NULL) break; // null name is double-check
+      if(strcmp(var, nm) == 0)  {
+	nameVals[ii].nv_found = YES;
+	nameVals[ii].nv_val64 += val64;
+	return 1;
+      }
+    }
+    return 0;
+  }
+
+  static bool readCgroupCounters(EVMod *mod, HSPDBusUnit *unit, EnumHSPCgroupFile cgf, EnumHSPCgroupFmt fmt, int nvals, HSPNameVal *nameVals) {
+    char buf[HSP_SYSTEMD_CGROUP_BUFLEN];
+    if(readCgroupFile(mod, unit, cgf, buf, HSP_SYSTEMD_CGROUP_BUFLEN) <= 0)
+      return NO;
+    int found = 0;
+    char *save_line = NULL;
+    for(char *line = strtok_r(buf, "\n", &save_line); line; line = strtok_r(NULL, "\n", &save_line)) {
+      if(fmt == HSP_CGFMT_FLAT && found == nvals) break;
+      if(fmt == HSP_CGFMT_KEYED) {
+	char *save_tok = NULL;
+	strtok_r(line, " ", &save_tok); // skip device
+	for(char *tok; (tok = strtok_r(NULL, " ", &save_tok)) != NULL; ) {
+	  char *eq = strchr(tok, '=');
+	  if(eq) {
+	    *eq = '\0';
+	    found += addCgroupVal(tok, strtoull(eq + 1, NULL, 0), nvals, nameVals);
 	  }
-        }
+	}
+      }
+      else {
+	char var[HSP_SYSTEMD_MAX_STATS_LINELEN];
+	uint64_t val64;
+	char *scanfmt = (fmt == HSP_CGFMT_DEV) ?
+	  "%*s %s %"SCNu64 :
+	  "%s %"SCNu64 ;
+	if(sscanf(line, scanfmt, var, &val64) == 2)
+	  found += addCgroupVal(var, val64, nvals, nameVals);
       }
-      fclose(statsFile);
     }
     return (found > 0);
   }
 
+  /*_________________---------------------------__________________
+    _________________     unitPopulated         __________________
+    -----------------___________________________------------------
+  */
+
+  static bool unitPopulated(EVMod *mod, HSPDBusUnit *unit) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    char buf[128];
+    if(mdata->cgroupV2) {
+      // the kernel keeps "populated 0|1" here, counting child cgroups too
+      if(readCgroupFile(mod, unit, HSP_CGF_EVENTS, buf, sizeof(buf)) <= 0)
+	return NO;
+      char *line = strstr(buf, "populated ");
+      return (line
+	      && line[10] == '1');
+    }
+    // v1: just need to know if there is at least one pid
+    return (readCgroupFile(mod, unit, HSP_CGF_PROCS, buf, sizeof(buf)) > 0);
+  }
+
   /*________________---------------------------__________________
     ________________   getCounters_SYSTEMD     __________________
     ----------------___________________________------------------
@@ -564,10 +771,15 @@ extern "C" {
     HSPDBusUnit *unit = UTHashGet(mdata->units, &search);
     if(unit == NULL
        || unit->cgroup == NULL
-       || UTHashN(unit->processes) == 0) {
+       || !unitPopulated(mod, unit)) {
       removeAndFreeVM_SYSTEMD(mod, container);
+      if(unit
+	 && unit->inactive)
+	untrackUnit(mod, unit->name);
       return;
     }
+    // the pid list is only read if something below needs it
+    bool gotProcesses = NO;
 
     SFL_COUNTERS_SAMPLE_TYPE cs = { 0 };
     HSPVMState *vm = (HSPVMState *)&container->vm;
@@ -613,37 +825,58 @@ extern "C" {
     enum SFLVirDomainState virState = SFL_VIR_DOMAIN_RUNNING;
     cpuElem.counterBlock.host_vrt_cpu.state = virState;
 
-    uint64_t cpu_total = 0;
-    if(unit->cpuAccounting) {
+    uint64_t cpu_mS = 0;
+    if(mdata->cgroupV2) {
+      // cpu.stat is always there in v2, even without the cpu controller
+      HSPNameVal cpuVals[] = {
+	{ "usage_usec",0,0 },
+	{ NULL,0,0},
+      };
+      if(readCgroupCounters(mod, unit, HSP_CGF_CPU, HSP_CGFMT_FLAT, 1, cpuVals)
+	 && cpuVals[0].nv_found)
+	cpu_mS = cpuVals[0].nv_val64 / 1000;
+    }
+    else if(unit->cpuAccounting) {
       HSPNameVal cpuVals[] = {
 	{ "user",0,0 },
 	{ "system",0,0},
 	{ NULL,0,0},
       };
-      if(readCgroupCounters(mod, "cpuacct", unit->cgroup, "cpuacct.stat", 2, cpuVals, NO)) {
+      uint64_t cpu_total = 0;
+      if(readCgroupCounters(mod, unit, HSP_CGF_CPU, HSP_CGFMT_FLAT, 2, cpuVals)) {
 	if(cpuVals[0].nv_found) cpu_total += cpuVals[0].nv_val64;
 	if(cpuVals[1].nv_found) cpu_total += cpuVals[1].nv_val64;
       }
+      cpu_mS = JIFFY_TO_MS(cpu_total);
     }
-    if(cpu_total == 0) {
-      cpu_total = accumulateProcessCPU(mod, unit);
+    if(cpu_mS == 0) {
+      if(!gotProcesses) {
+	readUnitProcesses(mod, unit);
+	gotProcesses = YES;
+      }
+      cpu_mS = JIFFY_TO_MS(accumulateProcessCPU(mod, unit));
     }
-    cpuElem.counterBlock.host_vrt_cpu.cpuTime = (uint32_t)(JIFFY_TO_MS(cpu_total));
+    cpuElem.counterBlock.host_vrt_cpu.cpuTime = (uint32_t)cpu_mS;
     SFLADD_ELEMENT(&cs, &cpuElem);
 
     SFLCounters_sample_element memElem = { 0 };
     memElem.tag = SFLCOUNTERS_HOST_VRT_MEM;
     uint64_t rss = 0;
-    if(unit->memoryAccounting) {
+    if(mdata->cgroupV2
+       || unit->memoryAccounting) {
       HSPNameVal memVals[] = {
-	{ "rss",0,0 },
+	{ mdata->cgroupV2 ? "anon" : "rss",0,0 },
 	{ NULL,0,0},
       };
-      if(readCgroupCounters(mod, "memory", unit->cgroup, "memory.stat", 2, memVals, NO)) {
+      if(readCgroupCounters(mod, unit, HSP_CGF_MEM, HSP_CGFMT_FLAT, 1, memVals)) {
 	if(memVals[0].nv_found) rss += memVals[0].nv_val64;
       }
     }
     if(rss == 0) {
+      if(!gotProcesses) {
+	readUnitProcesses(mod, unit);
+	gotProcesses = YES;
+      }
       rss = accumulateProcessRAM(mod, unit);
     }
     memElem.counterBlock.host_vrt_mem.memory = rss;
@@ -654,13 +887,32 @@ extern "C" {
     // VM disk I/O counters
     SFLCounters_sample_element dskElem = { 0 };
     dskElem.tag = SFLCOUNTERS_HOST_VRT_DSK;
-    if(unit->blockIOAccounting) {
+    bool gotDsk = NO;
+    if(mdata->cgroupV2) {
+      HSPNameVal dskVals[] = {
+	{ "rbytes",0,0 },
+	{ "wbytes",0,0 },
+	{ "rios",0,0 },
+	{ "wios",0,0 },
+	{ NULL,0,0},
+      };
+      if(readCgroupCounters(mod, unit, HSP_CGF_IOB, HSP_CGFMT_KEYED, 4, dskVals)) {
+	dskElem.counterBlock.host_vrt_dsk.rd_bytes += dskVals[0].nv_val64;
+	dskElem.counterBlock.host_vrt_dsk.wr_bytes += dskVals[1].nv_val64;
+	dskElem.counterBlock.host_vrt_dsk.rd_req += dskVals[2].nv_val64;
+	dskElem.counterBlock.host_vrt_dsk.wr_req += dskVals[3].nv_val64;
+      }
+      // an empty io.stat just means no I/O yet
+      gotDsk = (unit->cgroupFD[HSP_CGF_IOB] >= 0);
+    }
+    else if(unit->blockIOAccounting) {
+      gotDsk = YES;
       HSPNameVal dskValsB[] = {
 	{ "Read",0,0 },
 	{ "Write",0,0},
 	{ NULL,0,0},
       };
-      if(readCgroupCounters(mod, "blkio", unit->cgroup, "blkio.io_service_bytes_recursive", 2, dskValsB, YES)) {
+      if(readCgroupCounters(mod, unit, HSP_CGF_IOB, HSP_CGFMT_DEV, 2, dskValsB)) {
 	if(dskValsB[0].nv_found) {
 	  dskElem.counterBlock.host_vrt_dsk.rd_bytes += dskValsB[0].nv_val64;
 	}
@@ -675,7 +927,7 @@ extern "C" {
 	{ NULL,0,0},
       };
 
-      if(readCgroupCounters(mod, "blkio", unit->cgroup, "blkio.io_serviced_recursive", 2, dskValsO, YES)) {
+      if(readCgroupCounters(mod, unit, HSP_CGF_IOO, HSP_CGFMT_DEV, 2, dskValsO)) {
 	if(dskValsO[0].nv_found) {
 	  dskElem.counterBlock.host_vrt_dsk.rd_req += dskValsO[0].nv_val64;
 	}
@@ -684,31 +936,50 @@ extern "C" {
 	}
       }
     }
-    else {
+    if(!gotDsk) {
       // This requires root privileges to be retained, so don't even try
       // unless we are still root:
-      if(getuid() == 0)
+      if(getuid() == 0) {
+	if(!gotProcesses) {
+	  readUnitProcesses(mod, unit);
+	  gotProcesses = YES;
+	}
 	accumulateProcessIO(mod, unit, &dskElem.counterBlock.host_vrt_dsk);
+      }
     }
     // TODO: can we fill in capacity, allocation and available?
     SFLADD_ELEMENT(&cs, &dskElem);
 
-    // count file-descriptors and build inode->unit here. That way
-    // the fd-counter is correct, but it also has the effect of
-    // smoothing the /proc walks out over the polling interval
-    uint32_t maxProcessFDs = 0;
-    accumulateFileDescriptors(mod, unit, &maxProcessFDs);
+    // Walking /proc/<pid>/fd is by far the most expensive thing here, so
+    // it is only done to re-map listen sockets to units (markTraffic) when
+    // they changed, or if fdCount=on, when a rotating sample of processes
+    // is walked each time.
     // TODO: add fd count to new structure (or append to existing one)
     // it could be a total for the vm/container as well as a max for any
     // one process.  I guess it could also tally files, sockets etc.
     // separately,  but the main reason for doing this is to detect when
     // the ulimit might soon be reached. Running out of file-descriptors
     // is such a classic meltdown scenario...
+    bool mapListenSocks = mdata->listenSocks && (mdata->listenSocksRev != unit->listenSocksRev);
+    if(mapListenSocks
+       || sp->systemd.fdCount) {
+      if(!gotProcesses) {
+	readUnitProcesses(mod, unit);
+	gotProcesses = YES;
+      }
+      unit->fdCount = accumulateFileDescriptors(mod, unit, mapListenSocks, &unit->fdMax);
+      myDebug(2, "%s: fds=%u max_per_process=%u", unit->name, unit->fdCount, unit->fdMax);
+    }
 
     SEMLOCK_DO(sp->sync_agent) {
       sfl_poller_writeCountersSample(vm->poller, &cs);
       sp->counterSampleQueued = YES;
-      sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+      telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
+    }
+    if(unit->inactive) {
+      // that was the final look
+      removeAndFreeVM_SYSTEMD(mod, container);
+      untrackUnit(mod, unit->name);
     }
   }
 
@@ -881,100 +1152,94 @@ extern "C" {
 	  // cgroup name changed
 	  my_free(unit->cgroup);
 	  unit->cgroup = NULL;
+	  closeCgroupFiles(unit);
 	}
 	if(!unit->cgroup)
 	  unit->cgroup = my_strdup(val.str);
 
-	// read the process ids
-
-	// mark and sweep - mark
-	HSPDBusProcess *process;
-	UTHASH_WALK(unit->processes, process)
-	  process->marked = YES;
-
-	char path[HSP_SYSTEMD_MAX_FNAME_LEN+1];
-	sprintf(path, mdata->cgroup_procs, val.str);
-	FILE *pidsFile = fopen(path, "r");
-	if(pidsFile == NULL) {
-	  myDebug(2, "cannot open %s : %s", path, strerror(errno));
-	}
-	else {
-	  char line[MAX_PROC_LINELEN];
-	  uint64_t pid64;
-	  int truncated;
-	  while(my_readline(pidsFile, line, MAX_PROC_LINELEN, &truncated) != EOF) {
-	    if(sscanf(line, "%"SCNu64, &pid64) == 1) {
-	      myDebug(1, "got PID=%"PRIu64, pid64);
-	      HSPDBusProcess search = { .pid = pid64 };
-	      process = UTHashGet(unit->processes, &search);
-	      if(process)
-		process->marked = NO;
-	      else {
-		process = (HSPDBusProcess *)my_calloc(sizeof(HSPDBusProcess));
-		process->pid = pid64;
-		UTHashAdd(unit->processes, process);
-	      }
-	    }
-	  }
-	  fclose(pidsFile);
-
-	  if(UTHashN(unit->processes)) {
-	    // mark and sweep - sweep
-	    UTHASH_WALK(unit->processes, process)
-	      if(process->marked)
-		if(UTHashDel(unit->processes, process))
-		  my_free(process);
-	    // find or allocate the container
-	    getContainer(mod, unit, YES);
+	if(unitPopulated(mod, unit)) {
+	  // find or allocate the container
+	  getContainer(mod, unit, YES);
+	  // with cgroup v2 the presence of the files tells us what
+	  // accounting is enabled, but with v1 we have to ask.
+	  if(!mdata->cgroupV2) {
 	    getDbusProperty(mod, unit, handler_cpuAccounting, "CPUAccounting");
 	    getDbusProperty(mod, unit, handler_memoryAccounting, "MemoryAccounting");
 	    getDbusProperty(mod, unit, handler_blockIOAccounting, "BlockIOAccounting");
-	    // TODO: could try and get "MemoryCurrent" and "CPUUsageNSec" here, but since they
-	    // are usually not limited,  these numbers are usually == (uint64_t)-1.  So
-	    // we have to get the numbers from the cgroup accounting (if enabled) or fall
-	    // back on getting the numbers from each process.
 	  }
+	  // TODO: could try and get "MemoryCurrent" and "CPUUsageNSec" here, but since they
+	  // are usually not limited,  these numbers are usually == (uint64_t)-1.  So
+	  // we have to get the numbers from the cgroup accounting (if enabled) or fall
+	  // back on getting the numbers from each process.
 	}
       }
     }
   }
 
   /*_________________---------------------------__________________
-    _________________   handler_getUnit         __________________
+    _________________   trackUnit, untrackUnit  __________________
     -----------------___________________________------------------
+    Called for active services, whether we learned about them
+    from ListUnits or from a signal.
   */
 
-  static void handler_getUnit(EVMod *mod, DBusMessage *dbm, void *magic) {
-    HSPDBusUnit *unit = (HSPDBusUnit *)magic;
-    DBusMessageIter it;
-    if(dbus_message_iter_init(dbm, &it)) {
-      MyDBusBasicValue val;
-      if(db_get(&it, DBUS_TYPE_OBJECT_PATH, &val)
-	 && val.str) {
-	if(unit->obj
-	   && !my_strequal(unit->obj, val.str)) {
-	  // obj changed
-	  my_free(unit->obj);
-	  unit->obj = NULL;
-	}
-	if(!unit->obj)
-	  unit->obj = my_strdup(val.str);
-
-	myDebug(1, "UNIT OBJ[obj=\"%s\"]", val.str);
-	dbusMethod(mod,
-		   handler_controlGroup,
-		   unit,
-		   "org.freedesktop.systemd1",
-		   unit->obj,
-		   "org.freedesktop.DBus.Properties",
-		   "Get",
-		   DBUS_TYPE_STRING,
-		   "org.freedesktop.systemd1.Service",
-		   DBUS_TYPE_STRING,
-		   "ControlGroup",
-		   HSP_dbusMethod_endargs);
-      }
+  static HSPDBusUnit *trackUnit(EVMod *mod, char *name, char *obj) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    HSPDBusUnit search = { .name = name };
+    HSPDBusUnit *unit = UTHashGet(mdata->units, &search);
+    if(unit == NULL) {
+      unit = HSPDBusUnitNew(mod, name);
+      UTHashAdd(mdata->units, unit);
+    }
+    unit->marked = NO;
+    unit->inactive = NO;
+    if(unit->obj
+       && !my_strequal(unit->obj, obj)) {
+      // obj changed
+      my_free(unit->obj);
+      unit->obj = NULL;
+    }
+    if(!unit->obj)
+      unit->obj = my_strdup(obj);
+    if(unit->cgroup == NULL) {
+      myDebug(1, "UNIT OBJ[obj=\"%s\"]", obj);
+      dbusMethod(mod,
+		 handler_controlGroup,
+		 unit,
+		 HSP_SYSTEMD_DBUS_NAME,
+		 unit->obj,
+		 "org.freedesktop.DBus.Properties",
+		 "Get",
+		 DBUS_TYPE_STRING,
+		 "org.freedesktop.systemd1.Service",
+		 DBUS_TYPE_STRING,
+		 "ControlGroup",
+		 HSP_dbusMethod_endargs);
+    }
+    else if(getContainer(mod, unit, NO) == NULL
+	    && unitPopulated(mod, unit)) {
+      // we dropped it when it was empty, but now it has processes again
+      getContainer(mod, unit, YES);
     }
+    return unit;
+  }
+
+  static void untrackUnit(EVMod *mod, char *name) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    HSPDBusUnit search = { .name = name };
+    HSPDBusUnit *unit = UTHashGet(mdata->units, &search);
+    if(unit == NULL)
+      return;
+    if(!unit->inactive
+       && getContainer(mod, unit, NO)) {
+      // keep it so that the container gets a final look at its next
+      // poll, which then calls back here to finish the job
+      myDebug(1, "UNIT %s no longer active", name);
+      unit->inactive = YES;
+      return;
+    }
+    UTHashDel(mdata->units, unit);
+    HSPDBusUnitFree(mod, unit);
   }
 
   /*_________________---------------------------__________________
@@ -1011,36 +1276,22 @@ extern "C" {
 	DB_WALK(&it_unit, DBUS_TYPE_STRUCT, NULL) {
 	  DBusMessageIter it_field;
 	  dbus_message_iter_recurse(&it_unit, &it_field);
-	  MyDBusBasicValue nm, ds, ls, as;
+	  MyDBusBasicValue nm, ds, ls, as, ss, fl, op;
 	  if(db_get(&it_field,  DBUS_TYPE_STRING, &nm)
 	     && db_get_next(&it_field, DBUS_TYPE_STRING, &ds)
 	     && db_get_next(&it_field, DBUS_TYPE_STRING, &ls)
-	     && db_get_next(&it_field, DBUS_TYPE_STRING, &as)) {
+	     && db_get_next(&it_field, DBUS_TYPE_STRING, &as)
+	     && db_get_next(&it_field, DBUS_TYPE_STRING, &ss)
+	     && db_get_next(&it_field, DBUS_TYPE_STRING, &fl)
+	     && db_get_next(&it_field, DBUS_TYPE_OBJECT_PATH, &op)) {
 	    if(nm.str
 	       && my_strlen(nm.str)
+	       && op.str
 	       && my_strequal(ls.str, "loaded")
 	       && my_strequal(as.str, "active")
 	       && regexec(mdata->service_regex, nm.str, 0, NULL, 0) == 0) {
-	      HSPDBusUnit search = { .name = nm.str };
-	      unit = UTHashGet(mdata->units, &search);
-	      if(unit) {
-		unit->marked = NO;
-	      }
-	      else {
-		unit = HSPDBusUnitNew(mod, nm.str);
-		UTHashAdd(mdata->units, unit);
-	      }
 	      myDebug(1, "UNIT[name=\"%s\" descr=\"%s\" load=\"%s\" active=\"%s\"]", nm.str, ds.str, ls.str, as.str);
-	      dbusMethod(mod,
-			 handler_getUnit,
-			 unit,
-			 "org.freedesktop.systemd1",
-			 "/org/freedesktop/systemd1",
-			 "org.freedesktop.systemd1.Manager",
-			 "GetUnit",
-			 DBUS_TYPE_STRING,
-			 nm.str,
-			 HSP_dbusMethod_endargs);
+	      trackUnit(mod, nm.str, op.str);
 	    }
 	  }
 	}
@@ -1055,27 +1306,138 @@ extern "C" {
     }
   }
 
+  /*_________________---------------------------__________________
+    _________________   unit signals            __________________
+    -----------------___________________________------------------
+    After Subscribe, systemd tells us when a unit's ActiveState
+    changes (PropertiesChanged on the Unit interface), when a unit is
+    unloaded (UnitRemoved) and when it has reloaded its configuration
+    (Reloading), so we only need ListUnits at startup and after a
+    reload. UnitNew is not used: it fires whenever a unit is merely
+    loaded (e.g. by "systemctl status"), and a start is always
+    followed by ActiveState=active anyway.
+  */
+
+  static bool unitNameFromPath(char *path, char *buf, int bufLen) {
+    // systemd escapes the unit name in its object path as _xx (hex)
+    size_t prefixLen = strlen(HSP_SYSTEMD_DBUS_UNIT_PREFIX);
+    if(path == NULL
+       || strncmp(path, HSP_SYSTEMD_DBUS_UNIT_PREFIX, prefixLen) != 0)
+      return NO;
+    int len = 0;
+    for(char *p = path + prefixLen; *p; p++) {
+      if(len >= bufLen - 1)
+	return NO;
+      if(*p == '_'
+	 && isxdigit(p[1])
+	 && isxdigit(p[2])) {
+	char hex[3] = { p[1], p[2], '\0' };
+	buf[len++] = (char)strtol(hex, NULL, 16);
+	p += 2;
+      }
+      else
+	buf[len++] = *p;
+    }
+    buf[len] = '\0';
+    return (len > 0);
+  }
+
+  static void signal_propertiesChanged(EVMod *mod, DBusMessage *msg) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    char *path = (char *)dbus_message_get_path(msg);
+    char name[HSP_SYSTEMD_MAX_FNAME_LEN];
+    if(!unitNameFromPath(path, name, HSP_SYSTEMD_MAX_FNAME_LEN)
+       || regexec(mdata->service_regex, name, 0, NULL, 0) != 0)
+      return;
+    // (s interface, a{sv} changed, as invalidated)
+    DBusMessageIter it;
+    MyDBusBasicValue iface;
+    if(dbus_message_iter_init(msg, &it)
+       && db_get(&it, DBUS_TYPE_STRING, &iface)
+       && my_strequal(iface.str, "org.freedesktop.systemd1.Unit")
+       && db_next(&it)
+       && db_get(&it, DBUS_TYPE_ARRAY, NULL)) {
+      DBusMessageIter it_dict;
+      dbus_message_iter_recurse(&it, &it_dict);
+      DB_WALK(&it_dict, DBUS_TYPE_DICT_ENTRY, NULL) {
+	DBusMessageIter it_entry;
+	dbus_message_iter_recurse(&it_dict, &it_entry);
+	MyDBusBasicValue prop, state;
+	if(db_get(&it_entry, DBUS_TYPE_STRING, &prop)
+	   && my_strequal(prop.str, "ActiveState")
+	   && db_get_next(&it_entry, DBUS_TYPE_STRING, &state)) {
+	  myDebug(1, "UNIT %s ActiveState=%s", name, state.str);
+	  if(my_strequal(state.str, "active")
+	     || my_strequal(state.str, "reloading"))
+	    trackUnit(mod, name, path);
+	  else if(my_strequal(state.str, "inactive")
+		  || my_strequal(state.str, "failed"))
+	    untrackUnit(mod, name);
+	  // "activating" and "deactivating" are transitions - wait for the outcome
+	}
+      }
+    }
+  }
+
+  static void signal_unitRemoved(EVMod *mod, DBusMessage *msg) {
+    // (s id, o path)
+    DBusMessageIter it;
+    MyDBusBasicValue nm;
+    if(dbus_message_iter_init(msg, &it)
+       && db_get(&it, DBUS_TYPE_STRING, &nm)
+       && nm.str)
+      untrackUnit(mod, nm.str);
+  }
+
+  static void signal_reloading(EVMod *mod, DBusMessage *msg) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    // (b active) - sent before and after a daemon-reload
+    DBusMessageIter it;
+    MyDBusBasicValue active;
+    if(dbus_message_iter_init(msg, &it)
+       && db_get(&it, DBUS_TYPE_BOOLEAN, &active)
+       && !active.bool_val) {
+      myDebug(1, "SYSTEMD reloaded - resync units");
+      mdata->countdownToResync = 1;
+    }
+  }
+
+  static bool dbusSignal(EVMod *mod, DBusMessage *msg) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    if(dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged"))
+      signal_propertiesChanged(mod, msg);
+    else if(dbus_message_is_signal(msg, "org.freedesktop.systemd1.Manager", "UnitRemoved"))
+      signal_unitRemoved(mod, msg);
+    else if(dbus_message_is_signal(msg, "org.freedesktop.systemd1.Manager", "Reloading"))
+      signal_reloading(mod, msg);
+    else
+      return NO;
+    mdata->dbus_signals++;
+    return YES;
+  }
+
   /*_________________---------------------------__________________
     _________________   dbusSynchronize         __________________
     -----------------___________________________------------------
+    returns NO if it could not list the units yet
   */
 
-  static void dbusSynchronize(EVMod *mod) {
+  static bool dbusSynchronize(EVMod *mod) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
 
-#if HSP_DBUS_MONITOR
-    if(!mdata->subscribed) {
+    if(mdata->signals
+       && !mdata->subscribed) {
+      // ask systemd to send the unit signals we matched on
       mdata->subscribed = YES;
       dbusMethod(mod,
 		 NULL,
 		 NULL,
-		 "org.freedesktop.systemd1",
-		 "/org/freedesktop/systemd1",
+		 HSP_SYSTEMD_DBUS_NAME,
+		 HSP_SYSTEMD_DBUS_OBJ,
 		 "org.freedesktop.systemd1.Manager",
 		 "Subscribe",
 		 HSP_dbusMethod_endargs);
     }
-#endif
 
     if(UTHashN(mdata->dbusRequests)) {
       myDebug(1, "SYSTEMD: dbusSynchronize - outstanding requests=%u", UTHashN(mdata->dbusRequests));
@@ -1090,18 +1452,18 @@ extern "C" {
 	  my_free(req);
 	}
       }
+      return NO;
     }
-    else {
-      // kick off a unit discovery sweep
-      dbusMethod(mod,
-		 handler_listUnits,
-		 NULL,
-		 "org.freedesktop.systemd1",
-		 "/org/freedesktop/systemd1",
-		 "org.freedesktop.systemd1.Manager",
-		 "ListUnits",
-		 HSP_dbusMethod_endargs);
-    }
+    // kick off a unit discovery sweep
+    dbusMethod(mod,
+	       handler_listUnits,
+	       NULL,
+	       HSP_SYSTEMD_DBUS_NAME,
+	       HSP_SYSTEMD_DBUS_OBJ,
+	       "org.freedesktop.systemd1.Manager",
+	       "ListUnits",
+	       HSP_dbusMethod_endargs);
+    return YES;
   }
 
   /*_________________---------------------------__________________
@@ -1298,6 +1660,12 @@ extern "C" {
   static void evt_config_first(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
     mdata->countdownToResync = HSP_SYSTEMD_WAIT_STARTUP;
+    mdata->countdownToListenSocks = HSP_SYSTEMD_WAIT_STARTUP;
+    // signals and replies are read as soon as they arrive
+    int dbus_fd = -1;
+    if(mdata->connection
+       && dbus_connection_get_unix_fd(mdata->connection, &dbus_fd))
+      mdata->dbusSock = EVBusAddSocket(mod, EVCurrentBus(), dbus_fd, readDBus, NULL);
     if(mdata->listenSocks) {
       if((mdata->nl_sock = UTNLDiag_open()) > 0)
 	EVBusAddSocket(mod, EVCurrentBus(), mdata->nl_sock, readNL, NULL);
@@ -1371,14 +1739,24 @@ extern "C" {
     if(mdata->countdownToResync) {
       if(--mdata->countdownToResync == 0) {
 	// refresh units
-	dbusSynchronize(mod);
+	if(!dbusSynchronize(mod))
+	  mdata->countdownToResync = 1; // try again next tick
+	else if(mdata->signals)
+	  mdata->countdownToResync = sp->systemd.refreshVMListSecs ?: HSP_SYSTEMD_RESYNC_SECS;
+	else
+	  mdata->countdownToResync = sp->systemd.refreshVMListSecs ?: sp->refreshVMListSecs;
+      }
+    }
+
+    if(mdata->countdownToListenSocks) {
+      if(--mdata->countdownToListenSocks == 0) {
 	if(mdata->listenSocks && mdata->packetSamples) {
 	  // kick off the sequence that refreshes the listenSockets
 	  markListenSockets(mod);
 	  mdata->nextListenSockQuery = MAGIC_SEQ_TCP4;
 	}
 	// next countdown
-	mdata->countdownToResync = sp->systemd.refreshVMListSecs ?: sp->refreshVMListSecs;
+	mdata->countdownToListenSocks = sp->systemd.refreshVMListSecs ?: sp->refreshVMListSecs;
       }
     }
   }
@@ -1393,30 +1771,37 @@ extern "C" {
     UTHashReset(mdata->pollActions);
   }
 
-  // obtaining a selectable file-descriptor from libdbus is not as easy
-  // as it ought to be, so it turns out that polling with
-  // dbus_connection_read_write_dispatch() is the easiest way to drive
-  // the bus (so that method calls are asychronous and monitoring with filters
-  // can be layered on top if required).
+  // Incoming signals and replies are read when the dbus socket is
+  // readable (readDBus), but libdbus can also leave messages in its own
+  // buffer (e.g. while it blocks in dbus_bus_add_match), and outgoing
+  // method calls are only flushed when the connection is driven.  So
+  // we still poll with dbus_connection_read_write_dispatch() on deciTick
+  // while there is an outstanding request or undispatched data.
   // In most cases a single poll is enough to propagate the message through one
   // way or the other, but when we ask to "ListUnits" it actually takes
   // about 20 polls before the data finally starts to appear for us in the
   // dbusCB filter callback.  (I think that means a single poll of
   // dbux_connection_read_write_dispatch() will sometimes only trigger
   // a single socket read() operation with a limited size buffer.)
-  // We could spin tightly as long as their is an outstanding request, but
-  // it seems safer to do this polling on deciTick and allow that it might
-  // take a second or two of extra time before a call such as ListUnits delivers
-  // results.  Better to accept extra latency than risk going into a busy loop.
   // If we see progress in terms of messages send or received, then we
   // keep spinning, so a flurry of short method calls will complete quickly.
 
+  static void readDBus(EVMod *mod, EVSocket *sock, void *magic) {
+    HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
+    if(!dbus_connection_read_write(mdata->connection, 0)) {
+      myLog(LOG_ERR, "SYSTEMD: dbus connection closed");
+      // the fd belongs to libdbus
+      EVSocketClose(mod, sock, NO);
+      mdata->dbusSock = NULL;
+      return;
+    }
+    while(dbus_connection_dispatch(mdata->connection) == DBUS_DISPATCH_DATA_REMAINS);
+  }
+
   static void evt_deci(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
-    bool dbpoll = (UTHashN(mdata->dbusRequests) > 0);
-#if HSP_DBUS_MONITOR
-    dbpoll = YES
-#endif
+    bool dbpoll = (UTHashN(mdata->dbusRequests) > 0
+		   || dbus_connection_get_dispatch_status(mdata->connection) == DBUS_DISPATCH_DATA_REMAINS);
     if(dbpoll) {
       myDebug(2, "SYSTEMD deci - outstanding=%u tx=%u rx=%u", UTHashN(mdata->dbusRequests), mdata->dbus_tx, mdata->dbus_rx);
       uint32_t curr_tx = mdata->dbus_tx;
@@ -1470,7 +1855,9 @@ static DBusHandlerResult dbusCB(DBusConnection *connection, DBusMessage *message
   if(debug(2))
     parseDBusMessage(message);
 
-  if(dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_METHOD_RETURN) {
+  int mtype = dbus_message_get_type(message);
+  if(mtype == DBUS_MESSAGE_TYPE_METHOD_RETURN
+     || mtype == DBUS_MESSAGE_TYPE_ERROR) {
     int serial = dbus_message_get_reply_serial(message);
     HSPDBusRequest search = { .serial = serial };
     HSPDBusRequest *req = UTHashDelKey(mdata->dbusRequests, &search);
@@ -1482,12 +1869,19 @@ static DBusHandlerResult dbusCB(DBusConnection *connection, DBusMessage *message
 	      req->serial,
 	      EVTimeDiff_mS(&req->send_time, &now));
       }
-      if(req->handler)
+      if(mtype == DBUS_MESSAGE_TYPE_ERROR)
+	myDebug(1, "SYSTEMD dbus error reply (serial=%u) : %s", req->serial, dbus_message_get_error_name(message));
+      else if(req->handler
+	      && !req->cancelled)
 	(*req->handler)(mod, message, req->magic);
       my_free(req);
       return DBUS_HANDLER_RESULT_HANDLED;
     }
   }
+  else if(mtype == DBUS_MESSAGE_TYPE_SIGNAL) {
+    if(dbusSignal(mod, message))
+      return DBUS_HANDLER_RESULT_HANDLED;
+  }
 
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
@@ -1496,16 +1890,18 @@ static DBusHandlerResult dbusCB(DBusConnection *connection, DBusMessage *message
     _________________    addMatch               __________________
     -----------------___________________________------------------
   */
-#if HSP_DBUS_MONITOR
-  static void addMatch(EVMod *mod, char *rule) {
+
+  static bool addMatch(EVMod *mod, char *rule) {
     HSP_mod_SYSTEMD *mdata = (HSP_mod_SYSTEMD *)mod->data;
     dbus_bus_add_match(mdata->connection, rule, &mdata->error);
     if(dbus_error_is_set(&mdata->error)) {
       myLog(LOG_ERR, "SYSTEMD: addMatch() error adding <%s>", rule);
       log_dbus_error(mod, "dbus_bus_add_match");
+      dbus_error_free(&mdata->error);
+      return NO;
     }
+    return YES;
   }
-#endif
 
   /*_________________---------------------------__________________
     _________________    module init            __________________
@@ -1523,8 +1919,14 @@ static DBusHandlerResult dbusCB(DBusConnection *connection, DBusMessage *message
     requestVNodeRole(mod, HSP_VNODE_PRIORITY_SYSTEMD);
 
     // path formats for cgroup info - can be overridden in config
-    mdata->cgroup_procs = sp->systemd.cgroup_procs ?: HSP_SYSTEMD_CGROUP_PROCS;
     mdata->cgroup_acct = sp->systemd.cgroup_acct ?: HSP_SYSTEMD_CGROUP_ACCT;
+    // unified hierarchy (cgroup v2) if cgroup.controllers is at the top
+    char path[HSP_SYSTEMD_MAX_FNAME_LEN+1];
+    snprintf(path, HSP_SYSTEMD_MAX_FNAME_LEN, mdata->cgroup_acct, "", "", "cgroup.controllers");
+    mdata->cgroupV2 = (access(path, R_OK) == 0);
+    mdata->cgroup_procs = sp->systemd.cgroup_procs
+      ?: (mdata->cgroupV2 ? HSP_SYSTEMD_CGROUP_PROCS_V2 : HSP_SYSTEMD_CGROUP_PROCS);
+    myDebug(1, "SYSTEMD: cgroup %s", mdata->cgroupV2 ? "v2" : "v1");
     
     // get page size for scaling memory pages->bytes
 #if defined(PAGESIZE)
@@ -1560,13 +1962,17 @@ static DBusHandlerResult dbusCB(DBusConnection *connection, DBusMessage *message
       return;
     }
 
-#if HSP_DBUS_MONITOR
-    /* TODO: possible eavesdropping if we want to detect service start/stop asynchronously */
-    /* addMatch(mod, "eavesdrop=true,type='signal'"); */
-    /* addMatch(mod, "eavesdrop=true,type='method_call'"); */
-    /* addMatch(mod, "eavesdrop=true,type='method_return'"); */
-    /* addMatch(mod, "eavesdrop=true,type='error'"); */
-#endif
+    // unit signals (see dbusSignal). If we cannot have them we
+    // fall back on re-listing the units periodically.
+    mdata->signals =
+      addMatch(mod, "type='signal',sender='" HSP_SYSTEMD_DBUS_NAME "',"
+	       "interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',"
+	       "path_namespace='" HSP_SYSTEMD_DBUS_OBJ "/unit',"
+	       "arg0='org.freedesktop.systemd1.Unit'")
+      && addMatch(mod, "type='signal',sender='" HSP_SYSTEMD_DBUS_NAME "',"
+		  "interface='org.freedesktop.systemd1.Manager',member='UnitRemoved'")
+      && addMatch(mod, "type='signal',sender='" HSP_SYSTEMD_DBUS_NAME "',"
+		  "interface='org.freedesktop.systemd1.Manager',member='Reloading'");
 
     // register dispatch callback
     if(!dbus_connection_add_filter(mdata->connection, dbusCB, mod, NULL)) {
@@ -523,8 +523,9 @@ extern "C" {
 		SFLMacAddress macsrc,macdst;
 		memcpy(macdst.mac, ps->hdr, 6);
 		memcpy(macsrc.mac, ps->hdr + 6, 6);
-		ps->localSrc = (adaptorByMac(sp, &macsrc) != NULL);
-		ps->localDst = (adaptorByMac(sp, &macdst) != NULL);
+		HSPAdaptorLookup *lkp = adaptorLookup(sp);
+		ps->localSrc = (adaptorLookupMac(sp, lkp, &macsrc) != NULL);
+		ps->localDst = (adaptorLookupMac(sp, lkp, &macdst) != NULL);
 		myDebug(2, "tcp: IPIP localSrc=%s localDst=%s",
 			ps->localSrc ? "YES":"NO",
 			ps->localDst ? "YES":"NO");
@@ -115,6 +115,7 @@ extern "C" {
 	      }
 
 	      takeSample(sp,
+			 mod,
 			 dev_in,
 			 dev_out,
 			 NULL,
@@ -437,7 +437,7 @@ extern "C" {
       SEMLOCK_DO(sp->sync_agent) {
 	sfl_poller_writeCountersSample(poller, cs);
 	sp->counterSampleQueued = YES;
-	sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+	telemetryAdd(sp, mod, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
       }
     }
   }
@@ -625,6 +625,7 @@ extern "C" {
 	      UTHashDel(sp->adaptorsByMac, adaptor);
 	      adaptor->macs[0] = mac; // struct copy
 	      UTHashAdd(sp->adaptorsByMac, adaptor);
+	      requestAdaptorLookup(sp);
 	    }
 	  }
 	  free(macStr); // allocated by xs_read()
@@ -168,13 +168,13 @@ extern "C" {
 	// TODO: use HSPPendingCSample for HSPEVENT_HOST_COUNTER_SAMPLE too?
 	// (might be useful to consumers to get pointer to the poller too).
 	if(ps.suppress) {
-	  sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES_SUPPRESSED]++;
+	  telemetryAdd(sp, NULL, HSP_TELEMETRY_COUNTER_SAMPLES_SUPPRESSED, 1);
 	}
 	else {
 	  SEMLOCK_DO(sp->sync_agent) {
 	    sfl_poller_writeCountersSample(poller, cs);
 	    sp->counterSampleQueued = YES;
-	    sp->telemetry[HSP_TELEMETRY_COUNTER_SAMPLES]++;
+	    telemetryAdd(sp, NULL, HSP_TELEMETRY_COUNTER_SAMPLES, 1);
 	  }
 	}
       }
@@ -248,12 +248,14 @@ extern "C" {
     -----------------___________________________------------------
   */
 
-  static HSPPendingSample *pendingSampleNew(SFLSampler *sampler, SFL_FLOW_SAMPLE_TYPE *fs)  {
+  static HSPPendingSample *pendingSampleNew(EVMod *mod, SFLSampler *sampler, SFL_FLOW_SAMPLE_TYPE *fs)  {
     HSPPendingSample *ps = (HSPPendingSample *)my_calloc(sizeof(HSPPendingSample));
     ps->fs = fs;
     ps->sampler = sampler;
     ps->refCount = 1;
     ps->ptrsToFree = UTArrayNew(UTARRAY_DFLT);
+    ps->taken_nS = latencyClock_nS();
+    ps->module = mod;
     return ps;
   }
 
@@ -271,15 +273,22 @@ extern "C" {
   {
     if(--ps->refCount == 0) {
       EVBus *bus = EVCurrentBus();
+      uint64_t release_nS = latencyClock_nS();
+      if(ps->taken_nS)
+	latencyRecord(sp, ps->module, HSP_LATENCY_HOLD, release_nS - ps->taken_nS);
       if(ps->suppress) {
-	sp->telemetry[HSP_TELEMETRY_FLOW_SAMPLES_SUPPRESSED]++;
+	telemetryAdd(sp, ps->module, HSP_TELEMETRY_FLOW_SAMPLES_SUPPRESSED, 1);
       }
       else {
 	SEMLOCK_DO(sp->sync_agent) {
+	  // if this fills the datagram, the send is charged to this module too
+	  sp->sendModule = ps->module;
 	  sfl_agent_set_now(ps->sampler->agent, bus->now.tv_sec, bus->now.tv_nsec);
 	  sfl_sampler_writeFlowSample(ps->sampler, ps->fs);
-	  sp->telemetry[HSP_TELEMETRY_FLOW_SAMPLES]++;
+	  sp->sendModule = NULL;
+	  telemetryAdd(sp, ps->module, HSP_TELEMETRY_FLOW_SAMPLES, 1);
 	}
+	latencyRecord(sp, ps->module, HSP_LATENCY_ENCODE, latencyClock_nS() - release_nS);
       }
       void *ptr;
       UTARRAY_WALK(ps->ptrsToFree, ptr)
@@ -295,7 +304,7 @@ extern "C" {
     -----------------___________________________------------------
   */
 
-  void takeSample(HSP *sp, SFLAdaptor *ad_in, SFLAdaptor *ad_out, SFLAdaptor *ad_tap, uint32_t options, uint32_t hook, const u_char *mac_hdr, uint32_t mac_len, const u_char *cap_hdr, uint32_t cap_len, uint32_t pkt_len, uint32_t drops, uint32_t sampling_n)
+  void takeSample(HSP *sp, EVMod *mod, SFLAdaptor *ad_in, SFLAdaptor *ad_out, SFLAdaptor *ad_tap, uint32_t options, uint32_t hook, const u_char *mac_hdr, uint32_t mac_len, const u_char *cap_hdr, uint32_t cap_len, uint32_t pkt_len, uint32_t drops, uint32_t sampling_n)
   {
 
     if(getDebug() > 1) {
@@ -337,11 +346,13 @@ extern "C" {
 
     // If it is the container-end of a veth pair, then we want to
     // map it back to the other end that is in the global-namespace,
-    // Since those are the bridge ports.
+    // Since those are the bridge ports.  Use the read-only snapshot
+    // of the adaptor tables so we don't contend with the poll bus.
+    HSPAdaptorLookup *lkp = adaptorLookup(sp);
     if(ad_in) {
-      if(ADAPTOR_NIO(ad_in)->vm_or_container)
+      if(adaptorLookupFlags(lkp, ad_in) & HSP_ADLKP_VM_OR_CONTAINER)
 	bridgeModel = YES;
-      SFLAdaptor *ad_in_global = adaptorByPeerIndex(sp, ad_in->ifIndex);
+      SFLAdaptor *ad_in_global = adaptorLookupPeer(sp, lkp, ad_in);
       if(ad_in_global) {
 	if(getDebug()) {
 	  myLog(LOG_INFO, "  GlobalNS veth peer ad_in=%s(%u)",
@@ -353,9 +364,9 @@ extern "C" {
       }
     }
     if(ad_out) {
-      if(ADAPTOR_NIO(ad_out)->vm_or_container)
+      if(adaptorLookupFlags(lkp, ad_out) & HSP_ADLKP_VM_OR_CONTAINER)
 	bridgeModel = YES;
-      SFLAdaptor *ad_out_global = adaptorByPeerIndex(sp, ad_out->ifIndex);
+      SFLAdaptor *ad_out_global = adaptorLookupPeer(sp, lkp, ad_out);
       if(ad_out_global) {
 	if(getDebug()) {
 	  myLog(LOG_INFO, "  GlobalNS veth peer ad_out=%s(%u)",
@@ -419,8 +430,8 @@ extern "C" {
       sampler_dev = ad_in ?: ad_out;
       if(ad_in
 	 && ad_out
-	 && ADAPTOR_NIO(ad_in)->loopback
-	 && !ADAPTOR_NIO(ad_out)->loopback
+	 && (adaptorLookupFlags(lkp, ad_in) & HSP_ADLKP_LOOPBACK)
+	 && !(adaptorLookupFlags(lkp, ad_out) & HSP_ADLKP_LOOPBACK)
 	 && ad_out->ifIndex)
 	sampler_dev = ad_out;
     }
@@ -452,7 +463,7 @@ extern "C" {
     }
 
     // build the sampled header structure
-    HSPPendingSample *ps = pendingSampleNew(sampler, fs);
+    HSPPendingSample *ps = pendingSampleNew(mod, sampler, fs);
     SFLFlow_sample_element *hdrElem = pendingSample_calloc(ps, sizeof(SFLFlow_sample_element));
     hdrElem->tag = SFLFLOW_HEADER;
     uint32_t FCS_bytes = 4;
@@ -518,7 +529,7 @@ extern "C" {
     sampler->samplePool += actualSamplingRate;
     
     // accumulate total drops
-    sp->telemetry[HSP_TELEMETRY_DROPPED_SAMPLES] += drops;
+    telemetryAdd(sp, NULL, HSP_TELEMETRY_DROPPED_SAMPLES, drops);
 
     // also accumulate dropped-samples we detected against whichever sampler
     // sends the next sample. This is not perfect,  but is likely to accrue
@@ -590,92 +601,94 @@ extern "C" {
 #define NFT_ETHHDR_SIZ 14
 #define NFT_8022_SIZ 3
 #define NFT_MAX_8023_LEN 1500
+#define NFT_MAX_VLAN_TAGS 2
+#define NFT_MAX_MPLS_LABELS 8
 
 #define NFT_MIN_SIZ (NFT_ETHHDR_SIZ + sizeof(struct iphdr))
 
-  static int decodePacketHeader(SFLSampled_header *header, uint8_t *ipproto, int *l3_offset, int *l4_offset)
+#define NFT_ETYPE_IP4 0x0800
+#define NFT_ETYPE_IP6 0x86DD
+#define NFT_ETYPE_8021Q 0x8100
+#define NFT_ETYPE_8021AD 0x88A8
+#define NFT_ETYPE_MPLS_UC 0x8847
+#define NFT_ETYPE_MPLS_MC 0x8848
+#define NFT_ETYPE_TEB 0x6558 // transparent ethernet bridging
+
+  // Walk the MAC layer. Leaves *pptr at the start of the L3 header and
+  // returns the ethernet type there, or -1 if it cannot be decoded.
+  static int decodeMAC(uint8_t *ptr, uint8_t *end, uint8_t **pptr)
   {
-    uint8_t *start = header->header_bytes;
-    uint8_t *end = start + header->header_length;
-    uint8_t *ptr = start;
-    uint16_t type_len = 0;
-    
-    switch(header->header_protocol) {
-
-    case SFLHEADER_IPv4:
-      type_len = 0x0800;
-      break;
-
-    case SFLHEADER_IPv6:
-      type_len = 0x86DD;
-      break;
-
-    case SFLHEADER_ETHERNET_ISO8023:
-      // ethernet
-      if((end - ptr) < NFT_ETHHDR_SIZ)
-	return -1; // not enough for an Ethernet header
-      ptr += 6;
-      ptr += 6;
+    if((end - ptr) < NFT_ETHHDR_SIZ)
+      return -1; // not enough for an Ethernet header
+    ptr += 6;
+    ptr += 6;
+    uint16_t type_len = (ptr[0] << 8) + ptr[1];
+    ptr += 2;
+
+    for(int tags = 0;
+	tags < NFT_MAX_VLAN_TAGS
+	  && (type_len == NFT_ETYPE_8021Q
+	      || type_len == NFT_ETYPE_8021AD);
+	tags++) {
+      // 802.1Q (or 802.1ad outer tag)
+      if((end - ptr) < 4)
+	return -1; // not enough for an 802.1Q header
+      // VLAN  - next two bytes
+      // uint32_t vlanData = (ptr[0] << 8) + ptr[1];
+      // uint32_t vlan = vlanData & 0x0fff;
+      // uint32_t priority = vlanData >> 13;
+      ptr += 2;
+      //  _____________________________________ 
+      // |   pri  | c |         vlan-id        | 
+      //  ------------------------------------- 
+      // [priority = 3bits] [Canonical Format Flag = 1bit] [vlan-id = 12 bits] 
+      // now get the type_len again (next two bytes) 
       type_len = (ptr[0] << 8) + ptr[1];
       ptr += 2;
-      
-      if(type_len == 0x8100) {
-	// 802.1Q
-	if((end - ptr) < 4)
-	  return -1; // not enough for an 802.1Q header
-	// VLAN  - next two bytes
-	// uint32_t vlanData = (ptr[0] << 8) + ptr[1];
-	// uint32_t vlan = vlanData & 0x0fff;
-	// uint32_t priority = vlanData >> 13;
-	ptr += 2;
-	//  _____________________________________ 
-	// |   pri  | c |         vlan-id        | 
-	//  ------------------------------------- 
-	// [priority = 3bits] [Canonical Format Flag = 1bit] [vlan-id = 12 bits] 
-	// now get the type_len again (next two bytes) 
+    }
+
+    if(type_len <= NFT_MAX_8023_LEN) {
+      // assume 802.3+802.2 header 
+      if((end - ptr) < 8)
+	return -1; // not enough for SNAP
+      // check for SNAP 
+      if(ptr[0] == 0xAA &&
+	 ptr[1] == 0xAA &&
+	 ptr[2] == 0x03) {
+	ptr += 3;
+	if(ptr[0] != 0 ||
+	   ptr[1] != 0 ||
+	   ptr[2] != 0) {
+	  return -1; // no further decode for vendor-specific protocol 
+	}
+	ptr += 3;
+	// OUI == 00-00-00 means the next two bytes are the ethernet type (RFC 2895) 
 	type_len = (ptr[0] << 8) + ptr[1];
 	ptr += 2;
       }
-
-      // now we're just looking for IP or IP6
-      if((end - start) < sizeof(struct iphdr))
-	return -1; // not enough for an IPv4 header (or IPX, or SNAP) 
-      
-      if(type_len <= NFT_MAX_8023_LEN) {
-	// assume 802.3+802.2 header 
-	// check for SNAP 
-	if(ptr[0] == 0xAA &&
-	   ptr[1] == 0xAA &&
-	   ptr[2] == 0x03) {
-	  ptr += 3;
-	  if(ptr[0] != 0 ||
-	     ptr[1] != 0 ||
-	     ptr[2] != 0) {
-	    return -1; // no further decode for vendor-specific protocol 
-	  }
+      else {
+	if (ptr[0] == 0x06 &&
+	    ptr[1] == 0x06 &&
+	    (ptr[2] & 0x01)) {
+	  // IP over 8022 
 	  ptr += 3;
-	  // OUI == 00-00-00 means the next two bytes are the ethernet type (RFC 2895) 
-	  type_len = (ptr[0] << 8) + ptr[1];
-	  ptr += 2;
-	}
-	else {
-	  if (ptr[0] == 0x06 &&
-	      ptr[1] == 0x06 &&
-	      (ptr[2] & 0x01)) {
-	    // IP over 8022 
-	    ptr += 3;
-	    // force the type_len to be IP so we can inline the IP decode below 
-	    type_len = 0x0800;
-	  }
-	  else
-	    return -1;
+	  // force the type_len to be IP so we can inline the IP decode below 
+	  type_len = NFT_ETYPE_IP4;
 	}
+	else
+	  return -1;
       }
     }
-    
-    // type_len should be ethernet-type now
+    *pptr = ptr;
+    return type_len;
+  }
+
+  // Decode the IP header at ptr. Returns the IP version, -1 for
+  // a malformed header or -2 if type_len is not IP at all.
+  static int decodeIP(uint8_t *start, uint8_t *end, uint8_t *ptr, uint16_t type_len, uint8_t *ipproto, int *l3_offset, int *l4_offset)
+  {
     switch(type_len) {
-    case 0x0800:
+    case NFT_ETYPE_IP4:
       // IPV4 - check again that we have enough header bytes 
       if((end - ptr) < sizeof(struct iphdr))
 	return -1;
@@ -693,8 +706,10 @@ extern "C" {
       *ipproto = ptr[9];
       return 4; // IPv4
       
-    case 0x86DD:
+    case NFT_ETYPE_IP6:
       // IPV6 
+      if((end - ptr) < sizeof(struct ip6_hdr))
+	return -1;
       // look at first byte of header.... 
       if((*ptr >> 4) != 6)
 	return -1; // not version 6 
@@ -704,7 +719,7 @@ extern "C" {
       ptr += sizeof(struct ip6_hdr);
       bool decodingOptions = YES;
       while(decodingOptions
-	    && ptr < end) {
+	    && (end - ptr) >= 2) {
 	switch(*ipproto) {
 	  // these we can skip
 	case 0:  // hop
@@ -726,6 +741,8 @@ extern "C" {
 	  break;
 	}
       }
+      if(ptr > end)
+	ptr = end;
       *l4_offset = (ptr - start);
       return 6; // IPv6
     }
@@ -734,6 +751,232 @@ extern "C" {
     return -2;
   }
 
+  static int decodePacketHeader(SFLSampled_header *header, uint16_t *l3_type, uint8_t *ipproto, int *l3_offset, int *l4_offset)
+  {
+    uint8_t *start = header->header_bytes;
+    uint8_t *end = start + header->header_length;
+    uint8_t *ptr = start;
+    int type_len = 0;
+    
+    switch(header->header_protocol) {
+
+    case SFLHEADER_IPv4:
+      type_len = NFT_ETYPE_IP4;
+      break;
+
+    case SFLHEADER_IPv6:
+      type_len = NFT_ETYPE_IP6;
+      break;
+
+    case SFLHEADER_ETHERNET_ISO8023:
+      type_len = decodeMAC(ptr, end, &ptr);
+      if(type_len < 0)
+	return -1;
+      break;
+
+    default:
+      return -2;
+    }
+
+    // remember what we found, even if it is not IP
+    *l3_type = type_len;
+    *l3_offset = (ptr - start);
+    return decodeIP(start, end, ptr, type_len, ipproto, l3_offset, l4_offset);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      decodeTunnel         __________________
+    -----------------___________________________------------------
+    Each decoder is given the start of the encapsulation header and
+    returns its length, filling in the type of the payload that
+    follows (an ethernet type, with TEB meaning a full MAC header).
+  */
+
+  typedef int (*HSPTunnelDecodeFn)(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id);
+
+  static int decodeTunnel_IPIP(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id) {
+    *inner_type = NFT_ETYPE_IP4;
+    return 0;
+  }
+
+  static int decodeTunnel_IP6IP(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id) {
+    *inner_type = NFT_ETYPE_IP6;
+    return 0;
+  }
+
+  static int decodeTunnel_GRE(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id) {
+    // RFC 2784/2890: [C.K.S....|...ver] [protocol] [csum+rsvd] [key] [seq]
+    if((end - ptr) < 4)
+      return -1;
+    if((ptr[1] & 0x07) != 0)
+      return -1; // only version 0
+    int len = 4;
+    if(ptr[0] & 0x80)
+      len += 4; // checksum
+    if(ptr[0] & 0x20) {
+      if((end - ptr) < (len + 4))
+	return -1;
+      *tunnel_id = ((uint32_t)ptr[len] << 24)
+	| ((uint32_t)ptr[len+1] << 16)
+	| ((uint32_t)ptr[len+2] << 8)
+	| ptr[len+3];
+      len += 4; // key
+    }
+    if(ptr[0] & 0x10)
+      len += 4; // sequence number
+    *inner_type = (ptr[2] << 8) + ptr[3];
+    return len;
+  }
+
+  static int decodeTunnel_VXLAN(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id) {
+    // RFC 7348: [flags] [rsvd x3] [VNI x3] [rsvd]
+    if((end - ptr) < 8)
+      return -1;
+    if((ptr[0] & 0x08) == 0)
+      return -1; // VNI not valid
+    *tunnel_id = (ptr[4] << 16) + (ptr[5] << 8) + ptr[6];
+    *inner_type = NFT_ETYPE_TEB;
+    return 8;
+  }
+
+  static int decodeTunnel_Geneve(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id) {
+    // RFC 8926: [ver:2|optlen:6] [O|C|rsvd] [protocol] [VNI x3] [rsvd] [options]
+    if((end - ptr) < 8)
+      return -1;
+    if((ptr[0] >> 6) != 0)
+      return -1; // only version 0
+    *tunnel_id = (ptr[4] << 16) + (ptr[5] << 8) + ptr[6];
+    *inner_type = (ptr[2] << 8) + ptr[3];
+    return 8 + ((ptr[0] & 0x3F) * 4);
+  }
+
+  static int decodeTunnel_MPLS(uint8_t *ptr, uint8_t *end, uint16_t *inner_type, uint32_t *tunnel_id) {
+    // walk the label stack to the bottom-of-stack entry
+    for(int lbl = 0; lbl < NFT_MAX_MPLS_LABELS; lbl++) {
+      uint8_t *entry = ptr + (lbl * 4);
+      if((end - entry) < 4)
+	return -1;
+      if(lbl == 0)
+	*tunnel_id = (entry[0] << 12) + (entry[1] << 4) + (entry[2] >> 4);
+      if(entry[2] & 0x01) {
+	// bottom of stack. There is no payload type, so
+	// guess from the first nibble. Pseudowires with a
+	// control word (first nibble 0) are not decoded.
+	uint8_t *payload = entry + 4;
+	if(payload >= end)
+	  return -1;
+	switch(*payload >> 4) {
+	case 4: *inner_type = NFT_ETYPE_IP4; break;
+	case 6: *inner_type = NFT_ETYPE_IP6; break;
+	default: return -1;
+	}
+	return (payload - ptr);
+      }
+    }
+    return -1;
+  }
+
+  typedef struct _HSPTunnelDecoder {
+    EnumHSPTunnel tunnel;
+    uint8_t ipproto;   // match on IP protocol, or...
+    uint16_t udp_port; // ...match on UDP destination port
+    HSPTunnelDecodeFn decodeFn;
+  } HSPTunnelDecoder;
+
+  static const HSPTunnelDecoder HSPTunnelDecoders[] = {
+    { HSP_TUNNEL_IPIP, IPPROTO_IPIP, 0, decodeTunnel_IPIP },
+    { HSP_TUNNEL_IPIP, IPPROTO_IPV6, 0, decodeTunnel_IP6IP },
+    { HSP_TUNNEL_GRE, IPPROTO_GRE, 0, decodeTunnel_GRE },
+    { HSP_TUNNEL_MPLS, IPPROTO_MPLS, 0, decodeTunnel_MPLS },
+    { HSP_TUNNEL_VXLAN, IPPROTO_UDP, 4789, decodeTunnel_VXLAN },
+    { HSP_TUNNEL_GENEVE, IPPROTO_UDP, 6081, decodeTunnel_Geneve },
+    { HSP_TUNNEL_MPLS, IPPROTO_UDP, 6635, decodeTunnel_MPLS },
+  };
+
+  static const HSPTunnelDecoder *findTunnelDecoder(uint8_t ipproto, uint16_t udp_port) {
+    for(int ii = 0; ii < (sizeof(HSPTunnelDecoders) / sizeof(HSPTunnelDecoder)); ii++) {
+      const HSPTunnelDecoder *td = &HSPTunnelDecoders[ii];
+      if(td->ipproto == ipproto
+	 && td->udp_port == udp_port)
+	return td;
+    }
+    return NULL;
+  }
+
+  static int decodeTunnel(HSPPendingSample *ps)
+  {
+    uint8_t *start = ps->hdr;
+    uint8_t *end = start + ps->hdr_len;
+    uint8_t *ptr = NULL;
+    int type_len = 0;
+    const HSPTunnelDecoder *td = NULL;
+
+    if(ps->ipversion == 4
+       || ps->ipversion == 6) {
+      // a non-first IPv4 fragment has no L4 header, just payload.
+      // (for IPv6 the fragment header stops decodeIP() instead)
+      if(ps->ipversion == 4) {
+	uint8_t *ip = start + ps->l3_offset;
+	if((((ip[6] << 8) + ip[7]) & 0x1fff) != 0)
+	  return -2;
+      }
+      uint16_t udp_port = 0;
+      ptr = start + ps->l4_offset;
+      if(ps->ipproto == IPPROTO_UDP) {
+	if((end - ptr) < 8)
+	  return -1;
+	udp_port = (ptr[2] << 8) + ptr[3];
+	ptr += 8;
+      }
+      td = findTunnelDecoder(ps->ipproto, udp_port);
+    }
+    else if(ps->l3_type == NFT_ETYPE_MPLS_UC
+	    || ps->l3_type == NFT_ETYPE_MPLS_MC) {
+      ptr = start + ps->l3_offset;
+      td = findTunnelDecoder(IPPROTO_MPLS, 0);
+    }
+    if(td == NULL)
+      return -2; // not a tunnel we know
+    ps->tunnel = td->tunnel;
+
+    uint16_t inner_type = 0;
+    int len = td->decodeFn(ptr, end, &inner_type, &ps->tunnel_id);
+    if(len < 0)
+      return -1;
+    ptr += len;
+    if(ptr > end)
+      return -1;
+    // payload may be another MAC header, or MPLS (e.g. over GRE)
+    switch(inner_type) {
+    case NFT_ETYPE_TEB:
+      type_len = decodeMAC(ptr, end, &ptr);
+      break;
+    case NFT_ETYPE_MPLS_UC:
+    case NFT_ETYPE_MPLS_MC: {
+      // keep the outer tunnel_id (e.g. the GRE key)
+      uint32_t label = 0;
+      len = decodeTunnel_MPLS(ptr, end, &inner_type, &label);
+      if(len < 0)
+	return -1;
+      ptr += len;
+      type_len = inner_type;
+      break;
+    }
+    default:
+      type_len = inner_type;
+      break;
+    }
+    if(type_len < 0)
+      return -1;
+    return decodeIP(start,
+		    end,
+		    ptr,
+		    type_len,
+		    &ps->inner_ipproto,
+		    &ps->inner_l3_offset,
+		    &ps->inner_l4_offset);
+  }
+
   /*_________________---------------------------__________________
     _________________   decodePendingSample     __________________
     -----------------___________________________------------------
@@ -747,7 +990,7 @@ extern "C" {
 	  ps->hdr = header->header_bytes;
 	  ps->hdr_protocol = header->header_protocol;
 	  ps->hdr_len = header->header_length;
-	  ps->ipversion = decodePacketHeader(header, &ps->ipproto, &ps->l3_offset, &ps->l4_offset);
+	  ps->ipversion = decodePacketHeader(header, &ps->l3_type, &ps->ipproto, &ps->l3_offset, &ps->l4_offset);
 	  // extract IP src/dst addresses too, since they are so likely to be used
 	  if(ps->ipversion == 4) {
 	    ps->src.type = ps->dst.type = SFLADDRESSTYPE_IP_V4;
@@ -767,6 +1010,26 @@ extern "C" {
     return ps->ipversion;
   }
 
+  /*_________________---------------------------__________________
+    _________________ decodePendingSampleInner  __________________
+    -----------------___________________________------------------
+    Continue the decode through one layer of IPIP, GRE, VXLAN, Geneve
+    or MPLS encapsulation. This is only done the first time a consumer
+    asks for it, so samples that nobody wants to look inside are not
+    decoded any further than the outer L4 offset. Returns the inner IP
+    version, or a negative number if there is no inner IP header. The
+    outer fields are left untouched.
+  */
+
+  int decodePendingSampleInner(HSPPendingSample *ps) {
+    if(!ps->decoded_inner) {
+      decodePendingSample(ps);
+      ps->inner_ipversion = ps->hdr ? decodeTunnel(ps) : -2;
+      ps->decoded_inner = YES;
+    }
+    return ps->inner_ipversion;
+  }
+
 #if defined(__cplusplus)
 } /* extern "C" */
 #endif
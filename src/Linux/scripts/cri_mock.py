@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+
+# fake CRI runtime (containerd, CRI-O) for testing the mod_docker
+# cri { } backend: serves -n running containers over gRPC on a unix
+# socket. --churn replaces one every N seconds, --no-events answers
+# GetContainerEvents with UNIMPLEMENTED. Needs grpcio, installed
+# where the test runs: python3 -m pip install grpcio
+# requires "cri { socket=/tmp/cri_mock.sock }" in hsflowd.conf.
+
+import argparse
+import hashlib
+import json
+import mockstats
+import os
+import queue
+import threading
+import time
+from concurrent import futures
+
+try:
+  import grpc
+except ImportError:
+  raise SystemExit("cri_mock.py needs grpcio: python3 -m pip install grpcio")
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-s", "--socket",
+  dest="socket", default="/tmp/cri_mock.sock",
+  help="unix socket path to listen on")
+parser.add_argument("-n", "--containers",
+  dest="containers", type=int, default=20,
+  help="number of fake running containers")
+parser.add_argument("--pid",
+  dest="pid", type=int, default=0,
+  help="pid to report for every container (its cgroups are read for counters)")
+parser.add_argument("--churn",
+  dest="churn", type=float, default=0.0,
+  help="seconds between stopping one container and starting another (0=never)")
+parser.add_argument("--no-events",
+  dest="no_events", action="store_true",
+  help="answer GetContainerEvents with UNIMPLEMENTED")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+args = parser.parse_args()
+
+# protobuf wire format, just enough for runtime.v1
+
+def varint(n):
+  out = b""
+  while True:
+    b = n & 0x7f
+    n >>= 7
+    if n:
+      out += bytes([b | 0x80])
+    else:
+      return out + bytes([b])
+
+def f_varint(field, n):
+  return varint(field << 3) + varint(n)
+
+def f_bytes(field, data):
+  if isinstance(data, str):
+    data = data.encode()
+  return varint((field << 3) | 2) + varint(len(data)) + data
+
+def fields(msg):
+  off = 0
+  while off < len(msg):
+    key = 0; shift = 0
+    while True:
+      b = msg[off]; off += 1
+      key |= (b & 0x7f) << shift; shift += 7
+      if not b & 0x80:
+        break
+    field, wt = key >> 3, key & 7
+    if wt == 0:
+      val = 0; shift = 0
+      while True:
+        b = msg[off]; off += 1
+        val |= (b & 0x7f) << shift; shift += 7
+        if not b & 0x80:
+          break
+      yield field, val
+    elif wt == 2:
+      n = 0; shift = 0
+      while True:
+        b = msg[off]; off += 1
+        n |= (b & 0x7f) << shift; shift += 7
+        if not b & 0x80:
+          break
+      yield field, msg[off:off + n]
+      off += n
+    else:
+      return
+
+CONTAINER_RUNNING, CONTAINER_EXITED = 1, 2
+EV_CREATED, EV_STARTED, EV_STOPPED, EV_DELETED = 0, 1, 2, 3
+
+lock = threading.Lock()
+containers = {}  # id -> index
+seq = 0
+subscribers = []
+stats = mockstats.Stats("list", "status", "notfound", "event_streams", "events_sent")
+bump = stats.bump
+
+def new_container():
+  global seq
+  i = seq
+  seq += 1
+  # (hsflowd takes the VM uuid from the leading hex digits, so make them differ)
+  cid = hashlib.sha256(b"cri-mock-%d" % i).hexdigest()
+  containers[cid] = i
+  return cid
+
+def labels(i):
+  return {"io.kubernetes.container.name": "app",
+          "io.kubernetes.pod.name": "pod-%d" % i,
+          "io.kubernetes.pod.namespace": "default",
+          "io.kubernetes.pod.uid": "uid-%d" % i}
+
+def map_entry(field, k, v):
+  return f_bytes(field, f_bytes(1, k) + f_bytes(2, v))
+
+def list_containers(req, ctx):
+  bump("list")
+  want = None
+  for f, v in fields(req):
+    if f == 1:
+      for f2, v2 in fields(v):
+        if f2 == 2:
+          for f3, v3 in fields(v2):
+            if f3 == 1:
+              want = v3
+  out = b""
+  with lock:
+    items = list(containers.items())
+  for cid, i in items:
+    if want is not None and want != CONTAINER_RUNNING:
+      continue
+    c = (f_bytes(1, cid) + f_bytes(2, "sandbox-%d" % i)
+         + f_bytes(3, f_bytes(1, "app") + f_varint(2, 0))
+         + f_varint(6, CONTAINER_RUNNING))
+    for k, v in labels(i).items():
+      c += map_entry(8, k, v)
+    out += f_bytes(1, c)
+  return out
+
+def container_status(req, ctx):
+  bump("status")
+  cid = None
+  for f, v in fields(req):
+    if f == 1:
+      cid = v.decode()
+  with lock:
+    i = containers.get(cid)
+  if i is None:
+    bump("notfound")
+    ctx.abort(grpc.StatusCode.NOT_FOUND, "container %s not found" % cid)
+  linux = f_varint(1, 100000) + f_varint(2, 50000 * (1 + i % 4)) + f_varint(4, 256 << 20)
+  st = (f_bytes(1, cid)
+        + f_bytes(2, f_bytes(1, "app") + f_varint(2, 0))
+        + f_varint(3, CONTAINER_RUNNING))
+  for k, v in labels(i).items():
+    st += map_entry(12, k, v)
+  st += f_bytes(16, f_bytes(1, linux))
+  info = json.dumps({"pid": args.pid, "sandboxID": "sandbox-%d" % i})
+  return f_bytes(1, st) + map_entry(2, "info", info)
+
+def container_event(cid, ev):
+  return f_bytes(1, cid) + f_varint(2, ev) + f_varint(3, time.time_ns())
+
+def get_container_events(req, ctx):
+  if args.no_events:
+    ctx.abort(grpc.StatusCode.UNIMPLEMENTED, "unknown method GetContainerEvents")
+  bump("event_streams")
+  q = queue.Queue()
+  with lock:
+    subscribers.append(q)
+  try:
+    while ctx.is_active():
+      try:
+        msg = q.get(timeout=1.0)
+      except queue.Empty:
+        continue
+      bump("events_sent")
+      yield msg
+  finally:
+    with lock:
+      subscribers.remove(q)
+
+def publish(msg):
+  with lock:
+    subs = list(subscribers)
+  for q in subs:
+    q.put(msg)
+
+def churn():
+  while True:
+    time.sleep(args.churn)
+    with lock:
+      old = next(iter(containers), None)
+      if old:
+        del containers[old]
+      cid = new_container()
+    if old:
+      publish(container_event(old, EV_STOPPED))
+      publish(container_event(old, EV_DELETED))
+    publish(container_event(cid, EV_CREATED))
+    publish(container_event(cid, EV_STARTED))
+
+def gauges():
+  with lock:
+    return {"containers": len(containers)}
+
+for _ in range(args.containers):
+  new_container()
+
+handler = grpc.method_handlers_generic_handler("runtime.v1.RuntimeService", {
+  "ListContainers": grpc.unary_unary_rpc_method_handler(list_containers),
+  "ContainerStatus": grpc.unary_unary_rpc_method_handler(container_status),
+  "GetContainerEvents": grpc.unary_stream_rpc_method_handler(get_container_events),
+})
+
+if os.path.exists(args.socket):
+  os.unlink(args.socket)
+server = grpc.server(futures.ThreadPoolExecutor(max_workers=16))
+server.add_generic_rpc_handlers((handler,))
+server.add_insecure_port("unix:" + args.socket)
+server.start()
+stats.start(args.interval, gauges)
+if args.churn > 0:
+  t = threading.Thread(target=churn)
+  t.daemon = True
+  t.start()
+server.wait_for_termination()
@@ -0,0 +1,358 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+/* Corpus check, fuzzer and benchmark for decodePendingSampleInner().
+
+   Each line of the corpus is a sampled ethernet header with the
+   decode it must produce (see decode_corpus.txt):
+     name ipversion tunnel tunnel_id inner_ipversion inner_ipproto inner_l3 inner_l4 hexframe
+   with "-" for anything not to be checked.
+
+   After the corpus check, every frame is decoded again at every
+   truncated length and then with -n rounds of seeded random byte
+   mutations (and random truncation). Each frame is placed so that it
+   ends right at a PROT_NONE page, so any read past the sampled bytes
+   faults, and the offsets that come back are checked against the
+   frame length. With -b the corpus is decoded that many times over
+   and the cost per decode is reported.
+
+   The daemon code is compiled in, as for evsim, so the real
+   readPackets.o is what gets tested.
+
+   build and check (from src/Linux):
+     make check
+   run:
+     ./decode_fuzz -f scripts/decode_corpus.txt -n 100000
+     ./decode_fuzz -f scripts/decode_corpus.txt -n 0 -b 1000000
+*/
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#define main hsflowd_main
+#include "hsflowd.c"
+#undef main
+
+#define DF_MAX_CASES 1000
+#define DF_MAX_LINE 2048
+#define DF_UNCHECKED -1000
+
+  typedef struct _DFCase {
+    char *name;
+    int ipversion;
+    int tunnel;
+    int64_t tunnel_id;
+    int inner_ipversion;
+    int inner_ipproto;
+    int inner_l3;
+    int inner_l4;
+    u_char frame[HSP_MAX_HEADER_BYTES];
+    int len;
+  } DFCase;
+
+  static DFCase cases[DF_MAX_CASES];
+  static int num_cases;
+  static u_char *guardEnd; // first byte of the PROT_NONE page
+  static const char *current;
+  static uint64_t currentRound;
+
+  static const char *tunnelNames[] = { "none", "ipip", "gre", "vxlan", "geneve", "mpls" };
+
+  static void segv(int sig) {
+    char msg[256];
+    int len = snprintf(msg, sizeof(msg), "decode_fuzz: fault decoding %s (round %"PRIu64")\n",
+		       current ?: "?", currentRound);
+    if(write(STDERR_FILENO, msg, len) < 0) {}
+    _exit(EXIT_FAILURE);
+  }
+
+  static uint64_t rnd_state = 0x5EED;
+  static uint64_t rnd(void) {
+    // xorshift64
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+  }
+
+  /*_________________---------------------------__________________
+    _________________      corpus               __________________
+    -----------------___________________________------------------
+  */
+
+  static int dfInt(char *tok) {
+    return (tok == NULL || my_strequal(tok, "-")) ? DF_UNCHECKED : strtol(tok, NULL, 0);
+  }
+
+  static void readCorpus(char *path) {
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+      fprintf(stderr, "cannot open %s : %s\n", path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    char line[DF_MAX_LINE];
+    int lineNo = 0;
+    while(fgets(line, sizeof(line), f)) {
+      lineNo++;
+      if(line[0] == '#'
+	 || line[0] == '\n')
+	continue;
+      if(num_cases == DF_MAX_CASES) {
+	fprintf(stderr, "%s: too many cases\n", path);
+	exit(EXIT_FAILURE);
+      }
+      DFCase *dc = &cases[num_cases];
+      char *tok[9] = { 0 };
+      char *save = NULL;
+      int ntok = 0;
+      for(char *t = strtok_r(line, " \t\n", &save); t && ntok < 9; t = strtok_r(NULL, " \t\n", &save))
+	tok[ntok++] = t;
+      if(ntok != 9) {
+	fprintf(stderr, "%s:%d: expected 9 fields\n", path, lineNo);
+	exit(EXIT_FAILURE);
+      }
+      dc->name = my_strdup(tok[0]);
+      dc->ipversion = dfInt(tok[1]);
+      dc->tunnel = DF_UNCHECKED;
+      for(int ii = 0; ii < (sizeof(tunnelNames) / sizeof(char *)); ii++) {
+	if(my_strequal(tok[2], (char *)tunnelNames[ii]))
+	  dc->tunnel = ii;
+      }
+      dc->tunnel_id = my_strequal(tok[3], "-") ? DF_UNCHECKED : (int64_t)strtoull(tok[3], NULL, 0);
+      dc->inner_ipversion = dfInt(tok[4]);
+      dc->inner_ipproto = dfInt(tok[5]);
+      dc->inner_l3 = dfInt(tok[6]);
+      dc->inner_l4 = dfInt(tok[7]);
+      dc->len = hexToBinary((u_char *)tok[8], dc->frame, sizeof(dc->frame));
+      if(my_strlen(tok[8]) != (dc->len * 2)) {
+	fprintf(stderr, "%s:%d: bad or oversized hex frame\n", path, lineNo);
+	exit(EXIT_FAILURE);
+      }
+      num_cases++;
+    }
+    fclose(f);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      decode               __________________
+    -----------------___________________________------------------
+  */
+
+  typedef struct _DFSample {
+    HSPPendingSample ps;
+    SFL_FLOW_SAMPLE_TYPE fs;
+    SFLFlow_sample_element elem;
+  } DFSample;
+
+  static void dfSetup(DFSample *dfs, u_char *bytes, int len) {
+    memset(dfs, 0, sizeof(*dfs));
+    dfs->elem.tag = SFLFLOW_HEADER;
+    dfs->elem.flowType.header.header_protocol = SFLHEADER_ETHERNET_ISO8023;
+    dfs->elem.flowType.header.frame_length = len;
+    dfs->elem.flowType.header.header_length = len;
+    dfs->elem.flowType.header.header_bytes = bytes;
+    dfs->fs.elements = &dfs->elem;
+    dfs->ps.fs = &dfs->fs;
+  }
+
+  // decode a copy that ends right at the guard page
+  static HSPPendingSample *dfDecode(DFSample *dfs, u_char *frame, int len) {
+    u_char *bytes = guardEnd - len;
+    memcpy(bytes, frame, len);
+    dfSetup(dfs, bytes, len);
+    decodePendingSampleInner(&dfs->ps);
+    return &dfs->ps;
+  }
+
+  // whatever the input, the offsets must stay inside the frame
+  static const char *dfSane(HSPPendingSample *ps) {
+    int len = ps->hdr_len;
+    switch(ps->ipversion) {
+    case 4:
+      if(ps->l3_offset + 20 > len
+	 || ps->l4_offset < ps->l3_offset + 20)
+	return "outer IPv4 offsets";
+      break;
+    case 6:
+      if(ps->l3_offset + 40 > len
+	 || ps->l4_offset < ps->l3_offset + 40
+	 || ps->l4_offset > len)
+	return "outer IPv6 offsets";
+      break;
+    case -1:
+    case -2:
+      break;
+    default:
+      return "outer ipversion";
+    }
+    switch(ps->inner_ipversion) {
+    case 4:
+      if(ps->inner_l3_offset <= 0
+	 || ps->inner_l3_offset + 20 > len
+	 || ps->inner_l4_offset < ps->inner_l3_offset + 20)
+	return "inner IPv4 offsets";
+      break;
+    case 6:
+      if(ps->inner_l3_offset <= 0
+	 || ps->inner_l3_offset + 40 > len
+	 || ps->inner_l4_offset < ps->inner_l3_offset + 40
+	 || ps->inner_l4_offset > len)
+	return "inner IPv6 offsets";
+      break;
+    case -1:
+    case -2:
+      break;
+    default:
+      return "inner ipversion";
+    }
+    return NULL;
+  }
+
+  static bool dfExpect(DFCase *dc, const char *what, int64_t expected, int64_t got) {
+    if(expected == DF_UNCHECKED
+       || expected == got)
+      return YES;
+    fprintf(stderr, "%s: %s expected %"PRId64" got %"PRId64"\n", dc->name, what, expected, got);
+    return NO;
+  }
+
+  static bool checkCase(DFCase *dc) {
+    DFSample dfs;
+    current = dc->name;
+    HSPPendingSample *ps = dfDecode(&dfs, dc->frame, dc->len);
+    bool ok = YES;
+    const char *insane = dfSane(ps);
+    if(insane) {
+      fprintf(stderr, "%s: %s\n", dc->name, insane);
+      ok = NO;
+    }
+    ok &= dfExpect(dc, "ipversion", dc->ipversion, ps->ipversion);
+    ok &= dfExpect(dc, "tunnel", dc->tunnel, ps->tunnel);
+    ok &= dfExpect(dc, "tunnel_id", dc->tunnel_id, ps->tunnel_id);
+    ok &= dfExpect(dc, "inner_ipversion", dc->inner_ipversion, ps->inner_ipversion);
+    ok &= dfExpect(dc, "inner_ipproto", dc->inner_ipproto, ps->inner_ipproto);
+    ok &= dfExpect(dc, "inner_l3_offset", dc->inner_l3, ps->inner_l3_offset);
+    ok &= dfExpect(dc, "inner_l4_offset", dc->inner_l4, ps->inner_l4_offset);
+    return ok;
+  }
+
+  static uint64_t fuzzCase(DFCase *dc, uint32_t rounds, uint64_t *failed) {
+    DFSample dfs;
+    u_char frame[HSP_MAX_HEADER_BYTES];
+    uint64_t decodes = 0;
+    current = dc->name;
+    // every truncation
+    for(int len = 0; len <= dc->len; len++) {
+      currentRound = len;
+      const char *insane = dfSane(dfDecode(&dfs, dc->frame, len));
+      if(insane) {
+	fprintf(stderr, "%s: truncated to %d: %s\n", dc->name, len, insane);
+	(*failed)++;
+      }
+      decodes++;
+    }
+    // random mutations, biased towards the header bytes
+    for(uint32_t rr = 0; rr < rounds; rr++) {
+      currentRound = rr;
+      memcpy(frame, dc->frame, dc->len);
+      int len = dc->len;
+      int flips = 1 + (rnd() % 4);
+      for(int ff = 0; ff < flips && len; ff++) {
+	uint64_t r = rnd();
+	frame[(r >> 8) % len] = (r & 1) ? (r >> 32) : (frame[(r >> 8) % len] ^ (1 << ((r >> 1) & 7)));
+      }
+      if((rnd() % 4) == 0)
+	len = rnd() % (len + 1);
+      const char *insane = dfSane(dfDecode(&dfs, frame, len));
+      if(insane) {
+	fprintf(stderr, "%s: mutation round %u: %s\n", dc->name, rr, insane);
+	(*failed)++;
+      }
+      decodes++;
+    }
+    return decodes;
+  }
+
+  static double now_nS(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+  }
+
+  static void bench(uint64_t iterations) {
+    DFSample dfs;
+    uint64_t decodes = 0;
+    uint64_t tunnels = 0;
+    double t0 = now_nS();
+    for(uint64_t ii = 0; ii < iterations; ii++) {
+      for(int cc = 0; cc < num_cases; cc++) {
+	dfSetup(&dfs, cases[cc].frame, cases[cc].len);
+	if(decodePendingSampleInner(&dfs.ps) > 0)
+	  tunnels++;
+	decodes++;
+      }
+    }
+    double elapsed = now_nS() - t0;
+    printf("bench: decodes=%"PRIu64" inner=%"PRIu64" nS_per_decode=%.1f decodes_per_sec=%.0f\n",
+	   decodes, tunnels, elapsed / decodes, decodes * 1e9 / elapsed);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      main                 __________________
+    -----------------___________________________------------------
+  */
+
+  int main(int argc, char *argv[]) {
+    char *corpus = NULL;
+    uint32_t rounds = 1000;
+    uint64_t benchIterations = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "f:n:S:b:d:")) != -1) {
+      switch(opt) {
+      case 'f': corpus = optarg; break;
+      case 'n': rounds = strtoul(optarg, NULL, 0); break;
+      case 'S': rnd_state = strtoull(optarg, NULL, 0) ?: 1; break;
+      case 'b': benchIterations = strtoull(optarg, NULL, 0); break;
+      case 'd': setDebug(strtoul(optarg, NULL, 0)); break;
+      default:
+	fprintf(stderr, "usage: %s -f corpus [-n mutations_per_case] [-S seed] [-b bench_iterations] [-d debug]\n", argv[0]);
+	exit(EXIT_FAILURE);
+      }
+    }
+    if(corpus == NULL) {
+      fprintf(stderr, "usage: %s -f corpus [-n mutations_per_case] [-S seed] [-b bench_iterations] [-d debug]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    readCorpus(corpus);
+
+    // a frame placed against guardEnd faults on any over-read
+    long page = sysconf(_SC_PAGESIZE);
+    u_char *region = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED
+       || mprotect(region + page, page, PROT_NONE) != 0) {
+      fprintf(stderr, "guard page setup failed : %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    guardEnd = region + page;
+    signal(SIGSEGV, segv);
+    signal(SIGBUS, segv);
+
+    int failedCases = 0;
+    for(int cc = 0; cc < num_cases; cc++) {
+      if(!checkCase(&cases[cc]))
+	failedCases++;
+    }
+    printf("corpus: cases=%d failed=%d\n", num_cases, failedCases);
+
+    uint64_t decodes = 0, failed = 0;
+    for(int cc = 0; cc < num_cases; cc++)
+      decodes += fuzzCase(&cases[cc], rounds, &failed);
+    printf("fuzz: decodes=%"PRIu64" failed=%"PRIu64"\n", decodes, failed);
+
+    if(benchIterations)
+      bench(benchIterations);
+
+    return (failedCases || failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+
+# fake DNS server for testing mod_dnssd: answers SRV and TXT for
+# _sflow._udp.<domain> (NXDOMAIN otherwise), optionally slow, lossy,
+# shuffled, or changing the sampling rate every --change seconds.
+# requires "dns-sd { domain=.example.com ip=127.0.0.1 udpport=5353 }"
+# in hsflowd.conf.
+
+import argparse
+import asyncio
+import random
+import struct
+import time
+
+import mockstats
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-p", "--port",
+  dest="port", type=int, default=5353,
+  help="UDP port to listen on (127.0.0.1)")
+parser.add_argument("-d", "--domain",
+  dest="domain", default="example.com",
+  help="domain to serve _sflow._udp records for")
+parser.add_argument("-c", "--collectors",
+  dest="collectors", type=int, default=2,
+  help="number of SRV records (collectors)")
+parser.add_argument("--ttl",
+  dest="ttl", type=int, default=30,
+  help="TTL of the answers")
+parser.add_argument("--delay",
+  dest="delay", type=float, default=0.0,
+  help="seconds to wait before answering")
+parser.add_argument("--drop",
+  dest="drop", type=float, default=0.0,
+  help="fraction of queries to ignore")
+parser.add_argument("--shuffle",
+  dest="shuffle", action="store_true",
+  help="return the SRV records in a random order")
+parser.add_argument("--change",
+  dest="change", type=float, default=0.0,
+  help="seconds between sampling rate changes in the TXT record (0=never)")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+args = parser.parse_args()
+
+T_TXT, T_SRV, T_OPT = 16, 33, 41
+NAME = "_sflow._udp." + args.domain.strip(".")
+stats = mockstats.Stats("queries", "srv", "txt", "nx", "dropped")
+sampling = [1000]
+t0 = time.time()
+
+def encode_name(name):
+  out = b""
+  for label in name.strip(".").split("."):
+    out += bytes([len(label)]) + label.encode()
+  return out + b"\0"
+
+def decode_name(pkt, off):
+  labels = []
+  while True:
+    n = pkt[off]
+    off += 1
+    if n == 0:
+      return ".".join(labels), off
+    labels.append(pkt[off:off + n].decode())
+    off += n
+
+def rr(rtype, rdata):
+  # name is a pointer to the question at offset 12
+  return struct.pack("!HHHIH", 0xc00c, rtype, 1, args.ttl, len(rdata)) + rdata
+
+def answers(qtype):
+  if qtype == T_SRV:
+    recs = [rr(T_SRV, struct.pack("!HHH", 0, 0, 6343 + i) + encode_name("collector%d.%s" % (i, args.domain)))
+            for i in range(args.collectors)]
+    if args.shuffle:
+      random.shuffle(recs)
+    return recs
+  if qtype == T_TXT:
+    txt = b""
+    for kv in ("txtvers=1", "sampling=%d" % sampling[0], "polling=20"):
+      txt += bytes([len(kv)]) + kv.encode()
+    return [rr(T_TXT, txt)]
+  return []
+
+def respond(pkt):
+  qid, flags, qd, an, ns, ar = struct.unpack("!HHHHHH", pkt[:12])
+  qname, off = decode_name(pkt, 12)
+  qtype, qclass = struct.unpack("!HH", pkt[off:off + 4])
+  question = pkt[12:off + 4]
+  rd = flags & 0x0100
+  stats.bump("queries")
+  print("%8.3f query id=%u %s type=%u%s" % (time.time() - t0, qid, qname, qtype, " (EDNS)" if ar else ""), flush=True)
+  if qname.lower() != NAME.lower():
+    stats.bump("nx")
+    return struct.pack("!HHHHHH", qid, 0x8180 | rd | 3, 1, 0, 0, 0) + question
+  stats.bump("srv" if qtype == T_SRV else "txt")
+  recs = answers(qtype)
+  return struct.pack("!HHHHHH", qid, 0x8580 | rd, 1, len(recs), 0, 0) + question + b"".join(recs)
+
+class Proto(asyncio.DatagramProtocol):
+
+  def connection_made(self, transport):
+    self.transport = transport
+
+  def datagram_received(self, data, addr):
+    if args.drop and random.random() < args.drop:
+      stats.bump("dropped")
+      return
+    try:
+      out = respond(data)
+    except (struct.error, IndexError, UnicodeDecodeError):
+      return
+    if args.delay:
+      asyncio.get_event_loop().call_later(args.delay, self.transport.sendto, out, addr)
+    else:
+      self.transport.sendto(out, addr)
+
+async def change():
+  while True:
+    await asyncio.sleep(args.change)
+    sampling[0] = 2000 if sampling[0] == 1000 else 1000
+    print("%8.3f sampling now %d" % (time.time() - t0, sampling[0]), flush=True)
+
+async def main():
+  loop = asyncio.get_running_loop()
+  await loop.create_datagram_endpoint(Proto, local_addr=("127.0.0.1", args.port))
+  if args.change > 0:
+    asyncio.ensure_future(change())
+  asyncio.ensure_future(stats.areport(args.interval))
+  while True:
+    await asyncio.sleep(3600)
+
+asyncio.run(main())
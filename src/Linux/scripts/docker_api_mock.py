@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+
+# fake Docker engine API for testing mod_docker: serves -n running
+# containers on a unix socket and prints connection/request counts.
+# requires "docker { socket=/tmp/docker_mock.sock }" in hsflowd.conf.
+
+import argparse
+import hashlib
+import json
+import mockstats
+import os
+import random
+import socket
+import socketserver
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-s", "--socket",
+  dest="socket", default="/tmp/docker_mock.sock",
+  help="unix socket path to listen on")
+parser.add_argument("-n", "--containers",
+  dest="containers", type=int, default=100,
+  help="number of fake running containers")
+parser.add_argument("--delay",
+  dest="delay", type=float, default=0.0,
+  help="seconds to wait before answering a stats request")
+parser.add_argument("--close-every",
+  dest="close_every", type=int, default=0,
+  help="send \"Connection: close\" on every Nth response (0=never)")
+parser.add_argument("--pid",
+  dest="pid", type=int, default=0,
+  help="Pid to report for every container, e.g. to exercise docker { cgroupStats=on }")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+args = parser.parse_args()
+
+# (hsflowd takes the VM uuid from the leading hex digits, so make them differ)
+IDS = [hashlib.sha256(b"mock-%d" % i).hexdigest() for i in range(args.containers)]
+
+stats = mockstats.Stats("conns", "open", "max_open", "requests", "list", "inspect",
+                        "stats", "events", "notfound", "closes", "max_pipelined",
+                        rate="requests")
+bump = stats.bump
+
+def container_list():
+  return [{"Id": cid, "Names": ["/mock-%d" % i], "State": "running"}
+          for i, cid in enumerate(IDS)]
+
+def container_inspect(i, cid):
+  return {"Id": cid, "Name": "/mock-%d" % i,
+          "State": {"Pid": args.pid, "Status": "running", "Running": True},
+          "Config": {"Hostname": "mock-%d" % i, "Env": []},
+          "HostConfig": {"Memory": 0, "CpuCount": 0, "NanoCpus": 0}}
+
+def container_stats(i, cid):
+  now = time.time()
+  return {"id": cid, "name": "/mock-%d" % i,
+          "cpu_stats": {"cpu_usage": {"total_usage": int(now * 1e7) + i}},
+          "memory_stats": {"usage": 1000000 + i, "limit": 8000000000},
+          "networks": {"eth0": {"rx_bytes": i * 1000, "rx_packets": i * 10,
+                                "rx_dropped": 0, "rx_errors": 0,
+                                "tx_bytes": i * 2000, "tx_packets": i * 20,
+                                "tx_dropped": 0, "tx_errors": 0}},
+          "blkio_stats": {"io_service_bytes_recursive": [
+                            {"major": 8, "minor": 0, "op": "Read", "value": i * 4096},
+                            {"major": 8, "minor": 0, "op": "Write", "value": i * 8192}],
+                          "io_serviced_recursive": [
+                            {"major": 8, "minor": 0, "op": "Read", "value": i},
+                            {"major": 8, "minor": 0, "op": "Write", "value": i * 2}]}}
+
+def chunked(body):
+  # split into a few random-sized chunks to exercise the parser
+  out = b""
+  while body:
+    n = random.randint(1, max(1, len(body) // 2 + 1))
+    out += b"%x\r\n" % n + body[:n] + b"\r\n"
+    body = body[n:]
+  return out + b"0\r\n\r\n"
+
+class Handler(socketserver.BaseRequestHandler):
+
+  def respond(self, status, obj, use_chunked, close):
+    # pretty-print so the JSON has newlines in it
+    body = json.dumps(obj, indent=1).encode()
+    hdrs = "HTTP/1.1 %s\r\nContent-Type: application/json\r\n" % status
+    if close:
+      hdrs += "Connection: close\r\n"
+    if use_chunked:
+      self.request.sendall((hdrs + "Transfer-Encoding: chunked\r\n\r\n").encode() + chunked(body))
+    else:
+      self.request.sendall((hdrs + "Content-Length: %d\r\n\r\n" % len(body)).encode() + body)
+
+  def events(self):
+    bump("events")
+    self.request.sendall(b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                         b"Transfer-Encoding: chunked\r\n\r\n")
+    # hold the stream open until the client goes away
+    self.request.settimeout(1.0)
+    while True:
+      try:
+        if not self.request.recv(4096):
+          return
+      except socket.timeout:
+        pass
+      except OSError:
+        return
+
+  def handle(self):
+    bump("conns")
+    bump("open")
+    stats.high("max_open", stats["open"])
+    buf = b""
+    answered = 0
+    try:
+      while True:
+        data = self.request.recv(65536)
+        if not data:
+          return
+        buf += data
+        reqs = []
+        while b"\n\n" in buf or b"\r\n\r\n" in buf:
+          # requests have no body, so a blank line ends each one
+          ends = [i for i in (buf.find(b"\r\n\r\n"), buf.find(b"\n\n")) if i >= 0]
+          end = min(ends)
+          sep = 4 if buf[end:end + 4] == b"\r\n\r\n" else 2
+          reqs.append(buf[:end].decode(errors="replace"))
+          buf = buf[end + sep:]
+        stats.high("max_pipelined", len(reqs))
+        for req in reqs:
+          bump("requests")
+          path = req.split("\n", 1)[0].split(" ")[1]
+          answered += 1
+          close = args.close_every and (answered % args.close_every) == 0
+          if "/events" in path:
+            self.events()
+            return
+          parts = path.split("?")[0].split("/")
+          if path.split("?")[0].endswith("/containers/json"):
+            bump("list")
+            self.respond("200 OK", container_list(), True, close)
+          elif len(parts) == 5 and parts[2] == "containers" and parts[3] in IDS:
+            i = IDS.index(parts[3])
+            if parts[4] == "json":
+              bump("inspect")
+              self.respond("200 OK", container_inspect(i, parts[3]), False, close)
+            elif parts[4] == "stats":
+              bump("stats")
+              if args.delay:
+                time.sleep(args.delay)
+              self.respond("200 OK", container_stats(i, parts[3]), True, close)
+            else:
+              bump("notfound")
+              self.respond("404 Not Found", {"message": "page not found"}, False, close)
+          else:
+            bump("notfound")
+            self.respond("404 Not Found", {"message": "page not found"}, False, close)
+          if close:
+            bump("closes")
+            return
+    except OSError:
+      pass
+    finally:
+      bump("open", -1)
+
+class Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+  daemon_threads = True
+
+if os.path.exists(args.socket):
+  os.unlink(args.socket)
+server = Server(args.socket, Handler)
+stats.start(args.interval)
+server.serve_forever()
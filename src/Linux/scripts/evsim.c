@@ -0,0 +1,892 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+/* Deterministic simulation of hsflowd with real modules, for timing
+   and regression-testing the packet pipeline without root, a kernel
+   psample feed or a real collector.
+
+   The daemon code is compiled in (hsflowd.c is included here with its
+   main() renamed) and an HSP is set up as the EVInit() root data much
+   as main() does it, but with one synthetic interface instead of the
+   host's. The real mod_json.so and mod_psample.so are loaded with
+   EVLoadModule(), and every bus is driven from this one thread with
+   EVBusStep() against a virtual clock (EVClockSet), so deci/tick/tock
+   land at exactly the same virtual times on every run.
+
+   Records are injected two ways:
+     json    - a UDP datagram to the mod_json port on 127.0.0.1
+     psample - a PSAMPLE netlink message, written into a socketpair
+               that mod_psample was given in place of its netlink
+               socket (UTNLGeneric_open() is interposed below).
+               This end also answers the CTRL_CMD_GETFAMILY lookup
+               and only delivers once the group has been joined,
+               as the kernel would.
+   The sFlow datagrams come back to a collector socket on 127.0.0.1,
+   are counted by sample type and folded into a digest, so two runs
+   with the same arguments must print the same digest.
+
+   Records are generated at -r per second (half psample, half json
+   flow_sample/rtmetric) or read from a fixture file, one per line:
+     <mS> json <json text>
+     <mS> psample <sampling_n> <hex frame>
+   with <mS> relative to the start and in order, and # for comments.
+   Either way every json flow_sample, rtmetric, rtflow and psample
+   record must come out as exactly one sample, or evsim fails.
+
+   With -p, packets are replayed from a classic (not pcapng) ethernet
+   capture file instead, with the packet timestamps driving the virtual
+   clock. They are sampled 1-in-N here (-N, same skip logic as mod_pcap)
+   and the samples go in as psample records, truncated to the header
+   size, so the cost per sample of takeSample(), the flow_sample
+   consumers and the XDR encoding can be measured without a NIC or a
+   live collector. The run ends at end-of-file or after -s seconds.
+
+   build and check (from src/Linux):
+     make check
+   run:
+     ./evsim -l . -s 60 -r 10000
+     ./evsim -l . -s 10 -f fixture.txt -d 1
+     ./evsim -l . -s 3600 -p capture.pcap -N 100
+*/
+
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// the daemon itself, with main() out of the way, so that its static
+// setup functions (initAgent, openCollectorSockets ...) are in scope
+#define main hsflowd_main
+#include "hsflowd.c"
+#undef main
+
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/psample.h>
+
+#define SIM_START_SECS 1000
+#define SIM_SEED 0x5EED
+#define SIM_AGENT_IP "192.0.2.1"
+#define SIM_DEV "sim0"
+#define SIM_IFINDEX 7
+#define SIM_SAMPLING_N 400
+#define SIM_POLLING_SECS 10
+#define SIM_PSAMPLE_GROUP 1
+#define SIM_PSAMPLE_FAMILY 0x1d
+#define SIM_PSAMPLE_MCGRP 5
+#define SIM_NL_BUF 4096
+#define SIM_FRAME_LEN 128
+#define SIM_DRAIN_SECS 2
+#define SIM_MAX_MSG 10000
+#define SIM_MAX_DATAGRAM 65536
+#define SIM_PCAP_SNAPLEN 128
+#define SIM_PCAP_MAXLEN 262144
+
+  typedef struct _SimState {
+    // virtual clock
+    struct timespec now;
+    uint64_t now_mS;
+    // records
+    FILE *fixture;
+    uint32_t rate;
+    uint64_t scheduled;
+    // pcap replay
+    FILE *pcap;
+    bool pcapSwap;
+    bool pcapNano;
+    bool pcapEOF;
+    bool pcapStarted;
+    uint64_t pcapStart_uS;
+    uint32_t pcapSamplingN;
+    uint32_t pcapSkip;
+    uint64_t pcapPkts;
+    // json over UDP
+    int jsonFD;
+    struct sockaddr_in jsonAddr;
+    // netlink: the kernel's end and the module's end
+    int nlFD;
+    int nlModFD;
+    uint32_t nlPid;
+    bool nlJoined;
+    uint32_t nlSeq;
+    // collector
+    int collectorFD;
+    // daemon
+    HSP *sp;
+    // results
+    uint64_t jsonFlows;
+    uint64_t jsonRT;
+    uint64_t jsonOther;
+    uint64_t nlSamples;
+    uint64_t nlUnjoined;
+    uint64_t datagrams;
+    uint64_t flowSamples;
+    uint64_t counterSamples;
+    uint64_t otherSamples;
+    uint64_t deci;
+    uint64_t tick;
+    uint64_t tock;
+    uint64_t digest;
+  } SimState;
+
+  static SimState sim;
+
+  static void simClock(struct timespec *ts, void *magic) {
+    *ts = sim.now;
+  }
+
+  static void simAdvance(uint32_t mS) {
+    sim.now_mS += mS;
+    sim.now.tv_sec = SIM_START_SECS + (sim.now_mS / 1000);
+    sim.now.tv_nsec = (sim.now_mS % 1000) * 1000000;
+  }
+
+  // FNV-1a over the sequence of (virtual time, event) pairs
+  static void simDigest(const char *what, u_char *buf, size_t len) {
+    uint64_t h = sim.digest ?: 14695981039346656037ULL;
+    for(const char *p = what; *p; p++)
+      h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    for(size_t ii = 0; ii < len; ii++)
+      h = (h ^ buf[ii]) * 1099511628211ULL;
+    for(int ii = 0; ii < 8; ii++)
+      h = (h ^ ((sim.now_mS >> (ii * 8)) & 0xFF)) * 1099511628211ULL;
+    sim.digest = h;
+  }
+
+  static void simDeci(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    sim.deci++;
+    simDigest("deci", NULL, 0);
+  }
+
+  static void simTick(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    sim.tick++;
+    simDigest("tick", NULL, 0);
+  }
+
+  static void simTock(EVMod *mod, EVEvent *evt, void *data, size_t dataLen) {
+    sim.tock++;
+    simDigest("tock", NULL, 0);
+  }
+
+  /*_________________---------------------------__________________
+    _________________    netlink interposers    __________________
+    -----------------___________________________------------------
+    Defined here and exported with -rdynamic, these take precedence
+    over the util_netlink.c copy linked into mod_psample.so and over
+    libc, so the module talks to us instead of the kernel.
+  */
+
+  int UTNLGeneric_open(uint32_t mod_id) {
+    myDebug(1, "evsim: netlink socket for module id %u", mod_id);
+    return sim.nlModFD;
+  }
+
+  int setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen) {
+    if(fd == sim.nlModFD
+       && level == SOL_NETLINK) {
+      if(optname == NETLINK_ADD_MEMBERSHIP
+	 && *(uint32_t *)optval == SIM_PSAMPLE_MCGRP)
+	sim.nlJoined = YES;
+      return 0;
+    }
+    return syscall(SYS_setsockopt, fd, level, optname, optval, optlen);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      fake kernel          __________________
+    -----------------___________________________------------------
+  */
+
+  static int nlPut(u_char *buf, int len, uint16_t type, void *data, int dataLen) {
+    struct nlattr *nla = (struct nlattr *)(buf + len);
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + dataLen;
+    memcpy(buf + len + NLA_HDRLEN, data, dataLen);
+    return len + NLA_ALIGN(nla->nla_len);
+  }
+
+  // the genl controller does not flag its nests with NLA_F_NESTED
+  static int nlNest(u_char *buf, int len, uint16_t type) {
+    struct nlattr *nla = (struct nlattr *)(buf + len);
+    nla->nla_type = type;
+    return len + NLA_HDRLEN;
+  }
+
+  static void nlNestEnd(u_char *buf, int start, int len) {
+    ((struct nlattr *)(buf + start))->nla_len = len - start;
+  }
+
+  static void nlSend(u_char *buf, int len, uint16_t type, uint8_t cmd, uint32_t seq) {
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = len;
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_seq = seq;
+    nlh->nlmsg_pid = sim.nlPid;
+    struct genlmsghdr *ge = (struct genlmsghdr *)NLMSG_DATA(nlh);
+    ge->cmd = cmd;
+    ge->version = 1;
+    if(send(sim.nlFD, buf, len, 0) != len)
+      myLog(LOG_ERR, "evsim: netlink send failed : %s", strerror(errno));
+  }
+
+  static void kernelGetFamily(struct nlmsghdr *req) {
+    u_char buf[SIM_NL_BUF] = { 0 };
+    int len = NLMSG_HDRLEN + GENL_HDRLEN;
+    uint16_t family = SIM_PSAMPLE_FAMILY;
+    uint32_t grp = SIM_PSAMPLE_MCGRP;
+    len = nlPut(buf, len, CTRL_ATTR_FAMILY_NAME, PSAMPLE_GENL_NAME, sizeof(PSAMPLE_GENL_NAME));
+    len = nlPut(buf, len, CTRL_ATTR_FAMILY_ID, &family, sizeof(family));
+    int groups = len;
+    len = nlNest(buf, len, CTRL_ATTR_MCAST_GROUPS);
+    int group = len;
+    len = nlNest(buf, len, 1);
+    len = nlPut(buf, len, CTRL_ATTR_MCAST_GRP_NAME, PSAMPLE_NL_MCGRP_SAMPLE_NAME, sizeof(PSAMPLE_NL_MCGRP_SAMPLE_NAME));
+    len = nlPut(buf, len, CTRL_ATTR_MCAST_GRP_ID, &grp, sizeof(grp));
+    nlNestEnd(buf, group, len);
+    nlNestEnd(buf, groups, len);
+    nlSend(buf, len, GENL_ID_CTRL, CTRL_CMD_NEWFAMILY, req->nlmsg_seq);
+    // and the ACK that was asked for
+    u_char ack[NLMSG_SPACE(sizeof(struct nlmsgerr))] = { 0 };
+    struct nlmsghdr *nlh = (struct nlmsghdr *)ack;
+    nlh->nlmsg_len = sizeof(ack);
+    nlh->nlmsg_type = NLMSG_ERROR;
+    nlh->nlmsg_seq = req->nlmsg_seq;
+    nlh->nlmsg_pid = sim.nlPid;
+    ((struct nlmsgerr *)NLMSG_DATA(nlh))->msg = *req;
+    if(send(sim.nlFD, ack, sizeof(ack), 0) != sizeof(ack))
+      myLog(LOG_ERR, "evsim: netlink ack failed : %s", strerror(errno));
+  }
+
+  // answer whatever the module has asked for
+  static void kernelRead(void) {
+    u_char buf[SIM_NL_BUF];
+    int len;
+    while((len = recv(sim.nlFD, buf, sizeof(buf), 0)) > 0) {
+      for(struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+	struct genlmsghdr *ge = (struct genlmsghdr *)NLMSG_DATA(nlh);
+	sim.nlPid = nlh->nlmsg_pid;
+	if(nlh->nlmsg_type == GENL_ID_CTRL
+	   && ge->cmd == CTRL_CMD_GETFAMILY)
+	  kernelGetFamily(nlh);
+	else
+	  myDebug(1, "evsim: ignoring netlink type=%u cmd=%u", nlh->nlmsg_type, ge->cmd);
+      }
+    }
+  }
+
+  static void kernelSample(uint32_t sampling_n, u_char *frame, uint32_t frameLen, uint32_t origSize) {
+    if(!sim.nlJoined) {
+      // nobody listening yet, so the kernel would drop it
+      sim.nlUnjoined++;
+      return;
+    }
+    u_char buf[SIM_NL_BUF] = { 0 };
+    int len = NLMSG_HDRLEN + GENL_HDRLEN;
+    uint16_t ifin = SIM_IFINDEX;
+    uint16_t ifout = 0;
+    uint32_t grp = SIM_PSAMPLE_GROUP;
+    uint32_t seq = ++sim.nlSeq;
+    len = nlPut(buf, len, PSAMPLE_ATTR_IIFINDEX, &ifin, sizeof(ifin));
+    len = nlPut(buf, len, PSAMPLE_ATTR_OIFINDEX, &ifout, sizeof(ifout));
+    len = nlPut(buf, len, PSAMPLE_ATTR_ORIGSIZE, &origSize, sizeof(origSize));
+    len = nlPut(buf, len, PSAMPLE_ATTR_SAMPLE_GROUP, &grp, sizeof(grp));
+    len = nlPut(buf, len, PSAMPLE_ATTR_GROUP_SEQ, &seq, sizeof(seq));
+    len = nlPut(buf, len, PSAMPLE_ATTR_SAMPLE_RATE, &sampling_n, sizeof(sampling_n));
+    len = nlPut(buf, len, PSAMPLE_ATTR_DATA, frame, frameLen);
+    nlSend(buf, len, SIM_PSAMPLE_FAMILY, PSAMPLE_CMD_SAMPLE, 0);
+    sim.nlSamples++;
+  }
+
+  /*_________________---------------------------__________________
+    _________________      record injection     __________________
+    -----------------___________________________------------------
+  */
+
+  static void injectJSON(char *msg) {
+    if(sendto(sim.jsonFD, msg, my_strlen(msg), 0,
+	      (struct sockaddr *)&sim.jsonAddr, sizeof(sim.jsonAddr)) < 0) {
+      myLog(LOG_ERR, "evsim: json sendto failed : %s", strerror(errno));
+      return;
+    }
+    // top-level keys are matched without case, as cJSON does
+    if(strcasestr(msg, "\"flow_sample\""))
+      sim.jsonFlows++;
+    else if(strcasestr(msg, "\"rtmetric\"")
+	    || strcasestr(msg, "\"rtflow\""))
+      sim.jsonRT++;
+    else
+      sim.jsonOther++;
+  }
+
+  // a UDP/IPv4 frame that varies with n
+  static uint32_t simFrame(u_char *frame, uint64_t n) {
+    static const u_char hdr[] = {
+      0x02,0x00,0x00,0x00,0x00,0x01, 0x02,0x00,0x00,0x00,0x00,0x02, 0x08,0x00,
+      0x45,0x00,0x00,0x72, 0x00,0x00,0x40,0x00, 0x40,0x11,0x00,0x00,
+      0xc6,0x33,0x64,0x01, 0xc6,0x33,0x64,0x02,
+      0x30,0x39,0x00,0x35, 0x00,0x5e,0x00,0x00
+    };
+    memset(frame, 0, SIM_FRAME_LEN);
+    memcpy(frame, hdr, sizeof(hdr));
+    frame[18] = (n >> 8) & 0xFF; // IP id
+    frame[19] = n & 0xFF;
+    frame[33] = 2 + (n % 200);   // dst host
+    frame[35] = n & 0xFF;        // src port
+    return SIM_FRAME_LEN;
+  }
+
+  static void injectGenerated(uint64_t n) {
+    char msg[SIM_MAX_MSG];
+    switch(n % 4) {
+    case 0:
+    case 2: {
+      u_char frame[SIM_FRAME_LEN];
+      uint32_t frameLen = simFrame(frame, n);
+      kernelSample(SIM_SAMPLING_N, frame, frameLen, frameLen);
+      break;
+    }
+    case 1:
+      snprintf(msg, sizeof(msg),
+	       "{\"flow_sample\":{\"app_name\":\"evsim\",\"sampling_rate\":%u,"
+	       "\"app_operation\":{\"operation\":\"get\",\"attributes\":\"n=%"PRIu64"\","
+	       "\"status_descr\":\"OK\",\"status\":0,\"req_bytes\":%"PRIu64",\"resp_bytes\":%"PRIu64",\"uS\":%"PRIu64"}}}",
+	       SIM_SAMPLING_N, n, 100 + (n % 50), 1000 + (n % 900), 50 + (n % 1000));
+      injectJSON(msg);
+      break;
+    case 3:
+      snprintf(msg, sizeof(msg),
+	       "{\"rtmetric\":{\"datasource\":\"evsim%"PRIu64"\","
+	       "\"n\":{\"type\":\"counter64\",\"value\":%"PRIu64"},"
+	       "\"load\":{\"type\":\"gauge32\",\"value\":%"PRIu64"}}}",
+	       n % 8, n, n % 100);
+      injectJSON(msg);
+      break;
+    }
+  }
+
+  static void injectFixture(char *line) {
+    char *p = line;
+    strtoull(p, &p, 0);
+    while(*p == ' ') p++;
+    if(!strncmp(p, "json ", 5)) {
+      injectJSON(p + 5);
+    }
+    else if(!strncmp(p, "psample ", 8)) {
+      char *hex = NULL;
+      uint32_t sampling_n = strtoul(p + 8, &hex, 0);
+      while(*hex == ' ') hex++;
+      u_char frame[SIM_NL_BUF / 2];
+      int frameLen = hexToBinary((u_char *)hex, frame, sizeof(frame));
+      if(frameLen > 14)
+	kernelSample(sampling_n ?: 1, frame, frameLen, frameLen);
+      else
+	myLog(LOG_ERR, "evsim: bad psample frame: %s", line);
+    }
+    else
+      myLog(LOG_ERR, "evsim: unknown fixture record: %s", line);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      pcap replay          __________________
+    -----------------___________________________------------------
+    Just enough of the classic pcap format to read ethernet frames,
+    so that this does not need libpcap.
+  */
+
+  static uint32_t pcapU32(uint32_t val) {
+    return sim.pcapSwap ? __builtin_bswap32(val) : val;
+  }
+
+  static void pcapOpen(char *path) {
+    if((sim.pcap = fopen(path, "r")) == NULL) {
+      fprintf(stderr, "cannot open %s : %s\n", path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    uint32_t hdr[6];
+    if(fread(hdr, sizeof(hdr), 1, sim.pcap) != 1) {
+      fprintf(stderr, "%s: short pcap file header\n", path);
+      exit(EXIT_FAILURE);
+    }
+    switch(hdr[0]) {
+    case 0xa1b2c3d4: break;
+    case 0xd4c3b2a1: sim.pcapSwap = YES; break;
+    case 0xa1b23c4d: sim.pcapNano = YES; break;
+    case 0x4d3cb2a1: sim.pcapSwap = YES; sim.pcapNano = YES; break;
+    default:
+      fprintf(stderr, "%s: not a pcap file (magic=0x%08x)\n", path, hdr[0]);
+      exit(EXIT_FAILURE);
+    }
+    uint32_t linktype = pcapU32(hdr[5]);
+    if(linktype != 1) {
+      fprintf(stderr, "%s: not an ethernet capture (linktype=%u)\n", path, linktype);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // sample 1-in-N as readPackets_pcap_cb() does
+  static void pcapPacket(u_char *frame, uint32_t capLen, uint32_t origSize) {
+    sim.pcapPkts++;
+    if(--sim.pcapSkip == 0) {
+      uint32_t sr = sim.pcapSamplingN;
+      sim.pcapSkip = sr == 1 ? 1 : sfl_random((2 * sr) - 1);
+      if(capLen > SIM_PCAP_SNAPLEN)
+	capLen = SIM_PCAP_SNAPLEN;
+      if(capLen > 14)
+	kernelSample(sr, frame, capLen, origSize);
+    }
+  }
+
+  static void injectPcap(void) {
+    static u_char frame[SIM_PCAP_MAXLEN];
+    static uint32_t rec[4];
+    static bool haveRec = NO;
+    for(;;) {
+      if(!haveRec) {
+	if(fread(rec, sizeof(rec), 1, sim.pcap) != 1) {
+	  sim.pcapEOF = YES;
+	  return;
+	}
+	haveRec = YES;
+      }
+      uint64_t ts_uS = ((uint64_t)pcapU32(rec[0]) * 1000000)
+	+ (sim.pcapNano ? (pcapU32(rec[1]) / 1000) : pcapU32(rec[1]));
+      if(!sim.pcapStarted) {
+	// the first packet lands on the first step
+	sim.pcapStarted = YES;
+	sim.pcapStart_uS = ts_uS;
+      }
+      // out-of-order timestamps are due at once
+      uint64_t due_mS = (ts_uS > sim.pcapStart_uS) ? ((ts_uS - sim.pcapStart_uS) / 1000) : 0;
+      if(due_mS > sim.now_mS)
+	return;
+      haveRec = NO;
+      uint32_t capLen = pcapU32(rec[2]);
+      uint32_t origSize = pcapU32(rec[3]);
+      if(capLen > SIM_PCAP_MAXLEN
+	 || fread(frame, 1, capLen, sim.pcap) != capLen) {
+	myLog(LOG_ERR, "evsim: bad or truncated pcap record (caplen=%u)", capLen);
+	sim.pcapEOF = YES;
+	return;
+      }
+      pcapPacket(frame, capLen, origSize);
+    }
+  }
+
+  // inject everything that is due at or before now
+  static void inject(void) {
+    if(sim.pcap) {
+      injectPcap();
+      return;
+    }
+    if(sim.fixture) {
+      static char line[SIM_MAX_MSG];
+      static bool haveLine = NO;
+      for(;;) {
+	if(!haveLine) {
+	  if(fgets(line, sizeof(line), sim.fixture) == NULL)
+	    return;
+	  line[strcspn(line, "\r\n")] = '\0';
+	  if(line[0] == '\0' || line[0] == '#')
+	    continue;
+	  haveLine = YES;
+	}
+	if(strtoull(line, NULL, 0) > sim.now_mS)
+	  return;
+	haveLine = NO;
+	injectFixture(line);
+      }
+    }
+    for(;;) {
+      uint64_t due_mS = (sim.scheduled * 1000) / sim.rate;
+      if(due_mS > sim.now_mS)
+	return;
+      injectGenerated(sim.scheduled++);
+    }
+  }
+
+  /*_________________---------------------------__________________
+    _________________      collector            __________________
+    -----------------___________________________------------------
+  */
+
+  static void collectorDatagram(u_char *buf, int len) {
+    sim.datagrams++;
+    simDigest("datagram", buf, len);
+    // just enough XDR decoding to count the samples by type
+    uint32_t *xdr = (uint32_t *)buf;
+    uint32_t words = len / 4;
+    uint32_t addrType = (words > 1) ? ntohl(xdr[1]) : 0;
+    uint32_t cursor = (addrType == SFLADDRESSTYPE_IP_V6) ? 6 : 3;
+    cursor += 3; // subagent, sequence, uptime
+    if(cursor >= words)
+      return;
+    uint32_t samples = ntohl(xdr[cursor++]);
+    for(uint32_t ss = 0; ss < samples && (cursor + 2) <= words; ss++) {
+      uint32_t tag = ntohl(xdr[cursor++]);
+      uint32_t sampleLen = ntohl(xdr[cursor++]);
+      switch(tag) {
+      case SFLFLOW_SAMPLE:
+      case SFLFLOW_SAMPLE_EXPANDED:
+	sim.flowSamples++;
+	break;
+      case SFLCOUNTERS_SAMPLE:
+      case SFLCOUNTERS_SAMPLE_EXPANDED:
+	sim.counterSamples++;
+	break;
+      default:
+	sim.otherSamples++;
+      }
+      cursor += (sampleLen + 3) / 4;
+    }
+  }
+
+  static void collectorRead(void) {
+    u_char buf[SIM_MAX_DATAGRAM];
+    int len;
+    while((len = recv(sim.collectorFD, buf, sizeof(buf), 0)) > 0)
+      collectorDatagram(buf, len);
+  }
+
+  /*_________________---------------------------__________________
+    _________________      stepping             __________________
+    -----------------___________________________------------------
+  */
+
+  static void setNonBlocking(int fd) {
+    int fdFlags = fcntl(fd, F_GETFL);
+    if(fcntl(fd, F_SETFL, fdFlags | O_NONBLOCK) < 0) {
+      fprintf(stderr, "fcntl(O_NONBLOCK) failed : %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  static int pendingBytes(int fd) {
+    int n = 0;
+    ioctl(fd, FIONREAD, &n);
+    return n;
+  }
+
+  static bool busIdle(EVBus *bus) {
+    if(pendingBytes(bus->pipe[0]))
+      return NO;
+    EVSocket *sock;
+    UTARRAY_WALK(bus->sockets_run, sock) {
+      if(pendingBytes(sock->fd))
+	return NO;
+    }
+    return YES;
+  }
+
+  // step every bus until nothing is left in flight (or give up, so
+  // that a pipeline that cannot keep up shows as drops)
+  static void settle(EVMod *root) {
+    EVBus *bus;
+    for(int ii = 0; ii < 1000; ii++) {
+      bool idle = YES;
+      UTHASH_WALK(root->root->buses, bus) {
+	EVBusStep(bus);
+	kernelRead();
+	if(!busIdle(bus))
+	  idle = NO;
+      }
+      if(idle
+	 && pendingBytes(sim.nlFD) == 0)
+	break;
+    }
+    collectorRead();
+  }
+
+  /*_________________---------------------------__________________
+    _________________      daemon setup         __________________
+    -----------------___________________________------------------
+    The parts of main() that matter here, without readInterfaces(),
+    privileges, pid file, signals or threads.
+  */
+
+  static int udpSocket(uint16_t *port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET,
+			      .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t saLen = sizeof(sa);
+    if(fd < 0
+       || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+       || getsockname(fd, (struct sockaddr *)&sa, &saLen) < 0) {
+      fprintf(stderr, "evsim: UDP socket failed : %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    setNonBlocking(fd);
+    *port = ntohs(sa.sin_port);
+    return fd;
+  }
+
+  static void simConfig(HSP *sp, uint16_t collectorPort, uint16_t jsonPort) {
+    char path[] = "/tmp/evsim_conf_XXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if(f == NULL) {
+      fprintf(stderr, "evsim: cannot write config : %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    fprintf(f,
+	    "sflow {\n"
+	    "  sampling = %u\n"
+	    "  polling = %u\n"
+	    "  collector { ip=127.0.0.1 udpport=%u }\n"
+	    "  json { udpport=%u }\n"
+	    "  psample { group=%u }\n"
+	    "}\n",
+	    SIM_SAMPLING_N, SIM_POLLING_SECS, collectorPort, jsonPort, SIM_PSAMPLE_GROUP);
+    fclose(f);
+    sp->configFile = path;
+    bool ok = HSPReadConfigFile(sp);
+    unlink(path);
+    sp->configFile = NULL;
+    if(!ok) {
+      fprintf(stderr, "evsim: config rejected\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  static void simAdaptor(HSP *sp) {
+    u_char mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    SFLAdaptor *ad = nioAdaptorNew(SIM_DEV, mac, SIM_IFINDEX);
+    ad->ifSpeed = 10000000000LL;
+    ad->ifDirection = 1;
+    ADAPTOR_NIO(ad)->up = YES;
+    adaptorAddOrReplace(sp->adaptorsByName, ad, "byName");
+    adaptorAddOrReplace(sp->adaptorsByIndex, ad, "byIndex");
+    adaptorAddOrReplace(sp->adaptorsByMac, ad, "byMac");
+  }
+
+  static HSP *simDaemon(char *modulesPath, uint16_t collectorPort, uint16_t jsonPort) {
+    HSP *sp = (HSP *)my_calloc(sizeof(HSP));
+    setDefaults(sp);
+    sp->dropPriv = NO;
+    sp->modulesPath = modulesPath;
+    sp->f_out = tmpfile();
+
+    cJSON_Hooks hooks;
+    hooks.malloc_fn = my_calloc;
+    hooks.free_fn = my_free;
+    cJSON_InitHooks(&hooks);
+
+    sp->sync_agent = (pthread_mutex_t *)my_calloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(sp->sync_agent, NULL);
+    sp->sync_latency = (pthread_mutex_t *)my_calloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(sp->sync_latency, NULL);
+    sp->pollActions = UTArrayNew(UTARRAY_DFLT);
+    sp->adaptorsByName = UTHASH_NEW(SFLAdaptor, deviceName, UTHASH_SYNC | UTHASH_SKEY);
+    sp->adaptorsByIndex = UTHASH_NEW(SFLAdaptor, ifIndex, UTHASH_SYNC);
+    sp->adaptorsByPeerIndex = UTHASH_NEW(SFLAdaptor, peer_ifIndex, UTHASH_SYNC);
+    sp->adaptorsByMac = UTHASH_NEW(SFLAdaptor, macs[0], UTHASH_SYNC);
+    sp->adaptorLookup_stale = YES;
+    sp->vmsByUUID = UTHASH_NEW(HSPVMState, uuid, UTHASH_DFLT);
+    sp->vmsByDsIndex = UTHASH_NEW(HSPVMState, dsIndex, UTHASH_DFLT);
+    sp->localIP =  UTHASH_NEW(SFLAddress, address.ip_v4, UTHASH_DFLT);
+    sp->localIP6 = UTHASH_NEW(SFLAddress, address.ip_v6, UTHASH_DFLT);
+
+    simConfig(sp, collectorPort, jsonPort);
+    simAdaptor(sp);
+    parseNumericAddress(SIM_AGENT_IP, NULL, &sp->agentIP, PF_INET);
+    sfl_random_init(SIM_SEED);
+
+    // never go looking at the host's interfaces
+    sp->nio_polling_secs = 0;
+    sp->next_checkAdaptorList = LONG_MAX;
+    sp->next_refreshAdaptorList = LONG_MAX;
+
+    initAgent(sp);
+    sp->rootModule = EVInit(sp);
+    sp->pollBus = EVGetBus(sp->rootModule, HSPBUS_POLL, YES);
+    EVCurrentBusSet(sp->pollBus);
+
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, HSPEVENT_CONFIG_FIRST), evt_config_first);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, HSPEVENT_CONFIG_CHANGED), evt_config_changed);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, HSPEVENT_CONFIG_SHAKE), evt_config_shake);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, HSPEVENT_CONFIG_DONE), evt_config_done);
+
+    EVLoadModule(sp->rootModule, "mod_json", sp->modulesPath);
+    EVLoadModule(sp->rootModule, "mod_psample", sp->modulesPath);
+
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_TICK), evt_poll_tick);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_TOCK), evt_poll_tock);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, HSPEVENT_INTFS_CHANGED), evt_poll_intfs_changed);
+    EVEventRxAll(sp->rootModule, EVEVENT_TOCK, evt_all_tock);
+
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_DECI), simDeci);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_TICK), simTick);
+    EVEventRx(sp->rootModule, EVGetEvent(sp->pollBus, EVEVENT_TOCK), simTock);
+    return sp;
+  }
+
+  // installSFlowSettings() for the first config, except that
+  // pre_config_first() would read the host's interfaces
+  static void simInstallSettings(HSP *sp) {
+    HSPSFlowSettings *settings = sp->sFlowSettings_file;
+    sp->sFlowSettings_str = sFlowSettingsString(sp, settings);
+    sp->revisionNo++;
+    openCollectorSockets(sp, settings);
+    sp->sFlowSettings = settings;
+    updatePollingInterval(sp);
+    EVEventTxAll(sp->rootModule, HSPEVENT_CONFIG_FIRST, NULL, 0);
+    EVEventTxAll(sp->rootModule, HSPEVENT_CONFIG_CHANGED, NULL, 0);
+    sp->config_shake_countdown = EVBusCount(sp->rootModule);
+    EVEventTxAll(sp->rootModule, EVEVENT_HANDSHAKE, HSPEVENT_CONFIG_SHAKE, strlen(HSPEVENT_CONFIG_SHAKE));
+  }
+
+  /*_________________---------------------------__________________
+    _________________      main                 __________________
+    -----------------___________________________------------------
+  */
+
+  static void usage(char *cmd) {
+    fprintf(stderr, "usage: %s [-l modulesDir] [-s secs] [-q step_mS] [-r records_per_sec | -f fixture | -p file.pcap [-N sampling_n]] [-d debug]\n", cmd);
+    exit(EXIT_FAILURE);
+  }
+
+  static uint64_t cpu_nS(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+  }
+
+  int main(int argc, char *argv[]) {
+    uint32_t secs = 10;
+    uint32_t step_mS = 10;
+    char *modulesPath = ".";
+    sim.rate = 1000;
+    sim.pcapSamplingN = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "l:s:q:r:f:p:N:d:")) != -1) {
+      switch(opt) {
+      case 'l': modulesPath = optarg; break;
+      case 's': secs = strtoul(optarg, NULL, 0); break;
+      case 'q': step_mS = strtoul(optarg, NULL, 0); break;
+      case 'r': sim.rate = strtoul(optarg, NULL, 0); break;
+      case 'd': setDebug(strtoul(optarg, NULL, 0)); break;
+      case 'f':
+	if((sim.fixture = fopen(optarg, "r")) == NULL) {
+	  fprintf(stderr, "cannot open %s : %s\n", optarg, strerror(errno));
+	  exit(EXIT_FAILURE);
+	}
+	break;
+      case 'p': pcapOpen(optarg); break;
+      case 'N': sim.pcapSamplingN = strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]);
+      }
+    }
+    if(step_mS == 0 || step_mS > 1000 || sim.rate == 0 || sim.pcapSamplingN == 0)
+      usage(argv[0]);
+
+#ifdef UTHEAP
+    UTHeapInit();
+#endif
+
+    // the module's netlink socket is one end of this
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == -1) {
+      fprintf(stderr, "socketpair() failed : %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    sim.nlFD = fds[0];
+    sim.nlModFD = fds[1];
+    setNonBlocking(sim.nlFD);
+    setNonBlocking(sim.nlModFD);
+
+    uint16_t collectorPort, jsonPort;
+    sim.collectorFD = udpSocket(&collectorPort);
+    // find a free port for mod_json to bind
+    close(udpSocket(&jsonPort));
+    sim.jsonFD = socket(AF_INET, SOCK_DGRAM, 0);
+    sim.jsonAddr.sin_family = AF_INET;
+    sim.jsonAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sim.jsonAddr.sin_port = htons(jsonPort);
+
+    // time only moves when we move it
+    simAdvance(0);
+    EVClockSet(simClock, NULL);
+
+    HSP *sp = sim.sp = simDaemon(modulesPath, collectorPort, jsonPort);
+    if(EVGetModule(sp->rootModule, "mod_json")->initFn == NULL
+       || EVGetModule(sp->rootModule, "mod_psample")->initFn == NULL) {
+      fprintf(stderr, "modules not found in %s (make mod_json.so mod_psample.so)\n", modulesPath);
+      exit(EXIT_FAILURE);
+    }
+    simInstallSettings(sp);
+
+    EVMod *root = sp->rootModule;
+    EVBus *bus;
+    UTHASH_WALK(root->root->buses, bus)
+      EVBusStart(bus);
+    EVCurrentBusSet(sp->pollBus);
+
+    sim.pcapSkip = 1;
+    uint64_t allocs0 = 0;
+#ifdef UTHEAP
+    UTHeapStats(&allocs0, NULL);
+#endif
+    uint64_t cpu0 = cpu_nS();
+    uint64_t end_mS = (uint64_t)secs * 1000;
+    while(sim.now_mS < end_mS
+	  && !sim.pcapEOF) {
+      simAdvance(step_mS);
+      inject();
+      settle(root);
+    }
+    if(sim.pcapEOF)
+      end_mS = sim.now_mS;
+    // let the last samples flush
+    while(sim.now_mS < end_mS + (SIM_DRAIN_SECS * 1000)) {
+      simAdvance(step_mS);
+      settle(root);
+    }
+    uint64_t cpu = cpu_nS() - cpu0;
+    uint64_t allocs = 0;
+#ifdef UTHEAP
+    UTHeapStats(&allocs, NULL);
+#endif
+
+    UTHASH_WALK(root->root->buses, bus) {
+      bus->stop = YES;
+      EVBusStep(bus);
+    }
+
+    uint64_t records = sim.jsonFlows + sim.jsonRT + sim.jsonOther + sim.nlSamples;
+    printf("virtual_mS=%"PRIu64" step_mS=%u deci=%"PRIu64" tick=%"PRIu64" tock=%"PRIu64"\n",
+	   sim.now_mS, step_mS, sim.deci, sim.tick, sim.tock);
+    printf("json_flows=%"PRIu64" json_rt=%"PRIu64" json_other=%"PRIu64" psample=%"PRIu64" psample_unjoined=%"PRIu64"\n",
+	   sim.jsonFlows, sim.jsonRT, sim.jsonOther, sim.nlSamples, sim.nlUnjoined);
+    printf("datagrams=%"PRIu64" flow_samples=%"PRIu64" counter_samples=%"PRIu64" other_samples=%"PRIu64" json_drops=%"PRIu64"\n",
+	   sim.datagrams, sim.flowSamples, sim.counterSamples, sim.otherSamples,
+	   telemetryGet(sp, HSP_TELEMETRY_JSON_DROPS));
+    printf("digest=%016"PRIx64"\n", sim.digest);
+    printf("cpu_mS=%.1f records_per_cpu_sec=%.0f allocs_per_record=%.2f\n",
+	   cpu / 1e6,
+	   cpu ? (records * 1e9 / cpu) : 0.0,
+	   records ? ((double)(allocs - allocs0) / records) : 0.0);
+    if(sim.pcap)
+      printf("pcap_pkts=%"PRIu64" sampling_n=%u pcap_samples=%"PRIu64" ns_per_sample=%.0f datagrams_per_sample=%.3f\n",
+	     sim.pcapPkts, sim.pcapSamplingN, sim.nlSamples,
+	     sim.nlSamples ? ((double)cpu / sim.nlSamples) : 0.0,
+	     sim.nlSamples ? ((double)sim.datagrams / sim.nlSamples) : 0.0);
+
+    int status = EXIT_SUCCESS;
+    // every 100mS of virtual time gets its deci, and every second its tick
+    uint64_t expectDeci = (sim.now_mS - 1) / 100;
+    if(sim.deci != expectDeci
+       || sim.tick != sim.tock
+       || sim.tick != (expectDeci - 1) / 10) {
+      fprintf(stderr, "unexpected deci/tick count (expected deci=%"PRIu64")\n", expectDeci);
+      status = EXIT_FAILURE;
+    }
+    // every json flow and psample record is sampled 1:1 at the
+    // configured rate, and every rtmetric/rtflow goes straight out
+    // (fixtures must keep to that too)
+    if(sim.flowSamples != sim.jsonFlows + sim.nlSamples
+       || sim.otherSamples != sim.jsonRT) {
+      fprintf(stderr, "unexpected sample count (expected flow=%"PRIu64" other=%"PRIu64")\n",
+	      sim.jsonFlows + sim.nlSamples, sim.jsonRT);
+      status = EXIT_FAILURE;
+    }
+    return status;
+  }
@@ -0,0 +1,63 @@
+# Counters for the *_mock.py stand-ins here, printed as one line
+# every interval:
+#   HH:MM:SS <gauges> <counters, with a per-second rate for one> <tail>
+
+import asyncio
+import threading
+import time
+
+class Stats:
+
+  def __init__(self, *names, rate=None):
+    self.lock = threading.Lock()
+    self.counts = dict.fromkeys(names, 0)
+    self.rate = rate
+
+  def bump(self, name, n=1):
+    with self.lock:
+      self.counts[name] += n
+
+  def high(self, name, n):
+    with self.lock:
+      self.counts[name] = max(self.counts[name], n)
+
+  def __getitem__(self, name):
+    with self.lock:
+      return self.counts[name]
+
+  def snapshot(self):
+    with self.lock:
+      return dict(self.counts)
+
+  def line(self, interval, last, gauges=None, tail=None):
+    cur = self.snapshot()
+    out = [time.strftime("%H:%M:%S")]
+    if gauges:
+      out += ["%s=%s" % kv for kv in gauges().items()]
+    for name, val in cur.items():
+      out.append("%s=%s" % (name, val))
+      if name == self.rate:
+        out.append("%s/s=%.0f" % (name, (val - last[name]) / interval))
+    if tail:
+      out.append(tail())
+    print(" ".join(out), flush=True)
+    return cur
+
+  # gauges() returns a dict of current values to print first, and
+  # tail() a string to print last
+  def report(self, interval, gauges=None, tail=None):
+    last = self.snapshot()
+    while True:
+      time.sleep(interval)
+      last = self.line(interval, last, gauges, tail)
+
+  def start(self, interval, gauges=None, tail=None):
+    t = threading.Thread(target=self.report, args=(interval, gauges, tail))
+    t.daemon = True
+    t.start()
+
+  async def areport(self, interval, gauges=None, tail=None):
+    last = self.snapshot()
+    while True:
+      await asyncio.sleep(interval)
+      last = self.line(interval, last, gauges, tail)
@@ -0,0 +1,239 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+/* Fake libnvidia-ml.so for testing mod_nvml without a GPU:
+   NVML_STUB_GPUS devices (default 8), each call taking
+   NVML_STUB_CALL_uS microseconds (default 0). The calls made are
+   counted and printed on nvmlShutdown().
+   build against the real nvml.h, so that the versioned symbols match:
+     gcc -O2 -shared -fPIC -I/usr/local/cuda/include \
+       -Wl,-soname,libnvidia-ml.so.1 -o /tmp/nvml/libnvidia-ml.so.1 nvml_stub.c
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <nvml.h>
+
+struct nvmlDevice_st {
+  unsigned int index;
+};
+
+#define STUB_MAX_GPUS 64
+
+static struct nvmlDevice_st devices[STUB_MAX_GPUS];
+static unsigned int numDevices;
+static long callDelay_uS;
+static struct timespec startTime;
+
+enum {
+  CALL_UTILIZATION=0,
+  CALL_FIELD_VALUES,
+  CALL_POWER,
+  CALL_MEMORY,
+  CALL_ECC,
+  CALL_TEMPERATURE,
+  CALL_FAN,
+  CALL_PROCESSES,
+  CALL_OTHER,
+  CALL_NUM
+};
+
+static const char *callNames[CALL_NUM] = {
+  "utilization",
+  "field_values",
+  "power",
+  "memory",
+  "ecc",
+  "temperature",
+  "fan",
+  "processes",
+  "other",
+};
+
+static unsigned long calls[CALL_NUM];
+
+static uint64_t elapsed_mS(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((now.tv_sec - startTime.tv_sec) * 1000)
+    + ((now.tv_nsec - startTime.tv_nsec) / 1000000);
+}
+
+static void call(int which) {
+  calls[which]++;
+  if(callDelay_uS > 0) {
+    // spin, like a driver round-trip would
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+    } while(((t1.tv_sec - t0.tv_sec) * 1000000
+	     + (t1.tv_nsec - t0.tv_nsec) / 1000) < callDelay_uS);
+  }
+}
+
+static int badDevice(nvmlDevice_t device) {
+  return (device == NULL
+	  || device < devices
+	  || device >= devices + numDevices);
+}
+
+static unsigned int power_mW(nvmlDevice_t device) {
+  return 100000 + (device->index * 10000);
+}
+
+nvmlReturn_t nvmlInit(void) {
+  char *env = getenv("NVML_STUB_GPUS");
+  numDevices = env ? atoi(env) : 8;
+  if(numDevices > STUB_MAX_GPUS)
+    numDevices = STUB_MAX_GPUS;
+  env = getenv("NVML_STUB_CALL_uS");
+  callDelay_uS = env ? atol(env) : 0;
+  for(unsigned int ii = 0; ii < numDevices; ii++)
+    devices[ii].index = ii;
+  memset(calls, 0, sizeof(calls));
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlShutdown(void) {
+  uint64_t secs = elapsed_mS() / 1000;
+  unsigned long total = 0;
+  for(int cc = 0; cc < CALL_NUM; cc++)
+    total += calls[cc];
+  fprintf(stderr, "nvml_stub: %u devices, %lu calls in %lu seconds (%.1f/second):",
+	  numDevices, total, (unsigned long)secs, secs ? ((double)total / secs) : 0.0);
+  for(int cc = 0; cc < CALL_NUM; cc++)
+    fprintf(stderr, " %s=%lu", callNames[cc], calls[cc]);
+  fprintf(stderr, "\n");
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetCount(unsigned int *deviceCount) {
+  call(CALL_OTHER);
+  *deviceCount = numDevices;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetHandleByIndex(unsigned int index, nvmlDevice_t *device) {
+  call(CALL_OTHER);
+  if(index >= numDevices)
+    return NVML_ERROR_INVALID_ARGUMENT;
+  *device = &devices[index];
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetUUID(nvmlDevice_t device, char *uuid, unsigned int length) {
+  call(CALL_OTHER);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  snprintf(uuid, length, "GPU-5ab1e000-0000-4000-8000-%012x", device->index);
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetMinorNumber(nvmlDevice_t device, unsigned int *minorNumber) {
+  call(CALL_OTHER);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  *minorNumber = device->index;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetUtilizationRates(nvmlDevice_t device, nvmlUtilization_t *utilization) {
+  call(CALL_UTILIZATION);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  // sawtooth with a 1.7 second period, so point samples would alias
+  uint64_t phase = (elapsed_mS() + (device->index * 170)) % 1700;
+  utilization->gpu = (unsigned int)((phase * 100) / 1700);
+  utilization->memory = utilization->gpu / 2;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetPowerUsage(nvmlDevice_t device, unsigned int *power) {
+  call(CALL_POWER);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  *power = power_mW(device);
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetMemoryInfo(nvmlDevice_t device, nvmlMemory_t *memory) {
+  call(CALL_MEMORY);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  memory->total = 80ULL << 30;
+  memory->used = (unsigned long long)(device->index + 1) << 30;
+  memory->free = memory->total - memory->used;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetTotalEccErrors(nvmlDevice_t device, nvmlMemoryErrorType_t errorType, nvmlEccCounterType_t counterType, unsigned long long *eccCounts) {
+  call(CALL_ECC);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  *eccCounts = (errorType == NVML_DOUBLE_BIT_ECC) ? device->index : 0;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetTemperature(nvmlDevice_t device, nvmlTemperatureSensors_t sensorType, unsigned int *temp) {
+  call(CALL_TEMPERATURE);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  *temp = 40 + device->index;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetFanSpeed(nvmlDevice_t device, unsigned int *speed) {
+  call(CALL_FAN);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  *speed = 30 + device->index;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetComputeRunningProcesses(nvmlDevice_t device, unsigned int *infoCount, nvmlProcessInfo_t *infos) {
+  call(CALL_PROCESSES);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  unsigned int procs = device->index % 3;
+  if(infos == NULL || *infoCount < procs) {
+    *infoCount = procs;
+    return procs ? NVML_ERROR_INSUFFICIENT_SIZE : NVML_SUCCESS;
+  }
+  *infoCount = procs;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetFieldValues(nvmlDevice_t device, int valuesCount, nvmlFieldValue_t *values) {
+  call(CALL_FIELD_VALUES);
+  if(badDevice(device))
+    return NVML_ERROR_INVALID_ARGUMENT;
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  for(int ii = 0; ii < valuesCount; ii++) {
+    nvmlFieldValue_t *fv = &values[ii];
+    fv->timestamp = (now.tv_sec * 1000000LL) + (now.tv_nsec / 1000);
+    fv->latencyUsec = 0;
+    fv->nvmlReturn = NVML_SUCCESS;
+    fv->valueType = NVML_VALUE_TYPE_UNSIGNED_LONG_LONG;
+    switch(fv->fieldId) {
+    case NVML_FI_DEV_ECC_DBE_VOL_TOTAL:
+      fv->value.ullVal = device->index;
+      break;
+    case NVML_FI_DEV_TOTAL_ENERGY_CONSUMPTION:
+      // mW * mS / 1000 = mJ
+      fv->value.ullVal = (elapsed_mS() * power_mW(device)) / 1000;
+      break;
+    default:
+      fv->nvmlReturn = NVML_ERROR_NOT_SUPPORTED;
+      break;
+    }
+  }
+  return NVML_SUCCESS;
+}
@@ -0,0 +1,292 @@
+#!/usr/bin/env python3
+
+# fake ovsdb-server for testing the mod_ovs OVSDB client: just the
+# Bridge and sFlow tables, and monitor/transact/echo. --churn replaces
+# a bridge and --drift changes sFlow sampling every N seconds, and
+# --fail rejects the first N transactions; hsflowd should correct all
+# of them without forking ovs-vsctl.
+# requires "ovs { socket=/tmp/ovsdb_mock.sock }" in hsflowd.conf.
+
+import argparse
+import asyncio
+import json
+import mockstats
+import os
+import uuid
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-s", "--socket",
+  dest="socket", default="/tmp/ovsdb_mock.sock",
+  help="unix socket path to listen on")
+parser.add_argument("-n", "--bridges",
+  dest="bridges", type=int, default=2,
+  help="number of bridges")
+parser.add_argument("--churn",
+  dest="churn", type=float, default=0.0,
+  help="seconds between deleting one bridge and adding another (0=never)")
+parser.add_argument("--drift",
+  dest="drift", type=float, default=0.0,
+  help="seconds between changing sFlow sampling behind hsflowd's back (0=never)")
+parser.add_argument("--echo",
+  dest="echo", type=float, default=0.0,
+  help="seconds between inactivity probes sent to clients (0=never)")
+parser.add_argument("--fail",
+  dest="fail", type=int, default=0,
+  help="number of transactions to reject at the start")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+args = parser.parse_args()
+
+DB = "Open_vSwitch"
+tables = {"Bridge": {}, "sFlow": {}}
+monitors = []  # (writer, monitor-id, {table: columns})
+stats = mockstats.Stats("conns", "monitor", "transact", "ops", "failed", "updates", "echo")
+seq = 0
+
+# values
+
+def empty():
+  return ["set", []]
+
+def col_default(table, col):
+  return "" if (table, col) == ("Bridge", "name") else empty()
+
+def atoms(val):
+  if isinstance(val, list) and val and val[0] == "set":
+    return val[1]
+  return [val]
+
+def refs(val):
+  return [a[1] for a in atoms(val) if isinstance(a, list) and a[0] == "uuid"]
+
+# monitors
+
+def project(row, cols):
+  return {c: row.get(c) for c in cols if c in row}
+
+def notify(changes):
+  # changes: [(table, uuid, old, new)]
+  for writer, mon_id, req in monitors:
+    upd = {}
+    for table, u, old, new in changes:
+      if table not in req:
+        continue
+      cols = req[table]
+      entry = {}
+      if old is not None:
+        entry["old"] = project(old, cols)
+      if new is not None:
+        entry["new"] = project(new, cols)
+      upd.setdefault(table, {})[u] = entry
+    if upd:
+      stats.bump("updates")
+      send(writer, {"method": "update", "params": [mon_id, upd], "id": None})
+
+def gc(changes):
+  used = set()
+  for row in tables["Bridge"].values():
+    used.update(refs(row.get("sflow", empty())))
+  for u in [u for u in tables["sFlow"] if u not in used]:
+    changes.append(("sFlow", u, tables["sFlow"].pop(u), None))
+
+# transactions
+
+def match(table, where):
+  rows = tables[table]
+  out = list(rows)
+  for col, fn, val in where:
+    if col != "_uuid" or fn != "==":
+      raise ValueError("unsupported condition %s %s" % (col, fn))
+    out = [u for u in out if u == val[1]]
+  return out
+
+def transact(ops):
+  # all-or-nothing: work on a copy
+  global tables
+  saved = {t: {u: dict(r) for u, r in rows.items()} for t, rows in tables.items()}
+  named = {}
+  inserted = {}  # op index -> uuid
+  changes = []
+  results = []
+
+  def resolve(val):
+    if isinstance(val, list):
+      if len(val) == 2 and val[0] == "named-uuid":
+        return ["uuid", named[val[1]]]
+      return [resolve(v) for v in val]
+    return val
+
+  try:
+    if stats["transact"] <= args.fail:
+      raise ValueError("rejected by --fail")
+    for i, op in enumerate(ops):
+      stats.bump("ops")
+      table = op["table"]
+      if table not in tables:
+        raise ValueError("unknown table %s" % table)
+      kind = op["op"]
+      if kind == "insert":
+        u = str(uuid.uuid4())
+        if "uuid-name" in op:
+          named[op["uuid-name"]] = u
+        inserted[i] = u
+        tables[table][u] = {}
+        results.append({"uuid": ["uuid", u]})
+      elif kind in ("update", "delete"):
+        results.append({"count": len(match(table, op.get("where", [])))})
+      else:
+        raise ValueError("unsupported op %s" % kind)
+    # second pass now that every uuid-name is known
+    for i, op in enumerate(ops):
+      table = op["table"]
+      kind = op["op"]
+      if kind == "insert":
+        u = inserted[i]
+        row = {c: resolve(v) for c, v in op.get("row", {}).items()}
+        tables[table][u] = row
+        changes.append((table, u, None, dict(row)))
+      elif kind == "update":
+        for u in match(table, op.get("where", [])):
+          old = dict(tables[table][u])
+          tables[table][u].update({c: resolve(v) for c, v in op["row"].items()})
+          changes.append((table, u, old, dict(tables[table][u])))
+      elif kind == "delete":
+        for u in match(table, op.get("where", [])):
+          changes.append((table, u, tables[table].pop(u), None))
+    # referential integrity: a bridge must not point at a missing row
+    for row in tables["Bridge"].values():
+      for r in refs(row.get("sflow", empty())):
+        if r not in tables["sFlow"]:
+          raise ValueError("referential integrity violation: sFlow %s" % r)
+    gc(changes)
+  except (KeyError, ValueError) as e:
+    tables = saved
+    stats.bump("failed")
+    return results + [{"error": "constraint violation", "details": str(e)}], []
+  return results, changes
+
+# protocol
+
+def send(writer, msg):
+  writer.write(json.dumps(msg).encode())
+
+def handle_request(writer, msg):
+  method = msg.get("method")
+  params = msg.get("params", [])
+  mid = msg.get("id")
+  if method == "echo":
+    if mid is not None:
+      send(writer, {"result": params, "error": None, "id": mid})
+    return
+  if method == "list_dbs":
+    send(writer, {"result": [DB], "error": None, "id": mid})
+    return
+  if method == "monitor":
+    stats.bump("monitor")
+    _, mon_id, reqs = params
+    cols = {}
+    initial = {}
+    for table, req in reqs.items():
+      cols[table] = req.get("columns") or ["name", "sflow"]
+      for u, row in tables.get(table, {}).items():
+        full = {c: row.get(c, col_default(table, c)) for c in cols[table]}
+        initial.setdefault(table, {})[u] = {"new": full}
+    monitors.append((writer, mon_id, cols))
+    send(writer, {"result": initial, "error": None, "id": mid})
+    return
+  if method == "transact":
+    stats.bump("transact")
+    results, changes = transact(params[1:])
+    notify(changes)
+    send(writer, {"result": results, "error": None, "id": mid})
+    return
+  send(writer, {"result": None, "error": "unknown method", "id": mid})
+
+async def handle(reader, writer):
+  stats.bump("conns")
+  dec = json.JSONDecoder()
+  buf = ""
+  try:
+    while True:
+      data = await reader.read(65536)
+      if not data:
+        return
+      buf += data.decode()
+      while True:
+        buf = buf.lstrip()
+        if not buf:
+          break
+        try:
+          msg, end = dec.raw_decode(buf)
+        except json.JSONDecodeError:
+          break
+        buf = buf[end:]
+        if "method" in msg:
+          handle_request(writer, msg)
+        elif msg.get("id") == "echo":
+          stats.bump("echo")
+      await writer.drain()
+  except ConnectionError:
+    pass
+  finally:
+    for m in [m for m in monitors if m[0] is writer]:
+      monitors.remove(m)
+    writer.close()
+
+# background changes
+
+def add_bridge():
+  global seq
+  u = str(uuid.uuid4())
+  row = {"name": "br%d" % seq, "sflow": empty()}
+  seq += 1
+  tables["Bridge"][u] = row
+  return [("Bridge", u, None, dict(row))]
+
+async def churn():
+  while True:
+    await asyncio.sleep(args.churn)
+    changes = []
+    if tables["Bridge"]:
+      u = next(iter(tables["Bridge"]))
+      changes.append(("Bridge", u, tables["Bridge"].pop(u), None))
+    changes += add_bridge()
+    gc(changes)
+    notify(changes)
+
+async def drift():
+  while True:
+    await asyncio.sleep(args.drift)
+    for u, row in tables["sFlow"].items():
+      old = dict(row)
+      row["sampling"] = 1
+      notify([("sFlow", u, old, dict(row))])
+
+async def echo():
+  while True:
+    await asyncio.sleep(args.echo)
+    for writer, _, _ in monitors:
+      send(writer, {"method": "echo", "params": [], "id": "echo"})
+
+def summary():
+  out = []
+  for u, row in tables["sFlow"].items():
+    users = [b["name"] for b in tables["Bridge"].values() if u in refs(b.get("sflow", empty()))]
+    out.append("sflow(%s sampling=%s polling=%s targets=%s bridges=%s)" % (
+      u[:8], row.get("sampling"), row.get("polling"), atoms(row.get("targets", empty())), users))
+  return " ".join(out)
+
+async def main():
+  for _ in range(args.bridges):
+    add_bridge()
+  if os.path.exists(args.socket):
+    os.unlink(args.socket)
+  server = await asyncio.start_unix_server(handle, args.socket)
+  for fn, period in ((churn, args.churn), (drift, args.drift), (echo, args.echo)):
+    if period > 0:
+      asyncio.ensure_future(fn())
+  asyncio.ensure_future(stats.areport(args.interval, lambda: {"bridges": len(tables["Bridge"])}, summary))
+  await server.serve_forever()
+
+asyncio.run(main())
@@ -0,0 +1,127 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+/* Send rtmetric records to hsflowd through the shared-memory ring
+   (json { ring=<path> }) or as JSON over UDP (json { UDPport=<port> }),
+   and report the producer-side cost of each.
+
+   build:  gcc -O2 -I.. -o rtring_bench rtring_bench.c
+   run:    rtring_bench -r /run/hsflowd_ring.sock -n 1000000
+           rtring_bench -u 36343 -n 1000000
+
+   Compare rtmetric_samples and json_drops on the hsflowd telemetry
+   socket before and after to see how many arrived.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "hsflowd_ring.h"
+
+static double now_S(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static double cpu_S(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+    + ((ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  char *ringPath = NULL;
+  int udpPort = 0;
+  long n = 100000;
+  long rate = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "r:u:n:R:")) != -1) {
+    switch(opt) {
+    case 'r': ringPath = optarg; break;
+    case 'u': udpPort = atoi(optarg); break;
+    case 'n': n = atol(optarg); break;
+    case 'R': rate = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s (-r ringSocket | -u udpPort) [-n records] [-R records/sec]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  HSPRing ring;
+  int soc = -1;
+  struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = htons(udpPort) };
+  dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(ringPath) {
+    int err = hsp_ring_open(&ring, ringPath, 1 << 20);
+    if(err) {
+      fprintf(stderr, "hsp_ring_open(%s): %s\n", ringPath, strerror(-err));
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if(udpPort) {
+    soc = socket(AF_INET, SOCK_DGRAM, 0);
+  }
+  else {
+    fprintf(stderr, "need -r or -u\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long sent = 0, full = 0;
+  double t0 = now_S(), c0 = cpu_S();
+  for(long ii = 0; ii < n; ii++) {
+    if(rate
+       && ii % 100 == 0) {
+      // crude pacing
+      double due = t0 + ((double)ii / rate);
+      double wait = due - now_S();
+      if(wait > 0) {
+	struct timespec ts = { .tv_sec = (time_t)wait, .tv_nsec = (long)((wait - (time_t)wait) * 1e9) };
+	nanosleep(&ts, NULL);
+      }
+    }
+    if(ringPath) {
+      HSPRingRec rec;
+      hsp_rec_rtmetric(&rec, "bench");
+      hsp_rec_counter32(&rec, "seq", (uint32_t)ii);
+      hsp_rec_gauge32(&rec, "load", (uint32_t)(ii & 0xff));
+      hsp_rec_gaugeDouble(&rec, "ratio", ii / (double)n);
+      if(hsp_ring_write(&ring, &rec) == 0)
+	sent++;
+      else
+	full++;
+    }
+    else {
+      char msg[256];
+      int len = snprintf(msg, sizeof(msg),
+			 "{\"rtmetric\":{\"datasource\":\"bench\","
+			 "\"seq\":{\"type\":\"counter32\",\"value\":%ld},"
+			 "\"load\":{\"type\":\"gauge32\",\"value\":%ld},"
+			 "\"ratio\":{\"type\":\"gaugeDouble\",\"value\":%f}}}",
+			 ii, ii & 0xff, ii / (double)n);
+      if(sendto(soc, msg, len, 0, (struct sockaddr *)&dst, sizeof(dst)) == len)
+	sent++;
+      else
+	full++;
+    }
+  }
+  double secs = now_S() - t0, cpu = cpu_S() - c0;
+  printf("%s: sent=%ld failed=%ld secs=%.3f records/s=%.0f producer_cpu_nS/record=%.0f\n",
+	 ringPath ? "ring" : "udp-json",
+	 sent,
+	 full,
+	 secs,
+	 sent / secs,
+	 (cpu * 1e9) / (n ? n : 1));
+  if(ringPath) {
+    // give hsflowd a few deci ticks to drain before we close the ring
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 500000000 };
+    nanosleep(&ts, NULL);
+    hsp_ring_close(&ring);
+  }
+  return 0;
+}
@@ -0,0 +1,224 @@
+#!/usr/bin/env python
+
+# minimal sFlow collector stand-in for checking hsflowd end-to-end.
+# Decodes the sFlow v5 datagram and sample headers, and reports
+# datagram loss (agent sequence gaps), flow-sample loss (sample
+# sequence gaps and the drops field) and, for traffic sent with
+# --probe, the latency from packet send time to datagram arrival.
+# With --pid it also tracks the CPU and RSS of the hsflowd process.
+#
+# example (hsflowd.conf with "collector { ip=127.0.0.1 udpport=6343 }"
+# and "pcap { dev=lo }" or "psample { group=1 }"):
+#   sflow_collector.py --pid `cat /var/run/hsflowd.pid` --probe 127.0.0.1:9999 --rate 10000
+
+from __future__ import print_function
+import argparse
+import os
+import socket
+import struct
+import threading
+import time
+
+PROBE_MAGIC = b"HSPPROBE"
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-p", "--port",
+  dest="port", type=int, default=6343,
+  help="UDP port to listen on")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+parser.add_argument("--pid",
+  dest="pid", type=int,
+  help="hsflowd process to track CPU/RSS for")
+parser.add_argument("--probe",
+  dest="probe",
+  help="send timestamped UDP probes to HOST:PORT")
+parser.add_argument("--rate",
+  dest="rate", type=int, default=1000,
+  help="probe packets per second")
+args = parser.parse_args()
+
+def now_ns():
+  return int(time.time() * 1e9)
+
+# ---------- probe generator ----------
+
+def send_probes(host, port, rate):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  batch = max(1, rate // 100)
+  pad = b"\0" * 64
+  while True:
+    start = time.time()
+    for _ in range(batch):
+      sock.sendto(PROBE_MAGIC + struct.pack(">Q", now_ns()) + pad, (host, port))
+    snooze = 0.01 - (time.time() - start)
+    if snooze > 0:
+      time.sleep(snooze)
+
+# ---------- process stats ----------
+
+CLK_TCK = os.sysconf("SC_CLK_TCK")
+
+def proc_stats(pid):
+  try:
+    with open("/proc/%d/stat" % pid) as f:
+      fields = f.read().rsplit(")", 1)[1].split()
+    # utime and stime are fields 14 and 15 (counting from 1)
+    cpu = (int(fields[11]) + int(fields[12])) / float(CLK_TCK)
+    rss = 0
+    with open("/proc/%d/status" % pid) as f:
+      for line in f:
+        if line.startswith("VmRSS:"):
+          rss = int(line.split()[1])
+    return cpu, rss
+  except (IOError, OSError, IndexError, ValueError):
+    return None, None
+
+# ---------- XDR decode ----------
+
+class Stats(object):
+  def __init__(self):
+    self.datagrams = 0
+    self.bytes = 0
+    self.dgram_lost = 0
+    self.flow_samples = 0
+    self.counter_samples = 0
+    self.sample_lost = 0
+    self.drops = 0
+    self.latency = []
+    self.errors = 0
+
+agent_seq = {}   # (agent,subAgent) -> last datagram sequence number
+sample_seq = {}  # (agent,subAgent,source) -> last flow sample sequence number
+sample_drops = {}  # (agent,subAgent,source) -> last drops count
+
+def u32(buf, off):
+  return struct.unpack_from(">I", buf, off)[0], off + 4
+
+def check_seq(table, key, seq):
+  # returns number of missing sequence numbers since the last one seen
+  last = table.get(key)
+  table[key] = seq
+  if last is None or seq <= last:
+    return 0  # first time, or agent restarted
+  return seq - last - 1
+
+def decode_flow_records(buf, off, nrecs, arrival, stats):
+  for _ in range(nrecs):
+    fmt, off = u32(buf, off)
+    rlen, off = u32(buf, off)
+    if fmt == 1:
+      # raw packet header: protocol, frame_length, stripped, header_length, bytes
+      hdr_len = struct.unpack_from(">I", buf, off + 12)[0]
+      hdr = buf[off + 16:off + 16 + hdr_len]
+      idx = hdr.find(PROBE_MAGIC)
+      if idx >= 0 and idx + 16 <= len(hdr):
+        sent = struct.unpack_from(">Q", hdr, idx + len(PROBE_MAGIC))[0]
+        stats.latency.append((arrival - sent) / 1e6)
+    off += rlen
+
+def decode_datagram(buf, arrival, stats):
+  off = 0
+  version, off = u32(buf, off)
+  if version != 5:
+    stats.errors += 1
+    return
+  addr_type, off = u32(buf, off)
+  alen = 16 if addr_type == 2 else 4
+  agent = socket.inet_ntop(socket.AF_INET6 if addr_type == 2 else socket.AF_INET, buf[off:off + alen])
+  off += alen
+  sub_agent, off = u32(buf, off)
+  seq, off = u32(buf, off)
+  uptime, off = u32(buf, off)
+  nsamples, off = u32(buf, off)
+  stats.datagrams += 1
+  stats.bytes += len(buf)
+  stats.dgram_lost += check_seq(agent_seq, (agent, sub_agent), seq)
+  for _ in range(nsamples):
+    tag, off = u32(buf, off)
+    slen, off = u32(buf, off)
+    soff = off
+    off += slen
+    if tag == 1 or tag == 3:
+      # flow sample (or expanded flow sample)
+      stats.flow_samples += 1
+      sseq, soff = u32(buf, soff)
+      if tag == 1:
+        source, soff = u32(buf, soff)
+      else:
+        stype, soff = u32(buf, soff)
+        sindex, soff = u32(buf, soff)
+        source = (stype << 24) + sindex
+      soff += 8 # sampling_rate, sample_pool
+      drops, soff = u32(buf, soff)
+      soff += 8 if tag == 1 else 16 # input, output
+      nrecs, soff = u32(buf, soff)
+      key = (agent, sub_agent, source)
+      stats.sample_lost += check_seq(sample_seq, key, sseq)
+      last_drops = sample_drops.get(key)
+      sample_drops[key] = drops
+      if last_drops is not None and drops > last_drops:
+        stats.drops += drops - last_drops
+      decode_flow_records(buf, soff, nrecs, arrival, stats)
+    elif tag == 2 or tag == 4:
+      stats.counter_samples += 1
+
+def percentile(vals, pc):
+  if not vals:
+    return 0.0
+  return vals[min(len(vals) - 1, int(len(vals) * pc / 100.0))]
+
+# ---------- main loop ----------
+
+if args.probe:
+  host, port = args.probe.rsplit(":", 1)
+  t = threading.Thread(target=send_probes, args=(host, int(port), args.rate))
+  t.daemon = True
+  t.start()
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+sock.bind(("", args.port))
+sock.settimeout(0.5)
+
+stats = Stats()
+last_report = time.time()
+last_cpu = None
+if args.pid:
+  last_cpu, _ = proc_stats(args.pid)
+
+while True:
+  try:
+    buf = sock.recv(65536)
+    try:
+      decode_datagram(buf, now_ns(), stats)
+    except (struct.error, ValueError):
+      stats.errors += 1
+  except socket.timeout:
+    pass
+  now = time.time()
+  secs = now - last_report
+  if secs < args.interval:
+    continue
+  lat = sorted(stats.latency)
+  line = "dgrams=%d dgrams/s=%.0f kbps=%.0f dgram_lost=%d flow=%d flow/s=%.0f ctr=%d sample_lost=%d drops=%d errors=%d" % (
+    stats.datagrams, stats.datagrams / secs, stats.bytes * 8 / secs / 1000,
+    stats.dgram_lost, stats.flow_samples, stats.flow_samples / secs,
+    stats.counter_samples, stats.sample_lost, stats.drops, stats.errors)
+  if args.probe:
+    line += " probes=%d latency_ms p50=%.2f p99=%.2f max=%.2f" % (
+      len(lat), percentile(lat, 50), percentile(lat, 99), lat[-1] if lat else 0.0)
+  if args.pid:
+    cpu, rss = proc_stats(args.pid)
+    if cpu is None:
+      line += " pid=%d gone" % args.pid
+    elif last_cpu is None:
+      # first sight of it: start counting from here
+      line += " cpu=? rss_kB=%d" % rss
+    else:
+      line += " cpu=%.1f%% rss_kB=%d" % (100.0 * (cpu - last_cpu) / secs, rss)
+    last_cpu = cpu
+  print(time.strftime("%H:%M:%S") + " " + line)
+  stats = Stats()
+  last_report = now
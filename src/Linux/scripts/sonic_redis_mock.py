@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+
+# fake SONiC redis for testing mod_sonic: -n ports with the usual SAI
+# counters, bumped every second, and a database_config.json pointing
+# at itself. Reports how many commands arrive per read (pipelining).
+# requires "sonic { dbconfig=/tmp/sonic_mock/database_config.json }" in
+# hsflowd.conf, and hsflowd built with "make REDISONLY=yes".
+
+import argparse
+import asyncio
+import fnmatch
+import json
+import mockstats
+import os
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-d", "--dir",
+  dest="dir", default="/tmp/sonic_mock",
+  help="directory to write database_config.json in")
+parser.add_argument("-p", "--port",
+  dest="port", type=int, default=16379,
+  help="TCP port to listen on (127.0.0.1)")
+parser.add_argument("-s", "--socket",
+  dest="socket", default="",
+  help="also listen on this unix socket, and advertise it as unix_socket_path")
+parser.add_argument("-n", "--ports",
+  dest="ports", type=int, default=32,
+  help="number of fake switch ports")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+args = parser.parse_args()
+
+APPL_DB, COUNTERS_DB, CONFIG_DB, STATE_DB = 0, 2, 4, 6
+
+# the counters hsflowd reads, among the many it does not
+SAI_FIELDS = [
+  "SAI_PORT_STAT_IF_IN_OCTETS", "SAI_PORT_STAT_IF_IN_UCAST_PKTS",
+  "SAI_PORT_STAT_IF_IN_NON_UCAST_PKTS", "SAI_PORT_STAT_IF_IN_DISCARDS",
+  "SAI_PORT_STAT_IF_IN_ERRORS", "SAI_PORT_STAT_IF_IN_UNKNOWN_PROTOS",
+  "SAI_PORT_STAT_IF_IN_BROADCAST_PKTS", "SAI_PORT_STAT_IF_IN_MULTICAST_PKTS",
+  "SAI_PORT_STAT_IF_OUT_OCTETS", "SAI_PORT_STAT_IF_OUT_UCAST_PKTS",
+  "SAI_PORT_STAT_IF_OUT_NON_UCAST_PKTS", "SAI_PORT_STAT_IF_OUT_DISCARDS",
+  "SAI_PORT_STAT_IF_OUT_ERRORS", "SAI_PORT_STAT_IF_OUT_BROADCAST_PKTS",
+  "SAI_PORT_STAT_IF_OUT_MULTICAST_PKTS",
+] + ["SAI_PORT_STAT_ETHER_STATS_PKTS_%d_TO_%d_OCTETS" % (1 << i, (2 << i) - 1) for i in range(6, 14)] \
+  + ["SAI_PORT_STAT_PFC_%d_%s_PKTS" % (p, d) for p in range(8) for d in ("RX", "TX")] \
+  + ["SAI_PORT_STAT_QUEUE_%d_DROPPED_PKTS" % q for q in range(64)]
+
+dbs = {n: {} for n in (APPL_DB, COUNTERS_DB, CONFIG_DB, STATE_DB)}
+stats = mockstats.Stats("conns", "reads", "commands", "select", "hgetall", "hmget",
+                        "other", "max_per_read", rate="commands")
+ports = []
+
+def oid(i):
+  return "oid:0x1000000000%03x" % (i + 1)
+
+def populate():
+  cfg = dbs[CONFIG_DB]
+  cfg["DEVICE_METADATA|localhost"] = {"mac": "00:11:22:33:44:55", "bgp_asn": "65100"}
+  cfg["SFLOW|global"] = {"admin_state": "up", "polling_interval": "20", "agent_id": "lo"}
+  cfg["SFLOW_COLLECTOR|mock"] = {"collector_ip": "127.0.0.1", "collector_port": "6343"}
+  name_map = {}
+  for i in range(args.ports):
+    name = "Ethernet%d" % (i * 4)
+    ports.append(name)
+    name_map[name] = oid(i)
+    dbs[APPL_DB]["PORT_TABLE:" + name] = {
+      "alias": "etp%d" % (i + 1), "speed": "100000", "index": str(i + 1),
+      "admin_status": "up", "oper_status": "up" if i % 8 else "down", "mtu": "9100"}
+    dbs[STATE_DB]["PORT_INDEX_TABLE|" + name] = {"index": str(i + 1), "ifindex": str(1000 + i)}
+    dbs[COUNTERS_DB]["COUNTERS:" + oid(i)] = {f: "0" for f in SAI_FIELDS}
+  dbs[COUNTERS_DB]["COUNTERS_PORT_NAME_MAP"] = name_map
+
+def bump_counters(t):
+  for i in range(args.ports):
+    h = dbs[COUNTERS_DB]["COUNTERS:" + oid(i)]
+    for j, f in enumerate(SAI_FIELDS):
+      h[f] = str(t * (i + 1) * (j + 1) * (1500 if "OCTETS" in f else 1))
+
+def write_dbconfig():
+  inst = {"hostname": "127.0.0.1", "port": args.port, "unix_socket_path": args.socket}
+  dbcfg = {"INSTANCES": {"redis": inst},
+           "DATABASES": {
+             "APPL_DB": {"id": APPL_DB, "separator": ":", "instance": "redis"},
+             "COUNTERS_DB": {"id": COUNTERS_DB, "separator": ":", "instance": "redis"},
+             "CONFIG_DB": {"id": CONFIG_DB, "separator": "|", "instance": "redis"},
+             "STATE_DB": {"id": STATE_DB, "separator": "|", "instance": "redis"}},
+           "VERSION": "1.0"}
+  os.makedirs(args.dir, exist_ok=True)
+  with open(os.path.join(args.dir, "database_config.json"), "w") as f:
+    json.dump(dbcfg, f, indent=2)
+
+# RESP
+
+def enc(v):
+  if v is None:
+    return b"$-1\r\n"
+  if isinstance(v, int):
+    return b":%d\r\n" % v
+  if isinstance(v, list):
+    return b"*%d\r\n" % len(v) + b"".join(enc(x) for x in v)
+  if isinstance(v, Error):
+    return b"-" + v.s.encode() + b"\r\n"
+  if isinstance(v, Status):
+    return b"+" + v.s.encode() + b"\r\n"
+  v = v.encode() if isinstance(v, str) else v
+  return b"$%d\r\n" % len(v) + v + b"\r\n"
+
+class Status:
+  def __init__(self, s):
+    self.s = s
+
+class Error(Status):
+  pass
+
+def parse(buf):
+  # returns (command, rest) or (None, buf) if incomplete
+  if not buf:
+    return None, buf
+  if buf[:1] != b"*":
+    # inline command
+    end = buf.find(b"\r\n")
+    if end < 0:
+      return None, buf
+    return buf[:end].decode().split(), buf[end + 2:]
+  end = buf.find(b"\r\n")
+  if end < 0:
+    return None, buf
+  n = int(buf[1:end])
+  off = end + 2
+  out = []
+  for _ in range(n):
+    end = buf.find(b"\r\n", off)
+    if end < 0:
+      return None, buf
+    ln = int(buf[off + 1:end])
+    off = end + 2
+    if len(buf) < off + ln + 2:
+      return None, buf
+    out.append(buf[off:off + ln].decode())
+    off += ln + 2
+  return out, buf[off:]
+
+class Conn:
+
+  def __init__(self, writer):
+    self.writer = writer
+    self.db = 0
+    self.subscribed = False
+
+  def run(self, cmd):
+    op = cmd[0].upper()
+    stats.bump("commands")
+    key = {"SELECT": "select", "HGETALL": "hgetall", "HMGET": "hmget"}.get(op, "other")
+    stats.bump(key)
+    data = dbs.get(self.db, {})
+    if op == "PING":
+      return Status("PONG")
+    if op == "SELECT":
+      self.db = int(cmd[1])
+      return Status("OK")
+    if op == "HGETALL":
+      h = data.get(cmd[1], {})
+      return [x for kv in h.items() for x in kv]
+    if op == "HMGET":
+      h = data.get(cmd[1], {})
+      return [h.get(f) for f in cmd[2:]]
+    if op == "HGET":
+      return data.get(cmd[1], {}).get(cmd[2])
+    if op == "KEYS":
+      return [k for k in data if fnmatch.fnmatchcase(k, cmd[1])]
+    if op == "PSUBSCRIBE":
+      self.subscribed = True
+      return ["psubscribe", cmd[1], 1]
+    return Error("ERR unknown command '%s'" % cmd[0])
+
+async def handle(reader, writer):
+  stats.bump("conns")
+  conn = Conn(writer)
+  buf = b""
+  try:
+    while True:
+      data = await reader.read(65536)
+      if not data:
+        return
+      stats.bump("reads")
+      buf += data
+      out = b""
+      n = 0
+      while True:
+        cmd, buf = parse(buf)
+        if cmd is None:
+          break
+        n += 1
+        out += enc(conn.run(cmd))
+      stats.high("max_per_read", n)
+      if out:
+        writer.write(out)
+        await writer.drain()
+  except (ConnectionError, ValueError):
+    pass
+  finally:
+    writer.close()
+
+async def ticker():
+  t0 = time.time()
+  while True:
+    await asyncio.sleep(1)
+    bump_counters(int(time.time() - t0))
+
+async def main():
+  populate()
+  write_dbconfig()
+  servers = [await asyncio.start_server(handle, "127.0.0.1", args.port)]
+  if args.socket:
+    if os.path.exists(args.socket):
+      os.unlink(args.socket)
+    servers.append(await asyncio.start_unix_server(handle, args.socket))
+  asyncio.ensure_future(ticker())
+  asyncio.ensure_future(stats.areport(args.interval, lambda: {"ports": args.ports}))
+  await asyncio.gather(*(s.serve_forever() for s in servers))
+
+asyncio.run(main())
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+
+# fake systemd for testing mod_systemd: serves -n active services on
+# the D-Bus at $DBUS_SYSTEM_BUS_ADDRESS, with a cgroup v2 tree for them
+# under --cgroot. --churn replaces one every N seconds. Needs jeepney.
+# requires
+#   systemd { cgroup_acct=/tmp/sd_cg/%s%s/%s cgroup_procs=/tmp/sd_cg/%s/cgroup.procs }
+# in hsflowd.conf, and hsflowd run with the same DBUS_SYSTEM_BUS_ADDRESS.
+
+import argparse
+import mockstats
+import os
+import shutil
+import threading
+import time
+
+from jeepney import (DBusAddress, HeaderFields, MessageType,
+                     new_error, new_method_return, new_signal)
+from jeepney.bus_messages import message_bus
+from jeepney.io.blocking import open_dbus_connection
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--cgroot",
+  dest="cgroot", default="/tmp/sd_cg",
+  help="directory to build the fake cgroup v2 tree in")
+parser.add_argument("-n", "--services",
+  dest="services", type=int, default=50,
+  help="number of fake active services")
+parser.add_argument("--pid",
+  dest="pid", type=int, default=os.getpid(),
+  help="pid to list in every service's cgroup.procs")
+parser.add_argument("--churn",
+  dest="churn", type=float, default=0.0,
+  help="seconds between stopping one service and starting another (0=never)")
+parser.add_argument("-i", "--interval",
+  dest="interval", type=float, default=5.0,
+  help="seconds between reports")
+args = parser.parse_args()
+
+SYSTEMD = "org.freedesktop.systemd1"
+UNIT_PREFIX = "/org/freedesktop/systemd1/unit/"
+
+lock = threading.Lock()
+services = {}  # name -> index
+seq = 0
+stats = mockstats.Stats("calls", "list", "get", "subscribe", "signals")
+bump = stats.bump
+
+def unit_path(name):
+  # systemd's bus_label_escape()
+  return UNIT_PREFIX + "".join(c if c.isalnum() else "_%02x" % ord(c) for c in name)
+
+def unit_name(path):
+  label = path[len(UNIT_PREFIX):]
+  out = ""
+  i = 0
+  while i < len(label):
+    if label[i] == "_":
+      out += chr(int(label[i + 1:i + 3], 16))
+      i += 3
+    else:
+      out += label[i]
+      i += 1
+  return out
+
+def cgroup(name):
+  return "/system.slice/" + name
+
+def cgdir(name):
+  return args.cgroot + cgroup(name)
+
+def write_counters(name, i, t):
+  d = cgdir(name)
+  with open(d + "/cpu.stat", "w") as f:
+    f.write("usage_usec %d\nuser_usec %d\nsystem_usec %d\n" % (t * 1000 * (i + 1), t * 700 * (i + 1), t * 300 * (i + 1)))
+  with open(d + "/memory.stat", "w") as f:
+    f.write("anon %d\nfile %d\nkernel 0\n" % ((i + 1) << 20, (i + 1) << 19))
+  with open(d + "/io.stat", "w") as f:
+    f.write("8:0 rbytes=%d wbytes=%d rios=%d wios=%d dbytes=0 dios=0\n" % (t * 4096, t * 8192, t, t * 2))
+    f.write("8:16 rbytes=%d wbytes=0 rios=%d wios=0 dbytes=0 dios=0\n" % (t * 512, t))
+
+def start_service():
+  global seq
+  name = "mock-%d.service" % seq
+  d = cgdir(name)
+  os.makedirs(d, exist_ok=True)
+  with open(d + "/cgroup.procs", "w") as f:
+    f.write("%d\n" % args.pid)
+  with open(d + "/cgroup.events", "w") as f:
+    f.write("populated 1\nfrozen 0\n")
+  write_counters(name, seq, 0)
+  services[name] = seq
+  seq += 1
+  return name
+
+def stop_service(name):
+  del services[name]
+  shutil.rmtree(cgdir(name), ignore_errors=True)
+
+def reply(conn, msg):
+  hdr = msg.header
+  iface = hdr.fields.get(HeaderFields.interface)
+  member = hdr.fields.get(HeaderFields.member)
+  path = hdr.fields.get(HeaderFields.path)
+  bump("calls")
+  if iface == "org.freedesktop.systemd1.Manager" and member == "ListUnits":
+    bump("list")
+    with lock:
+      names = list(services)
+    units = [(n, "mock service", "loaded", "active", "running", "", unit_path(n), 0, "", "/")
+             for n in names]
+    # some units we should ignore
+    units.append(("mock.socket", "mock socket", "loaded", "active", "listening", "", unit_path("mock.socket"), 0, "", "/"))
+    units.append(("dead.service", "inactive", "loaded", "inactive", "dead", "", unit_path("dead.service"), 0, "", "/"))
+    return new_method_return(msg, "a(ssssssouso)", (units,))
+  if iface == "org.freedesktop.systemd1.Manager" and member == "Subscribe":
+    bump("subscribe")
+    return new_method_return(msg)
+  if iface == "org.freedesktop.DBus.Properties" and member == "Get":
+    bump("get")
+    _, prop = msg.body
+    name = unit_name(path)
+    with lock:
+      known = name in services
+    if not known:
+      return new_error(msg, "org.freedesktop.systemd1.NoSuchUnit", "s", ("unit %s not loaded" % name,))
+    if prop == "ControlGroup":
+      return new_method_return(msg, "v", (("s", cgroup(name)),))
+    return new_method_return(msg, "v", (("b", True),))
+  return new_error(msg, "org.freedesktop.DBus.Error.UnknownMethod", "s", ("unknown %s.%s" % (iface, member),))
+
+def signal(conn, send_lock, path, iface, member, sig, body):
+  with send_lock:
+    conn.send(new_signal(DBusAddress(path, interface=iface), member, sig, body))
+  bump("signals")
+
+def active_state(conn, send_lock, name, state):
+  signal(conn, send_lock, unit_path(name), "org.freedesktop.DBus.Properties", "PropertiesChanged", "sa{sv}as",
+         ("org.freedesktop.systemd1.Unit", {"ActiveState": ("s", state), "SubState": ("s", "running" if state == "active" else "dead")}, []))
+
+def churn(conn, send_lock):
+  while True:
+    time.sleep(args.churn)
+    with lock:
+      old = next(iter(services), None)
+      if old:
+        stop_service(old)
+      new = start_service()
+    if old:
+      active_state(conn, send_lock, old, "deactivating")
+      active_state(conn, send_lock, old, "inactive")
+      signal(conn, send_lock, "/org/freedesktop/systemd1", "org.freedesktop.systemd1.Manager", "UnitRemoved", "so", (old, unit_path(old)))
+    active_state(conn, send_lock, new, "activating")
+    active_state(conn, send_lock, new, "active")
+
+def tick():
+  t0 = time.time()
+  while True:
+    time.sleep(1)
+    t = int(time.time() - t0)
+    with lock:
+      for name, i in list(services.items()):
+        try:
+          write_counters(name, i, t)
+        except OSError:
+          pass
+
+def gauges():
+  with lock:
+    return {"services": len(services)}
+
+shutil.rmtree(args.cgroot, ignore_errors=True)
+os.makedirs(args.cgroot)
+with open(args.cgroot + "/cgroup.controllers", "w") as f:
+  f.write("cpu io memory pids\n")
+for _ in range(args.services):
+  start_service()
+
+conn = open_dbus_connection(bus="SYSTEM")
+conn.send_and_get_reply(message_bus.RequestName(SYSTEMD))
+send_lock = threading.Lock()
+stats.start(args.interval, gauges)
+threads = [(tick, ())]
+if args.churn > 0:
+  threads.append((churn, (conn, send_lock)))
+for fn, fargs in threads:
+  t = threading.Thread(target=fn, args=fargs)
+  t.daemon = True
+  t.start()
+while True:
+  msg = conn.receive()
+  if msg.header.message_type == MessageType.method_call:
+    out = reply(conn, msg)
+    with send_lock:
+      conn.send(out)
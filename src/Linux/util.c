@@ -242,6 +242,8 @@ extern "C" {
     UTHeapHeader *bufferLists[UT_MAX_BUFFER_Q];
     pid_t realmIdx;
     uint32_t totalAllocatedBytes;
+    uint64_t nAllocs;
+    uint64_t nOSAllocs;
   } UTHeapRealm;
 
   // separate realm for each thread
@@ -270,6 +272,7 @@ extern "C" {
     int queueIdx = 4;
     for(int l = (len + 15) >> 4; l > 0; l >>= 1) queueIdx++;
     UTHeapHeader *utBuf = (UTHeapHeader *)utRealm.bufferLists[queueIdx];
+    utRealm.nAllocs++;
     if(utBuf) {
       // peel it off
       utRealm.bufferLists[queueIdx] = utBuf->nxt;
@@ -278,6 +281,7 @@ extern "C" {
       // allocate a new one
       utBuf = (UTHeapHeader *)my_os_calloc(1<<queueIdx);
       utRealm.totalAllocatedBytes += (1<<queueIdx);
+      utRealm.nOSAllocs++;
     }
     // remember the details so we know what to do on free (overwriting the nxt pointer)
     utBuf->h.realmIdx = utRealm.realmIdx;
@@ -286,6 +290,18 @@ extern "C" {
     return (char *)utBuf + sizeof(UTHeapHeader);
   }
 
+  /*_________________---------------------------__________________
+    _________________       UTHeapStats         __________________
+    -----------------___________________________------------------
+    Allocation counts for the calling thread's realm. nOSAllocs is
+    the subset that could not be satisfied from a recycle queue.
+  */
+
+  void UTHeapStats(uint64_t *nAllocs, uint64_t *nOSAllocs) {
+    if(nAllocs) *nAllocs = utRealm.nAllocs;
+    if(nOSAllocs) *nOSAllocs = utRealm.nOSAllocs;
+  }
+
   /*_________________---------------------------__________________
     _________________    foreign thread free    __________________
     -----------------___________________________------------------
@@ -1801,7 +1817,7 @@ static uint32_t hashSearch(UTHash *oh, void *obj, void **found) {
     }
   }
 
-  int UTSocketUDP(char *bindaddr, int family, uint16_t port, int bufferSize)
+  static int socketUDP(char *bindaddr, int family, uint16_t port, int bufferSize, bool reusePort)
   {
     struct sockaddr_in myaddr_in = { 0 };
     struct sockaddr_in6 myaddr_in6 = { 0 };
@@ -1830,6 +1846,17 @@ static uint32_t hashSearch(UTHash *oh, void *obj, void **found) {
       myLog(LOG_ERR, "ULOG fcntl(F_SETFD=FD_CLOEXEC) failed: %s", strerror(errno));
     }
 
+    // allow several sockets to bind the same port, and let the
+    // kernel hash incoming datagrams across them
+    if(reusePort) {
+      int one = 1;
+      if(setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+	myLog(LOG_ERR, "setsockopt(SO_REUSEPORT) failed: %s", strerror(errno));
+	close(soc);
+	return 0;
+      }
+    }
+
     // lookup bind address
     struct sockaddr *psockaddr = (family == PF_INET6) ?
       (struct sockaddr *)&myaddr_in6 :
@@ -1860,6 +1887,14 @@ static uint32_t hashSearch(UTHash *oh, void *obj, void **found) {
     return soc;
   }
 
+  int UTSocketUDP(char *bindaddr, int family, uint16_t port, int bufferSize) {
+    return socketUDP(bindaddr, family, port, bufferSize, NO);
+  }
+
+  int UTSocketUDPReusePort(char *bindaddr, int family, uint16_t port, int bufferSize) {
+    return socketUDP(bindaddr, family, port, bufferSize, YES);
+  }
+
   int UTUnixDomainSocket(char *path) {
     struct sockaddr_un addr;
     int fd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -1878,6 +1913,31 @@ static uint32_t hashSearch(UTHash *oh, void *obj, void **found) {
     return fd;
   }
 
+  int UTUnixDomainSocketListen(char *path) {
+    struct sockaddr_un addr;
+    if(my_strlen(path) >= sizeof(addr.sun_path)) {
+      myLog(LOG_ERR, "UTUnixDomainSocketListen - path too long: %s", path);
+      return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1) {
+      myLog(LOG_ERR, "UTUnixDomainSocketListen - socket() failed: %s", strerror(errno));
+      return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    // clear out any stale socket from a previous run
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+       || listen(fd, 8) == -1) {
+      myLog(LOG_ERR, "UTUnixDomainSocketListen(%s) failed: %s", path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
   /*_________________---------------------------__________________
     _________________          regex            __________________
     -----------------___________________________------------------
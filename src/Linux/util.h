@@ -94,6 +94,7 @@ extern "C" {
   void *UTHeapQReAlloc(void *buf, size_t newSiz);
   void UTHeapQFree(void *buf);
   void UTHeapGC(void);
+  void UTHeapStats(uint64_t *nAllocs, uint64_t *nOSAllocs);
 
 #define my_calloc UTHeapQNew
 #define my_realloc UTHeapQReAlloc
@@ -247,7 +248,9 @@ extern "C" {
   // sockets
   void UTSocketRcvbuf(int fd, int requested);
   int UTSocketUDP(char *bindaddr, int family, uint16_t port, int bufferSize);
+  int UTSocketUDPReusePort(char *bindaddr, int family, uint16_t port, int bufferSize);
   int UTUnixDomainSocket(char *path);
+  int UTUnixDomainSocketListen(char *path);
 
   // SFLAddress utils
   char *SFLAddress_print(SFLAddress *addr, char *buf, size_t len);
@@ -317,10 +320,8 @@ extern "C" {
     (obj)->next = (q).head;			\
     (obj)->prev = NULL;				\
     if((q).head) (q).head->prev = (obj);	\
-    else {					\
-      (q).tail = (obj);				\
-      (q).head = (obj);				\
-    }						\
+    else (q).tail = (obj);			\
+    (q).head = (obj);				\
   } while(0)
 
 #define UTQ_ADD_TAIL(q, obj)			\
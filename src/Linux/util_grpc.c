@@ -0,0 +1,764 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <sys/socket.h>
+#include "util_grpc.h"
+
+  /*_________________---------------------------__________________
+    _________________    protobuf wire format   __________________
+    -----------------___________________________------------------
+  */
+
+  static bool pbVarint(u_char *msg, uint32_t msgLen, uint32_t *pOff, uint64_t *pVal) {
+    uint64_t val = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+      if(*pOff >= msgLen)
+	return NO;
+      u_char byte = msg[(*pOff)++];
+      val |= (uint64_t)(byte & 0x7F) << shift;
+      if((byte & 0x80) == 0) {
+	*pVal = val;
+	return YES;
+      }
+    }
+    return NO;
+  }
+
+  bool UTPB_next(u_char *msg, uint32_t msgLen, uint32_t *pOff, UTPBField *fld) {
+    uint64_t key;
+    if(*pOff >= msgLen
+       || !pbVarint(msg, msgLen, pOff, &key))
+      return NO;
+    memset(fld, 0, sizeof(*fld));
+    fld->field = (uint32_t)(key >> 3);
+    fld->wt = (uint32_t)(key & 7);
+    switch(fld->wt) {
+    case UTPB_WT_VARINT:
+      return pbVarint(msg, msgLen, pOff, &fld->varint);
+    case UTPB_WT_I64:
+      if((*pOff + 8) > msgLen) return NO;
+      memcpy(&fld->varint, msg + *pOff, 8); // little-endian on the wire
+      *pOff += 8;
+      return YES;
+    case UTPB_WT_I32:
+      if((*pOff + 4) > msgLen) return NO;
+      {
+	uint32_t val32;
+	memcpy(&val32, msg + *pOff, 4);
+	fld->varint = val32;
+      }
+      *pOff += 4;
+      return YES;
+    case UTPB_WT_LEN:
+      {
+	uint64_t len;
+	if(!pbVarint(msg, msgLen, pOff, &len)
+	   || len > (msgLen - *pOff))
+	  return NO;
+	fld->data = msg + *pOff;
+	fld->len = (uint32_t)len;
+	*pOff += (uint32_t)len;
+      }
+      return YES;
+    default:
+      // groups (3,4) are long obsolete
+      return NO;
+    }
+  }
+
+  char *UTPB_strdup(UTPBField *fld) {
+    char *str = (char *)my_calloc(fld->len + 1);
+    if(fld->len)
+      memcpy(str, fld->data, fld->len);
+    return str;
+  }
+
+  bool UTPB_strequal(UTPBField *fld, char *str) {
+    return (fld->wt == UTPB_WT_LEN
+	    && fld->len == my_strlen(str)
+	    && memcmp(fld->data, str, fld->len) == 0);
+  }
+
+  static int pbPutRawVarint(u_char *buf, int bufLen, int off, uint64_t val) {
+    do {
+      if(off < 0 || off >= bufLen)
+	return -1;
+      u_char byte = val & 0x7F;
+      val >>= 7;
+      buf[off++] = val ? (byte | 0x80) : byte;
+    } while(val);
+    return off;
+  }
+
+  int UTPB_putVarint(u_char *buf, int bufLen, int off, uint32_t field, uint64_t val) {
+    off = pbPutRawVarint(buf, bufLen, off, (field << 3) | UTPB_WT_VARINT);
+    return pbPutRawVarint(buf, bufLen, off, val);
+  }
+
+  int UTPB_putBytes(u_char *buf, int bufLen, int off, uint32_t field, void *data, uint32_t dataLen) {
+    off = pbPutRawVarint(buf, bufLen, off, (field << 3) | UTPB_WT_LEN);
+    off = pbPutRawVarint(buf, bufLen, off, dataLen);
+    if(off < 0
+       || (off + dataLen) > bufLen)
+      return -1;
+    memcpy(buf + off, data, dataLen);
+    return off + dataLen;
+  }
+
+  /*_________________---------------------------__________________
+    _________________    HTTP/2 framing         __________________
+    -----------------___________________________------------------
+  */
+
+#define UTH2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define UTH2_FRAME_HDR 9
+#define UTH2_MAX_FRAME 16384 // default SETTINGS_MAX_FRAME_SIZE, which we leave alone
+#define UTH2_WINDOW 0x1000000 // 16MB
+
+#define UTH2_DATA 0
+#define UTH2_HEADERS 1
+#define UTH2_RST_STREAM 3
+#define UTH2_SETTINGS 4
+#define UTH2_PUSH_PROMISE 5
+#define UTH2_PING 6
+#define UTH2_GOAWAY 7
+#define UTH2_WINDOW_UPDATE 8
+#define UTH2_CONTINUATION 9
+
+#define UTH2_FLAG_END_STREAM 0x1
+#define UTH2_FLAG_ACK 0x1
+#define UTH2_FLAG_END_HEADERS 0x4
+#define UTH2_FLAG_PADDED 0x8
+#define UTH2_FLAG_PRIORITY 0x20
+
+#define UTH2_SETTINGS_ENABLE_PUSH 0x2
+#define UTH2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+
+#define UTGRPC_MSG_HDR 5 // compressed flag + 32-bit length
+
+#define UTHPACK_TABLE_SIZE 4096 // default SETTINGS_HEADER_TABLE_SIZE
+#define UTHPACK_ENTRY_OVERHEAD 32
+#define UTHPACK_MAX_STR 4096
+
+  static void h2Put32(u_char *p, uint32_t val) {
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+  }
+
+  static uint32_t h2Get32(u_char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  }
+
+  static bool h2Send(UTGRPCConn *conn, u_char *buf, int len) {
+    while(len > 0) {
+      int sent = send(conn->fd, buf, len, MSG_NOSIGNAL);
+      if(sent < 0) {
+	if(errno == EINTR) continue;
+	myDebug(1, "grpc send() failed: %s", strerror(errno));
+	return NO;
+      }
+      buf += sent;
+      len -= sent;
+    }
+    return YES;
+  }
+
+  static bool h2SendFrame(UTGRPCConn *conn, u_char type, u_char flags, uint32_t streamId, u_char *payload, uint32_t len) {
+    u_char frame[UTH2_FRAME_HDR + UTH2_MAX_FRAME];
+    if(len > UTH2_MAX_FRAME)
+      return NO;
+    frame[0] = len >> 16;
+    frame[1] = len >> 8;
+    frame[2] = len;
+    frame[3] = type;
+    frame[4] = flags;
+    h2Put32(frame + 5, streamId & 0x7FFFFFFF);
+    if(len)
+      memcpy(frame + UTH2_FRAME_HDR, payload, len);
+    return h2Send(conn, frame, UTH2_FRAME_HDR + len);
+  }
+
+  static bool h2WindowUpdate(UTGRPCConn *conn, uint32_t streamId, uint32_t incr) {
+    u_char payload[4];
+    h2Put32(payload, incr & 0x7FFFFFFF);
+    return h2SendFrame(conn, UTH2_WINDOW_UPDATE, 0, streamId, payload, 4);
+  }
+
+  // HPACK integer with an N-bit prefix
+  static int hpackInt(u_char *buf, int bufLen, int off, u_char first, int prefixBits, uint32_t val) {
+    uint32_t max = (1 << prefixBits) - 1;
+    if(off >= bufLen) return -1;
+    if(val < max) {
+      buf[off++] = first | val;
+      return off;
+    }
+    buf[off++] = first | max;
+    val -= max;
+    while(val >= 128) {
+      if(off >= bufLen) return -1;
+      buf[off++] = (val & 0x7F) | 0x80;
+      val >>= 7;
+    }
+    if(off >= bufLen) return -1;
+    buf[off++] = val;
+    return off;
+  }
+
+  static int hpackString(u_char *buf, int bufLen, int off, char *str) {
+    uint32_t len = my_strlen(str);
+    off = hpackInt(buf, bufLen, off, 0x00, 7, len); // H=0: no Huffman
+    if(off < 0 || (off + len) > bufLen) return -1;
+    memcpy(buf + off, str, len);
+    return off + len;
+  }
+
+  // "Literal Header Field without Indexing" with the name taken from
+  // the static table, so the server's dynamic table is never touched
+  static int hpackIndexedName(u_char *buf, int bufLen, int off, uint32_t nameIdx, char *value) {
+    off = hpackInt(buf, bufLen, off, 0x00, 4, nameIdx);
+    if(off < 0) return -1;
+    return hpackString(buf, bufLen, off, value);
+  }
+
+  static int hpackLiteral(u_char *buf, int bufLen, int off, char *name, char *value) {
+    off = hpackInt(buf, bufLen, off, 0x00, 4, 0);
+    if(off < 0) return -1;
+    off = hpackString(buf, bufLen, off, name);
+    if(off < 0) return -1;
+    return hpackString(buf, bufLen, off, value);
+  }
+
+  /*_________________---------------------------__________________
+    _________________    HPACK decoding         __________________
+    -----------------___________________________------------------
+    RFC 7541. Every header block must be decoded, whether we want
+    anything from it or not, to keep our copy of the server's dynamic
+    table in step.
+  */
+
+  static const char *hpackStatic[61][2] = {
+    { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" },
+    { ":path", "/" }, { ":path", "/index.html" }, { ":scheme", "http" },
+    { ":scheme", "https" }, { ":status", "200" }, { ":status", "204" },
+    { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+    { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" }, { "accept-language", "" },
+    { "accept-ranges", "" }, { "accept", "" },
+    { "access-control-allow-origin", "" }, { "age", "" }, { "allow", "" },
+    { "authorization", "" }, { "cache-control", "" },
+    { "content-disposition", "" }, { "content-encoding", "" },
+    { "content-language", "" }, { "content-length", "" },
+    { "content-location", "" }, { "content-range", "" },
+    { "content-type", "" }, { "cookie", "" }, { "date", "" }, { "etag", "" },
+    { "expect", "" }, { "expires", "" }, { "from", "" }, { "host", "" },
+    { "if-match", "" }, { "if-modified-since", "" }, { "if-none-match", "" },
+    { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+    { "link", "" }, { "location", "" }, { "max-forwards", "" },
+    { "proxy-authenticate", "" }, { "proxy-authorization", "" },
+    { "range", "" }, { "referer", "" }, { "refresh", "" },
+    { "retry-after", "" }, { "server", "" }, { "set-cookie", "" },
+    { "strict-transport-security", "" }, { "transfer-encoding", "" },
+    { "user-agent", "" }, { "vary", "" }, { "via", "" },
+    { "www-authenticate", "" },
+  };
+
+  // The Huffman code is canonical, so it decodes from the first code
+  // and the number of codes of each length, with the symbols in code order.
+  static const uint32_t hpackHuffFirst[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+    0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+    0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+    0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+  };
+  static const u_char hpackHuffCount[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 3,
+  };
+  static const u_char hpackHuffSym[256] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+  };
+
+  static bool hpackHuffman(u_char *in, uint32_t len, char *out, uint32_t outLen, uint32_t *pOutLen) {
+    uint32_t code = 0, codeLen = 0, base = 0, nOut = 0;
+    for(uint32_t ii = 0; ii < len; ii++) {
+      for(int bit = 7; bit >= 0; bit--) {
+	code = (code << 1) | ((in[ii] >> bit) & 1);
+	if(++codeLen > 30)
+	  return NO;
+	if((code - hpackHuffFirst[codeLen]) < hpackHuffCount[codeLen]) {
+	  if(nOut >= outLen)
+	    return NO;
+	  out[nOut++] = hpackHuffSym[base + code - hpackHuffFirst[codeLen]];
+	  code = codeLen = base = 0;
+	}
+	else
+	  base += hpackHuffCount[codeLen];
+      }
+    }
+    // padding is the start of EOS (all ones), and less than a byte
+    if(codeLen > 7
+       || code != ((1U << codeLen) - 1))
+      return NO;
+    *pOutLen = nOut;
+    return YES;
+  }
+
+  static bool hpackGetInt(u_char *buf, uint32_t len, uint32_t *pOff, int prefixBits, uint32_t *pVal) {
+    uint32_t max = (1 << prefixBits) - 1;
+    if(*pOff >= len) return NO;
+    uint32_t val = buf[(*pOff)++] & max;
+    if(val == max) {
+      for(int shift = 0; ; shift += 7) {
+	if(shift > 21 || *pOff >= len) return NO;
+	u_char byte = buf[(*pOff)++];
+	val += (uint32_t)(byte & 0x7F) << shift;
+	if((byte & 0x80) == 0) break;
+      }
+    }
+    *pVal = val;
+    return YES;
+  }
+
+  static char *hpackGetString(u_char *buf, uint32_t len, uint32_t *pOff) {
+    if(*pOff >= len) return NULL;
+    bool huff = (buf[*pOff] & 0x80);
+    uint32_t slen;
+    if(!hpackGetInt(buf, len, pOff, 7, &slen)
+       || slen > (len - *pOff)
+       || slen > UTHPACK_MAX_STR)
+      return NULL;
+    u_char *str = buf + *pOff;
+    *pOff += slen;
+    if(!huff) {
+      char *ans = (char *)my_calloc(slen + 1);
+      memcpy(ans, str, slen);
+      return ans;
+    }
+    // at most 8 symbols per 5 bits
+    uint32_t outLen = (slen * 8) / 5 + 1;
+    char *ans = (char *)my_calloc(outLen + 1);
+    if(!hpackHuffman(str, slen, ans, outLen, &outLen)) {
+      my_free(ans);
+      return NULL;
+    }
+    ans[outLen] = '\0';
+    return ans;
+  }
+
+  static void hpackEvict(UTGRPCConn *conn, uint32_t maxSize) {
+    while(conn->dynSize > maxSize
+	  && conn->dynN) {
+      UTHPACKEntry *ent = &conn->dyn[--conn->dynN];
+      conn->dynSize -= ent->size;
+      my_free(ent->name);
+      my_free(ent->value);
+    }
+  }
+
+  // takes ownership of name and value
+  static void hpackInsert(UTGRPCConn *conn, char *name, char *value) {
+    uint32_t size = my_strlen(name) + my_strlen(value) + UTHPACK_ENTRY_OVERHEAD;
+    hpackEvict(conn, (size > conn->dynMax) ? 0 : (conn->dynMax - size));
+    if(size > conn->dynMax) {
+      // too big for the table: it just empties it
+      my_free(name);
+      my_free(value);
+      return;
+    }
+    if(conn->dynN == conn->dynCap) {
+      conn->dynCap = conn->dynCap ? (conn->dynCap * 2) : 16;
+      conn->dyn = (UTHPACKEntry *)my_realloc(conn->dyn, conn->dynCap * sizeof(UTHPACKEntry));
+    }
+    // newest first
+    memmove(conn->dyn + 1, conn->dyn, conn->dynN * sizeof(UTHPACKEntry));
+    conn->dyn[0].name = name;
+    conn->dyn[0].value = value;
+    conn->dyn[0].size = size;
+    conn->dynN++;
+    conn->dynSize += size;
+  }
+
+  static bool hpackLookup(UTGRPCConn *conn, uint32_t idx, const char **pName, const char **pValue) {
+    if(idx == 0)
+      return NO;
+    if(idx <= 61) {
+      *pName = hpackStatic[idx - 1][0];
+      *pValue = hpackStatic[idx - 1][1];
+      return YES;
+    }
+    idx -= 62;
+    if(idx >= conn->dynN)
+      return NO;
+    *pName = conn->dyn[idx].name;
+    *pValue = conn->dyn[idx].value;
+    return YES;
+  }
+
+  static void hpackHeader(UTGRPCStream *stream, const char *name, const char *value) {
+    if(stream == NULL)
+      return;
+    if(my_strequal((char *)name, "grpc-status"))
+      stream->status = strtol(value, NULL, 10);
+    else if(my_strequal((char *)name, "grpc-message")
+	    && *value)
+      myDebug(1, "grpc: stream %u grpc-message: %s", stream->id, value);
+  }
+
+  static bool hpackDecode(UTGRPCConn *conn, UTGRPCStream *stream, u_char *buf, uint32_t len) {
+    uint32_t off = 0;
+    while(off < len) {
+      u_char first = buf[off];
+      uint32_t idx;
+      if(first & 0x80) {
+	// indexed
+	const char *name, *value;
+	if(!hpackGetInt(buf, len, &off, 7, &idx)
+	   || !hpackLookup(conn, idx, &name, &value))
+	  return NO;
+	hpackHeader(stream, name, value);
+      }
+      else if((first & 0xE0) == 0x20) {
+	// dynamic table size update
+	if(!hpackGetInt(buf, len, &off, 5, &idx)
+	   || idx > UTHPACK_TABLE_SIZE)
+	  return NO;
+	conn->dynMax = idx;
+	hpackEvict(conn, conn->dynMax);
+      }
+      else {
+	// literal: with incremental indexing, without indexing or never indexed
+	bool indexing = ((first & 0xC0) == 0x40);
+	if(!hpackGetInt(buf, len, &off, indexing ? 6 : 4, &idx))
+	  return NO;
+	char *name = NULL;
+	if(idx) {
+	  const char *iname, *ivalue;
+	  if(!hpackLookup(conn, idx, &iname, &ivalue))
+	    return NO;
+	  name = my_strdup((char *)iname);
+	}
+	else if((name = hpackGetString(buf, len, &off)) == NULL)
+	  return NO;
+	char *value = hpackGetString(buf, len, &off);
+	if(value == NULL) {
+	  my_free(name);
+	  return NO;
+	}
+	hpackHeader(stream, name, value);
+	if(indexing)
+	  hpackInsert(conn, name, value);
+	else {
+	  my_free(name);
+	  my_free(value);
+	}
+      }
+    }
+    return YES;
+  }
+
+  /*_________________---------------------------__________________
+    _________________    connection             __________________
+    -----------------___________________________------------------
+  */
+
+  UTGRPCConn *UTGRPC_connect(char *sockPath, void *magic) {
+    int fd = UTUnixDomainSocket(sockPath);
+    if(fd < 0)
+      return NULL;
+    UTGRPCConn *conn = (UTGRPCConn *)my_calloc(sizeof(UTGRPCConn));
+    conn->fd = fd;
+    conn->magic = magic;
+    conn->nextStreamId = 1;
+    conn->rx = UTStrBuf_new();
+    conn->hdrBlock = UTStrBuf_new();
+    conn->dynMax = UTHPACK_TABLE_SIZE;
+    // client preface, then our SETTINGS and a bigger connection window
+    u_char settings[12];
+    settings[0] = 0;
+    settings[1] = UTH2_SETTINGS_ENABLE_PUSH;
+    h2Put32(settings + 2, 0);
+    settings[6] = 0;
+    settings[7] = UTH2_SETTINGS_INITIAL_WINDOW_SIZE;
+    h2Put32(settings + 8, UTH2_WINDOW);
+    if(!h2Send(conn, (u_char *)UTH2_PREFACE, strlen(UTH2_PREFACE))
+       || !h2SendFrame(conn, UTH2_SETTINGS, 0, 0, settings, sizeof(settings))
+       || !h2WindowUpdate(conn, 0, UTH2_WINDOW - 65535)) {
+      close(fd);
+      UTGRPC_free(conn);
+      return NULL;
+    }
+    return conn;
+  }
+
+  static void streamDone(UTGRPCStream *stream, bool ok) {
+    UTGRPCConn *conn = stream->conn;
+    UTQ_REMOVE(conn->streams, stream);
+    conn->nStreams--;
+    if(stream->doneCB)
+      (*stream->doneCB)(stream, ok, stream->status);
+    UTStrBuf_free(stream->rx);
+    my_free(stream);
+  }
+
+  void UTGRPC_free(UTGRPCConn *conn) {
+    while(!UTQ_EMPTY(conn->streams))
+      streamDone(UTQ_HEAD(conn->streams), NO);
+    UTStrBuf_free(conn->rx);
+    UTStrBuf_free(conn->hdrBlock);
+    hpackEvict(conn, 0);
+    if(conn->dyn)
+      my_free(conn->dyn);
+    my_free(conn);
+  }
+
+  UTGRPCStream *UTGRPC_call(UTGRPCConn *conn, char *path, u_char *req, uint32_t reqLen, UTGRPCMsgCB msgCB, UTGRPCDoneCB doneCB, void *magic, time_t now) {
+    if(conn->goaway
+       || (UTGRPC_MSG_HDR + reqLen) > UTH2_MAX_FRAME)
+      return NULL;
+    u_char hdrs[512];
+    int off = 0;
+    hdrs[off++] = 0x83; // :method POST
+    hdrs[off++] = 0x86; // :scheme http
+    off = hpackIndexedName(hdrs, sizeof(hdrs), off, 4, path); // :path
+    if(off >= 0) off = hpackIndexedName(hdrs, sizeof(hdrs), off, 1, "localhost"); // :authority
+    if(off >= 0) off = hpackIndexedName(hdrs, sizeof(hdrs), off, 31, "application/grpc"); // content-type
+    if(off >= 0) off = hpackLiteral(hdrs, sizeof(hdrs), off, "te", "trailers");
+    if(off < 0)
+      return NULL;
+    UTGRPCStream *stream = (UTGRPCStream *)my_calloc(sizeof(UTGRPCStream));
+    stream->conn = conn;
+    stream->id = conn->nextStreamId;
+    conn->nextStreamId += 2;
+    stream->msgCB = msgCB;
+    stream->doneCB = doneCB;
+    stream->magic = magic;
+    stream->startTime = now;
+    stream->status = UTGRPC_STATUS_NONE;
+    stream->rx = UTStrBuf_new();
+    UTQ_ADD_TAIL(conn->streams, stream);
+    conn->nStreams++;
+    // one DATA frame: the length-prefixed message, uncompressed
+    u_char data[UTH2_MAX_FRAME];
+    data[0] = 0;
+    h2Put32(data + 1, reqLen);
+    if(reqLen)
+      memcpy(data + UTGRPC_MSG_HDR, req, reqLen);
+    if(!h2SendFrame(conn, UTH2_HEADERS, UTH2_FLAG_END_HEADERS, stream->id, hdrs, off)
+       || !h2SendFrame(conn, UTH2_DATA, UTH2_FLAG_END_STREAM, stream->id, data, UTGRPC_MSG_HDR + reqLen)) {
+      // the caller learns about this from the doneCB when the
+      // connection is found to be closed, same as any other failure
+      myDebug(1, "grpc call %s: send failed", path);
+      shutdown(conn->fd, SHUT_RDWR);
+    }
+    return stream;
+  }
+
+  static UTGRPCStream *getStream(UTGRPCConn *conn, uint32_t streamId) {
+    UTGRPCStream *stream;
+    UTQ_WALK(conn->streams, stream) {
+      if(stream->id == streamId)
+	return stream;
+    }
+    return NULL;
+  }
+
+  static void streamData(UTGRPCStream *stream, u_char *data, uint32_t len) {
+    UTStrBuf_append_n(stream->rx, (char *)data, len);
+    // deliver each complete length-prefixed message
+    u_char *buf = (u_char *)UTSTRBUF_STR(stream->rx);
+    uint32_t avail = UTSTRBUF_LEN(stream->rx);
+    uint32_t consumed = 0;
+    while((avail - consumed) >= UTGRPC_MSG_HDR) {
+      u_char *msg = buf + consumed;
+      uint32_t msgLen = h2Get32(msg + 1);
+      if((avail - consumed - UTGRPC_MSG_HDR) < msgLen)
+	break;
+      consumed += UTGRPC_MSG_HDR + msgLen;
+      stream->nMsgs++;
+      if(msg[0]) {
+	// we never advertise grpc-accept-encoding, so this should not happen
+	myDebug(1, "grpc: ignoring compressed message on stream %u", stream->id);
+	continue;
+      }
+      if(stream->msgCB)
+	(*stream->msgCB)(stream, msg + UTGRPC_MSG_HDR, msgLen);
+    }
+    if(consumed) {
+      memmove(buf, buf + consumed, avail - consumed);
+      stream->rx->len = avail - consumed;
+    }
+  }
+
+  static bool h2HeaderBlock(UTGRPCConn *conn) {
+    UTGRPCStream *stream = getStream(conn, conn->hdrStreamId);
+    if(!hpackDecode(conn, stream, (u_char *)UTSTRBUF_STR(conn->hdrBlock), UTSTRBUF_LEN(conn->hdrBlock))) {
+      // the table may now be out of step, so the connection is unusable
+      myDebug(1, "grpc: bad header block on stream %u", conn->hdrStreamId);
+      return NO;
+    }
+    conn->hdrStreamId = 0;
+    UTStrBuf_reset(conn->hdrBlock);
+    if(stream
+       && conn->hdrEndStream)
+      streamDone(stream, YES);
+    return YES;
+  }
+
+  static bool h2Frame(UTGRPCConn *conn, u_char type, u_char flags, uint32_t streamId, u_char *payload, uint32_t len) {
+    UTGRPCStream *stream = streamId ? getStream(conn, streamId) : NULL;
+    switch(type) {
+    case UTH2_DATA:
+      {
+	uint32_t pad = 0;
+	if(flags & UTH2_FLAG_PADDED) {
+	  if(len < 1 || payload[0] >= len) return NO;
+	  pad = payload[0];
+	  payload++;
+	  len--;
+	}
+	// give back the flow-control credit straight away
+	uint32_t credit = len + pad + ((flags & UTH2_FLAG_PADDED) ? 1 : 0);
+	if(credit) {
+	  if(!h2WindowUpdate(conn, 0, credit))
+	    return NO;
+	  if(stream
+	     && !(flags & UTH2_FLAG_END_STREAM)
+	     && !h2WindowUpdate(conn, streamId, credit))
+	    return NO;
+	}
+	if(stream) {
+	  streamData(stream, payload, len - pad);
+	  if(flags & UTH2_FLAG_END_STREAM)
+	    streamDone(stream, YES);
+	}
+      }
+      break;
+    case UTH2_HEADERS:
+      {
+	// response headers or trailers, perhaps continued
+	uint32_t pad = 0, skip = 0;
+	if(flags & UTH2_FLAG_PADDED) {
+	  if(len < 1) return NO;
+	  pad = payload[0];
+	  skip = 1;
+	}
+	if(flags & UTH2_FLAG_PRIORITY)
+	  skip += 5;
+	if((skip + pad) > len)
+	  return NO;
+	conn->hdrStreamId = streamId;
+	conn->hdrEndStream = (flags & UTH2_FLAG_END_STREAM);
+	UTStrBuf_reset(conn->hdrBlock);
+	UTStrBuf_append_n(conn->hdrBlock, (char *)payload + skip, len - skip - pad);
+	if(flags & UTH2_FLAG_END_HEADERS)
+	  return h2HeaderBlock(conn);
+      }
+      break;
+    case UTH2_CONTINUATION:
+      if(streamId != conn->hdrStreamId)
+	return NO;
+      UTStrBuf_append_n(conn->hdrBlock, (char *)payload, len);
+      if(flags & UTH2_FLAG_END_HEADERS)
+	return h2HeaderBlock(conn);
+      break;
+    case UTH2_RST_STREAM:
+      if(stream) {
+	myDebug(1, "grpc: stream %u reset, error=%u", streamId, len >= 4 ? h2Get32(payload) : 0);
+	streamDone(stream, NO);
+      }
+      break;
+    case UTH2_SETTINGS:
+      if(!(flags & UTH2_FLAG_ACK))
+	return h2SendFrame(conn, UTH2_SETTINGS, UTH2_FLAG_ACK, 0, NULL, 0);
+      break;
+    case UTH2_PING:
+      if(!(flags & UTH2_FLAG_ACK))
+	return h2SendFrame(conn, UTH2_PING, UTH2_FLAG_ACK, 0, payload, len);
+      break;
+    case UTH2_GOAWAY:
+      {
+	// streams above lastStreamId were not processed
+	uint32_t lastStreamId = (len >= 4) ? (h2Get32(payload) & 0x7FFFFFFF) : 0;
+	myDebug(1, "grpc: GOAWAY lastStreamId=%u", lastStreamId);
+	conn->goaway = YES;
+	UTGRPCStream *st, *nx;
+	for(st = UTQ_HEAD(conn->streams); st; st = nx) {
+	  nx = st->next;
+	  if(st->id > lastStreamId)
+	    streamDone(st, NO);
+	}
+      }
+      break;
+    case UTH2_PUSH_PROMISE:
+      // we said ENABLE_PUSH=0
+      return NO;
+    default:
+      // WINDOW_UPDATE (our requests are tiny), PRIORITY and unknown
+      // types are ignored
+      break;
+    }
+    return YES;
+  }
+
+  bool UTGRPC_read(UTGRPCConn *conn) {
+    UTStrBuf *rx = conn->rx;
+    UTStrBuf_need(rx, UTH2_FRAME_HDR + UTH2_MAX_FRAME + 1);
+    int cc;
+  try_again:
+    cc = read(conn->fd, rx->buf + rx->len, rx->cap - rx->len - 1);
+    if(cc < 0) {
+      if(errno == EINTR) goto try_again;
+      if(errno == EAGAIN || errno == EWOULDBLOCK) return YES;
+      myDebug(1, "grpc read() failed: %s", strerror(errno));
+      return NO;
+    }
+    if(cc == 0)
+      return NO;
+    rx->len += cc;
+    u_char *buf = (u_char *)rx->buf;
+    uint32_t consumed = 0;
+    while((rx->len - consumed) >= UTH2_FRAME_HDR) {
+      u_char *frame = buf + consumed;
+      uint32_t len = ((uint32_t)frame[0] << 16) | ((uint32_t)frame[1] << 8) | frame[2];
+      if(len > UTH2_MAX_FRAME) {
+	myDebug(1, "grpc: frame too long (%u)", len);
+	return NO;
+      }
+      if((rx->len - consumed - UTH2_FRAME_HDR) < len)
+	break;
+      consumed += UTH2_FRAME_HDR + len;
+      if(!h2Frame(conn, frame[3], frame[4], h2Get32(frame + 5) & 0x7FFFFFFF, frame + UTH2_FRAME_HDR, len))
+	return NO;
+    }
+    if(consumed) {
+      memmove(buf, buf + consumed, rx->len - consumed);
+      rx->len -= consumed;
+    }
+    return !(conn->goaway && conn->nStreams == 0);
+  }
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
@@ -0,0 +1,110 @@
+/* This software is distributed under the following license:
+ * http://sflow.net/license.html
+ */
+
+#ifndef UTIL_GRPC_H
+#define UTIL_GRPC_H 1
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "util.h"
+
+  /* Minimal gRPC client over cleartext HTTP/2 ("h2c" with prior
+     knowledge) on a unix socket, plus a protobuf wire-format walker.
+     Just enough to talk to a CRI runtime (containerd, CRI-O) without
+     pulling in libgrpc/libprotobuf:
+     - request headers are sent as HPACK literals, so no encoder state.
+     - response headers and trailers are HPACK-decoded, but only
+       grpc-status is kept. It is passed to the done callback.
+     - received DATA is acknowledged immediately with WINDOW_UPDATE,
+       so long-lived server streams keep flowing.
+  */
+
+  // protobuf wire types
+#define UTPB_WT_VARINT 0
+#define UTPB_WT_I64 1
+#define UTPB_WT_LEN 2
+#define UTPB_WT_I32 5
+
+  typedef struct _UTPBField {
+    uint32_t field;
+    uint32_t wt;
+    uint64_t varint; // VARINT, I64, I32
+    u_char *data;    // LEN
+    uint32_t len;
+  } UTPBField;
+
+  // walk the fields of a message: returns NO at the end or on malformed input
+  bool UTPB_next(u_char *msg, uint32_t msgLen, uint32_t *pOff, UTPBField *fld);
+  char *UTPB_strdup(UTPBField *fld);
+  bool UTPB_strequal(UTPBField *fld, char *str);
+  // encoders return the new offset, or -1 if the buffer is full
+  int UTPB_putVarint(u_char *buf, int bufLen, int off, uint32_t field, uint64_t val);
+  int UTPB_putBytes(u_char *buf, int bufLen, int off, uint32_t field, void *data, uint32_t dataLen);
+
+  // grpc-status values
+#define UTGRPC_STATUS_NONE -1 // stream ended without one
+#define UTGRPC_STATUS_OK 0
+#define UTGRPC_STATUS_UNIMPLEMENTED 12
+
+  struct _UTGRPCConn;
+  struct _UTGRPCStream;
+  // one call per gRPC message received on the stream
+  typedef void (*UTGRPCMsgCB)(struct _UTGRPCStream *stream, u_char *msg, uint32_t msgLen);
+  // exactly once per stream. ok=NO for RST_STREAM, GOAWAY or a lost connection
+  typedef void (*UTGRPCDoneCB)(struct _UTGRPCStream *stream, bool ok, int status);
+
+  typedef struct _UTGRPCStream {
+    struct _UTGRPCStream *prev;
+    struct _UTGRPCStream *next;
+    struct _UTGRPCConn *conn;
+    uint32_t id;
+    UTGRPCMsgCB msgCB;
+    UTGRPCDoneCB doneCB;
+    void *magic;
+    time_t startTime;
+    uint32_t nMsgs;
+    int status; // grpc-status
+    UTStrBuf *rx; // partial gRPC message
+  } UTGRPCStream;
+
+  typedef struct _UTHPACKEntry {
+    char *name;
+    char *value;
+    uint32_t size;
+  } UTHPACKEntry;
+
+  typedef struct _UTGRPCConn {
+    int fd;
+    void *magic;
+    uint32_t nextStreamId;
+    UTQ(UTGRPCStream) streams;
+    uint32_t nStreams;
+    UTStrBuf *rx; // partial HTTP/2 frame
+    bool goaway;
+    // header block being collected from HEADERS + CONTINUATION
+    UTStrBuf *hdrBlock;
+    uint32_t hdrStreamId;
+    bool hdrEndStream;
+    // HPACK dynamic table, newest first
+    UTHPACKEntry *dyn;
+    uint32_t dynN;
+    uint32_t dynCap;
+    uint32_t dynSize;
+    uint32_t dynMax;
+  } UTGRPCConn;
+
+  UTGRPCConn *UTGRPC_connect(char *sockPath, void *magic);
+  UTGRPCStream *UTGRPC_call(UTGRPCConn *conn, char *path, u_char *req, uint32_t reqLen, UTGRPCMsgCB msgCB, UTGRPCDoneCB doneCB, void *magic, time_t now);
+  // call when conn->fd is readable: returns NO if the connection is finished
+  bool UTGRPC_read(UTGRPCConn *conn);
+  // fails any streams still open. Does not close conn->fd.
+  void UTGRPC_free(UTGRPCConn *conn);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
+
+#endif /* UTIL_GRPC_H */